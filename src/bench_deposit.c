@@ -0,0 +1,176 @@
+/*
+ * This file is part of heatbugs_GPU.
+ *
+ * heatbugs_GPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_GPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_GPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+
+
+/**
+ * Microbenchmark of the heat deposition modes, (--deposit), on the host: inline, atomic and gather, on a 4096 x 4096
+ * world (or the side given as argument) from 1% to 90% bug density.
+ *
+ * Bugs are on distinct random cells, as after the bug steps, and visited in bug id order, as the work-items of a
+ * bug kernel. inline is the plain read and store a bug step does, atomic the compare and exchange float add of
+ * 'atomic_add_heat(...)', gather the pass over every cell of 'deposit_heat_gather'. The time per bug and per pass
+ * are reported. The cost of a mode on a device is seen with --profile.
+ * */
+
+
+#define _GNU_SOURCE	/* clock_gettime(...) under -std=c99. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+
+#define BENCH_SIDE		4096
+#define BENCH_RUNS		10
+
+#define EMPTY_CELL		0x00000000
+#define BUG			0x00ff00aa
+#define GET_BUG_OUTPUT_HEAT( cell )	(((cell) & 0x0000ff00) >> 8)
+
+
+static const unsigned int densities[] = { 1, 10, 25, 50, 75, 90 };	/* Bugs per 100 cells. */
+
+
+
+static double now( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+
+/* As 'atomic_add_heat(...)' in the kernel. */
+static void atomic_add_heat( float *cell, const float heat )
+{
+	uint32_t old_bits, new_bits;
+	float old_heat, new_heat;
+
+	__atomic_load( (uint32_t *) cell, &old_bits, __ATOMIC_RELAXED );
+
+	do
+	{
+		memcpy( &old_heat, &old_bits, sizeof( float ) );
+		new_heat = old_heat + heat;
+		memcpy( &new_bits, &new_heat, sizeof( float ) );
+	}
+	while (!__atomic_compare_exchange_n( (uint32_t *) cell, &old_bits, new_bits, 0,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED ));
+}
+
+
+
+enum { DEPOSIT_INLINE = 0, DEPOSIT_ATOMIC, DEPOSIT_GATHER, DEPOSIT_COUNT };
+
+static const char *deposit_names[ DEPOSIT_COUNT ] = { "inline", "atomic", "gather" };
+
+
+/* One deposition of all the bugs. */
+static void deposit( int mode, float *heat_map, const uint32_t *swarm_map, const uint32_t *position, size_t bugs,
+			size_t cells )
+{
+	switch (mode)
+	{
+		case DEPOSIT_ATOMIC:
+			for (size_t bug = 0; bug < bugs; bug++)
+				atomic_add_heat( &heat_map[ position[ bug ] ],
+							(float) GET_BUG_OUTPUT_HEAT( swarm_map[ position[ bug ] ] ) );
+			break;
+		case DEPOSIT_GATHER:
+			for (size_t cell = 0; cell < cells; cell++)
+				if (swarm_map[ cell ] != EMPTY_CELL)
+					heat_map[ cell ] = heat_map[ cell ] +
+								(float) GET_BUG_OUTPUT_HEAT( swarm_map[ cell ] );
+			break;
+		default:
+			for (size_t bug = 0; bug < bugs; bug++)
+				heat_map[ position[ bug ] ] = heat_map[ position[ bug ] ] +
+								(float) GET_BUG_OUTPUT_HEAT( swarm_map[ position[ bug ] ] );
+	}
+}
+
+
+
+int main( int argc, char *argv[] )
+{
+	const size_t side = (argc > 1) ? strtoul( argv[1], NULL, 10 ) : BENCH_SIDE;
+	const size_t cells = side * side;
+
+	float *heat_map = calloc( cells, sizeof( float ) );
+	uint32_t *swarm_map = malloc( cells * sizeof( uint32_t ) );
+	uint32_t *position = malloc( cells * sizeof( uint32_t ) );	/* A shuffle of the cells, bugs take the first. */
+
+	double start, t;
+
+
+	if (!heat_map || !swarm_map || !position)
+	{
+		printf( "Not enough memory for a %zu x %zu world.\n", side, side );
+		return 1;
+	}
+
+	srand( 3291907895u );
+	for (size_t cell = 0; cell < cells; cell++) position[ cell ] = cell;
+	for (size_t cell = cells - 1; cell > 0; cell--)
+	{
+		const size_t other = ((size_t) rand() * RAND_MAX + rand()) % (cell + 1);
+		const uint32_t swap = position[ cell ];
+
+		position[ cell ] = position[ other ];
+		position[ other ] = swap;
+	}
+
+	printf( "%6s %10s %8s %10s %10s\n", "bugs%", "bugs", "deposit", "ns/bug", "ms/pass" );
+
+	for (size_t d = 0; d < sizeof( densities ) / sizeof( densities[0] ); d++)
+	{
+		const size_t bugs = cells / 100 * densities[ d ];
+
+		memset( swarm_map, 0, cells * sizeof( uint32_t ) );
+		for (size_t bug = 0; bug < bugs; bug++)
+			swarm_map[ position[ bug ] ] = BUG | ((uint32_t) (bug % 100) << 8);
+
+		for (int mode = 0; mode < DEPOSIT_COUNT; mode++)
+		{
+			deposit( mode, heat_map, swarm_map, position, bugs, cells );	/* Warm up. */
+
+			start = now();
+
+			for (int run = 0; run < BENCH_RUNS; run++)
+				deposit( mode, heat_map, swarm_map, position, bugs, cells );
+
+			t = (now() - start) / BENCH_RUNS;
+
+			printf( "%6u %10zu %8s %10.3f %10.3f\n", densities[ d ], bugs, deposit_names[ mode ],
+				t / bugs * 1e9, t * 1e3 );
+		}
+
+		fflush( stdout );
+	}
+
+	free( position );
+	free( swarm_map );
+	free( heat_map );
+
+	return 0;
+}
@@ -0,0 +1,130 @@
+/*
+ * This file is part of heatbugs_GPU.
+ *
+ * heatbugs_GPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_GPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_GPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+
+
+/**
+ * Microbenchmark of the host world heat step: scalar version against the SIMD version selected for this CPU, on
+ * square worlds from 1k x 1k up to 16k x 16k cells (or the side given as argument).
+ *
+ * For each world side, both versions run the same number of steps from the same random heat map. The time per step,
+ * the throughput in cells per second and the speedup are reported, and the results of both are checked to be bit
+ * identical.
+ * */
+
+
+#define _GNU_SOURCE	/* clock_gettime(...) under -std=c99. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "heatbugs_cpu.h"
+
+
+#define BENCH_MIN_SIDE		1024
+#define BENCH_MAX_SIDE		16384
+#define BENCH_CELLS_PER_RUN	(1UL << 30)	/* Cells computed per version and world side, (bounds the steps). */
+
+#define DIFFUSION_RATE		0.90f
+#define EVAPORATION_RATE	0.01f
+
+
+
+static double now( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+
+/* Run 'steps' double buffered steps from 'initial'. Return seconds per step. The last map is left in 'map[0]'. */
+static double run( HBHeatStepFn step, const float *initial, float *map[2], size_t side, size_t steps )
+{
+	double start;
+
+	memcpy( map[0], initial, side * side * sizeof( float ) );
+
+	start = now();
+
+	for (size_t i = 0; i < steps; i++)
+	{
+		step( map[0], map[1], side, side, DIFFUSION_RATE, EVAPORATION_RATE );
+
+		float *t = map[0]; map[0] = map[1]; map[1] = t;
+	}
+
+	return (now() - start) / steps;
+}
+
+
+
+int main( int argc, char *argv[] )
+{
+	const char *simd_name;
+	HBHeatStepFn simd = hb_heat_step_select( &simd_name );
+
+	size_t max_side = (argc > 1) ? strtoul( argv[1], NULL, 10 ) : BENCH_MAX_SIDE;
+
+
+	printf( "%8s %8s %14s %14s %10s %10s %8s %s\n", "side", "steps", "scalar ms", simd_name, "scalar Gc/s",
+		"simd Gc/s", "speedup", "check" );
+
+	for (size_t side = BENCH_MIN_SIDE; side <= max_side; side *= 2)
+	{
+		const size_t cells = side * side;
+		const size_t steps = (BENCH_CELLS_PER_RUN / cells) ? BENCH_CELLS_PER_RUN / cells : 1;
+
+		float *initial = malloc( cells * sizeof( float ) );
+		float *scalar_map[2] = { malloc( cells * sizeof( float ) ), malloc( cells * sizeof( float ) ) };
+		float *simd_map[2] = { malloc( cells * sizeof( float ) ), malloc( cells * sizeof( float ) ) };
+
+		double t_scalar, t_simd;
+
+		if (!initial || !scalar_map[0] || !scalar_map[1] || !simd_map[0] || !simd_map[1])
+		{
+			printf( "%8zu  skipped, not enough memory.\n", side );
+		}
+		else
+		{
+			srand( 3291907895u );
+			for (size_t i = 0; i < cells; i++)
+				initial[ i ] = (float) rand() / RAND_MAX * 100.0f;
+
+			t_scalar = run( hb_heat_step_scalar, initial, scalar_map, side, steps );
+			t_simd = run( simd, initial, simd_map, side, steps );
+
+			printf( "%8zu %8zu %14.3f %14.3f %10.3f %10.3f %7.2fx %s\n", side, steps,
+				t_scalar * 1e3, t_simd * 1e3, cells / t_scalar * 1e-9, cells / t_simd * 1e-9,
+				t_scalar / t_simd,
+				memcmp( scalar_map[0], simd_map[0], cells * sizeof( float ) ) ? "MISMATCH" : "ok" );
+		}
+
+		fflush( stdout );
+
+		free( simd_map[1] ); free( simd_map[0] );
+		free( scalar_map[1] ); free( scalar_map[0] );
+		free( initial );
+	}
+
+	return 0;
+}
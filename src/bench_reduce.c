@@ -0,0 +1,197 @@
+/*
+ * This file is part of heatbugs_GPU.
+ *
+ * heatbugs_GPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_GPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_GPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+
+
+/**
+ * Microbenchmark of the unhappiness accumulators, (--accumulator), on the host: float, kahan, double and fixed point,
+ * for 2^20 bugs up to 2^27 bugs (or the number given as argument).
+ *
+ * Each accumulator sums the same random unhappiness vector as 'unhappiness_step1_reduce' and
+ * 'unhappiness_step2_average' do: a serial sum per work-item over a strided range, then tree reductions within the
+ * work-groups and over the work-group sums. The time per bug, the throughput and the relative error of the sum,
+ * against a long double sum, are reported. The throughput cost of a mode on a device is seen with --profile.
+ * */
+
+
+#define _GNU_SOURCE	/* clock_gettime(...) under -std=c99. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+
+#define BENCH_MIN_BUGS		(1UL << 20)
+#define BENCH_MAX_BUGS		(1UL << 27)
+#define BENCH_BUGS_PER_RUN	(1UL << 29)	/* Bugs summed per accumulator and vector size, (bounds the runs). */
+
+#define BENCH_GROUPS		256		/* Work-groups of the first step, as REDUCE_NUM_WORKGROUPS. */
+#define BENCH_LOCAL		256		/* Work-items per work-group. */
+#define BENCH_ITEMS		(BENCH_GROUPS * BENCH_LOCAL)
+
+#define FIXED_ONE		1048576.0f	/* 2^20, UNHAPP_FIXED_ONE in the kernel. */
+
+
+typedef struct { float sum, comp; } kahan_t;
+
+
+static kahan_t partial_kahan[ BENCH_ITEMS ];
+static double partial_double[ BENCH_ITEMS ];
+static float partial_float[ BENCH_ITEMS ];
+static uint64_t partial_fixed[ BENCH_ITEMS ];
+
+
+
+static double now( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+
+/* As 'kahan_add(...)' in the kernel. */
+static kahan_t kahan_add( kahan_t a, kahan_t b )
+{
+	const float sum = a.sum + b.sum;
+	const float b_virtual = sum - a.sum;
+	kahan_t r;
+
+	r.sum = sum;
+	r.comp = a.comp + b.comp + ((a.sum - (sum - b_virtual)) + (b.sum - b_virtual));
+
+	return r;
+}
+
+
+
+/*
+ * The two step reduction of an accumulator type: serial sums into 'partial', then the work-group trees, leaving the
+ * work-group sums in the first BENCH_GROUPS slots, then the tree over them. TO_SUM and ADD as in the kernel.
+ * */
+#define REDUCE( partial, zero, TO_SUM, ADD ) \
+	do { \
+		for (size_t item = 0; item < BENCH_ITEMS; item++) \
+		{ \
+			partial[ item ] = zero; \
+			for (size_t i = item; i < bugs; i += BENCH_ITEMS) \
+				partial[ item ] = ADD( partial[ item ], TO_SUM( unhappiness[ i ] ) ); \
+		} \
+		for (size_t group = 0; group < BENCH_GROUPS; group++) \
+		{ \
+			for (size_t iter = BENCH_LOCAL / 2; iter > 0; iter >>= 1) \
+				for (size_t lid = 0; lid < iter; lid++) \
+					partial[ group * BENCH_LOCAL + lid ] = ADD( partial[ group * BENCH_LOCAL + lid ], \
+						partial[ group * BENCH_LOCAL + lid + iter ] ); \
+			partial[ group ] = partial[ group * BENCH_LOCAL ]; \
+		} \
+		for (size_t iter = BENCH_GROUPS / 2; iter > 0; iter >>= 1) \
+			for (size_t lid = 0; lid < iter; lid++) \
+				partial[ lid ] = ADD( partial[ lid ], partial[ lid + iter ] ); \
+	} while (0)
+
+#define PLAIN_ADD( a, b )	((a) + (b))
+#define FLOAT_SUM( u )		(u)
+#define DOUBLE_SUM( u )		((double) (u))
+#define FIXED_SUM( u )		((uint64_t) llrintf( (u) * FIXED_ONE ))
+#define KAHAN_SUM( u )		((kahan_t) { (u), 0.0f })
+
+
+enum { ACCUM_FLOAT = 0, ACCUM_KAHAN, ACCUM_DOUBLE, ACCUM_FIXED, ACCUM_COUNT };
+
+static const char *accum_names[ ACCUM_COUNT ] = { "float", "kahan", "double", "fixed" };
+
+
+/* Unhappiness sum of 'bugs' with the accumulator, in double so its error is not hidden by the average's rounding. */
+static double sum( int accum, const float *unhappiness, size_t bugs )
+{
+	const kahan_t kahan_zero = { 0.0f, 0.0f };
+
+	switch (accum)
+	{
+		case ACCUM_KAHAN:
+			REDUCE( partial_kahan, kahan_zero, KAHAN_SUM, kahan_add );
+			return (double) partial_kahan[ 0 ].sum + partial_kahan[ 0 ].comp;
+		case ACCUM_DOUBLE:
+			REDUCE( partial_double, 0.0, DOUBLE_SUM, PLAIN_ADD );
+			return partial_double[ 0 ];
+		case ACCUM_FIXED:
+			REDUCE( partial_fixed, 0, FIXED_SUM, PLAIN_ADD );
+			return partial_fixed[ 0 ] / (double) FIXED_ONE;
+		default:
+			REDUCE( partial_float, 0.0f, FLOAT_SUM, PLAIN_ADD );
+			return partial_float[ 0 ];
+	}
+}
+
+
+
+int main( int argc, char *argv[] )
+{
+	size_t max_bugs = (argc > 1) ? strtoul( argv[1], NULL, 10 ) : BENCH_MAX_BUGS;
+
+
+	printf( "%10s %6s %8s %12s %10s %12s\n", "bugs", "runs", "accum", "ns/bug", "Gbug/s", "rel. error" );
+
+	for (size_t bugs = BENCH_MIN_BUGS; bugs <= max_bugs; bugs *= 2)
+	{
+		const size_t runs = (BENCH_BUGS_PER_RUN / bugs) ? BENCH_BUGS_PER_RUN / bugs : 1;
+
+		float *unhappiness = malloc( bugs * sizeof( float ) );
+
+		long double exact = 0.0L;
+		double result = 0.0;
+		double start, t;
+
+		if (!unhappiness)
+		{
+			printf( "%10zu  skipped, not enough memory.\n", bugs );
+			continue;
+		}
+
+		srand( 3291907895u );
+		for (size_t i = 0; i < bugs; i++)
+		{
+			unhappiness[ i ] = (float) rand() / RAND_MAX * 100.0f;
+			exact += unhappiness[ i ];
+		}
+
+		for (int accum = 0; accum < ACCUM_COUNT; accum++)
+		{
+			start = now();
+
+			for (size_t run = 0; run < runs; run++)
+				result = sum( accum, unhappiness, bugs );
+
+			t = (now() - start) / runs;
+
+			printf( "%10zu %6zu %8s %12.3f %10.3f %12.3e\n", bugs, runs, accum_names[ accum ],
+				t / bugs * 1e9, bugs / t * 1e-9, (double) fabsl( (result - exact) / exact ) );
+		}
+
+		fflush( stdout );
+
+		free( unhappiness );
+	}
+
+	return 0;
+}
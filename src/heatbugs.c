@@ -17,21 +17,23 @@
 
 
 
-#define _GNU_SOURCE	/* this allow 'getopt(..)' function in <unistd.h> to compile under */
-			/* -std=c99 compiler option, because 'getopt' is POSIX, not c99.   */
+#define _GNU_SOURCE	/* mmap(...), madvise(...) under -std=c99. */
 
 #include <stdio.h>	/* printf(...)	*/
 #include <stdlib.h>	/* exit(...)	*/
 #include <unistd.h>
 #include <string.h>
-#include <ctype.h>	/* isprint(..)	*/
+#include <signal.h>	/* sig_atomic_t	*/
+#include <fcntl.h>	/* open(...)	*/
+#include <sys/mman.h>	/* mmap(...)	*/
+#include <sys/stat.h>	/* fstat(...)	*/
 
 
 /* Check documentation of cf4ocl2 @ https://fakenmc.github.io/cf4ocl/docs/latest/index.html */
 
 #include <cf4ocl2.h>	/* glib.h included by cf4ocl2.h*, MIN(...), g_random_int(). */
 
-#include "heatbugs.h"
+#include "heatbugs_engine.h"
 
 
 /** Default parameters. */
@@ -47,7 +49,44 @@
 #define BUGS_TEMP_MAX_IDEAL	40				/* [0..200] */
 #define BUGS_HEAT_MIN_OUTPUT	5				/* [0..100] */
 #define BUGS_HEAT_MAX_OUTPUT	25				/* [0..100] */
+#define WORLD_TILE		0				/* Side of the square memory tiles. (0 = row-major). */
+#define SNAPSHOT_PERIOD		0				/* Iterations between heat map snapshots. (0 = none). */
+#define DEVICE_TYPE		HB_DEVICE_GPU			/* Kind of OpenCL device to run on. */
+#define HEAT_VECTOR_WIDTH	0				/* Cells per comp_world_heat work-item. (0 = device's). */
 #define OUTPUT_FILENAME		"../results/heatbugsGPU.csv"	/* The file to send results. Directory must exist. */
+#define SNAPSHOT_FILENAME	"../results/heatbugsGPU.heat"	/* The file to send heat map snapshots. */
+#define ROI_FILENAME		"../results/heatbugsGPU.roi"	/* The file to send the regions of interest. */
+#define ROI_PERIOD		1				/* Iterations between reads of the regions of interest. */
+#define TRACE_FILENAME		"../results/heatbugsGPU.trace"	/* The file to send the bug trajectory samples. */
+#define TRACE_RING		64				/* Iterations of trajectory samples kept in the device. */
+#define TUNE_FILENAME		"./heatbugs.tune"		/* Work-group size profiles, written by --autotune. */
+#define WRITER_RING		4096				/* Results queued for the writer thread. Power of 2. */
+#define FLUSH_RECORDS		0				/* Results between flushes. (0 = by stdio). */
+#define FLUSH_MS		0				/* Milliseconds between flushes. (0 = by stdio). */
+#define CONVERGE_EPSILON	0.0f				/* Unhappiness change to stop at. (0 = never). */
+#define CONVERGE_WINDOW		100				/* Iterations the unhappiness change is measured over. */
+#define STILL_WINDOW		0				/* Iterations without bug moves to stop at. (0 = never). */
+#define ACTIVE_TILE		0				/* Side of the active region tiles. (0 = whole world). */
+#define ACTIVE_THRESHOLD	1.0e-6f				/* Heat a tile is flushed to zero at, when cold. */
+
+/* Largest side accepted for the memory tiles. */
+#define WORLD_TILE_MAX		64
+
+/* Largest OpenCL vector, in floats, used by the vectorised 'comp_world_heat'. */
+#define HEAT_VECTOR_WIDTH_MAX	16
+
+/* Times each candidate work-group size is run by the autotuner. The shortest run counts. */
+#define AUTOTUNE_REPETITIONS	10
+
+/* Largest local work size of the megakernel. A work-group per compute unit is launched. */
+#define MEGAKERNEL_LWS_MAX	256
+
+/* Largest side of the active region tiles, and of the local work size computing one. */
+#define ACTIVE_TILE_MAX		256
+#define ACTIVE_LWS_MAX		256
+
+/* Work-groups per compute unit striding over the active tile list. */
+#define ACTIVE_GROUPS_PER_CU	4
 
 
 /** The cl kernel file pathname. */
@@ -62,9 +101,24 @@
 #define KRNL_NAME__PREPARE_STEP_REPORT	"prepare_step_report"
 #define KRNL_NAME__BUG_STEP_BEST	"bug_step_best"
 #define KRNL_NAME__BUG_STEP_ANY_FREE	"bug_step_any_free"
+#define KRNL_NAME__BUG_STEP_CLASSIFY	"bug_step_classify"
+#define KRNL_NAME__BUG_STEP_BINNED	"bug_step_binned"
 #define KRNL_NAME__COMP_WORLD_HEAT	"comp_world_heat"
+#define KRNL_NAME__COMP_WORLD_HEAT_VEC	"comp_world_heat_vec"
+#define KRNL_NAME__COMP_WORLD_HEAT_IMG	"comp_world_heat_image"
 #define KRNL_NAME__UNHAPP_S1_REDUCE	"unhappiness_step1_reduce"
 #define KRNL_NAME__UNHAPP_S2_AVERAGE	"unhappiness_step2_average"
+#define KRNL_NAME__UNHAPP_REDUCE_FUSED	"unhappiness_reduce_fused"
+#define KRNL_NAME__MEGAKERNEL		"megakernel"
+#define KRNL_NAME__CONVERGENCE_CHECK	"convergence_check"
+#define KRNL_NAME__ACTIVE_TILES_LIST	"active_tiles_list"
+#define KRNL_NAME__COMP_HEAT_ACTIVE	"comp_world_heat_active"
+#define KRNL_NAME__BUG_STEP_CLAIM	"bug_step_claim"
+#define KRNL_NAME__BUG_STEP_RESOLVE	"bug_step_resolve"
+#define KRNL_NAME__BUG_STEP_RELEASE	"bug_step_release"
+#define KRNL_NAME__DEPOSIT_ATOMIC	"deposit_heat_atomic"
+#define KRNL_NAME__DEPOSIT_GATHER	"deposit_heat_gather"
+#define KRNL_NAME__TRACE_SAMPLE		"trace_sample"
 
 
 /** OpenCL options. */
@@ -74,28 +128,62 @@
 #define HB_NON_BLOCK	 CL_FALSE			/* Non blocked rd/wr operation. */
 
 
-#define OKI_DOKI	 0
-#define NOT_DOKI	-1
+/* The 'bug_step_retry' slot not in use, (as in the kernel). */
+#define OTHER_RETRY_SLOT( slot ) (1 - (slot))
+
+/* The heat map other than 'map', of the two swapped every iteration. */
+#define OTHER_HEAT_MAP( map ) (1 - (map))
+
+/* Megakernel 'mk_sync' buffer, as laid out in the kernel: its size, and where the iterations done are left. */
+#define MK_SYNC_STEPS	3
+#define MK_SYNC_SIZE	7
+
+/* The active tile list counter not in use, (as in the kernel). */
+#define OTHER_LIST_SLOT( slot ) (1 - (slot))
+
+/* Bins of the binned bug step, (as in the kernel), and the 'bin_count' set not in use. */
+#define NUM_BINS	3
+#define OTHER_BIN_SLOT( slot ) (1 - (slot))
+
+/* Bug attributes of a bug file, (as in the kernel): ideal temperature, output heat and random move chance. */
+#define NUM_BUG_ATTRS	3
+
+/* Bug file header. NUM_BUG_ATTRS arrays of 'bugs' floats follow it, in host byte order. */
+#define HB_BUG_FILE_MAGIC	"HBBUGS01"
+
+typedef struct hb_bug_file_header {
+	char magic[ 8 ];		/* HB_BUG_FILE_MAGIC, not null terminated. */
+	cl_ulong bugs;			/* Bugs in the file. */
+} HBBugFileHeader_t;
+
+/*
+   Scenario file header. The sections it has follow it, in this order: the initial heat, a float per cell, and the
+   obstacles, a byte per cell, non-zero where bugs can not go. Both row-major, in host byte order.
+ * */
+#define HB_SCENARIO_MAGIC	"HBSCEN01"
+
+#define HB_SCENARIO_HEAT	0x1	/* Initial heat section. */
+#define HB_SCENARIO_OBSTACLES	0x2	/* Obstacle section. */
+
+/* Bytes written to the device at once from a scenario file, so a very large world is not a single transfer. */
+#define HB_SCENARIO_CHUNK	(64 << 20)
 
+typedef struct hb_scenario_header {
+	char magic[ 8 ];		/* HB_SCENARIO_MAGIC, not null terminated. */
+	cl_uint width;			/* World width, it must be the simulated one. */
+	cl_uint height;			/* World height, it must be the simulated one. */
+	cl_uint sections;		/* HB_SCENARIO_* of the sections in the file. */
+	cl_uint reserved;		/* Zero. */
+} HBScenarioHeader_t;
 
-/** Input data used for simulation. */
-typedef struct parameters {
-	size_t seed;					/* IN: The seed to be used. */
-	size_t reduce_num_workgroups;			/* 'reduce_num_workgroups' used to send information across functions. */
-	size_t numIterations;				/* IN: Num Iterations to stop. (0 = non stop). */
-	size_t bugs_number;				/* IN: Number of bugs in the world. */
-	size_t world_width;				/* IN: World width size. */
-	size_t world_height;				/* IN: World height size. */
-	size_t world_size;				/* IN: World's vector size = (world_height * world_width). */
-	float world_diffusion_rate;			/* IN: [0..1], % temperature to adjacent cells. */
-	float world_evaporation_rate;			/* IN: [0..1], % temperature's loss to 'ether'.  */
-	float bugs_random_move_chance;			/* IN: [0..100], Chance a bug will move. */
-	unsigned int bugs_temperature_min_ideal;	/* IN: [0 .. 200], bug's minimum prefered temperature. */
-	unsigned int bugs_temperature_max_ideal;	/* IN: [0 .. 200], bug's maximum prefered temperature. */
-	unsigned int bugs_heat_min_output;		/* IN: [0 .. 100], min heat a bug leaves in the world per step. */
-	unsigned int bugs_heat_max_output;		/* IN: [0 .. 100], max heat a bug leaves in the world per step. */
-	char output_filename[256];			/* IN: File to send results. */
-} Parameters_t;
+/* Convergence 'conv_state' buffer, as laid out in the kernel: its size, and where the stop reason is. */
+#define CONV_REASON	2
+#define CONV_STATE_SIZE	4
+
+/* Trajectory samples file. Same record as the kernel's 'trace_sample', 2 words. */
+#define TRACE_MAGIC	"HBTR"
+#define TRACE_VERSION	1
+#define TRACE_RECORD	(2 * sizeof( cl_uint ))
 
 
 /** Holder for all OpenCl objects. */
@@ -103,6 +191,7 @@ typedef struct ocl_objects {
 	CCLContext *ctx;				/* Context.	*/
 	CCLDevice *dev;					/* Device.	*/
 	CCLQueue *queue;				/* Queue.	*/
+	CCLQueue *io_queue;				/* Transfer queue, for results and snapshots. Async I/O only. */
 	CCLProgram *prg;				/* Kernel code.	*/
 } OCLObjects_t;
 
@@ -116,9 +205,21 @@ typedef struct hb_kernels {
 	CCLKernel *prepare_step_report;			/* Reset the 'bug step retry' report flag. */
 	CCLKernel *bug_step_best;			/* Try to move the bug to the best place if the place is free. */
 	CCLKernel *bug_step_any_free;			/* Try to move the bug to a random free place. */
+	CCLKernel *bug_step_classify;			/* Bin the bugs by what they want to do. Binned step only. */
+	CCLKernel *bug_step_binned;			/* Try to move the binned bugs to their place. Binned step only. */
 	CCLKernel *comp_world_heat;			/* Compute world heat, diffusion then evaporation. */
 	CCLKernel *unhapp_step1_reduce;			/* Reduce (sum) the unhappiness vector. */
 	CCLKernel *unhapp_step2_average;		/* Further reduce the unhappiness vector and compute average. */
+	CCLKernel *unhapp_reduce_fused;			/* Both reduction steps in one launch. Fused pipeline only. */
+	CCLKernel *megakernel;				/* Many whole iterations in one launch. Megakernel mode only. */
+	CCLKernel *convergence_check;			/* Convergence stop criteria. Only if enabled. */
+	CCLKernel *active_tiles_list;			/* List the tiles to compute world heat on. Active tiles only. */
+	CCLKernel *comp_world_heat_active;		/* Compute world heat on the listed tiles. Active tiles only. */
+	CCLKernel *bug_step_claim;			/* Pick and claim the bug target cells. Deterministic mode only. */
+	CCLKernel *bug_step_resolve;			/* Move the bugs that won their claims. Deterministic mode only. */
+	CCLKernel *bug_step_release;			/* Clear the claims. Deterministic mode only. */
+	CCLKernel *deposit_heat;			/* Leave the heat of all bugs. Atomic or gather deposit only. */
+	CCLKernel *trace_sample;			/* Gather the trajectory samples. Only if sampling. */
 } HBKernels_t;
 
 
@@ -131,9 +232,20 @@ typedef struct hb_global_work_sizes {
 	size_t prepare_step_report[ HB_DIMS_1 ];
 	size_t bug_step_best[ HB_DIMS_1 ];
 	size_t bug_step_any_free[ HB_DIMS_1 ];
+	size_t bug_step_classify[ HB_DIMS_1 ];
+	size_t bug_step_binned[ HB_DIMS_1 ];
 	size_t comp_world_heat[ HB_DIMS_2 ];
 	size_t unhapp_step1_reduce[ HB_DIMS_1 ];
 	size_t unhapp_step2_average[ HB_DIMS_1 ];
+	size_t megakernel[ HB_DIMS_1 ];
+	size_t convergence_check[ HB_DIMS_1 ];
+	size_t active_tiles_list[ HB_DIMS_1 ];
+	size_t comp_world_heat_active[ HB_DIMS_1 ];
+	size_t bug_step_claim[ HB_DIMS_1 ];
+	size_t bug_step_resolve[ HB_DIMS_1 ];
+	size_t bug_step_release[ HB_DIMS_1 ];
+	size_t deposit_heat[ HB_DIMS_1 ];
+	size_t trace_sample[ HB_DIMS_1 ];
 } HBGlobalWorkSizes_t;
 
 
@@ -146,15 +258,37 @@ typedef struct hb_local_work_sizes {
 	size_t prepare_step_report[ HB_DIMS_1 ];
 	size_t bug_step_best[ HB_DIMS_1 ];
 	size_t bug_step_any_free[ HB_DIMS_1 ];
+	size_t bug_step_classify[ HB_DIMS_1 ];
+	size_t bug_step_binned[ HB_DIMS_1 ];
 	size_t comp_world_heat[ HB_DIMS_2 ];
 	size_t unhapp_step1_reduce[ HB_DIMS_1 ];
 	size_t unhapp_step2_average[ HB_DIMS_1 ];
+	size_t megakernel[ HB_DIMS_1 ];
+	size_t convergence_check[ HB_DIMS_1 ];
+	size_t active_tiles_list[ HB_DIMS_1 ];
+	size_t comp_world_heat_active[ HB_DIMS_1 ];
+	size_t bug_step_claim[ HB_DIMS_1 ];
+	size_t bug_step_resolve[ HB_DIMS_1 ];
+	size_t bug_step_release[ HB_DIMS_1 ];
+	size_t deposit_heat[ HB_DIMS_1 ];
+	size_t trace_sample[ HB_DIMS_1 ];
 } HBLocalWorkSizes_t;
 
 
+/** Local work sizes found by the autotuner for the kernels that benefit from it. A size 0 means not tuned. */
+typedef struct hb_tuned_sizes {
+	size_t bug_step_best[ HB_DIMS_1 ];
+	size_t bug_step_any_free[ HB_DIMS_1 ];
+	size_t comp_world_heat[ HB_DIMS_2 ];
+	size_t unhapp_step1_reduce[ HB_DIMS_1 ];
+} HBTunedSizes_t;
+
+
 /** Host Buffers. */
 typedef struct hb_host_buffers {
-	cl_uint *bug_step_retry;	/* SIZE: 1		- In any iteration if set, signals for another recall of the bug_step kernel. */
+	cl_uint *bug_step_retry;	/* SIZE: 2		- In any iteration if set, signals for another recall of the bug_step kernel. */
+	cl_float *heat_snapshot;	/* SIZE: WORLD_STORAGE	- Heat map as stored in the device, tiled or not. Device buffers only. */
+	cl_float *heat_row;		/* SIZE: WORLD_WIDTH	- One heat map row, converted back to row-major. */
 //	cl_uint *rng_state;		/* SIZE: BUGS_NUM	- Random seeds buffer. DEBUG: (to remove). */
 //	cl_uint *swarm_bugPosition;	/* SIZE: BUGS_NUM	- Bug's position in the swarm_map, (swarm_bugPosition). */
 //	cl_uint *swarm_map;		/* SIZE: WORLD_SIZE	- Bugs map. Each cell is: 'ideal-Temperature':8bit 'bug':1bit 'output_heat':7bit. */
@@ -162,44 +296,119 @@ typedef struct hb_host_buffers {
 //	cl_float *unhappiness;		/* SIZE: NUM_BUGS	- The Unhappiness vector. */
 //	cl_float *unhapp_reduced;	/* SIZE: REDUCE_NUM_WORKGROUPS - The number of workgroups performing reduction. */
 	cl_float *unhapp_average;	/* SIZE: 1		- Unhappiness average. The expected result at the end of each iteration. */
+	cl_float *unhapp_results;	/* SIZE: MK_STEPS	- Unhappiness average of each iteration of a megakernel launch. Device buffers only. */
+	cl_uint *bug_placement;		/* SIZE: BUGS_NUM	- Bug cells read from the placement file, row-major. */
+	cl_uint *roi_frame;		/* SIZE: ROI_FRAME	- Regions of interest, 4 byte cells, row-major. */
+	cl_uint *roi_staging;		/* SIZE: ROI_STAGING	- Whole tiles covering the regions of interest. Tiled maps only. */
+	cl_uint *trace_ring;		/* SIZE: TRACE_RING	- Trajectory samples, read from the device ring. */
 } HBHostBuffers_t;
 
 
 /** Device buffers. */
 typedef struct hb_device_buffers {
-	CCLBuffer *bug_step_retry;	/* SIZE: 1		- In any iteration if set, signals for another recall of the bug_step kernel. */
+	CCLBuffer *bug_step_retry;	/* SIZE: 2		- In any iteration if set, signals for another recall of the bug_step kernel. */
 	CCLBuffer *rng_state;		/* SIZE: BUGS_NUM	- Random seeds buffer. */
 	CCLBuffer *swarm_bugPosition;	/* SIZE: BUGS_NUM	- Bug's position in the swarm_map, (swarm_bugPosition). */
-	CCLBuffer *swarm_map;		/* SIZE: WORLD_SIZE	- Bugs map. Each cell is: 'ideal-Temperature':8bit 'bug':1bit 'output_heat':7bit. */
-	CCLBuffer *heat_map[2];		/* SIZE: WORLD_SIZE	- Temperature map (heat_map) & the buffer (heat_buffer). */
+	CCLBuffer *swarm_map;		/* SIZE: WORLD_STORAGE	- Bugs map. Each cell is: 'ideal-Temperature':8bit 'bug':1bit 'output_heat':7bit. */
+	CCLBuffer *bug_attrs;		/* SIZE: NUM_BUG_ATTRS * BUGS_NUM - Bug attributes, an array of each. Bug file only. */
+	CCLBuffer *scenario_heat;	/* SIZE: WORLD_SIZE	- Initial heat, row-major. Scenario heat only. */
+	CCLBuffer *scenario_obstacles;	/* SIZE: WORLD_SIZE	- Obstacle mask, a byte per cell, row-major. Scenario obstacles only. */
+	CCLBuffer *heat_map[2];		/* SIZE: WORLD_STORAGE	- Temperature map (heat_map) & the buffer (heat_buffer). */
+	CCLImage *heat_image[2];	/* SIZE: WORLD_SIZE	- Images over 'heat_map[2]', for 'comp_world_heat_image'. Heat image only. */
 	CCLBuffer *unhappiness;		/* SIZE: NUM_BUGS	- The Unhappiness vector. */
 	CCLBuffer *unhapp_reduced;	/* SIZE: REDOX_NUM_WORKGROUPS - The number of workgroups performing reduction. */
 	CCLBuffer *unhapp_average;	/* SIZE: 1		- Unhappiness average. The expected result at the end of each iteration. */
+	CCLBuffer *reduce_done;		/* SIZE: 1		- Work-groups done in the fused reduction. Zero between launches. */
+	CCLBuffer *mk_sync;		/* SIZE: MK_SYNC_SIZE	- Megakernel global barrier, retry slots and iterations done. */
+	CCLBuffer *mk_reduced;		/* SIZE: MK_GROUPS	- Megakernel unhappiness sum of each work-group. */
+	CCLBuffer *unhapp_results;	/* SIZE: MK_STEPS	- Unhappiness average of each iteration of a megakernel launch. */
+	CCLBuffer *stop_flag;		/* SIZE: 1		- Set by the host, mapped, to end a megakernel launch early. */
+	CCLBuffer *conv_window;		/* SIZE: CONV_WINDOW	- Last unhappiness averages, for the convergence check. */
+	CCLBuffer *conv_state;		/* SIZE: CONV_STATE_SIZE - Convergence check state, bug moves and stop reason. */
+	CCLBuffer *tile_flags;		/* SIZE: ACTIVE_TILES	- Iterations each active region tile was active in. */
+	CCLBuffer *active_list;		/* SIZE: ACTIVE_TILES	- Tiles to compute world heat on. */
+	CCLBuffer *active_count;	/* SIZE: 2		- Tiles listed, two counters used in turns. */
+	CCLBuffer *bug_target;		/* SIZE: BUGS_NUM	- Cell each bug claims or stays at. Deterministic mode only. */
+	CCLBuffer *claims;		/* SIZE: WORLD_STORAGE	- Lowest priority claiming each cell. Deterministic mode only. */
+	CCLBuffer *bin_list;		/* SIZE: NUM_BINS * BUGS_NUM - Bugs in each bin, a bin per BUGS_NUM entries. Binned step only. */
+	CCLBuffer *bin_count;		/* SIZE: 2 * NUM_BINS	- Bugs in each bin, two sets of counters used in turns. */
+	CCLBuffer *trace_last;		/* SIZE: TRACE_SAMPLE	- Storage cell of the last record of each sampled bug. */
+	CCLBuffer *trace_ring;		/* SIZE: TRACE_RING	- Trajectory samples, a slot of TRACE_SAMPLE records per iteration. */
 } HBDeviceBuffers_t;
 
 
 /** Buffers sizes. Sizes are common to host and device buffers. */
 typedef struct hb_buffers_size {
-	size_t bug_step_retry;		/* VAL: 1 * sizeof( cl_uint ) */
+	size_t bug_step_retry;		/* VAL: 2 * sizeof( cl_uint ), one per retry slot. */
 	size_t rng_state;		/* VAL: BUGS_NUM * sizeof( cl_uint ) */
 	size_t swarm_bugPosition;	/* VAL: BUGS_NUM * sizeof( cl_uint ) */
-	size_t swarm_map;		/* VAL: WORLD_SIZE * sizeof( cl_uint ) */
-	size_t heat_map;		/* VAL: WORLD_SIZE * sizeof( cl_float ) */
+	size_t swarm_map;		/* VAL: WORLD_STORAGE * sizeof( cl_uint ) */
+	size_t bug_attrs;		/* VAL: NUM_BUG_ATTRS * BUGS_NUM * sizeof( cl_float ) */
+	size_t scenario_heat;		/* VAL: WORLD_SIZE * sizeof( cl_float ) */
+	size_t scenario_obstacles;	/* VAL: WORLD_SIZE * sizeof( cl_uchar ) */
+	size_t heat_map;		/* VAL: WORLD_STORAGE * sizeof( cl_float ) */
 	size_t unhappiness;		/* VAL: BUGS_NUM * sizeof( cl_float ) */
-	size_t unhapp_reduced;		/* VAL: REDOX_NUM_WORKGROUPS * sizeof( cl_float ) */
+	size_t unhapp_reduced;		/* VAL: REDOX_NUM_WORKGROUPS * sizeof( cl_float ), cl_ulong if deterministic. */
 	size_t unhapp_average;		/* VAL: 1 * sizeof( cl_float ) */
+	size_t reduce_done;		/* VAL: 1 * sizeof( cl_uint ) */
+	size_t mk_sync;			/* VAL: MK_SYNC_SIZE * sizeof( cl_uint ) */
+	size_t mk_reduced;		/* VAL: MK_GROUPS * sizeof( cl_float ) */
+	size_t unhapp_results;		/* VAL: MK_STEPS * sizeof( cl_float ) */
+	size_t stop_flag;		/* VAL: 1 * sizeof( cl_uint ) */
+	size_t conv_window;		/* VAL: MAX( CONV_WINDOW, 1 ) * sizeof( cl_float ) */
+	size_t conv_state;		/* VAL: CONV_STATE_SIZE * sizeof( cl_uint ) */
+	size_t tile_flags;		/* VAL: MAX( ACTIVE_TILES, 1 ) * sizeof( cl_uint ) */
+	size_t active_list;		/* VAL: MAX( ACTIVE_TILES, 1 ) * sizeof( cl_uint ) */
+	size_t active_count;		/* VAL: 2 * sizeof( cl_uint ) */
+	size_t bug_target;		/* VAL: BUGS_NUM * sizeof( cl_uint ) */
+	size_t claims;			/* VAL: WORLD_STORAGE * sizeof( cl_uint ) */
+	size_t bin_list;		/* VAL: NUM_BINS * BUGS_NUM * sizeof( cl_uint ) */
+	size_t bin_count;		/* VAL: 2 * NUM_BINS * sizeof( cl_uint ) */
+	size_t trace_last;		/* VAL: TRACE_SAMPLE * sizeof( cl_uint ) */
+	size_t trace_ring;		/* VAL: TRACE_RING * TRACE_SAMPLE * TRACE_RECORD */
 } HBBuffersSize_t;
 
 
-
-const char version[] = "Heatbugs simulation for GPU (parallel processing) v3.1.";
-
-
-
-#define HB_ERROR hb_error_quark()
-
-
-static GQuark hb_error_quark( void ) {
+/** Simulation state, kept between the steps of an engine. */
+typedef struct hb_sim_state {
+	cl_uint heat_main;		/* The 'heat_map' buffer with the current world heat. */
+	cl_uint retry_slot;		/* The 'bug_step_retry' slot the next bug step launch reports to. */
+	cl_uint list_slot;		/* The 'active_count' slot the next active tile list is counted in. */
+	cl_uint bin_slot;		/* The 'bin_count' set the next binned bug step counts in. */
+	cl_uint step_key;		/* Deterministic bug step passes done. */
+	size_t iterations;		/* Iterations done. */
+	cl_float unhappiness;		/* Unhappiness average of the last iteration. */
+	cl_uint stop_reason;		/* Why it stopped, (enum hb_stop_reasons). */
+	volatile sig_atomic_t stop_requested;	/* Set by 'hb_engine_stop(...)'. */
+	volatile cl_uint *stop_flag;	/* The mapped megakernel stop flag, while the megakernel simulation runs. */
+	size_t trace_pending;		/* Trajectory sample slots filled in the device ring, not written yet. */
+} HBSimState_t;
+
+
+/** Simulation engine. The OpenCL objects and buffers live as long as the engine. */
+struct hb_engine {
+	Parameters_t params;		/* Checked copy of the parameters. */
+	OCLObjects_t oclobj;
+	HBKernels_t krnl;
+	HBGlobalWorkSizes_t gws;
+	HBLocalWorkSizes_t lws;
+	HBTunedSizes_t tuned;
+	HBHostBuffers_t hst_buff;
+	HBDeviceBuffers_t dev_buff;
+	HBBuffersSize_t bufsz;
+	HBSimState_t state;
+	int initiated;			/* Set once initiated, cleared on errors. */
+	int autotuned;			/* Set once the work-group sizes are tuned, they are tuned once. */
+	HBWriter_t *writer;		/* Receives the unhappiness averages. NULL for none. */
+	FILE *snapshot_file;		/* Receives the heat map snapshots. NULL for none. */
+	FILE *roi_file;			/* Receives the regions of interest. NULL for none. */
+	FILE *trace_file;		/* Receives the trajectory samples. NULL for none. */
+	CCLProf *prof;			/* Device times, '--profile' only. */
+};
+
+
+
+GQuark hb_error_quark( void ) {
 	return g_quark_from_static_string( "hb-error-quark" );
 }
 
@@ -232,33 +441,42 @@ inline int get_random_seed( size_t *seed )
 
 
 /**
- * Sets the parameters passed as command line arguments.
- * If there are no parameters, default parameters are used.
- * Default parameter will be used for every omitted parameter.
- *
- * This function uses the GNU 'getopt' command line argument parser, and requires the macro _GNU_SOURCE to be defined.
- * As such, the code using the 'getopt' function is not portable.
- * Consequence of using 'getopt' is that the previous result of 'argv' parameter may change after 'getopt' is used,
- * therefore 'argv' should not be used again.
- * The function 'getopt' is marked as Thread Unsafe.
- *
- * @param[out]	params - Parameters to be filled with default or
- *                     from command line.
- * @param[in]	argc   - Command line argument counter.
- * @param[in]	argv   - Command line arguments.
- * @param[out]	err    - GLib object for error reporting.
+ * Storage index of the world cell at ('row', 'col'). Mirror of the kernel's 'cell_index(...)', used to convert the
+ * maps read from the device back to row-major.
  * */
-static inline void getSimulParameters( Parameters_t *const params, int argc, char *argv[], GError **err )
+static inline size_t world_index( const Parameters_t *const params, size_t row, size_t col )
 {
-	int c;	/* Parsed command line option */
+	const size_t tile = params->world_tile;
+
+	if (tile == 0)
+		return row * params->world_width + col;
+
+	return ((row / tile) * params->world_tiles_x + col / tile) * SQUARE( tile ) + (row % tile) * tile + col % tile;
+}
+
 
-	/*
-	   The string 't:T:h:H:r:n:d:e:w:W:i:f:' is the parameter string to be checked by 'getopt' function.
-	   The ':' character means that a value is required after the parameter selector character (i.e. -t 50  or  -t50).
-	 * */
-	const char matches[] = "t:T:h:H:r:n:d:e:w:W:i:s:f:";
+
+/**
+ * Tiles of a tiled map covering a region of interest: 'ntx' x 'nty' tiles from tile ('ty0', 'tx0').
+ * */
+static inline void roi_tiles( const Parameters_t *const params, const HBRoi_t *const roi,
+				size_t *tx0, size_t *ty0, size_t *ntx, size_t *nty )
+{
+	const size_t tile = params->world_tile;
+
+	*tx0 = roi->col / tile;
+	*ty0 = roi->row / tile;
+	*ntx = (roi->col + roi->width - 1) / tile - *tx0 + 1;
+	*nty = (roi->row + roi->height - 1) / tile - *ty0 + 1;
+}
 
 
+
+/**
+ * Fill the parameters with the defaults. The seed is read from /dev/urandom, so runs differ unless a seed is given.
+ * */
+void hb_params_defaults( Parameters_t *params )
+{
 	/* Default / hardcoded parameters. */
 	params->seed = DEFAULT_SEED;					/* s */
 	params->numIterations = NUM_ITERATIONS;				/* i */
@@ -273,6 +491,46 @@ static inline void getSimulParameters( Parameters_t *const params, int argc, cha
 	params->bugs_heat_min_output = BUGS_HEAT_MIN_OUTPUT;		/* h */
 	params->bugs_heat_max_output = BUGS_HEAT_MAX_OUTPUT;		/* H */
 	strcpy( params->output_filename, OUTPUT_FILENAME );		/* f */
+	params->world_tile = WORLD_TILE;				/* --tile */
+	params->snapshot_period = SNAPSHOT_PERIOD;			/* --snapshot-period */
+	strcpy( params->snapshot_filename, SNAPSHOT_FILENAME );		/* --snapshot-file */
+	params->roi_count = 0;						/* --roi */
+	params->roi_period = ROI_PERIOD;				/* --roi-period */
+	strcpy( params->roi_filename, ROI_FILENAME );			/* --roi-file */
+	params->trace_sample = 0;					/* --trace */
+	params->trace_ring = TRACE_RING;				/* --trace-ring */
+	strcpy( params->trace_filename, TRACE_FILENAME );		/* --trace-file */
+	params->device_type = DEVICE_TYPE;				/* --device */
+	params->heat_vector_width = HEAT_VECTOR_WIDTH;			/* --vector-width */
+	params->heat_image = 0;						/* --heat-image */
+	params->binned_step = 0;					/* --binned-step */
+	params->autotune = 0;						/* --autotune */
+	strcpy( params->tune_filename, TUNE_FILENAME );			/* --tune-file */
+	params->fused = 0;						/* --fused */
+	params->megakernel_steps = 0;					/* --megakernel */
+	params->megakernel_groups = 0;
+	params->async_io = 0;						/* --async-io */
+	params->writer_ring = WRITER_RING;				/* --writer-ring */
+	params->flush_records = FLUSH_RECORDS;				/* --flush-records */
+	params->flush_ms = FLUSH_MS;					/* --flush-ms */
+	params->converge_epsilon = CONVERGE_EPSILON;			/* --converge-eps */
+	params->converge_window = CONVERGE_WINDOW;			/* --converge-window */
+	params->still_window = STILL_WINDOW;				/* --still-window */
+	params->active_tile = ACTIVE_TILE;				/* --active-tile */
+	params->active_threshold = ACTIVE_THRESHOLD;			/* --active-threshold */
+	params->active_groups = 0;
+	params->placement = HB_PLACE_RANDOM;				/* --placement */
+	params->placement_filename[ 0 ] = '\0';				/* --placement-file */
+	params->bug_filename[ 0 ] = '\0';					/* --bug-file */
+	params->scenario_filename[ 0 ] = '\0';				/* --scenario-file */
+	params->deterministic = 0;					/* --deterministic */
+	params->deposit = HB_DEPOSIT_INLINE;				/* --deposit */
+	params->accumulator = HB_ACCUM_FLOAT;				/* --accumulator */
+	params->neighbourhood = HB_NEIGHBOURS_MOORE;			/* --neighbourhood */
+	params->boundary = HB_BOUNDARY_TORUS;				/* --boundary */
+	params->profile = 0;						/* --profile */
+	params->buffers = HB_BUFFERS_AUTO;				/* --buffers */
+	params->host_buffers = 0;
 
 
         /* Read initial seed from linux /dev/urandom */
@@ -281,82 +539,244 @@ static inline void getSimulParameters( Parameters_t *const params, int argc, cha
                 fprintf( stderr, "Could not read from urandom device to get seed. " );
                 fprintf( stderr, "Default will be used unless one was provided.\n" );
         }
+}
+
+
+
+/**
+ * Check the simulation parameters, and compute the ones derived from them.
+ *
+ * @param[in,out] params - Parameters to be checked and completed.
+ * @param[out]	err    - GLib object for error reporting.
+ * */
+static inline void checkSimulParameters( Parameters_t *const params, GError **err )
+{
+	FILE *scenario_file = NULL;
+	HBScenarioHeader_t scenario;
+
+	params->world_size = params->world_height * params->world_width;
+
+	/* Check memory tiles. Tiles are squares with power of 2 side, so tiled addressing needs no divisions. */
+	hb_if_err_create_goto( *err, HB_ERROR,
+				(params->world_tile != 0) &&
+				(params->world_tile < 2 || params->world_tile > WORLD_TILE_MAX ||
+				 !IS_POW2( params->world_tile )),
+				HB_TILE_INVALID, error_handler,
+				"Memory tile side must be 0 (row-major) or a power of 2 in [2 .. %d].", WORLD_TILE_MAX );
+
+	/* Check the vectorised heat computation width. Must be an OpenCL vector size. */
+	hb_if_err_create_goto( *err, HB_ERROR,
+				(params->heat_vector_width != 0) &&
+				(params->heat_vector_width > HEAT_VECTOR_WIDTH_MAX || !IS_POW2( params->heat_vector_width )),
+				HB_INVALID_PARAMETER, error_handler,
+				"Vector width must be 0 (device's preferred) or a power of 2 up to %d.",
+				HEAT_VECTOR_WIDTH_MAX );
+
+	/* The unhappiness change is measured between at least 2 iterations. Window unused if no epsilon. */
+	hb_if_err_create_goto( *err, HB_ERROR,
+				params->converge_epsilon < 0 ||
+				(params->converge_epsilon > 0 && params->converge_window < 2),
+				HB_INVALID_PARAMETER, error_handler,
+				"Convergence epsilon must be positive, and its window at least 2 iterations." );
+
+	if (params->converge_epsilon == 0)
+		params->converge_window = 0;
+
+	/* The writer ring is indexed with a mask. */
+	hb_if_err_create_goto( *err, HB_ERROR,
+				params->writer_ring == 0 || !IS_POW2( params->writer_ring ),
+				HB_INVALID_PARAMETER, error_handler,
+				"Writer ring size must be a power of 2." );
+
+	/* The megakernel runs whole iterations by itself, there is no pipeline to fuse. */
+	hb_if_err_create_goto( *err, HB_ERROR,
+				params->megakernel_steps && params->fused,
+				HB_INVALID_PARAMETER, error_handler,
+				"Options --megakernel and --fused can not be used together." );
+
+	/* Active region tiles. Power of 2 sides, as the memory tiles, so locating a cell's tile needs no divisions. */
+	hb_if_err_create_goto( *err, HB_ERROR,
+				(params->active_tile != 0) &&
+				(params->active_tile < 2 || params->active_tile > ACTIVE_TILE_MAX ||
+				 !IS_POW2( params->active_tile )),
+				HB_TILE_INVALID, error_handler,
+				"Active tile side must be 0 (whole world) or a power of 2 in [2 .. %d].", ACTIVE_TILE_MAX );
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+				params->active_threshold < 0,
+				HB_INVALID_PARAMETER, error_handler,
+				"Active tile threshold can not be negative." );
+
+	/* The megakernel always computes the whole world. */
+	hb_if_err_create_goto( *err, HB_ERROR,
+				params->megakernel_steps && params->active_tile,
+				HB_INVALID_PARAMETER, error_handler,
+				"Options --megakernel and --active-tile can not be used together." );
+
+	/*
+	   Deterministic mode resolves the bug step conflicts in passes of its own, and sums the unhappiness in fixed point.
+	   Random placement depends on the order the bugs find their cells, so bugs are placed by permutation instead.
+	 * */
+	hb_if_err_create_goto( *err, HB_ERROR,
+				params->deterministic && (params->fused || params->megakernel_steps),
+				HB_INVALID_PARAMETER, error_handler,
+				"Option --deterministic can not be used with --fused nor --megakernel." );
+
+	if (params->deterministic && params->placement == HB_PLACE_RANDOM)
+		params->placement = HB_PLACE_PERMUTE;
+
+	if (params->deterministic)
+		params->accumulator = HB_ACCUM_FIXED;
+
+	/* The fused reduction and the megakernel sum in single precision. The others are for the two step reduction. */
+	hb_if_err_create_goto( *err, HB_ERROR,
+				params->accumulator != HB_ACCUM_FLOAT && (params->fused || params->megakernel_steps),
+				HB_INVALID_PARAMETER, error_handler,
+				"Options --fused and --megakernel sum with --accumulator float only." );
+
+	switch (params->accumulator)
+	{
+		case HB_ACCUM_KAHAN:
+			params->unhapp_sum_size = sizeof( cl_float2 );
+			break;
+		case HB_ACCUM_DOUBLE:
+			params->unhapp_sum_size = sizeof( cl_double );
+			break;
+		case HB_ACCUM_FIXED:
+			params->unhapp_sum_size = sizeof( cl_ulong );
+			break;
+		default:
+			params->unhapp_sum_size = sizeof( cl_float );
+	}
+
+	params->active_tiles_x = params->active_tile ? DIV_CEIL( params->world_width, params->active_tile ) : 0;
+	params->active_tiles_y = params->active_tile ? DIV_CEIL( params->world_height, params->active_tile ) : 0;
+
+	/* The world is stored as whole tiles. Cells past the world edges are padding, never read by the kernels. */
+	if (params->world_tile)
+	{
+		params->world_tiles_x = (params->world_width + params->world_tile - 1) / params->world_tile;
+		params->world_storage_size = params->world_tiles_x * SQUARE( params->world_tile ) *
+						((params->world_height + params->world_tile - 1) / params->world_tile);
+	}
+	else
+	{
+		params->world_tiles_x = 0;
+		params->world_storage_size = params->world_size;
+	}
 
+	/* Regions of interest. Inside the world, and each frame of them is 4 bytes per cell. */
+	hb_if_err_create_goto( *err, HB_ERROR,
+				params->roi_count > HB_ROI_MAX || (params->roi_count && params->roi_period == 0),
+				HB_INVALID_PARAMETER, error_handler,
+				"At most %d regions of interest, read every 1 or more iterations.", HB_ROI_MAX );
 
-	/* Parse command line arguments using GNU's getopt function. */
+	params->roi_frame_size = 0;
+	params->roi_staging_size = 0;
 
-	while ( (c = getopt( argc, argv, matches )) != -1 )
+	for (size_t i = 0; i < params->roi_count; i++)
 	{
-		switch (c)
+		const HBRoi_t *const roi = &params->rois[ i ];
+		size_t tx0, ty0, ntx, nty;
+
+		hb_if_err_create_goto( *err, HB_ERROR,
+					(roi->map != HB_ROI_HEAT && roi->map != HB_ROI_SWARM) ||
+					roi->height == 0 || roi->width == 0 ||
+					roi->height > params->world_height || roi->row > params->world_height - roi->height ||
+					roi->width > params->world_width || roi->col > params->world_width - roi->width,
+					HB_INVALID_PARAMETER, error_handler,
+					"Region of interest %zu is empty or out of the world.", i + 1 );
+
+		params->roi_frame_size += roi->height * roi->width * sizeof( cl_uint );
+
+		/* Tiled maps are read as the whole tiles covering the region. */
+		if (params->world_tile)
 		{
-			case 't':
-				params->bugs_temperature_min_ideal = atoi( optarg );
-				break;
-			case 'T':
-				params->bugs_temperature_max_ideal = atoi( optarg );
-				break;
-			case 'h':
-				params->bugs_heat_min_output = atoi( optarg );
-				break;
-			case 'H':
-				params->bugs_heat_max_output = atoi( optarg );
-				break;
-			case 'r':
-				params->bugs_random_move_chance = atof( optarg );
-				break;
-			case 'n':
-				params->bugs_number = atoi( optarg );
-				break;
-			case 'd':
-				params->world_diffusion_rate = atof( optarg );
-				break;
-			case 'e':
-				params->world_evaporation_rate = atof( optarg );
-				break;
-			case 'w':
-				params->world_width = atoi( optarg );
-				break;
-			case 'W':
-				params->world_height = atoi( optarg );
-				break;
-			case 'i':
-				params->numIterations = atoi( optarg );
-				break;
-			case 's':
-				params->seed = atoi( optarg );
-				break;
-			case 'f':
-				strcpy( params->output_filename, optarg );
-				break;
-			case '?':
-				hb_if_err_create_goto( *err, HB_ERROR,
-							(optopt != ':' && strchr( matches, optopt ) != NULL),
-							HB_PARAM_ARG_MISSING, error_handler,
-							"Option required argument missing." );
-
-				hb_if_err_create_goto( *err, HB_ERROR,
-							(isprint( optopt )),
-							HB_PARAM_OPTION_UNKNOWN, error_handler,
-							"Unknown option." );
-
-				hb_if_err_create_goto( *err, HB_ERROR,
-							CL_TRUE,
-							HB_PARAM_CHAR_UNKNOWN, error_handler,
-							"Unprintable character in command line." );
-			default:
-				hb_if_err_create_goto( *err, HB_ERROR,
-							CL_TRUE,
-							HB_PARAM_PARSING, error_handler,
-							"Weird error occurred while parsing parameter." );
+			roi_tiles( params, roi, &tx0, &ty0, &ntx, &nty );
+			params->roi_staging_size += ntx * nty * SQUARE( params->world_tile ) * sizeof( cl_uint );
 		}
 	}
 
 	/*
-	   NOTE: Check here for extra arguments... see:
-	   	 https://www.gnu.org/software/libc/manual/html_node/Example-of-Getopt.html
-	 */
+	   Trajectory samples. Bits 0 to 30 of a record hold the cell, and the ring is indexed in 32 bits. Sampling runs a
+	   kernel per iteration, the megakernel has no launch to add it to.
+	 * */
+	hb_if_err_create_goto( *err, HB_ERROR,
+				params->trace_sample &&
+				(params->trace_sample > params->bugs_number || params->trace_ring == 0 ||
+				 params->world_size > 0x7fffffff || params->trace_ring * params->trace_sample > 0x3fffffff),
+				HB_INVALID_PARAMETER, error_handler,
+				"Trajectory samples must be at most the bugs, in a ring of 1 or more iterations." );
 
-	params->world_size = params->world_height * params->world_width;
+	hb_if_err_create_goto( *err, HB_ERROR,
+				params->trace_sample && params->megakernel_steps,
+				HB_INVALID_PARAMETER, error_handler,
+				"Options --megakernel and --trace can not be used together." );
+
+	/*
+	   Heat maps as images. The images are created over the heat map buffers, so their cells must be row-major.
+	   The megakernel and the active tiles compute the world heat in kernels of their own, from the buffers.
+	 * */
+	hb_if_err_create_goto( *err, HB_ERROR,
+				params->heat_image && (params->world_tile || params->megakernel_steps || params->active_tile),
+				HB_INVALID_PARAMETER, error_handler,
+				"Option --heat-image can not be used with --tile, --megakernel nor --active-tile." );
+
+	/* Bug attributes are read by bug, and the gather deposition does not know which bug is on a cell. */
+	hb_if_err_create_goto( *err, HB_ERROR,
+				params->bug_filename[ 0 ] != '\0' && params->deposit == HB_DEPOSIT_GATHER,
+				HB_INVALID_PARAMETER, error_handler,
+				"Options --bug-file and --deposit gather can not be used together." );
+
+	/* The binned bug step replaces 'bug_step_best'. The megakernel and the deterministic mode step bugs their own way. */
+	hb_if_err_create_goto( *err, HB_ERROR,
+				params->binned_step && (params->megakernel_steps || params->deterministic),
+				HB_INVALID_PARAMETER, error_handler,
+				"Option --binned-step can not be used with --megakernel nor --deterministic." );
+
+	/*
+	   Scenario file header. Its sections select what 'init_maps' is built with, so they are known before the
+	   program is built. The sections are read with the buffers.
+	 * */
+	params->scenario_sections = 0;
+
+	if (params->scenario_filename[ 0 ] != '\0')
+	{
+		scenario_file = fopen( params->scenario_filename, "rb" );
+		hb_if_err_create_goto( *err, HB_ERROR,
+					scenario_file == NULL,
+					HB_UNABLE_OPEN_FILE, error_handler,
+					"Could not open scenario file '%s'.", params->scenario_filename );
+
+		hb_if_err_create_goto( *err, HB_ERROR,
+					fread( &scenario, sizeof( scenario ), 1, scenario_file ) != 1 ||
+					memcmp( scenario.magic, HB_SCENARIO_MAGIC, sizeof( scenario.magic ) ) != 0,
+					HB_UNABLE_TO_READ_FILE, error_handler,
+					"File '%s' is not a scenario file.", params->scenario_filename );
+
+		hb_if_err_create_goto( *err, HB_ERROR,
+					scenario.width != params->world_width || scenario.height != params->world_height,
+					HB_INVALID_PARAMETER, error_handler,
+					"Scenario file world is %u x %u, not %zu x %zu.",
+					scenario.width, scenario.height, params->world_width, params->world_height );
+
+		hb_if_err_create_goto( *err, HB_ERROR,
+					scenario.sections == 0 ||
+					(scenario.sections & ~(HB_SCENARIO_HEAT | HB_SCENARIO_OBSTACLES)) != 0,
+					HB_UNABLE_TO_READ_FILE, error_handler,
+					"Scenario file has unknown sections, (0x%x).", scenario.sections );
+
+		params->scenario_sections = scenario.sections;
+	}
+
+	/* The permutation leaves bugs on their cells, whatever is there. */
+	hb_if_err_create_goto( *err, HB_ERROR,
+				(params->scenario_sections & HB_SCENARIO_OBSTACLES) && params->placement == HB_PLACE_PERMUTE,
+				HB_INVALID_PARAMETER, error_handler,
+				"Scenario obstacles need --placement random or --placement-file%s.",
+				params->deterministic ? ", (--placement-file when --deterministic)" : "" );
+
+	params->trace_stride = params->trace_sample ? params->bugs_number / params->trace_sample : 1;
 
 	/* Check for bug's number related errors. */
 	hb_if_err_create_goto( *err, HB_ERROR,
@@ -393,14 +813,265 @@ static inline void getSimulParameters( Parameters_t *const params, int argc, cha
 				HB_OUTPUT_HEAT_OUT_RANGE, error_handler,
 				"Bug's max output heat is out of range." );
 
-	/* If numeber of bugs is 80% of the world space issue a warning. */
-	if (params->bugs_number >= 0.8 * params->world_size)
-		fprintf( stderr, "Warning: Bugs number near available world slots.\n" );
+	/* If numeber of bugs is 80% of the world space issue a warning. Only random placement slows down with it. */
+	if (params->placement == HB_PLACE_RANDOM && params->bugs_number >= 0.8 * params->world_size)
+		fprintf( stderr, "Warning: Bugs number near available world slots. Consider --placement permute.\n" );
+
+	/* The cell permutation works on the smallest range of an even number of bits covering the world. */
+	params->permute_half_bits = 1;
+
+	while ((1UL << (2 * params->permute_half_bits)) < params->world_size)
+		params->permute_half_bits++;
+
+
+error_handler:
+	/* If error handler is reached leave function imediately. */
+
+	if (scenario_file) fclose( scenario_file );
+
+	return;
+}
+
+
+
+/**
+ * Replace the work sizes suggested for a kernel by a tuned local work size, if there is one. The global work size
+ * becomes the real size rounded up to a multiple of the local work size, kernels discard the work-items out of range.
+ *
+ * @param[in]	dims  - Number of dimensions.
+ * @param[in]	real  - Real size of the problem, in each dimension.
+ * @param[in]	tuned - Tuned local work size. Left alone when tuned[0] is 0, (not tuned).
+ * @param[out]	gws   - Global work size.
+ * @param[out]	lws   - Local work size.
+ * */
+static inline void applyTunedWorksizes( size_t dims, const size_t *const real, const size_t *const tuned,
+						size_t *const gws, size_t *const lws )
+{
+	if (tuned[ 0 ] == 0) return;
+
+	for (size_t d = 0; d < dims; d++)
+	{
+		lws[ d ] = tuned[ d ];
+		gws[ d ] = DIV_CEIL( real[ d ], tuned[ d ] ) * tuned[ d ];
+	}
+}
+
+
+
+/**
+ * Check a tuned local work size loaded from the profile against what runs: each dimension within the device's
+ * maximum work-item sizes, and no more work-items than the kernel, (or the device, before the kernel is built), takes
+ * in a work-group. The profile may be stale, from other kernels, or edited by hand. A size that does not fit is
+ * reported, and the suggested one is used instead.
+ *
+ * @param[in]	krnl  - The kernel, NULL to check against the device only.
+ * @param[in]	dev   - The device.
+ * @param[in]	name  - Name of the kernel, for the warning.
+ * @param[in]	dims  - Number of dimensions.
+ * @param[in]	tuned - Tuned local work size. Fits when tuned[0] is 0, (not tuned).
+ * @param[in]	pow2  - If set, each dimension must also be a power of 2, (tree reductions).
+ * @param[out]	err   - GLib object for error reporting.
+ *
+ * @return 1 if the tuned size can be applied, 0 if not.
+ * */
+static inline int tunedWorksizesFit( CCLKernel *const krnl, CCLDevice *const dev, const char *const name,
+					size_t dims, const size_t *const tuned, int pow2, CCLErr **err )
+{
+	size_t *max_item;
+	size_t max_lws, items = 1;
+	int fits = 1;
+
+	CCLErr *err_fit = NULL;
+
+
+	if (tuned[ 0 ] == 0) return 1;
+
+	max_item = ccl_device_get_info_array( dev, CL_DEVICE_MAX_WORK_ITEM_SIZES, size_t*, &err_fit );
+	hb_if_err_propagate_goto( err, err_fit, error_handler );
+
+	if (krnl)
+		max_lws = ccl_kernel_get_workgroup_info_scalar( krnl, dev, CL_KERNEL_WORK_GROUP_SIZE, size_t, &err_fit );
+	else
+		max_lws = ccl_device_get_info_scalar( dev, CL_DEVICE_MAX_WORK_GROUP_SIZE, size_t, &err_fit );
+	hb_if_err_propagate_goto( err, err_fit, error_handler );
+
+	for (size_t d = 0; d < dims; d++)
+	{
+		if (tuned[ d ] > max_item[ d ] || (pow2 && !IS_POW2( tuned[ d ] ))) fits = 0;
+
+		items *= tuned[ d ];
+	}
+
+	if (items > max_lws) fits = 0;
+
+	if (!fits)
+		fprintf( stderr, "Warning: Tuned work size of '%s' does not fit this kernel, the suggested one is used.\n",
+				name );
+
+	return fits;
+
+
+error_handler:
+	/* If error handler is reached leave function imediately. */
+
+	return 0;
+}
+
+
+
+/**
+ * Name of the group, in the work-group size profile file, for the current device and world. The world, the bugs and
+ * the main kernel variants are part of the name, so a profile is not used with a world or kernels it was not tuned
+ * for. Not every build option is: loaded sizes are still checked against the built kernels, (see
+ * 'tunedWorksizesFit(...)').
+ *
+ * @param[in]	oclobj - The OpenCL objects, the device is used.
+ * @param[in]	params - Simulation parameters.
+ * @param[out]	err    - GLib object for error reporting.
+ *
+ * @return A newly allocated group name, to be freed with g_free(...). NULL on error.
+ * */
+static inline gchar *tuneProfileGroup( const OCLObjects_t *const oclobj, const Parameters_t *const params,
+						CCLErr **err )
+{
+	char *dev_name;
+
+	CCLErr *err_group = NULL;
+
+
+	dev_name = ccl_device_get_info_array( oclobj->dev, CL_DEVICE_NAME, char*, &err_group );
+	hb_if_err_propagate_goto( err, err_group, error_handler );
+
+	/* The kernel variants built, (e.g. the image heat kernel has the scalar one's vector width, 1, and key). */
+	return g_strdup_printf( "%s / world %zux%zu / bugs %zu / tile %zu / vector %zu / image %d / neighbourhood %d"
+				" / boundary %d / deterministic %d / binned %d / accumulator %d", dev_name,
+				params->world_width, params->world_height, params->bugs_number,
+				params->world_tile, params->heat_vector_width, params->heat_image, params->neighbourhood,
+				params->boundary, params->deterministic, params->binned_step, params->accumulator );
+
+
+error_handler:
+	/* If error handler is reached leave function imediately. */
+
+	return NULL;
+}
+
+
+
+/**
+ * Read one tuned local work size from the profile. Missing or malformed entries are left as not tuned.
+ * */
+static inline void tuneProfileGet( GKeyFile *key_file, const gchar *group, const gchar *key, size_t dims,
+					size_t *const tuned )
+{
+	gsize len = 0;
+	gint *values = g_key_file_get_integer_list( key_file, group, key, &len, NULL );
+
+	if (values != NULL && len == dims)
+	{
+		for (size_t d = 0; d < dims; d++)
+			tuned[ d ] = (values[ d ] > 0) ? (size_t) values[ d ] : 0;
+
+		/* All dimensions or none. */
+		for (size_t d = 0; d < dims; d++)
+			if (tuned[ d ] == 0) tuned[ 0 ] = 0;
+	}
+
+	g_free( values );
+}
+
+
+
+/**
+ * Load the tuned local work sizes of the current device and world, from the profile file written by a previous
+ * '--autotune' run. Having no profile file, or no profile for this device and world, is not an error: the sizes
+ * are left as not tuned and the suggested ones are used.
+ *
+ * @param[out]	tuned  - Tuned local work sizes.
+ * @param[in]	oclobj - The OpenCL objects, the device is used.
+ * @param[in]	params - Simulation parameters.
+ * @param[out]	err    - GLib object for error reporting.
+ * */
+static inline void loadTuneProfile( HBTunedSizes_t *const tuned, const OCLObjects_t *const oclobj,
+					const Parameters_t *const params, CCLErr **err )
+{
+	GKeyFile *key_file = g_key_file_new();
+	gchar *group = NULL;
+
+	CCLErr *err_load = NULL;
+
+
+	group = tuneProfileGroup( oclobj, params, &err_load );
+	hb_if_err_propagate_goto( err, err_load, error_handler );
+
+	if (g_key_file_load_from_file( key_file, params->tune_filename, G_KEY_FILE_NONE, NULL ))
+	{
+		tuneProfileGet( key_file, group, KRNL_NAME__BUG_STEP_BEST, HB_DIMS_1, tuned->bug_step_best );
+		tuneProfileGet( key_file, group, KRNL_NAME__BUG_STEP_ANY_FREE, HB_DIMS_1, tuned->bug_step_any_free );
+		tuneProfileGet( key_file, group, KRNL_NAME__COMP_WORLD_HEAT, HB_DIMS_2, tuned->comp_world_heat );
+		tuneProfileGet( key_file, group, KRNL_NAME__UNHAPP_S1_REDUCE, HB_DIMS_1, tuned->unhapp_step1_reduce );
+	}
+
+
+error_handler:
+	/* If error handler is reached leave function imediately. */
+
+	g_free( group );
+	g_key_file_free( key_file );
+
+	return;
+}
+
+
+
+/**
+ * Save the tuned local work sizes of the current device and world to the profile file. Profiles of other devices
+ * and worlds, already in the file, are kept.
+ *
+ * @param[in]	tuned  - Tuned local work sizes.
+ * @param[in]	oclobj - The OpenCL objects, the device is used.
+ * @param[in]	params - Simulation parameters.
+ * @param[out]	err    - GLib object for error reporting.
+ * */
+static inline void saveTuneProfile( const HBTunedSizes_t *const tuned, const OCLObjects_t *const oclobj,
+					const Parameters_t *const params, CCLErr **err )
+{
+	GKeyFile *key_file = g_key_file_new();
+	gchar *group = NULL;
+	gint values[ HB_DIMS_2 ];
+
+	CCLErr *err_save = NULL;
+
+
+	group = tuneProfileGroup( oclobj, params, &err_save );
+	hb_if_err_propagate_goto( err, err_save, error_handler );
+
+	/* Keep existing profiles. A missing file is fine, it will be created. */
+	g_key_file_load_from_file( key_file, params->tune_filename, G_KEY_FILE_KEEP_COMMENTS, NULL );
+
+	values[ 0 ] = tuned->bug_step_best[ 0 ];
+	g_key_file_set_integer_list( key_file, group, KRNL_NAME__BUG_STEP_BEST, values, HB_DIMS_1 );
+
+	values[ 0 ] = tuned->bug_step_any_free[ 0 ];
+	g_key_file_set_integer_list( key_file, group, KRNL_NAME__BUG_STEP_ANY_FREE, values, HB_DIMS_1 );
+
+	values[ 0 ] = tuned->comp_world_heat[ 0 ];
+	values[ 1 ] = tuned->comp_world_heat[ 1 ];
+	g_key_file_set_integer_list( key_file, group, KRNL_NAME__COMP_WORLD_HEAT, values, HB_DIMS_2 );
+
+	values[ 0 ] = tuned->unhapp_step1_reduce[ 0 ];
+	g_key_file_set_integer_list( key_file, group, KRNL_NAME__UNHAPP_S1_REDUCE, values, HB_DIMS_1 );
+
+	g_key_file_save_to_file( key_file, params->tune_filename, &err_save );
+	hb_if_err_propagate_goto( err, err_save, error_handler );
 
 
 error_handler:
 	/* If error handler is reached leave function imediately. */
 
+	g_free( group );
+	g_key_file_free( key_file );
+
 	return;
 }
 
@@ -410,16 +1081,18 @@ error_handler:
  * Get and / or create all OpenCL objects.
  *	- Create a Context, get the device (GPU) from the context.
  *	- Create a command queue.
+ *	- Load the tuned work-group sizes for the device, if any.
  *	- Create and build a program for devices in the context (GPU).
  *
  * @param[out]	oclobj	- A structure holding the pointers for each OpenCL object.
  * @param[out]	gws	- Structure with global work sizes.
  * @param[out]	lws	- Structure with local work sizes.
+ * @param[out]	tuned	- Tuned local work sizes, loaded from the profile file.
  * @param[in]	params	- The simulation parameters. Used to create the program's compiler options.
  * @param[out]	err	- GLib object for error reporting.
  * */
 static inline void getOCLObjects( OCLObjects_t *const oclobj, HBGlobalWorkSizes_t *const gws, HBLocalWorkSizes_t *const lws,
-					Parameters_t *const params, CCLErr **err )
+					HBTunedSizes_t *const tuned, Parameters_t *const params, CCLErr **err )
 {
 	/*
 	   OpenCL built in compiler parameter's template.
@@ -428,31 +1101,78 @@ static inline void getOCLObjects( OCLObjects_t *const oclobj, HBGlobalWorkSizes_
 	   The '-D' option, is the kernel's compiler directive to make the constants available to the kernel.
 	 * */
 	const char *cl_compiler_opts_template = QUOTE(
-			-D INIT_SEED=%u
 			-D REDUCE_NUM_WORKGROUPS=%zu
 			-D BUGS_NUMBER=%zu
 			-D WORLD_WIDTH=%zu
 			-D WORLD_HEIGHT=%zu
 			-D WORLD_SIZE=%zu
+			-D WORLD_TILE=%zu
+			-D WORLD_TILES_X=%zu
+			-D WORLD_STORAGE_SIZE=%zu
+			-D WORLD_WIDTH_POW2=%d
+			-D WORLD_HEIGHT_POW2=%d
+			-D HEAT_VECTOR_WIDTH=%zu
 			-D WORLD_DIFFUSION_RATE=%f
 			-D WORLD_EVAPORATION_RATE=%f
 			-D BUGS_RANDOM_MOVE_CHANCE=%f
 			-D BUGS_TEMPERATURE_MIN_IDEAL=%u
 			-D BUGS_TEMPERATURE_MAX_IDEAL=%u
 			-D BUGS_HEAT_MIN_OUTPUT=%u
-			-D BUGS_HEAT_MAX_OUTPUT=%u );
-
-
-	char cl_compiler_opts[512];	/* OpenCL built in compiler/builder parameters. */
+			-D BUGS_HEAT_MAX_OUTPUT=%u
+			-D CONVERGE_WINDOW=%zu
+			-D CONVERGE_EPSILON=%.9ef
+			-D STILL_WINDOW=%zu
+			-D ACTIVE_TILE=%zu
+			-D ACTIVE_TILES_X=%zu
+			-D ACTIVE_TILES_Y=%zu
+			-D ACTIVE_THRESHOLD=%.9ef
+			-D INIT_PLACEMENT=%d
+			-D PERMUTE_HALF_BITS=%u
+			-D DETERMINISTIC=%d
+			-D HEAT_DEPOSIT=%d
+			-D HEAT_IMAGE=%d
+			-D BINNED_STEP=%d
+			-D BUG_ATTRIBUTES=%d
+			-D SCENARIO_HEAT=%d
+			-D SCENARIO_OBSTACLES=%d
+			-D UNHAPP_ACCUM=%d
+			-D NEIGHBOURHOOD=%d
+			-D BOUNDARY=%d
+			-D TRACE_SAMPLE=%zu
+			-D TRACE_STRIDE=%zu );
+
+
+	char cl_compiler_opts[2048];	/* OpenCL built in compiler/builder parameters. */
+
+	cl_device_fp_config double_config;	/* Double accumulator support. */
+
+	cl_bool image_support;		/* Heat image device limits. */
+	cl_uint opencl_version;
+	int image_from_buffer;
+	char *extensions;
+	cl_uint pitch_alignment;
+	size_t image_width, image_height;
+
+	int reduce_fits;		/* Tuned reduction size checked. */
 
 	CCLErr *err_get_oclobj = NULL;
 
 
 	/* *** GPU preparation. Initiate OpenCL objects. *** */
 
-	/* Create context wrapper for a GPU device. */
-	/* First found GPU device will be used.          */
-	oclobj->ctx = ccl_context_new_gpu( &err_get_oclobj );
+	/* Create context wrapper for a device of the requested kind. */
+	/* First found device of that kind will be used.                 */
+	switch (params->device_type)
+	{
+		case HB_DEVICE_CPU:
+			oclobj->ctx = ccl_context_new_cpu( &err_get_oclobj );
+			break;
+		case HB_DEVICE_ANY:
+			oclobj->ctx = ccl_context_new_any( &err_get_oclobj );
+			break;
+		default:
+			oclobj->ctx = ccl_context_new_gpu( &err_get_oclobj );
+	}
 	hb_if_err_propagate_goto( err, err_get_oclobj, error_handler );
 
 	/* Get the device (index 0) in te context, (that is the first device). */
@@ -463,21 +1183,175 @@ static inline void getOCLObjects( OCLObjects_t *const oclobj, HBGlobalWorkSizes_
 	oclobj->queue = ccl_queue_new( oclobj->ctx, oclobj->dev, CL_QUEUE_PROFILING_ENABLE, &err_get_oclobj );
 	hb_if_err_propagate_goto( err, err_get_oclobj, error_handler );
 
-
-	/* *** Program creation. *** */
-
-	/* Create a new program from kernel's source. */
-	oclobj->prg = ccl_program_new_from_source_file( oclobj->ctx, CL_KERNEL_SRC_FILE, &err_get_oclobj );
-	hb_if_err_propagate_goto( err, err_get_oclobj, error_handler );
+	/* A second queue for device to host transfers, so they do not wait behind the kernels. */
+	if (params->async_io)
+	{
+		oclobj->io_queue = ccl_queue_new( oclobj->ctx, oclobj->dev, CL_QUEUE_PROFILING_ENABLE, &err_get_oclobj );
+		hb_if_err_propagate_goto( err, err_get_oclobj, error_handler );
+	}
 
 	/*
-	   Query device for importante parameters before program's build, so those parameters can be sent
+	   Buffers read by the host go to host memory on devices sharing it with the host, (CPU runtimes, integrated
+	   GPUs), where mapping them costs no copy. Discrete GPUs keep them in their own memory, and copy.
+	 * */
+	if (params->buffers == HB_BUFFERS_AUTO)
+	{
+		params->host_buffers = ccl_device_get_info_scalar( oclobj->dev, CL_DEVICE_HOST_UNIFIED_MEMORY,
+									cl_bool, &err_get_oclobj );
+		hb_if_err_propagate_goto( err, err_get_oclobj, error_handler );
+	}
+	else
+	{
+		params->host_buffers = (params->buffers == HB_BUFFERS_HOST);
+	}
+
+
+	/* *** Program creation. *** */
+
+	/* Create a new program from kernel's source. */
+	oclobj->prg = ccl_program_new_from_source_file( oclobj->ctx, CL_KERNEL_SRC_FILE, &err_get_oclobj );
+	hb_if_err_propagate_goto( err, err_get_oclobj, error_handler );
+
+	/*
+	   Query device for importante parameters before program's build, so those parameters can be sent
 	   to the kernel as external defines.
 	 * */
 	ccl_kernel_suggest_worksizes( NULL, oclobj->dev, HB_DIMS_1, &params->bugs_number,
 						gws->unhapp_step1_reduce, lws->unhapp_step1_reduce, &err_get_oclobj );
 	hb_if_err_propagate_goto( err, err_get_oclobj, error_handler );
 
+	/*
+	   Number of cells each 'comp_world_heat' work-item computes. Unless given, it is the device's preferred float
+	   vector width: 1 on most GPUs, 4 to 16 on CPU runtimes. In a tiled world a vector must not cross tiles.
+	 * */
+	if (params->heat_vector_width == 0)
+	{
+		params->heat_vector_width = ccl_device_get_info_scalar( oclobj->dev, CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT,
+										cl_uint, &err_get_oclobj );
+		hb_if_err_propagate_goto( err, err_get_oclobj, error_handler );
+
+		params->heat_vector_width = MIN( params->heat_vector_width, HEAT_VECTOR_WIDTH_MAX );
+
+		/* Round down to a power of 2. */
+		while (!IS_POW2( params->heat_vector_width ))
+			params->heat_vector_width &= params->heat_vector_width - 1;
+	}
+
+	if (params->world_tile)
+		params->heat_vector_width = MIN( params->heat_vector_width, params->world_tile );
+
+	/* Heat images are read a cell at a time. */
+	if (params->heat_image)
+		params->heat_vector_width = 1;
+
+	/* The megakernel global barriers need all its work-groups resident at once: one per compute unit. */
+	if (params->megakernel_steps)
+	{
+		params->megakernel_groups = ccl_device_get_info_scalar( oclobj->dev, CL_DEVICE_MAX_COMPUTE_UNITS,
+										cl_uint, &err_get_oclobj );
+		hb_if_err_propagate_goto( err, err_get_oclobj, error_handler );
+	}
+
+	/* Work-groups striding over the active tile list, a few per compute unit, never more than the tiles. */
+	if (params->active_tile)
+	{
+		params->active_groups = ccl_device_get_info_scalar( oclobj->dev, CL_DEVICE_MAX_COMPUTE_UNITS,
+									cl_uint, &err_get_oclobj );
+		hb_if_err_propagate_goto( err, err_get_oclobj, error_handler );
+
+		params->active_groups = MIN( params->active_groups * ACTIVE_GROUPS_PER_CU,
+						params->active_tiles_x * params->active_tiles_y );
+	}
+
+	/* The double accumulator needs double precision, (cl_khr_fp64): a device without it has no double config. */
+	if (params->accumulator == HB_ACCUM_DOUBLE)
+	{
+		double_config = ccl_device_get_info_scalar( oclobj->dev, CL_DEVICE_DOUBLE_FP_CONFIG, cl_device_fp_config,
+								&err_get_oclobj );
+		if (err_get_oclobj)
+		{
+			g_clear_error( &err_get_oclobj );
+			double_config = 0;
+		}
+
+		hb_if_err_create_goto( *err, HB_ERROR,
+					double_config == 0,
+					HB_INVALID_PARAMETER, error_handler,
+					"Option --accumulator double needs a device with double precision." );
+	}
+
+	/*
+	   Images over the heat map buffers need a device with image support, that creates images from buffers,
+	   (OpenCL 2.0, or cl_khr_image2d_from_buffer before), and image rows on its pitch alignment. The heat map rows
+	   have no padding, so the world width must be a multiple of it. Devices not knowing the alignment query can not.
+	 * */
+	if (params->heat_image)
+	{
+		image_support = ccl_device_get_info_scalar( oclobj->dev, CL_DEVICE_IMAGE_SUPPORT, cl_bool, &err_get_oclobj );
+		hb_if_err_propagate_goto( err, err_get_oclobj, error_handler );
+
+		opencl_version = ccl_device_get_opencl_version( oclobj->dev, &err_get_oclobj );
+		hb_if_err_propagate_goto( err, err_get_oclobj, error_handler );
+
+		if (opencl_version >= 200)
+		{
+			image_from_buffer = 1;
+		}
+		else
+		{
+			extensions = ccl_device_get_info_array( oclobj->dev, CL_DEVICE_EXTENSIONS, char*, &err_get_oclobj );
+			hb_if_err_propagate_goto( err, err_get_oclobj, error_handler );
+
+			image_from_buffer = strstr( extensions, "cl_khr_image2d_from_buffer" ) != NULL;
+		}
+
+		pitch_alignment = ccl_device_get_info_scalar( oclobj->dev, CL_DEVICE_IMAGE_PITCH_ALIGNMENT, cl_uint,
+								&err_get_oclobj );
+		if (err_get_oclobj)
+		{
+			g_clear_error( &err_get_oclobj );
+			pitch_alignment = 0;
+		}
+
+		hb_if_err_create_goto( *err, HB_ERROR,
+					!image_support || !image_from_buffer || pitch_alignment == 0,
+					HB_INVALID_PARAMETER, error_handler,
+					"Option --heat-image needs a device creating images from buffers." );
+
+		image_width = ccl_device_get_info_scalar( oclobj->dev, CL_DEVICE_IMAGE2D_MAX_WIDTH, size_t, &err_get_oclobj );
+		hb_if_err_propagate_goto( err, err_get_oclobj, error_handler );
+
+		image_height = ccl_device_get_info_scalar( oclobj->dev, CL_DEVICE_IMAGE2D_MAX_HEIGHT, size_t,
+								&err_get_oclobj );
+		hb_if_err_propagate_goto( err, err_get_oclobj, error_handler );
+
+		hb_if_err_create_goto( *err, HB_ERROR,
+					params->world_width > image_width || params->world_height > image_height,
+					HB_INVALID_PARAMETER, error_handler,
+					"With --heat-image the world can not exceed %zu x %zu cells.", image_width, image_height );
+
+		hb_if_err_create_goto( *err, HB_ERROR,
+					params->world_width % pitch_alignment != 0,
+					HB_INVALID_PARAMETER, error_handler,
+					"With --heat-image the world width must be a multiple of %u.", pitch_alignment );
+	}
+
+	/*
+	   Tuned work-group sizes, from a previous '--autotune' run. The reduction size is used here, the others in
+	   'getKernels(...)'.
+	 * */
+	loadTuneProfile( tuned, oclobj, params, &err_get_oclobj );
+	hb_if_err_propagate_goto( err, err_get_oclobj, error_handler );
+
+	/* The kernel is not built yet: checked against the device here, against the kernel in 'getKernels(...)'. */
+	reduce_fits = tunedWorksizesFit( NULL, oclobj->dev, KRNL_NAME__UNHAPP_S1_REDUCE, HB_DIMS_1,
+						tuned->unhapp_step1_reduce, 1, &err_get_oclobj );
+	hb_if_err_propagate_goto( err, err_get_oclobj, error_handler );
+
+	if (reduce_fits)
+		applyTunedWorksizes( HB_DIMS_1, &params->bugs_number, tuned->unhapp_step1_reduce,
+					gws->unhapp_step1_reduce, lws->unhapp_step1_reduce );
+
 	/*
 	    MIN(...) included by cf4ocl2 from glib/gmacros.h.
 
@@ -492,24 +1366,54 @@ static inline void getOCLObjects( OCLObjects_t *const oclobj, HBGlobalWorkSizes_
 	   Get OpenCL build options to be sent as 'defines' to kernel, preventing the need to send extra arguments.
 	   These parameters work as 'work-items' private variables. A null terminated string is garanted in
 	   'cl_compiler_opts'.
+
+	   World dimensions that are a power of 2 are flagged, so the kernel variant doing the toroidal wrap with
+	   masks, instead of compare and select, is the one built. The neighbourhood and the boundary are built in
+	   the same way: each model variant is a program of its own, with its neighbour loops unrolled.
 	 * */
 
 	params->reduce_num_workgroups = gws->unhapp_step1_reduce[ 0 ] / lws->unhapp_step1_reduce[ 0 ];
 
 	sprintf( cl_compiler_opts, cl_compiler_opts_template,
-				params->seed,
 				params->reduce_num_workgroups,
 				params->bugs_number,
 				params->world_width,
 				params->world_height,
 				params->world_size,
+				params->world_tile,
+				params->world_tiles_x,
+				params->world_storage_size,
+				IS_POW2( params->world_width ),
+				IS_POW2( params->world_height ),
+				params->heat_vector_width,
 				params->world_diffusion_rate,
 				params->world_evaporation_rate,
 				params->bugs_random_move_chance,
 				params->bugs_temperature_min_ideal,
 				params->bugs_temperature_max_ideal,
 				params->bugs_heat_min_output,
-				params->bugs_heat_max_output );
+				params->bugs_heat_max_output,
+				params->converge_window,
+				params->converge_epsilon,
+				params->still_window,
+				params->active_tile,
+				params->active_tiles_x,
+				params->active_tiles_y,
+				params->active_threshold,
+				params->placement,
+				params->permute_half_bits,
+				params->deterministic,
+				params->deposit,
+				params->heat_image,
+				params->binned_step,
+				params->bug_filename[ 0 ] != '\0',
+				(params->scenario_sections & HB_SCENARIO_HEAT) != 0,
+				(params->scenario_sections & HB_SCENARIO_OBSTACLES) != 0,
+				params->accumulator,
+				params->neighbourhood,
+				params->boundary,
+				params->trace_sample,
+				params->trace_stride );
 
 
 	/* Build CL Program. */
@@ -527,6 +1431,331 @@ error_handler:
 
 
 
+/**
+ * Create the 'bug_attrs' buffer from the bug file. The file is mapped, not read: every bug's attributes are checked
+ * in place, then copied from the mapping to the buffer, with no intermediate host buffer.
+ *
+ * The file is a HBBugFileHeader_t, then the ideal temperatures, the output heats and the random move chances, (0 to
+ * 100), each an array of a float per bug. There must be 'params->bugs_number' bugs.
+ *
+ * @param[in]	ctx    - OpenCL context.
+ * @param[in]	params - Simulation parameters.
+ * @param[in]	size   - Bytes of the attribute arrays.
+ * @param[out]	err    - GLib object for error reporting.
+ * @return	The buffer, or NULL on error.
+ * */
+static inline CCLBuffer *loadBugAttributes( CCLContext *const ctx, const Parameters_t *const params, const size_t size,
+						CCLErr **err )
+{
+	CCLBuffer *bug_attrs = NULL;
+	const HBBugFileHeader_t *header;
+	const cl_float *attrs;
+	size_t bug;
+
+	int bug_file = -1;
+	struct stat file_stat;
+	void *mapping = MAP_FAILED;
+
+	CCLErr *err_load = NULL;
+
+
+	bug_file = open( params->bug_filename, O_RDONLY );
+	hb_if_err_create_goto( *err, HB_ERROR,
+				bug_file < 0,
+				HB_UNABLE_OPEN_FILE, error_handler,
+				"Could not open bug file '%s'.", params->bug_filename );
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+				fstat( bug_file, &file_stat ) != 0 || (size_t) file_stat.st_size < sizeof( HBBugFileHeader_t ),
+				HB_UNABLE_TO_READ_FILE, error_handler,
+				"Bug file '%s' has no header.", params->bug_filename );
+
+	mapping = mmap( NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, bug_file, 0 );
+	hb_if_err_create_goto( *err, HB_ERROR,
+				mapping == MAP_FAILED,
+				HB_UNABLE_TO_READ_FILE, error_handler,
+				"Could not map bug file '%s'.", params->bug_filename );
+
+	/* A hint only, for a larger read ahead. */
+	madvise( mapping, file_stat.st_size, MADV_SEQUENTIAL );
+
+	header = (const HBBugFileHeader_t *) mapping;
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+				memcmp( header->magic, HB_BUG_FILE_MAGIC, sizeof( header->magic ) ) != 0,
+				HB_UNABLE_TO_READ_FILE, error_handler,
+				"File '%s' is not a bug file.", params->bug_filename );
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+				header->bugs != params->bugs_number ||
+				(size_t) file_stat.st_size != sizeof( HBBugFileHeader_t ) + size,
+				HB_UNABLE_TO_READ_FILE, error_handler,
+				"Bug file has %llu bugs, %zu needed.", (unsigned long long) header->bugs, params->bugs_number );
+
+	/* Check every bug's attributes while mapped, in the ranges of the global ones. Written so NaN fails. */
+	attrs = (const cl_float *) ((const char *) mapping + sizeof( HBBugFileHeader_t ));
+
+	for (bug = 0; bug < params->bugs_number; bug++)
+	{
+		const cl_float ideal = attrs[ bug ];
+		const cl_float output = attrs[ params->bugs_number + bug ];
+		const cl_float chance = attrs[ 2 * params->bugs_number + bug ];
+
+		hb_if_err_create_goto( *err, HB_ERROR,
+					!(ideal >= 0 && ideal < 200),
+					HB_TEMPERATURE_OUT_RANGE, error_handler,
+					"Bug file bug %zu ideal temperature is out of range, (0 to 200).", bug );
+
+		hb_if_err_create_goto( *err, HB_ERROR,
+					!(output >= 0 && output < 100),
+					HB_OUTPUT_HEAT_OUT_RANGE, error_handler,
+					"Bug file bug %zu output heat is out of range, (0 to 100).", bug );
+
+		hb_if_err_create_goto( *err, HB_ERROR,
+					!(chance >= 0 && chance <= 100),
+					HB_INVALID_PARAMETER, error_handler,
+					"Bug file bug %zu random move chance is out of range, (0 to 100).", bug );
+	}
+
+	/* CL_MEM_COPY_HOST_PTR copies the attributes out of the mapping into the buffer. */
+	bug_attrs = ccl_buffer_new( ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, size,
+					(char *) mapping + sizeof( HBBugFileHeader_t ), &err_load );
+	hb_if_err_propagate_goto( err, err_load, error_handler );
+
+
+error_handler:
+
+	if (mapping != MAP_FAILED) munmap( mapping, file_stat.st_size );
+	if (bug_file >= 0) close( bug_file );
+
+	return bug_attrs;
+}
+
+
+
+/**
+ * Write 'size' bytes of 'data' to the start of 'buffer', non-blocking, in HB_SCENARIO_CHUNK pieces. The writes are
+ * added to 'ewl'.
+ * */
+static inline void enqueueChunkedWrite( CCLBuffer *const buffer, CCLQueue *const queue, const void *const data,
+						const size_t size, CCLEventWaitList *ewl, CCLErr **err )
+{
+	CCLEvent *evt_wr;
+	size_t offset, chunk;
+
+	CCLErr *err_write = NULL;
+
+
+	for (offset = 0; offset < size; offset += chunk)
+	{
+		chunk = MIN( (size_t) HB_SCENARIO_CHUNK, size - offset );
+
+		evt_wr = ccl_buffer_enqueue_write( buffer, queue, HB_NON_BLOCK, offset, chunk,
+							(void *) ((const char *) data + offset), NULL, &err_write );
+		hb_if_err_propagate_goto( err, err_write, error_handler );
+
+		ccl_event_wait_list_add( ewl, evt_wr, NULL );
+	}
+
+
+error_handler:
+
+	return;
+}
+
+
+
+/**
+ * Write the sections of the scenario file to 'scenario_heat' and 'scenario_obstacles', as 'init_maps' reads them.
+ * The file is mapped, and each section written to its buffer from the mapping. The mapping is kept until the writes
+ * finish.
+ *
+ * The obstacles are checked against the bugs: there must be a free cell for each bug, and no bug of
+ * 'bug_placement', if any, on an obstacle.
+ *
+ * @param[in]	dev_buff      - Device buffers, with the scenario buffers created.
+ * @param[in]	bufsz         - Buffer sizes.
+ * @param[in]	oclobj        - OpenCL objects.
+ * @param[in]	params        - Simulation parameters, with the sections of the file.
+ * @param[in]	bug_placement - Bug cells of a placement file, row-major. NULL if none.
+ * @param[out]	err           - GLib object for error reporting.
+ * */
+static inline void loadScenario( const HBDeviceBuffers_t *const dev_buff, const HBBuffersSize_t *const bufsz,
+					const OCLObjects_t *const oclobj, const Parameters_t *const params,
+					const cl_uint *const bug_placement, CCLErr **err )
+{
+	CCLEventWaitList ewl = NULL;
+
+	int scenario_file = -1;
+	struct stat file_stat;
+	void *mapping = MAP_FAILED;
+
+	const char *section;
+	const cl_uchar *obstacles;
+	size_t expected_size, obstacle_count = 0, bug;
+
+	CCLErr *err_load = NULL;
+
+
+	expected_size = sizeof( HBScenarioHeader_t ) +
+			((params->scenario_sections & HB_SCENARIO_HEAT) ? bufsz->scenario_heat : 0) +
+			((params->scenario_sections & HB_SCENARIO_OBSTACLES) ? bufsz->scenario_obstacles : 0);
+
+	scenario_file = open( params->scenario_filename, O_RDONLY );
+	hb_if_err_create_goto( *err, HB_ERROR,
+				scenario_file < 0,
+				HB_UNABLE_OPEN_FILE, error_handler,
+				"Could not open scenario file '%s'.", params->scenario_filename );
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+				fstat( scenario_file, &file_stat ) != 0 || (size_t) file_stat.st_size != expected_size,
+				HB_UNABLE_TO_READ_FILE, error_handler,
+				"Scenario file '%s' is not %zu bytes long, as its header says.",
+				params->scenario_filename, expected_size );
+
+	mapping = mmap( NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, scenario_file, 0 );
+	hb_if_err_create_goto( *err, HB_ERROR,
+				mapping == MAP_FAILED,
+				HB_UNABLE_TO_READ_FILE, error_handler,
+				"Could not map scenario file '%s'.", params->scenario_filename );
+
+	/* A hint only, for a larger read ahead. */
+	madvise( mapping, file_stat.st_size, MADV_SEQUENTIAL );
+
+	section = (const char *) mapping + sizeof( HBScenarioHeader_t );
+
+	if (params->scenario_sections & HB_SCENARIO_HEAT)
+	{
+		enqueueChunkedWrite( dev_buff->scenario_heat, oclobj->queue, section, bufsz->scenario_heat,
+					&ewl, &err_load );
+		hb_if_err_propagate_goto( err, err_load, error_handler );
+
+		section += bufsz->scenario_heat;
+	}
+
+	if (params->scenario_sections & HB_SCENARIO_OBSTACLES)
+	{
+		enqueueChunkedWrite( dev_buff->scenario_obstacles, oclobj->queue, section, bufsz->scenario_obstacles,
+					&ewl, &err_load );
+		hb_if_err_propagate_goto( err, err_load, error_handler );
+
+		/* Checked while the writes go on. */
+		obstacles = (const cl_uchar *) section;
+
+		for (size_t cell = 0; cell < params->world_size; cell++)
+			obstacle_count += (obstacles[ cell ] != 0);
+
+		hb_if_err_create_goto( *err, HB_ERROR,
+					params->bugs_number >= params->world_size - obstacle_count,
+					HB_BUGS_OVERFLOW, error_handler,
+					"Scenario has %zu free cells for %zu bugs.",
+					params->world_size - obstacle_count, params->bugs_number );
+
+		for (bug = 0; bug_placement != NULL && bug < params->bugs_number; bug++)
+		{
+			hb_if_err_create_goto( *err, HB_ERROR,
+						obstacles[ bug_placement[ bug ] ] != 0,
+						HB_INVALID_PARAMETER, error_handler,
+						"Placement file bug %zu, at cell (%zu, %zu), is on an obstacle.", bug,
+						(size_t) bug_placement[ bug ] / params->world_width,
+						(size_t) bug_placement[ bug ] % params->world_width );
+		}
+	}
+
+	ccl_event_wait( &ewl, &err_load );
+	hb_if_err_propagate_goto( err, err_load, error_handler );
+
+
+error_handler:
+
+	/* Writes still reading the mapping finish first, whatever failed. */
+	if (ewl) ccl_event_wait( &ewl, NULL );
+
+	if (mapping != MAP_FAILED) munmap( mapping, file_stat.st_size );
+	if (scenario_file >= 0) close( scenario_file );
+
+	return;
+}
+
+
+
+/**
+ * Read the bug cells of a placement file into 'bug_placement', as row-major world indices.
+ *
+ * One bug per line, as its row and column, separated by blanks. Empty lines and lines starting with '#' are skipped.
+ * There must be a line for each bug, inside the world and all in different cells.
+ *
+ * @param[out]	bug_placement - Bug cells, 'params->bugs_number' of them.
+ * @param[in]	params        - Simulation parameters.
+ * @param[out]	err           - GLib object for error reporting.
+ * */
+static inline void loadPlacement( cl_uint *const bug_placement, const Parameters_t *const params, CCLErr **err )
+{
+	FILE *placement_file = NULL;
+	unsigned char *taken = NULL;	/* One bit per world cell, set when a bug is placed there. */
+
+	char line[256];
+	unsigned long row, col;
+	size_t bugs = 0, line_number = 0, cell;
+
+
+	placement_file = fopen( params->placement_filename, "r" );
+	hb_if_err_create_goto( *err, HB_ERROR,
+				placement_file == NULL,
+				HB_UNABLE_OPEN_FILE, error_handler,
+				"Could not open placement file '%s'.", params->placement_filename );
+
+	taken = (unsigned char *) calloc( DIV_CEIL( params->world_size, 8 ), 1 );
+	hb_if_err_create_goto( *err, HB_ERROR,
+				taken == NULL,
+				HB_MALLOC_FAILURE, error_handler,
+				"Unable to allocate host memory for the placement check." );
+
+	while (bugs < params->bugs_number && fgets( line, sizeof( line ), placement_file ) != NULL)
+	{
+		line_number++;
+
+		if (line[ strspn( line, " \t\r\n" ) ] == '\0' || line[ strspn( line, " \t" ) ] == '#')
+			continue;
+
+		hb_if_err_create_goto( *err, HB_ERROR,
+					sscanf( line, "%lu %lu", &row, &col ) != 2,
+					HB_UNABLE_TO_READ_FILE, error_handler,
+					"Placement file line %zu: expected a row and a column.", line_number );
+
+		hb_if_err_create_goto( *err, HB_ERROR,
+					row >= params->world_height || col >= params->world_width,
+					HB_INVALID_PARAMETER, error_handler,
+					"Placement file line %zu: cell (%lu, %lu) is out of the world.", line_number, row, col );
+
+		cell = row * params->world_width + col;
+
+		hb_if_err_create_goto( *err, HB_ERROR,
+					taken[ cell / 8 ] & (1 << (cell % 8)),
+					HB_INVALID_PARAMETER, error_handler,
+					"Placement file line %zu: cell (%lu, %lu) already has a bug.", line_number, row, col );
+
+		taken[ cell / 8 ] |= 1 << (cell % 8);
+
+		bug_placement[ bugs++ ] = cell;
+	}
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+				bugs < params->bugs_number,
+				HB_UNABLE_TO_READ_FILE, error_handler,
+				"Placement file has %zu bugs, %zu needed.", bugs, params->bugs_number );
+
+
+error_handler:
+
+	if (taken) free( taken );
+	if (placement_file) fclose( placement_file );
+
+	return;
+}
+
+
+
 /**
  * Create all the buffers for both, host and device.
  *
@@ -569,17 +1798,31 @@ error_handler:
  *	CL_MEM_COPY_HOST_PTR  -
  *
  * NOTE: Check this about alignment (https://software.intel.com/en-us/articles/getting-the-most-from-opencl-12-how-to-increase-performance-by-minimizing-buffer-copies-on-intel-processor-graphics )
+ *
+ * With host buffers ('params->host_buffers'), the buffers the host reads in bulk, the heat maps and the megakernel
+ * results, are CL_MEM_ALLOC_HOST_PTR: the runtime allocates them page aligned in host memory, and the host maps them
+ * instead of reading them, (see 'beginReadback(...)'). Their host copies are then not allocated.
  * */
 static inline void setupBuffers( HBHostBuffers_t *const hst_buff, HBDeviceBuffers_t *const dev_buff,
 					HBBuffersSize_t *const bufsz, const OCLObjects_t *const oclobj,
 					const Parameters_t *const params, CCLErr **err )
 {
+	cl_uint zero = 0;
+
+	/* Flags of the buffers the host reads in bulk. */
+	const cl_mem_flags readback_flags = params->host_buffers ? CL_MEM_ALLOC_HOST_PTR : 0;
+
+	/* Heat images, a float per cell. */
+	const cl_image_format heat_format = { CL_R, CL_FLOAT };
+	CCLImageDesc heat_desc = CCL_IMAGE_DESC_BLANK;
+	int i;
+
 	CCLErr *err_setbuf = NULL;
 
 
-	/** STEP_RETRY_FLAG */
+	/** STEP_RETRY_FLAG - Two slots, bug step launches alternate between them in the fused pipeline. */
 
-	bufsz->bug_step_retry = sizeof( cl_uint );
+	bufsz->bug_step_retry = 2 * sizeof( cl_uint );
 
 	hst_buff->bug_step_retry = (cl_uint *) malloc( bufsz->bug_step_retry );
 	hb_if_err_create_goto( *err, HB_ERROR,
@@ -627,10 +1870,65 @@ static inline void setupBuffers( HBHostBuffers_t *const hst_buff, HBDeviceBuffer
 							bufsz->swarm_bugPosition, NULL, &err_setbuf );
 	hb_if_err_propagate_goto( err, err_setbuf, error_handler );
 
+	/* Bug cells from a file. Written to 'swarm_bugPosition' before each 'init_swarm'. */
+	if (params->placement == HB_PLACE_FILE)
+	{
+		hst_buff->bug_placement = (cl_uint *) malloc( bufsz->swarm_bugPosition );
+		hb_if_err_create_goto( *err, HB_ERROR,
+					hst_buff->bug_placement == NULL,
+					HB_MALLOC_FAILURE, error_handler,
+					"Unable to allocate host memory for bug placement." );
+
+		loadPlacement( hst_buff->bug_placement, params, &err_setbuf );
+		hb_if_err_propagate_goto( err, err_setbuf, error_handler );
+	}
+
+
+	/** BUG ATTRIBUTES - From the bug file, read only. Also needed, unused, when there is none. */
+
+	if (params->bug_filename[ 0 ] != '\0')
+	{
+		bufsz->bug_attrs = NUM_BUG_ATTRS * params->bugs_number * sizeof( cl_float );
+
+		dev_buff->bug_attrs = loadBugAttributes( oclobj->ctx, params, bufsz->bug_attrs, &err_setbuf );
+		hb_if_err_propagate_goto( err, err_setbuf, error_handler );
+	}
+	else
+	{
+		bufsz->bug_attrs = sizeof( cl_float );
+
+		dev_buff->bug_attrs = ccl_buffer_new( oclobj->ctx, CL_MEM_READ_ONLY,
+							bufsz->bug_attrs, NULL, &err_setbuf );
+		hb_if_err_propagate_goto( err, err_setbuf, error_handler );
+	}
+
+
+	/** SCENARIO - Initial heat and obstacles, read only, for 'init_maps'. Also needed, unused, without them. */
+
+	bufsz->scenario_heat = ((params->scenario_sections & HB_SCENARIO_HEAT) ? params->world_size : 1)
+				* sizeof( cl_float );
+
+	dev_buff->scenario_heat = ccl_buffer_new( oclobj->ctx, CL_MEM_READ_ONLY,
+							bufsz->scenario_heat, NULL, &err_setbuf );
+	hb_if_err_propagate_goto( err, err_setbuf, error_handler );
+
+	bufsz->scenario_obstacles = ((params->scenario_sections & HB_SCENARIO_OBSTACLES) ? params->world_size : 1)
+					* sizeof( cl_uchar );
+
+	dev_buff->scenario_obstacles = ccl_buffer_new( oclobj->ctx, CL_MEM_READ_ONLY,
+							bufsz->scenario_obstacles, NULL, &err_setbuf );
+	hb_if_err_propagate_goto( err, err_setbuf, error_handler );
+
+	if (params->scenario_sections)
+	{
+		loadScenario( dev_buff, bufsz, oclobj, params, hst_buff->bug_placement, &err_setbuf );
+		hb_if_err_propagate_goto( err, err_setbuf, error_handler );
+	}
+
 
 	/** SWARM MAP */
 
-	bufsz->swarm_map = params->world_size * sizeof( cl_uint );
+	bufsz->swarm_map = params->world_storage_size * sizeof( cl_uint );
 
 /*
 	hst_buff->swarm_map = (cl_uint *) malloc( bufsz->swarm_map );
@@ -648,7 +1946,26 @@ static inline void setupBuffers( HBHostBuffers_t *const hst_buff, HBDeviceBuffer
 
 	/** HEAT MAP */
 
-	bufsz->heat_map = params->world_size * sizeof( cl_float );
+	bufsz->heat_map = params->world_storage_size * sizeof( cl_float );
+
+	/* Host side heat map, only needed to take snapshots. Host buffers are mapped instead. */
+	if (params->snapshot_period)
+	{
+		if (!params->host_buffers)
+		{
+			hst_buff->heat_snapshot = (cl_float *) malloc( bufsz->heat_map );
+			hb_if_err_create_goto( *err, HB_ERROR,
+						hst_buff->heat_snapshot == NULL,
+						HB_MALLOC_FAILURE, error_handler,
+						"Unable to allocate host memory for heat map snapshot." );
+		}
+
+		hst_buff->heat_row = (cl_float *) malloc( params->world_width * sizeof( cl_float ) );
+		hb_if_err_create_goto( *err, HB_ERROR,
+					hst_buff->heat_row == NULL,
+					HB_MALLOC_FAILURE, error_handler,
+					"Unable to allocate host memory for heat map snapshot row." );
+	}
 
 /*
 	hst_buff->heat_map[0] = (cl_float *) malloc( bufsz->heat_map );
@@ -668,14 +1985,35 @@ static inline void setupBuffers( HBHostBuffers_t *const hst_buff, HBDeviceBuffer
 
 	/* Allocate two vectors of temperature maps in device memory. One vector is used for double buffering. */
 
-	dev_buff->heat_map[0] = ccl_buffer_new( oclobj->ctx, CL_MEM_READ_WRITE,
+	dev_buff->heat_map[0] = ccl_buffer_new( oclobj->ctx, CL_MEM_READ_WRITE | readback_flags,
 							bufsz->heat_map, NULL, &err_setbuf );
 	hb_if_err_propagate_goto( err, err_setbuf, error_handler );
 
-	dev_buff->heat_map[1] = ccl_buffer_new( oclobj->ctx, CL_MEM_READ_WRITE,
+	dev_buff->heat_map[1] = ccl_buffer_new( oclobj->ctx, CL_MEM_READ_WRITE | readback_flags,
 							bufsz->heat_map, NULL, &err_setbuf );
 	hb_if_err_propagate_goto( err, err_setbuf, error_handler );
 
+	/*
+	   Heat image only. A single channel float image over each heat map buffer, sharing its memory: the world heat
+	   reads one and writes the other, as images, and every other kernel keeps using the buffers.
+	 * */
+	if (params->heat_image)
+	{
+		heat_desc.image_type = CL_MEM_OBJECT_IMAGE2D;
+		heat_desc.image_width = params->world_width;
+		heat_desc.image_height = params->world_height;
+		heat_desc.image_row_pitch = params->world_width * sizeof( cl_float );
+
+		for (i = 0; i < 2; i++)
+		{
+			heat_desc.memobj = (CCLMemObj *) dev_buff->heat_map[ i ];
+
+			dev_buff->heat_image[ i ] = ccl_image_new_v( oclobj->ctx, CL_MEM_READ_WRITE, &heat_format,
+									&heat_desc, NULL, &err_setbuf );
+			hb_if_err_propagate_goto( err, err_setbuf, error_handler );
+		}
+	}
+
 
 	/** UNHAPINESS */
 
@@ -696,7 +2034,7 @@ static inline void setupBuffers( HBHostBuffers_t *const hst_buff, HBDeviceBuffer
 
 	/** UNHAPPINESS REDUCED - all group sum to global memory. */
 
-	bufsz->unhapp_reduced = params->reduce_num_workgroups * sizeof( cl_float );
+	bufsz->unhapp_reduced = params->reduce_num_workgroups * params->unhapp_sum_size;
 
 /*
 	hst_buff->unhapp_reduced = ( cl_float *) malloc( bufsz->unhapp_reduced );
@@ -726,30 +2064,201 @@ static inline void setupBuffers( HBHostBuffers_t *const hst_buff, HBDeviceBuffer
 	hb_if_err_propagate_goto( err, err_setbuf, error_handler );
 
 
-error_handler:
-	/* If error handler is reached leave function imediately. */
+	/** REGIONS OF INTEREST - Host only, read from the heat and swarm maps. */
 
-	return;
-}
+	if (params->roi_count)
+	{
+		hst_buff->roi_frame = (cl_uint *) malloc( params->roi_frame_size );
+		hb_if_err_create_goto( *err, HB_ERROR,
+					hst_buff->roi_frame == NULL,
+					HB_MALLOC_FAILURE, error_handler,
+					"Unable to allocate host memory for the regions of interest." );
 
+		if (params->world_tile)
+		{
+			hst_buff->roi_staging = (cl_uint *) malloc( params->roi_staging_size );
+			hb_if_err_create_goto( *err, HB_ERROR,
+						hst_buff->roi_staging == NULL,
+						HB_MALLOC_FAILURE, error_handler,
+						"Unable to allocate host memory for the region of interest tiles." );
+		}
+	}
 
 
-/**
- * Get the kernel objects from the program. One for each kernel
- * function.
- *
- * @param[out]	krnl   - The kernels.
- * @param[out]	gws    - Global work sizes for each kernel.
- * @param[out]	lws    - Local woek sizes for each kernel.
- * @param[in]	oclobj - Yhe OpenCL objects, program, queue...
- * @param[in]	params - Simulation parameters.
+	/** REDUCE DONE - Work-group counter of the fused reduction. Starts at zero, the kernel leaves it at zero. */
+
+	bufsz->reduce_done = sizeof( cl_uint );
+
+	dev_buff->reduce_done = ccl_buffer_new( oclobj->ctx, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+							bufsz->reduce_done, &zero, &err_setbuf );
+	hb_if_err_propagate_goto( err, err_setbuf, error_handler );
+
+
+	/** CONVERGENCE - Unhappiness window and check state. Also needed, unused, when the check is disabled. */
+
+	bufsz->conv_window = MAX( params->converge_window, 1 ) * sizeof( cl_float );
+
+	dev_buff->conv_window = ccl_buffer_new( oclobj->ctx, CL_MEM_READ_WRITE,
+						bufsz->conv_window, NULL, &err_setbuf );
+	hb_if_err_propagate_goto( err, err_setbuf, error_handler );
+
+	bufsz->conv_state = CONV_STATE_SIZE * sizeof( cl_uint );
+
+	dev_buff->conv_state = ccl_buffer_new( oclobj->ctx, CL_MEM_READ_WRITE,
+						bufsz->conv_state, NULL, &err_setbuf );
+	hb_if_err_propagate_goto( err, err_setbuf, error_handler );
+
+
+	/** ACTIVE TILES - Tile flags, work list and its counters. Also needed, unused, when disabled. Set by 'init_maps'. */
+
+	bufsz->tile_flags = MAX( params->active_tiles_x * params->active_tiles_y, 1 ) * sizeof( cl_uint );
+
+	dev_buff->tile_flags = ccl_buffer_new( oclobj->ctx, CL_MEM_READ_WRITE,
+						bufsz->tile_flags, NULL, &err_setbuf );
+	hb_if_err_propagate_goto( err, err_setbuf, error_handler );
+
+	bufsz->active_list = bufsz->tile_flags;
+
+	dev_buff->active_list = ccl_buffer_new( oclobj->ctx, CL_MEM_READ_WRITE,
+						bufsz->active_list, NULL, &err_setbuf );
+	hb_if_err_propagate_goto( err, err_setbuf, error_handler );
+
+	bufsz->active_count = 2 * sizeof( cl_uint );
+
+	dev_buff->active_count = ccl_buffer_new( oclobj->ctx, CL_MEM_READ_WRITE,
+						bufsz->active_count, NULL, &err_setbuf );
+	hb_if_err_propagate_goto( err, err_setbuf, error_handler );
+
+
+	/** DETERMINISTIC - Bug targets and cell claims. Also needed, unused, when disabled. Claims set by 'init_maps'. */
+
+	bufsz->bug_target = (params->deterministic ? params->bugs_number : 1) * sizeof( cl_uint );
+
+	dev_buff->bug_target = ccl_buffer_new( oclobj->ctx, CL_MEM_READ_WRITE,
+						bufsz->bug_target, NULL, &err_setbuf );
+	hb_if_err_propagate_goto( err, err_setbuf, error_handler );
+
+	bufsz->claims = (params->deterministic ? params->world_storage_size : 1) * sizeof( cl_uint );
+
+	dev_buff->claims = ccl_buffer_new( oclobj->ctx, CL_MEM_READ_WRITE,
+						bufsz->claims, NULL, &err_setbuf );
+	hb_if_err_propagate_goto( err, err_setbuf, error_handler );
+
+
+	/** BINNED STEP - Bug bins and their counters. Counters also needed, unused, when disabled. Set by 'init_maps'. */
+
+	if (params->binned_step)
+	{
+		bufsz->bin_list = NUM_BINS * params->bugs_number * sizeof( cl_uint );
+
+		dev_buff->bin_list = ccl_buffer_new( oclobj->ctx, CL_MEM_READ_WRITE,
+							bufsz->bin_list, NULL, &err_setbuf );
+		hb_if_err_propagate_goto( err, err_setbuf, error_handler );
+	}
+
+	bufsz->bin_count = 2 * NUM_BINS * sizeof( cl_uint );
+
+	dev_buff->bin_count = ccl_buffer_new( oclobj->ctx, CL_MEM_READ_WRITE,
+						bufsz->bin_count, NULL, &err_setbuf );
+	hb_if_err_propagate_goto( err, err_setbuf, error_handler );
+
+
+	/** TRAJECTORY SAMPLES - Ring of samples, in the device, and the last cell of each sampled bug. */
+
+	if (params->trace_sample)
+	{
+		bufsz->trace_last = params->trace_sample * sizeof( cl_uint );
+
+		dev_buff->trace_last = ccl_buffer_new( oclobj->ctx, CL_MEM_READ_WRITE,
+							bufsz->trace_last, NULL, &err_setbuf );
+		hb_if_err_propagate_goto( err, err_setbuf, error_handler );
+
+		bufsz->trace_ring = params->trace_ring * params->trace_sample * TRACE_RECORD;
+
+		hst_buff->trace_ring = (cl_uint *) malloc( bufsz->trace_ring );
+		hb_if_err_create_goto( *err, HB_ERROR,
+					hst_buff->trace_ring == NULL,
+					HB_MALLOC_FAILURE, error_handler,
+					"Unable to allocate host memory for trajectory samples." );
+
+		dev_buff->trace_ring = ccl_buffer_new( oclobj->ctx, CL_MEM_WRITE_ONLY,
+							bufsz->trace_ring, NULL, &err_setbuf );
+		hb_if_err_propagate_goto( err, err_setbuf, error_handler );
+	}
+
+
+	/** MEGAKERNEL - Synchronization, work-group sums, results of a launch and the stop flag. */
+
+	if (params->megakernel_steps)
+	{
+		bufsz->mk_sync = MK_SYNC_SIZE * sizeof( cl_uint );
+
+		dev_buff->mk_sync = ccl_buffer_new( oclobj->ctx, CL_MEM_READ_WRITE,
+							bufsz->mk_sync, NULL, &err_setbuf );
+		hb_if_err_propagate_goto( err, err_setbuf, error_handler );
+
+		bufsz->mk_reduced = params->megakernel_groups * sizeof( cl_float );
+
+		dev_buff->mk_reduced = ccl_buffer_new( oclobj->ctx, CL_MEM_READ_WRITE,
+							bufsz->mk_reduced, NULL, &err_setbuf );
+		hb_if_err_propagate_goto( err, err_setbuf, error_handler );
+
+		bufsz->unhapp_results = params->megakernel_steps * sizeof( cl_float );
+
+		if (!params->host_buffers)
+		{
+			hst_buff->unhapp_results = (cl_float *) malloc( bufsz->unhapp_results );
+			hb_if_err_create_goto( *err, HB_ERROR,
+						hst_buff->unhapp_results == NULL,
+						HB_MALLOC_FAILURE, error_handler,
+						"Unable to allocate host memory for megakernel results." );
+		}
+
+		dev_buff->unhapp_results = ccl_buffer_new( oclobj->ctx, CL_MEM_WRITE_ONLY | readback_flags,
+							bufsz->unhapp_results, NULL, &err_setbuf );
+		hb_if_err_propagate_goto( err, err_setbuf, error_handler );
+
+		/* Host accessible, it stays mapped while the megakernel runs. */
+		bufsz->stop_flag = sizeof( cl_uint );
+
+		dev_buff->stop_flag = ccl_buffer_new( oclobj->ctx, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+							bufsz->stop_flag, NULL, &err_setbuf );
+		hb_if_err_propagate_goto( err, err_setbuf, error_handler );
+	}
+
+
+error_handler:
+	/* If error handler is reached leave function imediately. */
+
+	return;
+}
+
+
+
+/**
+ * Get the kernel objects from the program. One for each kernel
+ * function.
+ *
+ * @param[out]	krnl   - The kernels.
+ * @param[out]	gws    - Global work sizes for each kernel.
+ * @param[out]	lws    - Local woek sizes for each kernel.
+ * @param[in]	tuned  - Tuned local work sizes. Used instead of the suggested ones, when set.
+ * @param[in]	oclobj - Yhe OpenCL objects, program, queue...
+ * @param[in]	params - Simulation parameters.
  * @param[out]	err    - GLib object for error reporting.
  * */
 static inline void getKernels( HBKernels_t *const krnl, HBGlobalWorkSizes_t *const gws, HBLocalWorkSizes_t *const lws,
-					const OCLObjects_t *const oclobj, const Parameters_t *const params, CCLErr **err )
+					const HBTunedSizes_t *const tuned, const OCLObjects_t *const oclobj,
+					const Parameters_t *const params, CCLErr **err )
 {
 	size_t world_realdims[2] = {params->world_width, params->world_height};
+	size_t world_vectordims[2] = {
+		(params->world_width + params->heat_vector_width - 1) / params->heat_vector_width,
+		params->world_height };
 	size_t step_retry_flag_size = 1;
+	size_t tiles;
+	size_t max_lws, max_lws_average;
+	int fits;
 
 	CCLErr *err_getkernels = NULL;
 
@@ -769,12 +2278,12 @@ static inline void getKernels( HBKernels_t *const krnl, HBGlobalWorkSizes_t *con
 
 
 	/** init_maps: swarm_map and heat_map initialization Kernel.
-	    Size is 'world_size'. */
+	    Size is 'world_storage_size', so tile padding is also cleared. */
 
 	krnl->init_maps = ccl_kernel_new( oclobj->prg, KRNL_NAME__INIT_MAPS, &err_getkernels );
 	hb_if_err_propagate_goto( err, err_getkernels, error_handler );
 
-	ccl_kernel_suggest_worksizes( krnl->init_maps, oclobj->dev, HB_DIMS_1, &params->world_size,
+	ccl_kernel_suggest_worksizes( krnl->init_maps, oclobj->dev, HB_DIMS_1, &params->world_storage_size,
 						gws->init_maps, lws->init_maps,	&err_getkernels );
 	hb_if_err_propagate_goto( err, err_getkernels, error_handler );
 
@@ -835,6 +2344,14 @@ static inline void getKernels( HBKernels_t *const krnl, HBGlobalWorkSizes_t *con
 						gws->bug_step_best, lws->bug_step_best, &err_getkernels );
 	hb_if_err_propagate_goto( err, err_getkernels, error_handler );
 
+	fits = tunedWorksizesFit( krnl->bug_step_best, oclobj->dev, KRNL_NAME__BUG_STEP_BEST, HB_DIMS_1,
+					tuned->bug_step_best, 0, &err_getkernels );
+	hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+
+	if (fits)
+		applyTunedWorksizes( HB_DIMS_1, &params->bugs_number, tuned->bug_step_best,
+					gws->bug_step_best, lws->bug_step_best );
+
 	// printf( "[ kernel ]: bug_step.\n    '-> world_size = %zu; gws = %zu; lws = %zu\n", params->bugs_number, gws->bug_step[0], lws->bug_step[0] );
 
 
@@ -848,17 +2365,94 @@ static inline void getKernels( HBKernels_t *const krnl, HBGlobalWorkSizes_t *con
 						gws->bug_step_any_free, lws->bug_step_any_free, &err_getkernels );
 	hb_if_err_propagate_goto( err, err_getkernels, error_handler );
 
+	fits = tunedWorksizesFit( krnl->bug_step_any_free, oclobj->dev, KRNL_NAME__BUG_STEP_ANY_FREE, HB_DIMS_1,
+					tuned->bug_step_any_free, 0, &err_getkernels );
+	hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+
+	if (fits)
+		applyTunedWorksizes( HB_DIMS_1, &params->bugs_number, tuned->bug_step_any_free,
+					gws->bug_step_any_free, lws->bug_step_any_free );
+
+
+
+	/** bug_step_classify and bug_step_binned: the passes of the binned bug step, in place of 'bug_step_best'.
+	    Size is 'bugs_number'. */
+
+	if (params->binned_step)
+	{
+		krnl->bug_step_classify = ccl_kernel_new( oclobj->prg, KRNL_NAME__BUG_STEP_CLASSIFY, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+
+		ccl_kernel_suggest_worksizes( krnl->bug_step_classify, oclobj->dev, HB_DIMS_1, &params->bugs_number,
+							gws->bug_step_classify, lws->bug_step_classify, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+
+		krnl->bug_step_binned = ccl_kernel_new( oclobj->prg, KRNL_NAME__BUG_STEP_BINNED, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+
+		ccl_kernel_suggest_worksizes( krnl->bug_step_binned, oclobj->dev, HB_DIMS_1, &params->bugs_number,
+							gws->bug_step_binned, lws->bug_step_binned, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+	}
+
 
 
 	/** comp_world_heat: kernel.
-	    Compute the new world heat, that is world diffusion followed by world evaporation. */
+	    Compute the new world heat, that is world diffusion followed by world evaporation.
+	    With a vector width above 1, each work-item computes a run of that many cells of a row. With heat images,
+	    each work-item computes a cell, reading and writing the heat maps as images. */
 
-	krnl->comp_world_heat = ccl_kernel_new( oclobj->prg, KRNL_NAME__COMP_WORLD_HEAT, &err_getkernels );
-	hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+	if (params->heat_image)
+	{
+		krnl->comp_world_heat = ccl_kernel_new( oclobj->prg, KRNL_NAME__COMP_WORLD_HEAT_IMG, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
 
-	ccl_kernel_suggest_worksizes( krnl->comp_world_heat, oclobj->dev, HB_DIMS_2, world_realdims,
-						gws->comp_world_heat, lws->comp_world_heat, &err_getkernels );
-	hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+		ccl_kernel_suggest_worksizes( krnl->comp_world_heat, oclobj->dev, HB_DIMS_2, world_realdims,
+							gws->comp_world_heat, lws->comp_world_heat, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+
+		fits = tunedWorksizesFit( krnl->comp_world_heat, oclobj->dev, KRNL_NAME__COMP_WORLD_HEAT_IMG, HB_DIMS_2,
+						tuned->comp_world_heat, 0, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+
+		if (fits)
+			applyTunedWorksizes( HB_DIMS_2, world_realdims, tuned->comp_world_heat,
+						gws->comp_world_heat, lws->comp_world_heat );
+	}
+	else if (params->heat_vector_width > 1)
+	{
+		krnl->comp_world_heat = ccl_kernel_new( oclobj->prg, KRNL_NAME__COMP_WORLD_HEAT_VEC, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+
+		ccl_kernel_suggest_worksizes( krnl->comp_world_heat, oclobj->dev, HB_DIMS_2, world_vectordims,
+							gws->comp_world_heat, lws->comp_world_heat, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+
+		fits = tunedWorksizesFit( krnl->comp_world_heat, oclobj->dev, KRNL_NAME__COMP_WORLD_HEAT_VEC, HB_DIMS_2,
+						tuned->comp_world_heat, 0, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+
+		if (fits)
+			applyTunedWorksizes( HB_DIMS_2, world_vectordims, tuned->comp_world_heat,
+						gws->comp_world_heat, lws->comp_world_heat );
+	}
+	else
+	{
+		krnl->comp_world_heat = ccl_kernel_new( oclobj->prg, KRNL_NAME__COMP_WORLD_HEAT, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+
+		ccl_kernel_suggest_worksizes( krnl->comp_world_heat, oclobj->dev, HB_DIMS_2, world_realdims,
+							gws->comp_world_heat, lws->comp_world_heat, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+
+		fits = tunedWorksizesFit( krnl->comp_world_heat, oclobj->dev, KRNL_NAME__COMP_WORLD_HEAT, HB_DIMS_2,
+						tuned->comp_world_heat, 0, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+
+		if (fits)
+			applyTunedWorksizes( HB_DIMS_2, world_realdims, tuned->comp_world_heat,
+						gws->comp_world_heat, lws->comp_world_heat );
+	}
 
 	// printf( "[ kernel ]: comp_world_heat.\n    '-> world_dims = [%zu, %zu]; gws = [%zu, %zu]; lws = [%zu, %zu]\n", world_realdims[0], world_realdims[1], gws->comp_world_heat[0], gws->comp_world_heat[1], lws->comp_world_heat[0], lws->comp_world_heat[1] );
 
@@ -886,9 +2480,171 @@ static inline void getKernels( HBKernels_t *const krnl, HBGlobalWorkSizes_t *con
 	gws->unhapp_step2_average[ 0 ] = lws->unhapp_step1_reduce[ 0 ];
 	lws->unhapp_step2_average[ 0 ] = lws->unhapp_step1_reduce[ 0 ];
 
+	/* The reduction size is built in, (REDUCE_NUM_WORKGROUPS), so a size the kernels can not take is an error here. */
+	max_lws = ccl_kernel_get_workgroup_info_scalar( krnl->unhapp_step1_reduce, oclobj->dev,
+								CL_KERNEL_WORK_GROUP_SIZE, size_t, &err_getkernels );
+	hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+
+	max_lws_average = ccl_kernel_get_workgroup_info_scalar( krnl->unhapp_step2_average, oclobj->dev,
+									CL_KERNEL_WORK_GROUP_SIZE, size_t, &err_getkernels );
+	hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+				lws->unhapp_step1_reduce[ 0 ] > MIN( max_lws, max_lws_average ),
+				HB_INVALID_PARAMETER, error_handler,
+				"Reduction work-group size %zu exceeds the %zu the kernels take on this device%s.",
+				lws->unhapp_step1_reduce[ 0 ], MIN( max_lws, max_lws_average ),
+				tuned->unhapp_step1_reduce[ 0 ] == lws->unhapp_step1_reduce[ 0 ] ?
+					", remove it from the work size profile" : "" );
+
 	// printf( "[ kernel ]: unhapp_stp2_average.\n    '-> gws = %zu; lws = %zu\n\n", gws->unhapp_stp2_average[0], lws->unhapp_stp2_average[0] );
 
 
+
+	/** unhappiness_reduce_fused: Both reduction steps, fused pipeline only.
+	    Uses the work sizes of 'unhappiness_step1_reduce'. */
+
+	if (params->fused)
+	{
+		krnl->unhapp_reduce_fused = ccl_kernel_new( oclobj->prg, KRNL_NAME__UNHAPP_REDUCE_FUSED, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+	}
+
+
+
+	/** convergence_check: Convergence stop criteria, one work-item. Only if enabled. */
+
+	if (params->converge_window || params->still_window)
+	{
+		krnl->convergence_check = ccl_kernel_new( oclobj->prg, KRNL_NAME__CONVERGENCE_CHECK, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+
+		ccl_kernel_suggest_worksizes( krnl->convergence_check, oclobj->dev, HB_DIMS_1, &step_retry_flag_size,
+							gws->convergence_check, lws->convergence_check, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+	}
+
+
+
+	/** active_tiles_list and comp_world_heat_active: world heat over the active tiles only.
+	    The list, one work-item per tile. The heat, 'params->active_groups' work-groups of the largest power of 2
+	    size the kernel allows, up to a tile or ACTIVE_LWS_MAX. */
+
+	if (params->active_tile)
+	{
+		tiles = params->active_tiles_x * params->active_tiles_y;
+
+		krnl->active_tiles_list = ccl_kernel_new( oclobj->prg, KRNL_NAME__ACTIVE_TILES_LIST, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+
+		ccl_kernel_suggest_worksizes( krnl->active_tiles_list, oclobj->dev, HB_DIMS_1, &tiles,
+							gws->active_tiles_list, lws->active_tiles_list, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+
+		krnl->comp_world_heat_active = ccl_kernel_new( oclobj->prg, KRNL_NAME__COMP_HEAT_ACTIVE, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+
+		lws->comp_world_heat_active[ 0 ] = ccl_kernel_get_workgroup_info_scalar( krnl->comp_world_heat_active,
+										oclobj->dev, CL_KERNEL_WORK_GROUP_SIZE,
+										size_t, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+
+		lws->comp_world_heat_active[ 0 ] = MIN( lws->comp_world_heat_active[ 0 ],
+							MIN( SQUARE( params->active_tile ), ACTIVE_LWS_MAX ) );
+
+		while (!IS_POW2( lws->comp_world_heat_active[ 0 ] ))
+			lws->comp_world_heat_active[ 0 ] &= lws->comp_world_heat_active[ 0 ] - 1;
+
+		gws->comp_world_heat_active[ 0 ] = lws->comp_world_heat_active[ 0 ] * params->active_groups;
+	}
+
+
+
+	/** bug_step_claim, bug_step_resolve and bug_step_release: the passes of the deterministic bug step.
+	    Size is 'bugs_number'. */
+
+	if (params->deterministic)
+	{
+		krnl->bug_step_claim = ccl_kernel_new( oclobj->prg, KRNL_NAME__BUG_STEP_CLAIM, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+
+		ccl_kernel_suggest_worksizes( krnl->bug_step_claim, oclobj->dev, HB_DIMS_1, &params->bugs_number,
+							gws->bug_step_claim, lws->bug_step_claim, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+
+		krnl->bug_step_resolve = ccl_kernel_new( oclobj->prg, KRNL_NAME__BUG_STEP_RESOLVE, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+
+		ccl_kernel_suggest_worksizes( krnl->bug_step_resolve, oclobj->dev, HB_DIMS_1, &params->bugs_number,
+							gws->bug_step_resolve, lws->bug_step_resolve, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+
+		krnl->bug_step_release = ccl_kernel_new( oclobj->prg, KRNL_NAME__BUG_STEP_RELEASE, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+
+		ccl_kernel_suggest_worksizes( krnl->bug_step_release, oclobj->dev, HB_DIMS_1, &params->bugs_number,
+							gws->bug_step_release, lws->bug_step_release, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+	}
+
+
+
+	/** deposit_heat_atomic or deposit_heat_gather: heat deposition once all bugs are done, unless bugs leave their
+	    heat as they step. Size is 'bugs_number' or 'world_storage_size'. The megakernel deposits by itself. */
+
+	if (params->deposit != HB_DEPOSIT_INLINE && !params->megakernel_steps)
+	{
+		krnl->deposit_heat = ccl_kernel_new( oclobj->prg, params->deposit == HB_DEPOSIT_ATOMIC ?
+								KRNL_NAME__DEPOSIT_ATOMIC : KRNL_NAME__DEPOSIT_GATHER,
+							&err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+
+		ccl_kernel_suggest_worksizes( krnl->deposit_heat, oclobj->dev, HB_DIMS_1,
+						params->deposit == HB_DEPOSIT_ATOMIC ?
+							&params->bugs_number : &params->world_storage_size,
+						gws->deposit_heat, lws->deposit_heat, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+	}
+
+
+
+	/** trace_sample: Trajectory samples, only if sampling. Size is 'trace_sample'. */
+
+	if (params->trace_sample)
+	{
+		krnl->trace_sample = ccl_kernel_new( oclobj->prg, KRNL_NAME__TRACE_SAMPLE, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+
+		ccl_kernel_suggest_worksizes( krnl->trace_sample, oclobj->dev, HB_DIMS_1, &params->trace_sample,
+							gws->trace_sample, lws->trace_sample, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+	}
+
+
+
+	/** megakernel: Whole iterations, megakernel mode only.
+	    A work-group per compute unit, of the largest power of 2 size the kernel allows, up to MEGAKERNEL_LWS_MAX. */
+
+	if (params->megakernel_steps)
+	{
+		krnl->megakernel = ccl_kernel_new( oclobj->prg, KRNL_NAME__MEGAKERNEL, &err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+
+		lws->megakernel[ 0 ] = ccl_kernel_get_workgroup_info_scalar( krnl->megakernel, oclobj->dev,
+										CL_KERNEL_WORK_GROUP_SIZE, size_t,
+										&err_getkernels );
+		hb_if_err_propagate_goto( err, err_getkernels, error_handler );
+
+		lws->megakernel[ 0 ] = MIN( lws->megakernel[ 0 ], MEGAKERNEL_LWS_MAX );
+
+		/* Round down to a power of 2, for the reduction. */
+		while (!IS_POW2( lws->megakernel[ 0 ] ))
+			lws->megakernel[ 0 ] &= lws->megakernel[ 0 ] - 1;
+
+		gws->megakernel[ 0 ] = lws->megakernel[ 0 ] * params->megakernel_groups;
+	}
+
+
 error_handler:
 		/* If error handler is reached leave function imediately. */
 
@@ -905,10 +2661,13 @@ error_handler:
  *                       setted as kernel parameters.
  * @param[in]	lws      - The local Work Size will be used to set
  *                       device's local memory to be passed to kernel.
+ * @param[in]	params   - Simulation parameters.
  * */
 static inline void setKernelParameters( const HBKernels_t *const krnl, const HBDeviceBuffers_t *const dev_buff,
-						const HBLocalWorkSizes_t *const lws )
+						const HBLocalWorkSizes_t *const lws, const Parameters_t *const params )
 {
+	cl_uint retry_slot = 0;		/* The bug step kernels report to the first 'bug_step_retry' slot. */
+
 	/** 'init_random' kernel arguments. */
 	ccl_kernel_set_arg( krnl->init_random, 0, dev_buff->rng_state );
 
@@ -916,12 +2675,19 @@ static inline void setKernelParameters( const HBKernels_t *const krnl, const HBD
 	ccl_kernel_set_arg( krnl->init_maps, 0, dev_buff->swarm_map );
 	ccl_kernel_set_arg( krnl->init_maps, 1, dev_buff->heat_map[0] );
 	ccl_kernel_set_arg( krnl->init_maps, 2, dev_buff->heat_map[1] );		/* heat_buffer */
+	ccl_kernel_set_arg( krnl->init_maps, 3, dev_buff->tile_flags );
+	ccl_kernel_set_arg( krnl->init_maps, 4, dev_buff->active_count );
+	ccl_kernel_set_arg( krnl->init_maps, 5, dev_buff->claims );
+	ccl_kernel_set_arg( krnl->init_maps, 6, dev_buff->bin_count );
+	ccl_kernel_set_arg( krnl->init_maps, 7, dev_buff->scenario_heat );
+	ccl_kernel_set_arg( krnl->init_maps, 8, dev_buff->scenario_obstacles );
 
 	/** 'init_swarm' kernel arguments. 'swarm[0]' and 'swarm[1]'	  */
 	ccl_kernel_set_arg( krnl->init_swarm, 0, dev_buff->swarm_bugPosition );
 	ccl_kernel_set_arg( krnl->init_swarm, 1, dev_buff->swarm_map );
 	ccl_kernel_set_arg( krnl->init_swarm, 2, dev_buff->unhappiness );
 	ccl_kernel_set_arg( krnl->init_swarm, 3, dev_buff->rng_state );
+	ccl_kernel_set_arg( krnl->init_swarm, 5, dev_buff->bug_attrs );
 
 	/** 'prepare_bug_step' kernel arguments.			  */
 	ccl_kernel_set_arg( krnl->prepare_bug_step, 0, dev_buff->swarm_bugPosition );
@@ -937,6 +2703,10 @@ static inline void setKernelParameters( const HBKernels_t *const krnl, const HBD
 	ccl_kernel_set_arg( krnl->bug_step_best, 3, dev_buff->unhappiness );
 	ccl_kernel_set_arg( krnl->bug_step_best, 4, dev_buff->bug_step_retry );
 	ccl_kernel_set_arg( krnl->bug_step_best, 5, dev_buff->rng_state );
+	ccl_kernel_set_arg( krnl->bug_step_best, 6, ccl_arg_priv( retry_slot, cl_uint ) );	/* Changes in the fused pipeline. */
+	ccl_kernel_set_arg( krnl->bug_step_best, 7, dev_buff->conv_state );
+	ccl_kernel_set_arg( krnl->bug_step_best, 8, dev_buff->tile_flags );
+	ccl_kernel_set_arg( krnl->bug_step_best, 9, dev_buff->bug_attrs );
 
 	/** 'bug_step_any_free' kernel arguments. */
 	ccl_kernel_set_arg( krnl->bug_step_any_free, 0, dev_buff->swarm_bugPosition );
@@ -944,6 +2714,60 @@ static inline void setKernelParameters( const HBKernels_t *const krnl, const HBD
 	// ccl_kernel_set_arg( krnl->bug_step_any_free, 2, dev_buff->heat_map[0] );
 	ccl_kernel_set_arg( krnl->bug_step_any_free, 3, dev_buff->bug_step_retry );
 	ccl_kernel_set_arg( krnl->bug_step_any_free, 4, dev_buff->rng_state );
+	ccl_kernel_set_arg( krnl->bug_step_any_free, 5, ccl_arg_priv( retry_slot, cl_uint ) );	/* Changes in the fused pipeline. */
+	ccl_kernel_set_arg( krnl->bug_step_any_free, 6, dev_buff->conv_state );
+	ccl_kernel_set_arg( krnl->bug_step_any_free, 7, dev_buff->tile_flags );
+	ccl_kernel_set_arg( krnl->bug_step_any_free, 8, dev_buff->bug_attrs );
+
+	/** Deterministic bug step kernels arguments. Heat map, pass number and retry slot change in every pass, they are
+	    set in 'enqueueBugStepDeterministic(...)'. */
+	if (krnl->bug_step_claim)
+	{
+		ccl_kernel_set_arg( krnl->bug_step_claim, 0, dev_buff->swarm_bugPosition );
+		ccl_kernel_set_arg( krnl->bug_step_claim, 1, dev_buff->swarm_map );
+		ccl_kernel_set_arg( krnl->bug_step_claim, 3, dev_buff->unhappiness );
+		ccl_kernel_set_arg( krnl->bug_step_claim, 4, dev_buff->rng_state );
+		ccl_kernel_set_arg( krnl->bug_step_claim, 5, dev_buff->bug_target );
+		ccl_kernel_set_arg( krnl->bug_step_claim, 6, dev_buff->claims );
+		ccl_kernel_set_arg( krnl->bug_step_claim, 10, dev_buff->bug_attrs );
+
+		ccl_kernel_set_arg( krnl->bug_step_resolve, 0, dev_buff->swarm_bugPosition );
+		ccl_kernel_set_arg( krnl->bug_step_resolve, 1, dev_buff->swarm_map );
+		ccl_kernel_set_arg( krnl->bug_step_resolve, 3, dev_buff->bug_target );
+		ccl_kernel_set_arg( krnl->bug_step_resolve, 4, dev_buff->claims );
+		ccl_kernel_set_arg( krnl->bug_step_resolve, 5, dev_buff->bug_step_retry );
+		ccl_kernel_set_arg( krnl->bug_step_resolve, 8, dev_buff->conv_state );
+		ccl_kernel_set_arg( krnl->bug_step_resolve, 9, dev_buff->tile_flags );
+		ccl_kernel_set_arg( krnl->bug_step_resolve, 11, dev_buff->bug_attrs );
+
+		ccl_kernel_set_arg( krnl->bug_step_release, 0, dev_buff->bug_target );
+		ccl_kernel_set_arg( krnl->bug_step_release, 1, dev_buff->claims );
+	}
+
+
+	/** 'bug_step_classify' and 'bug_step_binned' kernel arguments. Heat map, retry and bin slots change in every
+	    iteration, they are set in 'simulate(...)'. */
+	if (params->binned_step)
+	{
+		ccl_kernel_set_arg( krnl->bug_step_classify, 0, dev_buff->swarm_bugPosition );
+		ccl_kernel_set_arg( krnl->bug_step_classify, 1, dev_buff->swarm_map );
+		ccl_kernel_set_arg( krnl->bug_step_classify, 3, dev_buff->unhappiness );
+		ccl_kernel_set_arg( krnl->bug_step_classify, 4, dev_buff->rng_state );
+		ccl_kernel_set_arg( krnl->bug_step_classify, 5, dev_buff->tile_flags );
+		ccl_kernel_set_arg( krnl->bug_step_classify, 6, dev_buff->bin_list );
+		ccl_kernel_set_arg( krnl->bug_step_classify, 7, dev_buff->bin_count );
+		ccl_kernel_set_arg( krnl->bug_step_classify, 9, dev_buff->bug_attrs );
+
+		ccl_kernel_set_arg( krnl->bug_step_binned, 0, dev_buff->swarm_bugPosition );
+		ccl_kernel_set_arg( krnl->bug_step_binned, 1, dev_buff->swarm_map );
+		ccl_kernel_set_arg( krnl->bug_step_binned, 3, dev_buff->bug_step_retry );
+		ccl_kernel_set_arg( krnl->bug_step_binned, 4, dev_buff->rng_state );
+		ccl_kernel_set_arg( krnl->bug_step_binned, 6, dev_buff->conv_state );
+		ccl_kernel_set_arg( krnl->bug_step_binned, 7, dev_buff->tile_flags );
+		ccl_kernel_set_arg( krnl->bug_step_binned, 8, dev_buff->bin_list );
+		ccl_kernel_set_arg( krnl->bug_step_binned, 9, dev_buff->bin_count );
+		ccl_kernel_set_arg( krnl->bug_step_binned, 11, dev_buff->bug_attrs );
+	}
 
 
 	/** 'comp_world_heat' kernel arguments. */
@@ -952,23 +2776,97 @@ static inline void setKernelParameters( const HBKernels_t *const krnl, const HBD
 	//ccl_kernel_set_arg( krnl->comp_world_heat, 0, dev_buff->heat_map[0] );
 	//ccl_kernel_set_arg( krnl->comp_world_heat, 1, dev_buff->heat_map[1] );
 
+	/** 'active_tiles_list' and 'comp_world_heat_active' kernel arguments. Heat maps and list slot change in every
+	    iteration, they are set in 'simulate(...)'. */
+	if (krnl->active_tiles_list)
+	{
+		ccl_kernel_set_arg( krnl->active_tiles_list, 0, dev_buff->tile_flags );
+		ccl_kernel_set_arg( krnl->active_tiles_list, 1, dev_buff->active_list );
+		ccl_kernel_set_arg( krnl->active_tiles_list, 2, dev_buff->active_count );
+
+		ccl_kernel_set_arg( krnl->comp_world_heat_active, 2, dev_buff->tile_flags );
+		ccl_kernel_set_arg( krnl->comp_world_heat_active, 3, dev_buff->active_list );
+		ccl_kernel_set_arg( krnl->comp_world_heat_active, 4, dev_buff->active_count );
+	}
+
 	/** 'unhappiness_stp1_reduce' kernel arguments. */
 	ccl_kernel_set_arg( krnl->unhapp_step1_reduce, 0, dev_buff->unhappiness );
-	ccl_kernel_set_arg( krnl->unhapp_step1_reduce, 1, ccl_arg_local( lws->unhapp_step1_reduce[ 0 ], cl_float ) );
+	ccl_kernel_set_arg( krnl->unhapp_step1_reduce, 1,
+				ccl_arg_local( lws->unhapp_step1_reduce[ 0 ] * params->unhapp_sum_size, cl_uchar ) );
 	ccl_kernel_set_arg( krnl->unhapp_step1_reduce, 2, dev_buff->unhapp_reduced );
 
 	/** 'unhappiness_stp2_average' kernel arguments. */
 	ccl_kernel_set_arg( krnl->unhapp_step2_average, 0, dev_buff->unhapp_reduced );
-	ccl_kernel_set_arg( krnl->unhapp_step2_average, 1, ccl_arg_local( lws->unhapp_step2_average[ 0 ], cl_float ) );
+	ccl_kernel_set_arg( krnl->unhapp_step2_average, 1,
+				ccl_arg_local( lws->unhapp_step2_average[ 0 ] * params->unhapp_sum_size, cl_uchar ) );
 	ccl_kernel_set_arg( krnl->unhapp_step2_average, 2, dev_buff->unhapp_average );
 
+	/** 'unhappiness_reduce_fused' kernel arguments. */
+	if (krnl->unhapp_reduce_fused)
+	{
+		ccl_kernel_set_arg( krnl->unhapp_reduce_fused, 0, dev_buff->unhappiness );
+		ccl_kernel_set_arg( krnl->unhapp_reduce_fused, 1, ccl_arg_local( lws->unhapp_step1_reduce[ 0 ], cl_float ) );
+		ccl_kernel_set_arg( krnl->unhapp_reduce_fused, 2, dev_buff->unhapp_reduced );
+		ccl_kernel_set_arg( krnl->unhapp_reduce_fused, 3, dev_buff->unhapp_average );
+		ccl_kernel_set_arg( krnl->unhapp_reduce_fused, 4, dev_buff->reduce_done );
+	}
+
+	/** 'megakernel' kernel arguments. Heat maps and number of iterations are set in 'simulateMegakernel(...)'. */
+	if (krnl->megakernel)
+	{
+		ccl_kernel_set_arg( krnl->megakernel, 2, dev_buff->swarm_bugPosition );
+		ccl_kernel_set_arg( krnl->megakernel, 3, dev_buff->swarm_map );
+		ccl_kernel_set_arg( krnl->megakernel, 4, dev_buff->unhappiness );
+		ccl_kernel_set_arg( krnl->megakernel, 5, dev_buff->rng_state );
+		ccl_kernel_set_arg( krnl->megakernel, 6, ccl_arg_local( lws->megakernel[ 0 ], cl_float ) );
+		ccl_kernel_set_arg( krnl->megakernel, 7, dev_buff->mk_reduced );
+		ccl_kernel_set_arg( krnl->megakernel, 8, dev_buff->unhapp_results );
+		ccl_kernel_set_arg( krnl->megakernel, 9, dev_buff->mk_sync );
+		ccl_kernel_set_arg( krnl->megakernel, 10, dev_buff->stop_flag );
+		ccl_kernel_set_arg( krnl->megakernel, 12, dev_buff->conv_window );
+		ccl_kernel_set_arg( krnl->megakernel, 13, dev_buff->conv_state );
+		ccl_kernel_set_arg( krnl->megakernel, 14, dev_buff->bug_attrs );
+	}
+
+	/** 'convergence_check' kernel arguments. */
+	if (krnl->convergence_check)
+	{
+		ccl_kernel_set_arg( krnl->convergence_check, 0, dev_buff->unhapp_average );
+		ccl_kernel_set_arg( krnl->convergence_check, 1, dev_buff->conv_window );
+		ccl_kernel_set_arg( krnl->convergence_check, 2, dev_buff->conv_state );
+	}
+
+	/** 'deposit_heat_atomic' or 'deposit_heat_gather' kernel arguments. Heat map is set in 'simulate(...)'. */
+	if (krnl->deposit_heat)
+	{
+		if (params->deposit == HB_DEPOSIT_ATOMIC)
+		{
+			ccl_kernel_set_arg( krnl->deposit_heat, 1, dev_buff->swarm_bugPosition );
+			ccl_kernel_set_arg( krnl->deposit_heat, 2, dev_buff->swarm_map );
+			ccl_kernel_set_arg( krnl->deposit_heat, 3, dev_buff->bug_attrs );
+		}
+		else
+		{
+			ccl_kernel_set_arg( krnl->deposit_heat, 1, dev_buff->swarm_map );
+		}
+	}
+
+	/** 'trace_sample' kernel arguments. The slot is set in 'enqueueTraceSample(...)'. */
+	if (krnl->trace_sample)
+	{
+		ccl_kernel_set_arg( krnl->trace_sample, 0, dev_buff->swarm_bugPosition );
+		ccl_kernel_set_arg( krnl->trace_sample, 1, dev_buff->unhappiness );
+		ccl_kernel_set_arg( krnl->trace_sample, 2, dev_buff->trace_last );
+		ccl_kernel_set_arg( krnl->trace_sample, 3, dev_buff->trace_ring );
+	}
+
 	return;
 }
 
 
 
 /**
- * Run all init kernels.
+ * Run all init kernels. The seed is a kernel argument, set here, so a new seed needs no new build.
  * */
 static inline void initiate( HBKernels_t *const krnl, const HBGlobalWorkSizes_t *const gws,
 				const HBLocalWorkSizes_t *const lws, OCLObjects_t *const oclobj,
@@ -977,11 +2875,28 @@ static inline void initiate( HBKernels_t *const krnl, const HBGlobalWorkSizes_t
 {
 	/** Events. */
 	CCLEvent *evt_krnl_exec = NULL;  /* Event termination signal for kernel execution. */
+	CCLEvent *evt_rdwr = NULL;       /* Event termination signal for buffer writes. */
 	CCLEventWaitList ewl = NULL;     /* Event Waiting List. A list of OpenCL events for operations to be finished. */
 
+	cl_uint conv_state[ CONV_STATE_SIZE ] = { 0 };
+
+	cl_uint seed = (cl_uint) params->seed;
+
 	CCLErr *err_init = NULL;
 
 
+	/** The run's seed. */
+
+	ccl_kernel_set_arg( krnl->init_random, 1, ccl_arg_priv( seed, cl_uint ) );
+	ccl_kernel_set_arg( krnl->init_swarm, 4, ccl_arg_priv( seed, cl_uint ) );
+
+	if (krnl->bug_step_claim)
+	{
+		ccl_kernel_set_arg( krnl->bug_step_claim, 9, ccl_arg_priv( seed, cl_uint ) );
+		ccl_kernel_set_arg( krnl->bug_step_resolve, 10, ccl_arg_priv( seed, cl_uint ) );
+	}
+
+
 	/** INIT RANDOM. */
 
 	// printf( "Init random:\n\tgws = %zu; lws = %zu\n", gws->init_random[0], lws->init_random[0] );
@@ -1028,6 +2943,16 @@ static inline void initiate( HBKernels_t *const krnl, const HBGlobalWorkSizes_t
 	ccl_event_wait_list_add( &ewl, evt_krnl_exec, NULL );
 
 
+	/** RESET CONVERGENCE STATE. Bug steps, (e.g. when autotuning), count moves. */
+
+	evt_rdwr = ccl_buffer_enqueue_write( dev_buff->conv_state, oclobj->queue, HB_NON_BLOCK, 0,
+						bufsz->conv_state, conv_state, NULL, &err_init );
+	hb_if_err_propagate_goto( err, err_init, error_handler );
+
+	/* Add write termination event to the wait list. */
+	ccl_event_wait_list_add( &ewl, evt_rdwr, NULL );
+
+
 	/* Wait events termination. */
 	ccl_event_wait( &ewl, &err_init );
 	hb_if_err_propagate_goto( err, err_init, error_handler );
@@ -1078,6 +3003,16 @@ static inline void initiate( HBKernels_t *const krnl, const HBGlobalWorkSizes_t
 
 	/* INIT SWARM Fill the swarm map with bugs, compute unhapinnes. */
 
+	/* Bugs placed from a file take their cells from 'swarm_bugPosition'. */
+	if (params->placement == HB_PLACE_FILE)
+	{
+		evt_rdwr = ccl_buffer_enqueue_write( dev_buff->swarm_bugPosition, oclobj->queue, HB_NON_BLOCK, 0,
+							bufsz->swarm_bugPosition, hst_buff->bug_placement, NULL, &err_init );
+		hb_if_err_propagate_goto( err, err_init, error_handler );
+
+		ccl_event_wait_list_add( &ewl, evt_rdwr, NULL );
+	}
+
 	hbprintf( "Init swarm:\n\tgws = %zu; lws = %zu\n", gws->init_swarm[0], lws->init_swarm[0] );
 
 	evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->init_swarm, oclobj->queue, HB_DIMS_1, NULL,
@@ -1160,385 +3095,2273 @@ error_handler:
 
 
 /**
- * NOTE: Check this about Buffer Read/Write vs. Map/Unmap ( http://downloads.ti.com/mctools/esd/docs/opencl/memory/access-model.html )
+ * Time a kernel run with the given work sizes, from the queue's profiling events. The kernel is run
+ * AUTOTUNE_REPETITIONS times, each run preceded by 'pre_krnl' (not timed) when given, and the shortest run is kept.
+ *
+ * @param[in]	krnl     - Kernel to time. Its arguments must be set.
+ * @param[in]	dims     - Number of dimensions.
+ * @param[in]	gws      - Global work size.
+ * @param[in]	lws      - Local work size.
+ * @param[in]	pre_krnl - Kernel to run before each timed run, to set up its work. NULL if none.
+ * @param[in]	pre_gws  - Global work size of 'pre_krnl', (1 dimension).
+ * @param[in]	pre_lws  - Local work size of 'pre_krnl', (1 dimension).
+ * @param[in]	oclobj   - The OpenCL objects, the queue is used.
+ * @param[out]	err      - GLib object for error reporting.
+ *
+ * @return The shortest run, in nanoseconds. 0 if the device does not accept the work sizes for this kernel, which is
+ *         not an error.
  * */
-static inline void simulate( const HBKernels_t *const krnl, const HBGlobalWorkSizes_t *const gws,
-				const HBLocalWorkSizes_t *const lws, OCLObjects_t *const oclobj,
-				HBDeviceBuffers_t *const dev_buff, HBHostBuffers_t *const hst_buff,
-				HBBuffersSize_t *const bufsz, const Parameters_t *const params, FILE *hbResultFile,
-				CCLErr **err )
+static inline cl_ulong timeKernel( CCLKernel *const krnl, cl_uint dims, const size_t *const gws,
+					const size_t *const lws, CCLKernel *const pre_krnl,
+					const size_t *const pre_gws, const size_t *const pre_lws,
+					OCLObjects_t *const oclobj, CCLErr **err )
 {
-//	FILE *hbResultFile = NULL;
-        CCLEvent *evt_rdwr = NULL;	    /* Read/Write termination event.  */
-        CCLEvent *evt_krnl_exec = NULL;	    /* Kernel exec termination event. */
-        CCLEventWaitList ewl = NULL;	    /* Event wait list. */
+	CCLEvent *evt_krnl_exec = NULL;	/* Kernel exec termination event. */
+	CCLEventWaitList ewl = NULL;	/* Event wait list. */
 
-         /* Buffer selectors. In each step they swap value to indicate the correct 'heat_map' buffer to be sent to kernel. */
-        struct {
-        	cl_uint main;		    /* Heatmap main.   */
-        	cl_uint secd;		    /* Heatmap buffer. */
-        } bufsel;
+	cl_ulong start, end, best = 0;
 
-        size_t iter_counter;		    /* Iteration counter. */
+	CCLErr *err_time = NULL;
 
-        CCLErr *err_simul = NULL;
 
+	for (size_t rep = 0; rep < AUTOTUNE_REPETITIONS; rep++)
+	{
+		if (pre_krnl)
+		{
+			evt_krnl_exec = ccl_kernel_enqueue_ndrange( pre_krnl, oclobj->queue, HB_DIMS_1, NULL,
+									pre_gws, pre_lws, &ewl, &err_time );
+			hb_if_err_propagate_goto( err, err_time, error_handler );
 
-	/** Get first bugs unhappiness. */
+			/* Add kernel termination event to wait list. */
+			ccl_event_wait_list_add( &ewl, evt_krnl_exec, NULL );
+		}
 
-	/* Call reduction first, because initial state does already contain the bug's unhappiness. */
+		evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl, oclobj->queue, dims, NULL, gws, lws, &ewl, &err_time );
 
-	/* Reduce step 1: */
-	evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->unhapp_step1_reduce, oclobj->queue, HB_DIMS_1, NULL,
+		if (err_time != NULL)
+		{
+			/* Work sizes rejected by the device, (i.e. too much local memory). Skip the candidate. */
+			g_clear_error( &err_time );
+			ccl_event_wait_list_clear( &ewl );
+
+			ccl_queue_finish( oclobj->queue, &err_time );
+			hb_if_err_propagate_goto( err, err_time, error_handler );
+
+			return 0;
+		}
+
+		/* Add kernel termination event to wait list. */
+		ccl_event_wait_list_add( &ewl, evt_krnl_exec, NULL );
+
+		/* Wait for kernel completion. */
+		ccl_event_wait( &ewl, &err_time );
+		hb_if_err_propagate_goto( err, err_time, error_handler );
+
+		start = ccl_event_get_profiling_info_scalar( evt_krnl_exec, CL_PROFILING_COMMAND_START, cl_ulong,
+									&err_time );
+		hb_if_err_propagate_goto( err, err_time, error_handler );
+
+		end = ccl_event_get_profiling_info_scalar( evt_krnl_exec, CL_PROFILING_COMMAND_END, cl_ulong,
+									&err_time );
+		hb_if_err_propagate_goto( err, err_time, error_handler );
+
+		/* A run can not take 0 ns, so 0 is kept as 'rejected'. */
+		if (best == 0 || end - start < best)
+			best = MAX( end - start, 1 );
+	}
+
+
+error_handler:
+	/* If error handler is reached leave function imediately. */
+
+	return best;
+}
+
+
+
+/**
+ * Try every power of 2 local work size, up to the kernel's work-group size limit on the device, and keep the fastest
+ * in 'tuned'. In 2 dimensions, every combination of powers of 2 is tried.
+ *
+ * @param[in]	krnl     - Kernel to tune. Its arguments must be set.
+ * @param[in]	dims     - Number of dimensions, 1 or 2.
+ * @param[in]	real     - Real size of the problem, in each dimension.
+ * @param[in]	pre_krnl - Kernel to run before each timed run, (see 'timeKernel(...)'). NULL if none.
+ * @param[in]	pre_gws  - Global work size of 'pre_krnl'.
+ * @param[in]	pre_lws  - Local work size of 'pre_krnl'.
+ * @param[in]	oclobj   - The OpenCL objects.
+ * @param[out]	tuned    - The fastest local work size. Left alone if no candidate was accepted.
+ * @param[out]	err      - GLib object for error reporting.
+ *
+ * @return The run time with the fastest local work size, in nanoseconds. 0 if no candidate was accepted.
+ * */
+static inline cl_ulong tuneKernel( CCLKernel *const krnl, cl_uint dims, const size_t *const real,
+					CCLKernel *const pre_krnl, const size_t *const pre_gws,
+					const size_t *const pre_lws, OCLObjects_t *const oclobj,
+					size_t *const tuned, CCLErr **err )
+{
+	size_t max_lws, max_y;
+	size_t cand[ HB_DIMS_2 ], cand_gws[ HB_DIMS_2 ], cand_lws[ HB_DIMS_2 ];
+
+	cl_ulong time, best = 0;
+
+	CCLErr *err_tune = NULL;
+
+
+	max_lws = ccl_kernel_get_workgroup_info_scalar( krnl, oclobj->dev, CL_KERNEL_WORK_GROUP_SIZE, size_t,
+								&err_tune );
+	hb_if_err_propagate_goto( err, err_tune, error_handler );
+
+	/* There is no point in work-groups larger than twice the problem, (all but one work-item idle). */
+	for (cand[ 0 ] = 1; cand[ 0 ] <= max_lws && cand[ 0 ] < 2 * real[ 0 ]; cand[ 0 ] *= 2)
+	{
+		max_y = (dims == HB_DIMS_2) ? MIN( max_lws / cand[ 0 ], 2 * real[ 1 ] - 1 ) : 1;
+
+		for (cand[ 1 ] = 1; cand[ 1 ] <= max_y; cand[ 1 ] *= 2)
+		{
+			applyTunedWorksizes( dims, real, cand, cand_gws, cand_lws );
+
+			time = timeKernel( krnl, dims, cand_gws, cand_lws, pre_krnl, pre_gws, pre_lws, oclobj,
+						&err_tune );
+			hb_if_err_propagate_goto( err, err_tune, error_handler );
+
+			if (time != 0 && (best == 0 || time < best))
+			{
+				best = time;
+				memcpy( tuned, cand, dims * sizeof( size_t ) );
+			}
+		}
+	}
+
+
+error_handler:
+	/* If error handler is reached leave function imediately. */
+
+	return best;
+}
+
+
+
+/**
+ * Find the fastest local work sizes on this device, for the kernels whose sizes are worth tuning: the 2D world heat
+ * kernel, the bug step kernels and the first reduction step. The other kernels run once, or on a single item.
+ *
+ * Kernels run on the live buffers, so the world must have been initiated, and must be initiated again before the
+ * simulation. The sizes found are used for the rest of this run, except the reduction size: the number of reduction
+ * work-groups is a build time define (REDUCE_NUM_WORKGROUPS), so reduction candidates write to a scratch buffer and
+ * the size found is only used in the next runs, loaded from the profile.
+ *
+ * @param[in]	krnl     - The kernels, with their arguments set.
+ * @param[out]	gws      - Global work sizes, updated with the tuned sizes.
+ * @param[out]	lws      - Local work sizes, updated with the tuned sizes.
+ * @param[in]	oclobj   - The OpenCL objects.
+ * @param[in]	dev_buff - Device buffers.
+ * @param[in]	params   - Simulation parameters.
+ * @param[out]	tuned    - The tuned local work sizes.
+ * @param[out]	err      - GLib object for error reporting.
+ * */
+static inline void autotune( const HBKernels_t *const krnl, HBGlobalWorkSizes_t *const gws,
+				HBLocalWorkSizes_t *const lws, OCLObjects_t *const oclobj,
+				HBDeviceBuffers_t *const dev_buff, const Parameters_t *const params,
+				HBTunedSizes_t *const tuned, CCLErr **err )
+{
+	/* The 'comp_world_heat' problem size. With vectorisation, a work-item computes a run of cells. */
+	size_t world_dims[2] = {
+		DIV_CEIL( params->world_width, params->heat_vector_width ),
+		params->world_height };
+
+	size_t max_lws, cand[ HB_DIMS_1 ], cand_gws[ HB_DIMS_1 ], cand_lws[ HB_DIMS_1 ];
+
+	CCLBuffer *scratch_reduced = NULL;	/* Reduction output for candidates, one float per work-group. */
+
+	cl_ulong time, best;
+
+	CCLErr *err_autotune = NULL;
+
+
+	/** comp_world_heat. */
+
+	if (params->heat_image)
+	{
+		ccl_kernel_set_arg( krnl->comp_world_heat, 0, dev_buff->heat_image[ 0 ] );
+		ccl_kernel_set_arg( krnl->comp_world_heat, 1, dev_buff->heat_image[ 1 ] );
+	}
+	else
+	{
+		ccl_kernel_set_arg( krnl->comp_world_heat, 0, dev_buff->heat_map[ 0 ] );
+		ccl_kernel_set_arg( krnl->comp_world_heat, 1, dev_buff->heat_map[ 1 ] );
+	}
+
+	best = tuneKernel( krnl->comp_world_heat, HB_DIMS_2, world_dims, NULL, NULL, NULL, oclobj,
+				tuned->comp_world_heat, &err_autotune );
+	hb_if_err_propagate_goto( err, err_autotune, error_handler );
+
+	printf( "Autotune: %-26s lws = [%zu, %zu]\t%10.3f us\n", KRNL_NAME__COMP_WORLD_HEAT,
+			tuned->comp_world_heat[ 0 ], tuned->comp_world_heat[ 1 ], best * 1e-3 );
+
+
+	/** bug_step_best and bug_step_any_free. Bugs are all set to move before each run, so all of them search. */
+
+	ccl_kernel_set_arg( krnl->bug_step_best, 2, dev_buff->heat_map[ 1 ] );
+	ccl_kernel_set_arg( krnl->bug_step_any_free, 2, dev_buff->heat_map[ 1 ] );
+
+	best = tuneKernel( krnl->bug_step_best, HB_DIMS_1, &params->bugs_number, krnl->prepare_bug_step,
+				gws->prepare_bug_step, lws->prepare_bug_step, oclobj,
+				tuned->bug_step_best, &err_autotune );
+	hb_if_err_propagate_goto( err, err_autotune, error_handler );
+
+	printf( "Autotune: %-26s lws = %zu\t\t%10.3f us\n", KRNL_NAME__BUG_STEP_BEST,
+			tuned->bug_step_best[ 0 ], best * 1e-3 );
+
+	best = tuneKernel( krnl->bug_step_any_free, HB_DIMS_1, &params->bugs_number, krnl->prepare_bug_step,
+				gws->prepare_bug_step, lws->prepare_bug_step, oclobj,
+				tuned->bug_step_any_free, &err_autotune );
+	hb_if_err_propagate_goto( err, err_autotune, error_handler );
+
+	printf( "Autotune: %-26s lws = %zu\t\t%10.3f us\n", KRNL_NAME__BUG_STEP_ANY_FREE,
+			tuned->bug_step_any_free[ 0 ], best * 1e-3 );
+
+
+	/** unhappiness_step1_reduce. The global work size is bound to the square of the local work size, (see
+	    'getOCLObjects(...)'), so there are never more work-groups than work-items in one. The tree reduction
+	    needs a power of 2 local work size. */
+
+	max_lws = ccl_kernel_get_workgroup_info_scalar( krnl->unhapp_step1_reduce, oclobj->dev,
+								CL_KERNEL_WORK_GROUP_SIZE, size_t, &err_autotune );
+	hb_if_err_propagate_goto( err, err_autotune, error_handler );
+
+	scratch_reduced = ccl_buffer_new( oclobj->ctx, CL_MEM_READ_WRITE, max_lws * params->unhapp_sum_size, NULL,
+						&err_autotune );
+	hb_if_err_propagate_goto( err, err_autotune, error_handler );
+
+	ccl_kernel_set_arg( krnl->unhapp_step1_reduce, 2, scratch_reduced );
+
+	best = 0;
+
+	for (cand[ 0 ] = 2; cand[ 0 ] <= max_lws; cand[ 0 ] *= 2)
+	{
+		applyTunedWorksizes( HB_DIMS_1, &params->bugs_number, cand, cand_gws, cand_lws );
+		cand_gws[ 0 ] = MIN( SQUARE( cand_lws[ 0 ] ), cand_gws[ 0 ] );
+
+		ccl_kernel_set_arg( krnl->unhapp_step1_reduce, 1,
+					ccl_arg_local( cand_lws[ 0 ] * params->unhapp_sum_size, cl_uchar ) );
+
+		time = timeKernel( krnl->unhapp_step1_reduce, HB_DIMS_1, cand_gws, cand_lws, NULL, NULL, NULL, oclobj,
+					&err_autotune );
+		hb_if_err_propagate_goto( err, err_autotune, error_handler );
+
+		if (time != 0 && (best == 0 || time < best))
+		{
+			best = time;
+			tuned->unhapp_step1_reduce[ 0 ] = cand[ 0 ];
+		}
+	}
+
+	printf( "Autotune: %-26s lws = %zu\t\t%10.3f us (from next run)\n", KRNL_NAME__UNHAPP_S1_REDUCE,
+			tuned->unhapp_step1_reduce[ 0 ], best * 1e-3 );
+
+
+	/* Use the tuned sizes from now on. */
+	applyTunedWorksizes( HB_DIMS_2, world_dims, tuned->comp_world_heat, gws->comp_world_heat, lws->comp_world_heat );
+	applyTunedWorksizes( HB_DIMS_1, &params->bugs_number, tuned->bug_step_best,
+				gws->bug_step_best, lws->bug_step_best );
+	applyTunedWorksizes( HB_DIMS_1, &params->bugs_number, tuned->bug_step_any_free,
+				gws->bug_step_any_free, lws->bug_step_any_free );
+
+
+error_handler:
+	/* If error handler is reached leave function imediately. */
+
+	/* Restore the reduction arguments of this run. */
+	ccl_kernel_set_arg( krnl->unhapp_step1_reduce, 1,
+				ccl_arg_local( lws->unhapp_step1_reduce[ 0 ] * params->unhapp_sum_size, cl_uchar ) );
+	ccl_kernel_set_arg( krnl->unhapp_step1_reduce, 2, dev_buff->unhapp_reduced );
+
+	if (scratch_reduced) ccl_buffer_destroy( scratch_reduced );
+
+	return;
+}
+
+
+
+/**
+ * Append a heat map, as read back from the device, to the snapshot file.
+ *
+ * Each snapshot is a raw frame of 'world_height' rows of 'world_width' floats, in row-major order, whatever the
+ * layout used to store the map in the device.
+ *
+ * @param[in]	heat_snapshot  - The heat map, as stored in the device. Read, or mapped.
+ * @param[in]	hst_buff       - Host buffers, receiving each converted row.
+ * @param[in]	params         - Simulation parameters, describe the map layout.
+ * @param[in]	hbSnapshotFile - The file to append the snapshot to.
+ * @param[out]	err            - GLib object for error reporting.
+ * */
+static inline void writeHeatSnapshot( const cl_float *const heat_snapshot, HBHostBuffers_t *const hst_buff,
+					const Parameters_t *const params, FILE *hbSnapshotFile, CCLErr **err )
+{
+	size_t row, col, wr_elem = 0;
+
+
+	if (params->world_tile == 0)
+	{
+		/* Already row-major. */
+		wr_elem = fwrite( heat_snapshot, sizeof( cl_float ), params->world_size, hbSnapshotFile );
+	}
+	else
+	{
+		/* Untile, one row at a time. */
+		for (row = 0; row < params->world_height; row++)
+		{
+			for (col = 0; col < params->world_width; col++)
+				hst_buff->heat_row[ col ] = heat_snapshot[ world_index( params, row, col ) ];
+
+			wr_elem += fwrite( hst_buff->heat_row, sizeof( cl_float ), params->world_width, hbSnapshotFile );
+		}
+	}
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+				wr_elem != params->world_size,
+				HB_UNABLE_TO_WRITE_FILE, error_handler,
+				"Could not write heat map snapshot." );
+
+
+error_handler:
+	/* If error handler is reached leave function imediately. */
+
+	return;
+}
+
+
+
+/**
+ * Enqueue the transfer of a device buffer region to the host, not blocking. With host buffers
+ * ('params->host_buffers') the region is mapped for reading, so nothing is copied, otherwise it is read into 'host'.
+ *
+ * @param[in]	buffer - The device buffer.
+ * @param[in]	queue  - The queue to enqueue the transfer in.
+ * @param[in]	offset - Offset of the region, in bytes.
+ * @param[in]	size   - Size of the region, in bytes.
+ * @param[in]	host   - Host memory to read into. Not used with host buffers.
+ * @param[in]	params - Simulation parameters.
+ * @param[in]	wait   - Events the transfer waits for. Cleared.
+ * @param[in]	ewl    - Event wait list. The transfer termination event is added.
+ * @param[out]	err    - GLib object for error reporting.
+ *
+ * @return Where the region is, once the transfer is done. Valid until 'endReadback(...)'.
+ * */
+static inline void *beginReadback( CCLBuffer *const buffer, CCLQueue *const queue, size_t offset, size_t size,
+					void *const host, const Parameters_t *const params, CCLEventWaitList *wait,
+					CCLEventWaitList *ewl, CCLErr **err )
+{
+	CCLEvent *evt_rdwr = NULL;	/* Map / read termination event. */
+	void *data = NULL;
+
+	CCLErr *err_readback = NULL;
+
+
+	if (params->host_buffers)
+	{
+		data = ccl_buffer_enqueue_map( buffer, queue, HB_NON_BLOCK, CL_MAP_READ, offset, size,
+						wait, &evt_rdwr, &err_readback );
+		hb_if_err_propagate_goto( err, err_readback, error_handler );
+	}
+	else
+	{
+		evt_rdwr = ccl_buffer_enqueue_read( buffer, queue, HB_NON_BLOCK, offset, size, host,
+							wait, &err_readback );
+		hb_if_err_propagate_goto( err, err_readback, error_handler );
+
+		data = host;
+	}
+
+	/* Add map / read termination event to the wait list. */
+	ccl_event_wait_list_add( ewl, evt_rdwr, NULL );
+
+
+error_handler:
+	/* If error handler is reached leave function imediately. */
+
+	return data;
+}
+
+
+
+/**
+ * Release a region given by 'beginReadback(...)'. With host buffers it is unmapped, and this waits for it, so the
+ * kernels may write the buffer again whatever queue they are in. Nothing to do otherwise.
+ *
+ * @param[in]	buffer - The device buffer.
+ * @param[in]	queue  - The queue the transfer was enqueued in.
+ * @param[in]	data   - The region, as returned by 'beginReadback(...)'.
+ * @param[in]	params - Simulation parameters.
+ * @param[out]	err    - GLib object for error reporting.
+ * */
+static inline void endReadback( CCLBuffer *const buffer, CCLQueue *const queue, void *const data,
+					const Parameters_t *const params, CCLErr **err )
+{
+	CCLEvent *evt_rdwr = NULL;	/* Unmap termination event. */
+	CCLEventWaitList ewl = NULL;	/* Event wait list. */
+
+	CCLErr *err_readback = NULL;
+
+
+	if (!params->host_buffers) return;
+
+	evt_rdwr = ccl_buffer_enqueue_unmap( buffer, queue, data, NULL, &err_readback );
+	hb_if_err_propagate_goto( err, err_readback, error_handler );
+
+	ccl_event_wait_list_add( &ewl, evt_rdwr, NULL );
+
+	ccl_event_wait( &ewl, &err_readback );
+	hb_if_err_propagate_goto( err, err_readback, error_handler );
+
+
+error_handler:
+	/* If error handler is reached leave function imediately. */
+
+	return;
+}
+
+
+
+/**
+ * Read a heat map from the device, or map it, and append it to the snapshot file.
+ *
+ * @param[in]	heat_map       - The device heat map to read.
+ * @param[in]	oclobj         - The OpenCL objects, the queue is used for the read.
+ * @param[out]	hst_buff       - Host buffers, receiving the stored map, (unless mapped), and each converted row.
+ * @param[in]	bufsz          - Buffer sizes.
+ * @param[in]	params         - Simulation parameters, describe the map layout.
+ * @param[in]	hbSnapshotFile - The file to append the snapshot to.
+ * @param[out]	err            - GLib object for error reporting.
+ * */
+static inline void takeHeatSnapshot( CCLBuffer *const heat_map, OCLObjects_t *const oclobj,
+					HBHostBuffers_t *const hst_buff, const HBBuffersSize_t *const bufsz,
+					const Parameters_t *const params, FILE *hbSnapshotFile, CCLErr **err )
+{
+	CCLEventWaitList ewl = NULL;	/* Event wait list. */
+	cl_float *heat_snapshot = NULL;
+
+	CCLErr *err_snapshot = NULL;
+
+
+	heat_snapshot = beginReadback( heat_map, oclobj->queue, 0, bufsz->heat_map, hst_buff->heat_snapshot, params,
+					NULL, &ewl, &err_snapshot );
+	hb_if_err_propagate_goto( err, err_snapshot, error_handler );
+
+	/* Wait for read event completion. */
+	ccl_event_wait( &ewl, &err_snapshot );
+	hb_if_err_propagate_goto( err, err_snapshot, error_handler );
+
+	writeHeatSnapshot( heat_snapshot, hst_buff, params, hbSnapshotFile, &err_snapshot );
+	hb_if_err_propagate_goto( err, err_snapshot, error_handler );
+
+	endReadback( heat_map, oclobj->queue, heat_snapshot, params, &err_snapshot );
+	hb_if_err_propagate_goto( err, err_snapshot, release_handler );
+
+	return;
+
+
+error_handler:
+	/* A mapped heat map is released on errors too. Errors of the release itself are left out. */
+
+	if (heat_snapshot) endReadback( heat_map, oclobj->queue, heat_snapshot, params, NULL );
+
+release_handler:
+
+	return;
+}
+
+
+
+/**
+ * Enqueue the reads of the regions of interest, not blocking. Each region is one rectangular read: straight into
+ * 'frame' from a row-major map, or into the tile staging buffer from a tiled map, as the whole tiles covering it,
+ * (see 'unpackRois(...)').
+ *
+ * @param[in]	heat_map - The device heat map to read the heat regions from.
+ * @param[in]	dev_buff - Device buffers, the swarm map is used.
+ * @param[in]	queue    - The queue to enqueue the reads in.
+ * @param[out]	hst_buff - Host buffers, receiving the tiles of tiled maps.
+ * @param[in]	params   - Simulation parameters, describe the regions and the map layout.
+ * @param[out]	frame    - Receives the regions of row-major maps, 'params->roi_frame_size' bytes.
+ * @param[in]	wait     - Events the first read waits for. Cleared.
+ * @param[in]	ewl      - Event wait list. The read termination events are added.
+ * @param[out]	err      - GLib object for error reporting.
+ * */
+static inline void enqueueRoiReads( CCLBuffer *const heat_map, const HBDeviceBuffers_t *const dev_buff,
+					CCLQueue *const queue, HBHostBuffers_t *const hst_buff,
+					const Parameters_t *const params, cl_uint *const frame, CCLEventWaitList *wait,
+					CCLEventWaitList *ewl, CCLErr **err )
+{
+	const size_t tile_bytes = SQUARE( params->world_tile ) * sizeof( cl_uint );
+	const size_t host_origin[ 3 ] = { 0, 0, 0 };
+
+	size_t buffer_origin[ 3 ], region[ 3 ];
+	size_t tx0, ty0, ntx, nty;
+	size_t frame_at = 0, staging_at = 0;	/* Cells of the frame and of the staging buffer used. */
+
+	CCLEvent *evt_rdwr = NULL;	/* Read termination event. */
+
+	CCLErr *err_roi = NULL;
+
+
+	for (size_t i = 0; i < params->roi_count; i++)
+	{
+		const HBRoi_t *const roi = &params->rois[ i ];
+		CCLBuffer *const map = (roi->map == HB_ROI_HEAT) ? heat_map : dev_buff->swarm_map;
+
+		if (params->world_tile == 0)
+		{
+			/* Rows of the region, packed. */
+			buffer_origin[ 0 ] = roi->col * sizeof( cl_uint );
+			buffer_origin[ 1 ] = roi->row;
+			buffer_origin[ 2 ] = 0;
+
+			region[ 0 ] = roi->width * sizeof( cl_uint );
+			region[ 1 ] = roi->height;
+			region[ 2 ] = 1;
+
+			evt_rdwr = ccl_buffer_enqueue_read_rect( map, queue, HB_NON_BLOCK, buffer_origin, host_origin,
+								region, params->world_width * sizeof( cl_uint ), 0,
+								region[ 0 ], 0, frame + frame_at, wait, &err_roi );
+			hb_if_err_propagate_goto( err, err_roi, error_handler );
+		}
+		else
+		{
+			/* A tile is a row, a row of tiles is a slice. */
+			roi_tiles( params, roi, &tx0, &ty0, &ntx, &nty );
+
+			buffer_origin[ 0 ] = 0;
+			buffer_origin[ 1 ] = tx0;
+			buffer_origin[ 2 ] = ty0;
+
+			region[ 0 ] = tile_bytes;
+			region[ 1 ] = ntx;
+			region[ 2 ] = nty;
+
+			evt_rdwr = ccl_buffer_enqueue_read_rect( map, queue, HB_NON_BLOCK, buffer_origin, host_origin,
+								region, tile_bytes, params->world_tiles_x * tile_bytes,
+								tile_bytes, ntx * tile_bytes,
+								hst_buff->roi_staging + staging_at, wait, &err_roi );
+			hb_if_err_propagate_goto( err, err_roi, error_handler );
+
+			staging_at += ntx * nty * SQUARE( params->world_tile );
+		}
+
+		ccl_event_wait_list_add( ewl, evt_rdwr, NULL );
+
+		frame_at += roi->height * roi->width;
+		wait = NULL;
+	}
+
+
+error_handler:
+	/* If error handler is reached leave function imediately. */
+
+	return;
+}
+
+
+
+/**
+ * Once read, pack the regions of interest of a tiled map into 'frame', in row-major order. Row-major maps are read
+ * into it as they are, nothing to do.
+ * */
+static inline void unpackRois( const HBHostBuffers_t *const hst_buff, const Parameters_t *const params,
+				cl_uint *const frame )
+{
+	const size_t tile = params->world_tile;
+
+	size_t tx0, ty0, ntx, nty;
+	size_t r, c, row, col;
+	size_t frame_at = 0, staging_at = 0;
+
+
+	if (tile == 0) return;
+
+	for (size_t i = 0; i < params->roi_count; i++)
+	{
+		const HBRoi_t *const roi = &params->rois[ i ];
+
+		roi_tiles( params, roi, &tx0, &ty0, &ntx, &nty );
+
+		for (r = 0; r < roi->height; r++)
+		{
+			row = roi->row + r;
+
+			for (c = 0; c < roi->width; c++)
+			{
+				col = roi->col + c;
+
+				frame[ frame_at + r * roi->width + c ] = hst_buff->roi_staging[ staging_at +
+					((row / tile - ty0) * ntx + col / tile - tx0) * SQUARE( tile ) +
+					(row % tile) * tile + col % tile ];
+			}
+		}
+
+		frame_at += roi->height * roi->width;
+		staging_at += ntx * nty * SQUARE( tile );
+	}
+}
+
+
+
+/**
+ * Append the regions of interest, once read, to the region of interest file, as one frame.
+ *
+ * @param[in]	hst_buff   - Host buffers, with the regions read, (and the tiles they are in, if tiled).
+ * @param[in]	params     - Simulation parameters.
+ * @param[in]	hbRoiFile  - The file to append the frame to.
+ * @param[out]	err        - GLib object for error reporting.
+ * */
+static inline void writeRois( HBHostBuffers_t *const hst_buff, const Parameters_t *const params, FILE *hbRoiFile,
+				CCLErr **err )
+{
+	unpackRois( hst_buff, params, hst_buff->roi_frame );
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+				fwrite( hst_buff->roi_frame, 1, params->roi_frame_size, hbRoiFile ) != params->roi_frame_size,
+				HB_UNABLE_TO_WRITE_FILE, error_handler,
+				"Could not write regions of interest." );
+
+
+error_handler:
+	/* If error handler is reached leave function imediately. */
+
+	return;
+}
+
+
+
+/**
+ * Enqueue the gathering of the trajectory samples of an iteration into the next free slot of the device ring.
+ *
+ * @param[in]	krnl   - Kernels.
+ * @param[in]	gws    - Global work sizes.
+ * @param[in]	lws    - Local work sizes.
+ * @param[in]	oclobj - The OpenCL objects, the queue is used.
+ * @param[in]	state  - Simulation state, the slot is taken from it.
+ * @param[in]	start  - Set for the initial world: no bug moved.
+ * @param[in]	ewl    - Event wait list. Used, and the kernel termination event is left in it.
+ * @param[out]	err    - GLib object for error reporting.
+ * */
+static inline void enqueueTraceSample( const HBKernels_t *const krnl, const HBGlobalWorkSizes_t *const gws,
+					const HBLocalWorkSizes_t *const lws, OCLObjects_t *const oclobj,
+					HBSimState_t *const state, cl_uint start, CCLEventWaitList *ewl, CCLErr **err )
+{
+	CCLEvent *evt_krnl_exec = NULL;	/* Kernel exec termination event. */
+	cl_uint slot = (cl_uint) state->trace_pending;
+
+	CCLErr *err_trace = NULL;
+
+
+	ccl_kernel_set_arg( krnl->trace_sample, 4, ccl_arg_priv( slot, cl_uint ) );
+	ccl_kernel_set_arg( krnl->trace_sample, 5, ccl_arg_priv( start, cl_uint ) );
+
+	evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->trace_sample, oclobj->queue, HB_DIMS_1, NULL,
+							gws->trace_sample, lws->trace_sample, ewl, &err_trace );
+	hb_if_err_propagate_goto( err, err_trace, error_handler );
+
+	/* Add kernel termination event to wait list. */
+	ccl_event_wait_list_add( ewl, evt_krnl_exec, NULL );
+
+	state->trace_pending++;
+
+
+error_handler:
+	/* If error handler is reached leave function imediately. */
+
+	return;
+}
+
+
+
+/**
+ * Enqueue the read of the first 'frames' slots of the trajectory sample ring, in one transfer, not blocking.
+ *
+ * @param[in]	dev_buff - Device buffers.
+ * @param[in]	queue    - The queue to enqueue the read in.
+ * @param[out]	hst_buff - Host buffers, receiving the samples.
+ * @param[in]	params   - Simulation parameters.
+ * @param[in]	frames   - Slots to read.
+ * @param[in]	wait     - Events the read waits for. Cleared.
+ * @param[in]	ewl      - Event wait list. The read termination event is added.
+ * @param[out]	err      - GLib object for error reporting.
+ * */
+static inline void enqueueTraceRead( const HBDeviceBuffers_t *const dev_buff, CCLQueue *const queue,
+					HBHostBuffers_t *const hst_buff, const Parameters_t *const params, size_t frames,
+					CCLEventWaitList *wait, CCLEventWaitList *ewl, CCLErr **err )
+{
+	CCLEvent *evt_rdwr = NULL;	/* Read termination event. */
+
+	CCLErr *err_trace = NULL;
+
+
+	evt_rdwr = ccl_buffer_enqueue_read( dev_buff->trace_ring, queue, HB_NON_BLOCK, 0,
+						frames * params->trace_sample * TRACE_RECORD, hst_buff->trace_ring,
+						wait, &err_trace );
+	hb_if_err_propagate_goto( err, err_trace, error_handler );
+
+	ccl_event_wait_list_add( ewl, evt_rdwr, NULL );
+
+
+error_handler:
+	/* If error handler is reached leave function imediately. */
+
+	return;
+}
+
+
+
+/** Append 'frames' iterations of trajectory samples, once read, to the trace file. */
+static inline void writeTrace( const HBHostBuffers_t *const hst_buff, const Parameters_t *const params, size_t frames,
+				FILE *hbTraceFile, CCLErr **err )
+{
+	const size_t records = frames * params->trace_sample;
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+				fwrite( hst_buff->trace_ring, TRACE_RECORD, records, hbTraceFile ) != records,
+				HB_UNABLE_TO_WRITE_FILE, error_handler,
+				"Could not write trajectory samples." );
+
+
+error_handler:
+	/* If error handler is reached leave function imediately. */
+
+	return;
+}
+
+
+
+/** Write the header of the trace file, (see 'hb_engine_set_outputs(...)'). */
+static inline void writeTraceHeader( const Parameters_t *const params, FILE *hbTraceFile, CCLErr **err )
+{
+	const cl_uint header[ 5 ] = { TRACE_VERSION, (cl_uint) params->trace_sample, (cl_uint) params->trace_stride,
+					(cl_uint) params->world_width, (cl_uint) params->world_height };
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+				fwrite( TRACE_MAGIC, 1, 4, hbTraceFile ) != 4 ||
+				fwrite( header, sizeof( cl_uint ), 5, hbTraceFile ) != 5,
+				HB_UNABLE_TO_WRITE_FILE, error_handler,
+				"Could not write trajectory samples." );
+
+
+error_handler:
+	/* If error handler is reached leave function imediately. */
+
+	return;
+}
+
+
+
+/** Read the trajectory samples left in the device ring, and write them. Waits for them. */
+static inline void flushTrace( const HBDeviceBuffers_t *const dev_buff, OCLObjects_t *const oclobj,
+				HBHostBuffers_t *const hst_buff, const Parameters_t *const params,
+				HBSimState_t *const state, FILE *hbTraceFile, CCLErr **err )
+{
+	CCLEventWaitList ewl = NULL;	/* Event wait list. */
+
+	CCLErr *err_trace = NULL;
+
+
+	if (state->trace_pending == 0) return;
+
+	enqueueTraceRead( dev_buff, oclobj->queue, hst_buff, params, state->trace_pending, NULL, &ewl, &err_trace );
+	hb_if_err_propagate_goto( err, err_trace, error_handler );
+
+	ccl_event_wait( &ewl, &err_trace );
+	hb_if_err_propagate_goto( err, err_trace, error_handler );
+
+	writeTrace( hst_buff, params, state->trace_pending, hbTraceFile, &err_trace );
+	hb_if_err_propagate_goto( err, err_trace, error_handler );
+
+	state->trace_pending = 0;
+
+
+error_handler:
+	/* If error handler is reached leave function imediately. */
+
+	return;
+}
+
+
+
+/**
+ * Enqueue the unhappiness reduction: both reduction steps, or the fused reduction kernel in the fused pipeline.
+ * The wait list is used, and the termination event of the reduction is left in it.
+ *
+ * @param[in]	krnl   - Kernels.
+ * @param[in]	gws    - Global work sizes.
+ * @param[in]	lws    - Local work sizes.
+ * @param[in]	oclobj - The OpenCL objects, the queue is used.
+ * @param[in]	params - Simulation parameters.
+ * @param[in]	ewl    - Event wait list.
+ * @param[out]	err    - GLib object for error reporting.
+ * */
+static inline void enqueueUnhappReduce( const HBKernels_t *const krnl, const HBGlobalWorkSizes_t *const gws,
+						const HBLocalWorkSizes_t *const lws, OCLObjects_t *const oclobj,
+						const Parameters_t *const params, CCLEventWaitList *ewl, CCLErr **err )
+{
+	CCLEvent *evt_krnl_exec = NULL;	/* Kernel exec termination event. */
+
+	CCLErr *err_reduce = NULL;
+
+
+	if (params->fused)
+	{
+		/* Both steps, one launch. */
+		evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->unhapp_reduce_fused, oclobj->queue, HB_DIMS_1, NULL,
+								gws->unhapp_step1_reduce, lws->unhapp_step1_reduce,
+								ewl, &err_reduce );
+		hb_if_err_propagate_goto( err, err_reduce, error_handler );
+
+		/* Add 'kernel termination' event to the wait list. */
+		ccl_event_wait_list_add( ewl, evt_krnl_exec, NULL );
+
+		return;
+	}
+
+	/* Reduce step 1: */
+	evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->unhapp_step1_reduce, oclobj->queue, HB_DIMS_1, NULL,
 							gws->unhapp_step1_reduce, lws->unhapp_step1_reduce,
-							&ewl, &err_simul );
-	hb_if_err_propagate_goto( err, err_simul, error_handler );
+							ewl, &err_reduce );
+	hb_if_err_propagate_goto( err, err_reduce, error_handler );
+
+	/* Add 'kernel termination' event to the wait list. */
+	ccl_event_wait_list_add( ewl, evt_krnl_exec, NULL );
+
+	/* Reduce step 2: */
+	evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->unhapp_step2_average, oclobj->queue, HB_DIMS_1, NULL,
+							gws->unhapp_step2_average, lws->unhapp_step2_average,
+							ewl, &err_reduce );
+	hb_if_err_propagate_goto( err, err_reduce, error_handler );
+
+	/* Add 'kernel termination' event to the wait list. */
+	ccl_event_wait_list_add( ewl, evt_krnl_exec, NULL );
+
+
+error_handler:
+	/* If error handler is reached leave function imediately. */
+
+	return;
+}
+
+
+
+/**
+ * Enqueue a pass of the deterministic bug step: 'bug_step_claim', 'bug_step_resolve' and 'bug_step_release'.
+ *
+ * @param[in]	krnl       - The kernels.
+ * @param[in]	gws        - Global work sizes.
+ * @param[in]	lws        - Local work sizes.
+ * @param[in]	oclobj     - OpenCL objects.
+ * @param[in]	heat_map   - The heat map the bugs are on.
+ * @param[in]	first_pass - If set, bugs go for their best place, otherwise bugs not done go for any free place.
+ * @param[in]	retry_slot - The 'bug_step_retry' slot the pass reports to.
+ * @param[in]	step_key   - Pass number, keys the claim priorities.
+ * @param[in]	ewl        - Event wait list. The release termination event is left in it.
+ * @param[out]	err        - GLib object for error reporting.
+ * */
+static inline void enqueueBugStepPass( const HBKernels_t *const krnl, const HBGlobalWorkSizes_t *const gws,
+					const HBLocalWorkSizes_t *const lws, OCLObjects_t *const oclobj,
+					CCLBuffer *const heat_map, cl_uint first_pass, cl_uint retry_slot,
+					cl_uint step_key, CCLEventWaitList *ewl, CCLErr **err )
+{
+	CCLEvent *evt_krnl_exec = NULL;	/* Kernel exec termination event. */
+
+	CCLErr *err_pass = NULL;
+
+
+	/* Claim. */
+	ccl_kernel_set_arg( krnl->bug_step_claim, 2, heat_map );
+	ccl_kernel_set_arg( krnl->bug_step_claim, 7, ccl_arg_priv( step_key, cl_uint ) );
+	ccl_kernel_set_arg( krnl->bug_step_claim, 8, ccl_arg_priv( first_pass, cl_uint ) );
+
+	evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->bug_step_claim, oclobj->queue, HB_DIMS_1, NULL,
+							gws->bug_step_claim, lws->bug_step_claim, ewl, &err_pass );
+	hb_if_err_propagate_goto( err, err_pass, error_handler );
+
+	ccl_event_wait_list_add( ewl, evt_krnl_exec, NULL );
+
+	/* Resolve. */
+	ccl_kernel_set_arg( krnl->bug_step_resolve, 2, heat_map );
+	ccl_kernel_set_arg( krnl->bug_step_resolve, 6, ccl_arg_priv( retry_slot, cl_uint ) );
+	ccl_kernel_set_arg( krnl->bug_step_resolve, 7, ccl_arg_priv( step_key, cl_uint ) );
+
+	evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->bug_step_resolve, oclobj->queue, HB_DIMS_1, NULL,
+							gws->bug_step_resolve, lws->bug_step_resolve, ewl, &err_pass );
+	hb_if_err_propagate_goto( err, err_pass, error_handler );
+
+	ccl_event_wait_list_add( ewl, evt_krnl_exec, NULL );
+
+	/* Release. */
+	evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->bug_step_release, oclobj->queue, HB_DIMS_1, NULL,
+							gws->bug_step_release, lws->bug_step_release, ewl, &err_pass );
+	hb_if_err_propagate_goto( err, err_pass, error_handler );
+
+	ccl_event_wait_list_add( ewl, evt_krnl_exec, NULL );
+
+
+error_handler:
+	/* If error handler is reached leave function imediately. */
+
+	return;
+}
+
+
+
+/**
+ * Async I/O: wait for the transfers of the previous iteration, enqueued in the transfer queue, and output them.
+ *
+ * @param[in]	io_ewl         - Event wait list with the pending transfers. Cleared.
+ * @param[in]	oclobj         - OpenCL objects, a mapped snapshot is released in the transfer queue.
+ * @param[in]	hst_buff       - Host buffers, holding the transferred results.
+ * @param[in]	params         - Simulation parameters.
+ * @param[in]	snapshot_map   - The device heat map the snapshot is from.
+ * @param[in]	snapshot       - The snapshot, as given by 'beginReadback(...)', if one is among the transfers.
+ * @param[in]	hbResultWriter - The writer of the unhappiness averages.
+ * @param[in]	hbSnapshotFile - The file to append the snapshot to.
+ * @param[in]	rois           - Set if the regions of interest are among the transfers.
+ * @param[in]	hbRoiFile      - The file to append them to.
+ * @param[in]	trace_frames   - Iterations of trajectory samples among the transfers, if any.
+ * @param[in]	hbTraceFile    - The file to append them to.
+ * @param[out]	err            - GLib object for error reporting.
+ * */
+static inline void outputPendingTransfers( CCLEventWaitList *io_ewl, OCLObjects_t *const oclobj,
+						HBHostBuffers_t *const hst_buff, const Parameters_t *const params,
+						CCLBuffer *const snapshot_map, cl_float *const snapshot,
+						HBWriter_t *hbResultWriter, FILE *hbSnapshotFile, int rois,
+						FILE *hbRoiFile, size_t trace_frames, FILE *hbTraceFile, CCLErr **err )
+{
+	CCLErr *err_output = NULL;
+
+
+	ccl_event_wait( io_ewl, &err_output );
+	hb_if_err_propagate_goto( err, err_output, error_handler );
+
+	if (hbResultWriter) hb_writer_push( hbResultWriter, hst_buff->unhapp_average, 1 );
+
+	if (snapshot)
+	{
+		writeHeatSnapshot( snapshot, hst_buff, params, hbSnapshotFile, &err_output );
+		hb_if_err_propagate_goto( err, err_output, error_handler );
+
+		endReadback( snapshot_map, oclobj->io_queue, snapshot, params, &err_output );
+		hb_if_err_propagate_goto( err, err_output, error_handler );
+	}
+
+	if (rois)
+	{
+		writeRois( hst_buff, params, hbRoiFile, &err_output );
+		hb_if_err_propagate_goto( err, err_output, error_handler );
+	}
+
+	if (trace_frames)
+	{
+		writeTrace( hst_buff, params, trace_frames, hbTraceFile, &err_output );
+		hb_if_err_propagate_goto( err, err_output, error_handler );
+	}
+
+
+error_handler:
+	/* If error handler is reached leave function imediately. */
+
+	return;
+}
+
+
+
+/**
+ * Start a simulation on the initiated world: reduce and output the initial unhappiness, and reset the state kept
+ * between steps. Common to 'simulate(...)' and 'simulateMegakernel(...)'.
+ * */
+static inline void startSimulation( const HBKernels_t *const krnl, const HBGlobalWorkSizes_t *const gws,
+					const HBLocalWorkSizes_t *const lws, OCLObjects_t *const oclobj,
+					HBDeviceBuffers_t *const dev_buff, HBHostBuffers_t *const hst_buff,
+					HBBuffersSize_t *const bufsz, const Parameters_t *const params,
+					HBWriter_t *hbResultWriter, FILE *hbTraceFile, HBSimState_t *const state,
+					CCLErr **err )
+{
+	CCLEvent *evt_rdwr = NULL;	/* Read/Write termination event.  */
+	CCLEvent *evt_krnl_exec = NULL;	/* Kernel exec termination event. */
+	CCLEventWaitList ewl = NULL;	/* Event wait list. */
+
+	CCLErr *err_start = NULL;
+
+
+	/* First step: main heat map 0, first retry and list slots. A stop requested meanwhile is kept. */
+	state->heat_main = 0;
+	state->retry_slot = 0;
+	state->list_slot = 0;
+	state->bin_slot = 0;
+	state->step_key = 0;
+	state->iterations = 0;
+	state->stop_reason = HB_STOP_ITERATIONS;
+	state->trace_pending = 0;
+
+
+	/** Get first bugs unhappiness. */
+
+	/* Call reduction first, because initial state does already contain the bug's unhappiness. */
+
+	enqueueUnhappReduce( krnl, gws, lws, oclobj, params, &ewl, &err_start );
+	hb_if_err_propagate_goto( err, err_start, error_handler );
+
+	/* The fused pipeline and the deterministic mode need the first retry slot clear, bug step launches keep clearing
+	   them after that. */
+	if (params->fused || params->deterministic)
+	{
+		evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->prepare_step_report, oclobj->queue, HB_DIMS_1, NULL,
+								gws->prepare_step_report, lws->prepare_step_report,
+								&ewl, &err_start );
+		hb_if_err_propagate_goto( err, err_start, error_handler );
+
+		/* Add kernel termination event to wait list. */
+		ccl_event_wait_list_add( &ewl, evt_krnl_exec, NULL );
+	}
+
+	/* The initial world is the first frame of trajectory samples. */
+	if (hbTraceFile && krnl->trace_sample)
+	{
+		enqueueTraceSample( krnl, gws, lws, oclobj, state, CL_TRUE, &ewl, &err_start );
+		hb_if_err_propagate_goto( err, err_start, error_handler );
+	}
+
+
+	/* read unhappiness. */
+
+	evt_rdwr = ccl_buffer_enqueue_read( dev_buff->unhapp_average, oclobj->queue, HB_NON_BLOCK, 0,
+							bufsz->unhapp_average, hst_buff->unhapp_average,
+							&ewl, &err_start );
+	hb_if_err_propagate_goto( err, err_start, error_handler );
+
+	/* Add read termination event to the wait list. */
+	ccl_event_wait_list_add( &ewl, evt_rdwr, NULL );
+
+
+	/* Wait for last event completion. */
+	ccl_event_wait( &ewl, &err_start );
+	hb_if_err_propagate_goto( err, err_start, error_handler );
+
+
+	/* Output result to file. */
+	if (hbResultWriter) hb_writer_push( hbResultWriter, hst_buff->unhapp_average, 1 );
+
+	state->unhappiness = *hst_buff->unhapp_average;
+
+	if (hbTraceFile && state->trace_pending == params->trace_ring)
+	{
+		flushTrace( dev_buff, oclobj, hst_buff, params, state, hbTraceFile, &err_start );
+		hb_if_err_propagate_goto( err, err_start, error_handler );
+	}
+
+
+error_handler:
+	/* If error handler is reached leave function imediately. */
+
+	return;
+}
+
+
+
+/**
+ * With async I/O ('params->async_io'), the unhappiness average and the snapshots of an iteration are read in the
+ * transfer queue, after the reduction, and the host only waits for them, and outputs them, once the world heat of
+ * the next iteration is enqueued and flushed. So the readback and file output of iteration i overlap the heat
+ * diffusion of iteration i + 1. The transfers are done before the next reduction overwrites the average, and before
+ * the heat map read is written again, two world heat computations later. The bug step retry flag is still read
+ * in the compute queue, the host needs it to go on.
+ *
+ * With the fused pipeline ('params->fused'), an iteration is 3 launches when all bugs find their best place:
+ * 'comp_world_heat', 'bug_step_best' and 'unhappiness_reduce_fused'. The bug state is not reset by
+ * 'prepare_bug_step', as bugs start each iteration at rest and 'bug_step_best' leaves only the bugs that failed in
+ * the 'want to move' state. The retry flag is not reset by 'prepare_step_report', as bug step launches alternate
+ * between its two slots, each launch clearing the slot of the next one.
+ *
+ * In deterministic mode ('params->deterministic'), each bug step is done in passes of claims, resolved by priority,
+ * (see 'bug_step_claim(...)'), so results depend on the seed only. The retry flag slots are used as in the fused
+ * pipeline.
+ *
+ * With atomic or gather deposit ('params->deposit'), bug steps leave no heat, and 'krnl->deposit_heat' adds the heat
+ * of all bugs after the last bug step. So no bug reads a temperature another bug is changing, and no deposit is a
+ * store of a stale temperature.
+ *
+ * With active tiles ('params->active_tile'), world heat is only computed around the tiles with bugs or heat, as
+ * listed on the device by 'active_tiles_list', and cold tiles are flushed to zero, (see 'comp_world_heat_active').
+ *
+ * With the convergence check enabled, ('krnl->convergence_check'), it runs after each reduction and its stop reason is
+ * read with the unhappiness average, so it costs no extra wait. With async I/O, the reason is known one iteration
+ * late: the world heat of the next iteration may be computed, but that iteration is not counted.
+ *
+ * The regions of interest, when due, are read with the unhappiness average, also at no extra wait: each one is a
+ * single rectangular read, (see 'enqueueRoiReads(...)').
+ *
+ * With trajectory sampling ('krnl->trace_sample'), 'trace_sample' compacts the records of the sampled bugs into the
+ * next slot of a ring, on the device, after each iteration. The ring is read when full, with the unhappiness average,
+ * and what is left of it before each call returns, so the host reads a few records per iteration, in large batches.
+ *
+ * Each call runs up to 'num_iterations' iterations, (0 = until a stop criterion), going on from 'state', as left by
+ * 'startSimulation(...)' or the previous call. Async I/O transfers are all output before it returns.
+ *
+ * NOTE: Check this about Buffer Read/Write vs. Map/Unmap ( http://downloads.ti.com/mctools/esd/docs/opencl/memory/access-model.html )
+ * */
+static inline void simulate( const HBKernels_t *const krnl, const HBGlobalWorkSizes_t *const gws,
+				const HBLocalWorkSizes_t *const lws, OCLObjects_t *const oclobj,
+				HBDeviceBuffers_t *const dev_buff, HBHostBuffers_t *const hst_buff,
+				HBBuffersSize_t *const bufsz, const Parameters_t *const params, HBWriter_t *hbResultWriter,
+				FILE *hbSnapshotFile, FILE *hbRoiFile, FILE *hbTraceFile, HBSimState_t *const state,
+				size_t num_iterations, CCLErr **err )
+{
+//	FILE *hbResultFile = NULL;
+        CCLEvent *evt_rdwr = NULL;	    /* Read/Write termination event.  */
+        CCLEvent *evt_krnl_exec = NULL;	    /* Kernel exec termination event. */
+        CCLEventWaitList ewl = NULL;	    /* Event wait list. */
+
+         /* Buffer selectors. In each step they swap value to indicate the correct 'heat_map' buffer to be sent to kernel. */
+        struct {
+        	cl_uint main;		    /* Heatmap main.   */
+        	cl_uint secd;		    /* Heatmap buffer. */
+        } bufsel;
+
+        size_t iter_counter = 0;	    /* Iterations of this call. */
+
+        cl_uint retry_slot = state->retry_slot;   /* The 'bug_step_retry' slot the next bug step launch reports to. */
+        cl_uint list_slot = state->list_slot;	    /* The 'active_count' slot the next active tile list is counted in. */
+        cl_uint bin_slot = state->bin_slot;	    /* The 'bin_count' set the next binned bug step counts in. */
+        cl_uint step_key = state->step_key;	    /* Deterministic bug step passes done. */
+
+        CCLEventWaitList io_ewl = NULL;	    /* Transfers of the previous iteration. Async I/O only. */
+        int io_pending = 0;		    /* Set if there are transfers in 'io_ewl'. */
+        cl_float *snapshot_pending = NULL;  /* The heat map snapshot among them, if any. */
+        CCLBuffer *snapshot_map = NULL;	    /* The device heat map it is from. */
+        int snapshot_due;
+        int rois_pending = 0;		    /* Set if the regions of interest are among them. */
+        int rois_due;
+        size_t trace_pending = 0;	    /* Iterations of trajectory samples among them. */
+        size_t trace_frames;		    /* Iterations of trajectory samples read in this iteration. */
+
+        const int trace_on = hbTraceFile && krnl->trace_sample;
+
+        cl_uint conv_reason = HB_STOP_ITERATIONS;    /* Convergence stop reason, read with the unhappiness average. */
+        cl_uint conv_pending = HB_STOP_ITERATIONS;   /* Async I/O: stop reason being read, valid after the 'io_ewl' wait. */
+
+        CCLErr *err_simul = NULL;
+
+
+	bufsel.main = state->heat_main;
+	bufsel.secd = OTHER_HEAT_MAP( bufsel.main );
+
+
+	/*******************************/
+	/**      SIMULATION LOOP      **/
+	/*******************************/
+
+	while (!state->stop_requested && !conv_reason &&
+		((state->iterations < params->numIterations) || (params->numIterations == 0)) &&
+		((iter_counter < num_iterations) || (num_iterations == 0)))
+	{
+		/** Compute world heat, diffusion followed by evaporation. */
+
+		if (params->active_tile)
+		{
+			/* List the tiles around the active ones, then compute those. */
+			ccl_kernel_set_arg( krnl->active_tiles_list, 3, ccl_arg_priv( list_slot, cl_uint ) );
+
+			evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->active_tiles_list, oclobj->queue, HB_DIMS_1, NULL,
+									gws->active_tiles_list, lws->active_tiles_list,
+									&ewl, &err_simul );
+			hb_if_err_propagate_goto( err, err_simul, error_handler );
+
+			/* Add kernel termination event to wait list. */
+			ccl_event_wait_list_add( &ewl, evt_krnl_exec, NULL );
+
+			/* Set transient arguments, using 'bufsel' to switch over. */
+			ccl_kernel_set_arg( krnl->comp_world_heat_active, 0, dev_buff->heat_map[ bufsel.main ] );
+			ccl_kernel_set_arg( krnl->comp_world_heat_active, 1, dev_buff->heat_map[ bufsel.secd ] );
+			ccl_kernel_set_arg( krnl->comp_world_heat_active, 5, ccl_arg_priv( list_slot, cl_uint ) );
+
+			evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->comp_world_heat_active, oclobj->queue,
+									HB_DIMS_1, NULL,
+									gws->comp_world_heat_active,
+									lws->comp_world_heat_active,
+									&ewl, &err_simul );
+			hb_if_err_propagate_goto( err, err_simul, error_handler );
+
+			/* Next list is counted in the other slot. */
+			list_slot = OTHER_LIST_SLOT( list_slot );
+		}
+		else
+		{
+			/* Set transient arguments, using 'bufsel' to switch over. */
+			if (params->heat_image)
+			{
+				ccl_kernel_set_arg( krnl->comp_world_heat, 0, dev_buff->heat_image[ bufsel.main ] );
+				ccl_kernel_set_arg( krnl->comp_world_heat, 1, dev_buff->heat_image[ bufsel.secd ] );
+			}
+			else
+			{
+				ccl_kernel_set_arg( krnl->comp_world_heat, 0, dev_buff->heat_map[ bufsel.main ] );
+				ccl_kernel_set_arg( krnl->comp_world_heat, 1, dev_buff->heat_map[ bufsel.secd ] );
+			}
+
+			evt_krnl_exec =	ccl_kernel_enqueue_ndrange( krnl->comp_world_heat, oclobj->queue, HB_DIMS_2, NULL,
+									gws->comp_world_heat, lws->comp_world_heat,
+									&ewl, &err_simul );
+			hb_if_err_propagate_goto( err, err_simul, error_handler );
+		}
+
+		/* Add kernel termination event to wait list. */
+		ccl_event_wait_list_add( &ewl, evt_krnl_exec, NULL );
+
+
+		/** Async I/O: output the previous iteration while the device computes the world heat. */
+
+		if (io_pending)
+		{
+			ccl_queue_flush( oclobj->queue, &err_simul );
+			hb_if_err_propagate_goto( err, err_simul, error_handler );
+
+			outputPendingTransfers( &io_ewl, oclobj, hst_buff, params, snapshot_map, snapshot_pending,
+						hbResultWriter, hbSnapshotFile, rois_pending, hbRoiFile, trace_pending,
+						hbTraceFile, &err_simul );
+			hb_if_err_propagate_goto( err, err_simul, error_handler );
+
+			state->unhappiness = *hst_buff->unhapp_average;
+			conv_reason = conv_pending;
+			io_pending = 0;
+
+			/* The previous iteration converged. */
+			if (conv_reason) break;
+		}
+
+
+
+		if (!params->fused && !params->deterministic)
+		{
+			/** Prepare step report. */
+
+			evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->prepare_step_report, oclobj->queue, HB_DIMS_1, NULL,
+									gws->prepare_step_report, lws->prepare_step_report,
+									&ewl, &err_simul );
+			hb_if_err_propagate_goto( err, err_simul, error_handler );
+
+			/* Add kernel termination event to wait list. */
+			ccl_event_wait_list_add( &ewl, evt_krnl_exec, NULL );
+
+
+
+			/** Prepare bug step. */
+
+			evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->prepare_bug_step, oclobj->queue, HB_DIMS_1, NULL,
+									gws->prepare_bug_step, lws->prepare_bug_step,
+									&ewl, &err_simul );
+			hb_if_err_propagate_goto( err, err_simul, error_handler );
+
+			/* Add kernel termination event to wait list. */
+			ccl_event_wait_list_add( &ewl, evt_krnl_exec, NULL );
+		}
+
+
+
+		/** Perform bug step for best place. Also compute the new unhappiness vector. */
+
+		if (params->deterministic)
+		{
+			enqueueBugStepPass( krnl, gws, lws, oclobj, dev_buff->heat_map[ bufsel.secd ], CL_TRUE, retry_slot,
+						step_key++, &ewl, &err_simul );
+			hb_if_err_propagate_goto( err, err_simul, error_handler );
+		}
+		else if (params->binned_step)
+		{
+			/* Bin the bugs, then step them bin after bin. Same transient arguments as 'bug_step_best'. */
+			ccl_kernel_set_arg( krnl->bug_step_classify, 2, dev_buff->heat_map[ bufsel.secd ] );
+			ccl_kernel_set_arg( krnl->bug_step_classify, 8, ccl_arg_priv( bin_slot, cl_uint ) );
+
+			evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->bug_step_classify, oclobj->queue, HB_DIMS_1, NULL,
+									gws->bug_step_classify, lws->bug_step_classify,
+									&ewl, &err_simul );
+			hb_if_err_propagate_goto( err, err_simul, error_handler );
+
+			ccl_event_wait_list_add( &ewl, evt_krnl_exec, NULL );
+
+			ccl_kernel_set_arg( krnl->bug_step_binned, 2, dev_buff->heat_map[ bufsel.secd ] );
+			ccl_kernel_set_arg( krnl->bug_step_binned, 5, ccl_arg_priv( retry_slot, cl_uint ) );
+			ccl_kernel_set_arg( krnl->bug_step_binned, 10, ccl_arg_priv( bin_slot, cl_uint ) );
+
+			evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->bug_step_binned, oclobj->queue, HB_DIMS_1, NULL,
+									gws->bug_step_binned, lws->bug_step_binned,
+									&ewl, &err_simul );
+			hb_if_err_propagate_goto( err, err_simul, error_handler );
+
+			/* Add kernel termination event to wait list. */
+			ccl_event_wait_list_add( &ewl, evt_krnl_exec, NULL );
+
+			/* The next binned bug step counts in the other set. */
+			bin_slot = OTHER_BIN_SLOT( bin_slot );
+		}
+		else
+		{
+			/* Set transient arguments, using 'bufsel' to use apropriate heat buffer. */
+			ccl_kernel_set_arg( krnl->bug_step_best, 2, dev_buff->heat_map[ bufsel.secd ] );
+			ccl_kernel_set_arg( krnl->bug_step_best, 6, ccl_arg_priv( retry_slot, cl_uint ) );
+
+			evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->bug_step_best, oclobj->queue, HB_DIMS_1, NULL,
+									gws->bug_step_best, lws->bug_step_best,
+									&ewl, &err_simul );
+			hb_if_err_propagate_goto( err, err_simul, error_handler );
+
+			/* Add kernel termination event to wait list. */
+			ccl_event_wait_list_add( &ewl, evt_krnl_exec, NULL );
+		}
+
+
+
+		/** Check flag 'bug_step_retry' to determine if kernel bug_step_any_free should be called. */
+
+		evt_rdwr = ccl_buffer_enqueue_read( dev_buff->bug_step_retry, oclobj->queue, HB_NON_BLOCK,
+							retry_slot * sizeof( cl_uint ), sizeof( cl_uint ),
+							hst_buff->bug_step_retry, &ewl, &err_simul );
+		hb_if_err_propagate_goto( err, err_simul, error_handler );
+
+		/* Add read termination event to the wait list. */
+		ccl_event_wait_list_add( &ewl, evt_rdwr, NULL );
+
+		/* Wait for read event completion. */
+		ccl_event_wait( &ewl, &err_simul );
+		hb_if_err_propagate_goto( err, err_simul, error_handler );
+
+		/* Next bug step launch reports to the other slot. */
+		if (params->fused || params->deterministic) retry_slot = OTHER_RETRY_SLOT( retry_slot );
+
+
+
+		/* Loop until all bugs resolve their movement. */
+		while (*hst_buff->bug_step_retry)
+		{
+			/** Prepare step report. */
+
+			if (!params->fused && !params->deterministic)
+			{
+				evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->prepare_step_report, oclobj->queue,
+										HB_DIMS_1, NULL,
+										gws->prepare_step_report,
+										lws->prepare_step_report,
+										&ewl, &err_simul );
+				hb_if_err_propagate_goto( err, err_simul, error_handler );
+
+				/* Add kernel termination event to wait list. */
+				ccl_event_wait_list_add( &ewl, evt_krnl_exec, NULL );
+			}
+
+
+
+			/** Perform bug step any free location. */
+
+			if (params->deterministic)
+			{
+				enqueueBugStepPass( krnl, gws, lws, oclobj, dev_buff->heat_map[ bufsel.secd ], CL_FALSE,
+							retry_slot, step_key++, &ewl, &err_simul );
+				hb_if_err_propagate_goto( err, err_simul, error_handler );
+			}
+			else
+			{
+				/* Set transient arguments, using 'bufsel' to use apropriate heat buffer. */
+				ccl_kernel_set_arg( krnl->bug_step_any_free, 2, dev_buff->heat_map[ bufsel.secd ] );
+				ccl_kernel_set_arg( krnl->bug_step_any_free, 5, ccl_arg_priv( retry_slot, cl_uint ) );
+
+				evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->bug_step_any_free, oclobj->queue,
+										HB_DIMS_1, NULL,
+										gws->bug_step_any_free,
+										lws->bug_step_any_free,
+										&ewl, &err_simul );
+				hb_if_err_propagate_goto( err, err_simul, error_handler );
+
+				/* Add kernel termination event to wait list. */
+				ccl_event_wait_list_add( &ewl, evt_krnl_exec, NULL );
+			}
+
+
+
+			/** Check flag 'bug_step_retry' to determine if kernel bug_step_any_free should be called. */
+
+			evt_rdwr = ccl_buffer_enqueue_read( dev_buff->bug_step_retry, oclobj->queue, HB_NON_BLOCK,
+								retry_slot * sizeof( cl_uint ), sizeof( cl_uint ),
+								hst_buff->bug_step_retry, &ewl, &err_simul );
+			hb_if_err_propagate_goto( err, err_simul, error_handler );
+
+			/* Add read termination event to the wait list. */
+			ccl_event_wait_list_add( &ewl, evt_rdwr, NULL );
+
+			/* Wait for read event completion. */
+			ccl_event_wait( &ewl, &err_simul );
+			hb_if_err_propagate_goto( err, err_simul, error_handler );
+
+			/* Next bug step launch reports to the other slot. */
+			if (params->fused || params->deterministic) retry_slot = OTHER_RETRY_SLOT( retry_slot );
+
+			//printf("iter: %lu -- step retry: %u\n", iter_counter, *hst_buff->bug_step_retry);
+		}
+
+
+
+		/** Leave the heat of all bugs, now at rest, unless they left it as they stepped. */
+
+		if (krnl->deposit_heat)
+		{
+			ccl_kernel_set_arg( krnl->deposit_heat, 0, dev_buff->heat_map[ bufsel.secd ] );
+
+			evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->deposit_heat, oclobj->queue, HB_DIMS_1, NULL,
+									gws->deposit_heat, lws->deposit_heat,
+									&ewl, &err_simul );
+			hb_if_err_propagate_goto( err, err_simul, error_handler );
+
+			/* Add kernel termination event to wait list. */
+			ccl_event_wait_list_add( &ewl, evt_krnl_exec, NULL );
+		}
+
+
+
+		/** Get unhappiness. */
+
+		enqueueUnhappReduce( krnl, gws, lws, oclobj, params, &ewl, &err_simul );
+		hb_if_err_propagate_goto( err, err_simul, error_handler );
+
+
+		/** Convergence check. */
+
+		if (krnl->convergence_check)
+		{
+			evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->convergence_check, oclobj->queue, HB_DIMS_1, NULL,
+									gws->convergence_check, lws->convergence_check,
+									&ewl, &err_simul );
+			hb_if_err_propagate_goto( err, err_simul, error_handler );
+
+			/* Add kernel termination event to wait list. */
+			ccl_event_wait_list_add( &ewl, evt_krnl_exec, NULL );
+		}
+
+		/** Sample the trajectories. The ring is read once full, and its slots used again from the first. */
+
+		trace_frames = 0;
+
+		if (trace_on)
+		{
+			enqueueTraceSample( krnl, gws, lws, oclobj, state, CL_FALSE, &ewl, &err_simul );
+			hb_if_err_propagate_goto( err, err_simul, error_handler );
+
+			if (state->trace_pending == params->trace_ring)
+			{
+				trace_frames = state->trace_pending;
+				state->trace_pending = 0;
+			}
+		}
+
+		/* The up to date heat map is the secondary buffer, until swap. */
+		snapshot_due = hbSnapshotFile && params->snapshot_period &&
+				(state->iterations + 1) % params->snapshot_period == 0;
+		rois_due = hbRoiFile && params->roi_count && (state->iterations + 1) % params->roi_period == 0;
+
+
+		if (params->async_io)
+		{
+			/** Async I/O: enqueue the snapshot and the unhappiness reads after the reduction, output them later.
+			    The transfer queue is in order, so only its first read needs the wait list. */
+
+			snapshot_pending = NULL;
+
+			if (snapshot_due)
+			{
+				snapshot_map = dev_buff->heat_map[ bufsel.secd ];
+
+				snapshot_pending = beginReadback( snapshot_map, oclobj->io_queue, 0, bufsz->heat_map,
+									hst_buff->heat_snapshot, params, &ewl, &io_ewl,
+									&err_simul );
+				hb_if_err_propagate_goto( err, err_simul, error_handler );
+			}
+
+			evt_rdwr = ccl_buffer_enqueue_read( dev_buff->unhapp_average, oclobj->io_queue, HB_NON_BLOCK, 0,
+								bufsz->unhapp_average, hst_buff->unhapp_average,
+								&ewl, &err_simul );
+			hb_if_err_propagate_goto( err, err_simul, error_handler );
+
+			ccl_event_wait_list_add( &io_ewl, evt_rdwr, NULL );
+
+			if (krnl->convergence_check)
+			{
+				evt_rdwr = ccl_buffer_enqueue_read( dev_buff->conv_state, oclobj->io_queue, HB_NON_BLOCK,
+									CONV_REASON * sizeof( cl_uint ), sizeof( cl_uint ),
+									&conv_pending, NULL, &err_simul );
+				hb_if_err_propagate_goto( err, err_simul, error_handler );
+
+				ccl_event_wait_list_add( &io_ewl, evt_rdwr, NULL );
+			}
+
+			if (rois_due)
+			{
+				enqueueRoiReads( dev_buff->heat_map[ bufsel.secd ], dev_buff, oclobj->io_queue, hst_buff,
+							params, hst_buff->roi_frame, NULL, &io_ewl, &err_simul );
+				hb_if_err_propagate_goto( err, err_simul, error_handler );
+			}
+
+			if (trace_frames)
+			{
+				enqueueTraceRead( dev_buff, oclobj->io_queue, hst_buff, params, trace_frames, NULL, &io_ewl,
+							&err_simul );
+				hb_if_err_propagate_goto( err, err_simul, error_handler );
+			}
+
+			rois_pending = rois_due;
+			trace_pending = trace_frames;
+			io_pending = 1;
+		}
+		else
+		{
+			/* Read unhappiness. */
+
+			evt_rdwr = ccl_buffer_enqueue_read( dev_buff->unhapp_average, oclobj->queue, HB_NON_BLOCK, 0,
+									bufsz->unhapp_average, hst_buff->unhapp_average,
+									&ewl, &err_simul );
+			hb_if_err_propagate_goto( err, err_simul, error_handler );
+
+			/* Add read termination event to the wait list. */
+			ccl_event_wait_list_add( &ewl, evt_rdwr, NULL );
+
+			/* Read the convergence stop reason, same wait. */
+			if (krnl->convergence_check)
+			{
+				evt_rdwr = ccl_buffer_enqueue_read( dev_buff->conv_state, oclobj->queue, HB_NON_BLOCK,
+									CONV_REASON * sizeof( cl_uint ), sizeof( cl_uint ),
+									&conv_reason, NULL, &err_simul );
+				hb_if_err_propagate_goto( err, err_simul, error_handler );
+
+				ccl_event_wait_list_add( &ewl, evt_rdwr, NULL );
+			}
+
+			/* Read the regions of interest, same wait. */
+			if (rois_due)
+			{
+				enqueueRoiReads( dev_buff->heat_map[ bufsel.secd ], dev_buff, oclobj->queue, hst_buff,
+							params, hst_buff->roi_frame, NULL, &ewl, &err_simul );
+				hb_if_err_propagate_goto( err, err_simul, error_handler );
+			}
+
+			/* And the trajectory samples, if the ring is full. */
+			if (trace_frames)
+			{
+				enqueueTraceRead( dev_buff, oclobj->queue, hst_buff, params, trace_frames, NULL, &ewl,
+							&err_simul );
+				hb_if_err_propagate_goto( err, err_simul, error_handler );
+			}
+
+			/* Wait for read event completion. */
+			ccl_event_wait( &ewl, &err_simul );
+			hb_if_err_propagate_goto( err, err_simul, error_handler );
+
+
+			/* Output result to file. */
+			if (hbResultWriter) hb_writer_push( hbResultWriter, hst_buff->unhapp_average, 1 );
+
+			state->unhappiness = *hst_buff->unhapp_average;
+
+			if (rois_due)
+			{
+				writeRois( hst_buff, params, hbRoiFile, &err_simul );
+				hb_if_err_propagate_goto( err, err_simul, error_handler );
+			}
+
+			if (trace_frames)
+			{
+				writeTrace( hst_buff, params, trace_frames, hbTraceFile, &err_simul );
+				hb_if_err_propagate_goto( err, err_simul, error_handler );
+			}
+
+
+			/** Take a heat map snapshot. */
+
+			if (snapshot_due)
+			{
+				takeHeatSnapshot( dev_buff->heat_map[ bufsel.secd ], oclobj, hst_buff, bufsz, params,
+							hbSnapshotFile, &err_simul );
+				hb_if_err_propagate_goto( err, err_simul, error_handler );
+			}
+		}
+
+		/* Swap buffer's indices. */
+		SWAP( cl_uint, bufsel.main, bufsel.secd );
+
+		/* Next iteration. */
+		iter_counter++;
+		state->iterations++;
+	}
+
+	/* Async I/O: output the last iteration. */
+	if (io_pending)
+	{
+		outputPendingTransfers( &io_ewl, oclobj, hst_buff, params, snapshot_map, snapshot_pending,
+					hbResultWriter, hbSnapshotFile, rois_pending, hbRoiFile, trace_pending, hbTraceFile,
+					&err_simul );
+		hb_if_err_propagate_goto( err, err_simul, error_handler );
 
-	/* Add 'kernel termination' event to the wait list. */
-	ccl_event_wait_list_add( &ewl, evt_krnl_exec, NULL );
+		state->unhappiness = *hst_buff->unhapp_average;
+		conv_reason = conv_pending;
+	}
 
-	/* Reduce step 2: */
-	evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->unhapp_step2_average, oclobj->queue, HB_DIMS_1, NULL,
-							gws->unhapp_step2_average, lws->unhapp_step2_average,
-							&ewl, &err_simul );
-	hb_if_err_propagate_goto( err, err_simul, error_handler );
+	/* Trajectory samples left in the ring. */
+	if (trace_on)
+	{
+		flushTrace( dev_buff, oclobj, hst_buff, params, state, hbTraceFile, &err_simul );
+		hb_if_err_propagate_goto( err, err_simul, error_handler );
+	}
 
-	/* Add 'kernel termination' event to the wait list. */
-	ccl_event_wait_list_add( &ewl, evt_krnl_exec, NULL );
+	state->heat_main = bufsel.main;
+	state->retry_slot = retry_slot;
+	state->list_slot = list_slot;
+	state->bin_slot = bin_slot;
+	state->step_key = step_key;
+	state->stop_reason = conv_reason ? conv_reason : state->stop_requested ? HB_STOP_REQUESTED : HB_STOP_ITERATIONS;
 
 
-	/* read unhappiness. */
+error_handler:
 
-	evt_rdwr = ccl_buffer_enqueue_read( dev_buff->unhapp_average, oclobj->queue, HB_NON_BLOCK, 0,
-							bufsz->unhapp_average, hst_buff->unhapp_average,
-							&ewl, &err_simul );
-	hb_if_err_propagate_goto( err, err_simul, error_handler );
+	/* Transfers still writing to 'conv_pending', or the host buffers, finish before it goes. */
+	if (io_ewl) ccl_event_wait( &io_ewl, NULL );
 
-	/* Add read termination event to the wait list. */
-	ccl_event_wait_list_add( &ewl, evt_rdwr, NULL );
+	return;
+}
 
 
-	/* Wait for last event completion. */
-	ccl_event_wait( &ewl, &err_simul );
-	hb_if_err_propagate_goto( err, err_simul, error_handler );
 
+/**
+ * Simulation loop of the megakernel mode ('params->megakernel_steps'): each launch of 'megakernel' runs up to that
+ * many iterations without returning to the host, then the host writes their results and takes the heat map snapshot,
+ * and the regions of interest, if due. Launches never run past the next snapshot, the next regions of interest, nor
+ * past 'params->numIterations'.
+ *
+ * The stop flag stays mapped while the launches run. A stop request, ('hb_engine_stop(...)'), sets it, the running launch
+ * ends at the end of its iteration, and no other launch is made. This needs a runtime where the mapped flag and the device buffer are the
+ * same memory, (CPU runtimes, integrated GPUs); elsewhere the simulation stops at the end of the launch.
+ *
+ * The convergence check, if enabled, runs inside the launch, ending it; its stop reason is read with the iterations
+ * done.
+ *
+ * As 'simulate(...)', each call runs up to 'num_iterations' iterations, going on from 'state'.
+ * */
+static inline void simulateMegakernel( const HBKernels_t *const krnl, const HBGlobalWorkSizes_t *const gws,
+					const HBLocalWorkSizes_t *const lws, OCLObjects_t *const oclobj,
+					HBDeviceBuffers_t *const dev_buff, HBHostBuffers_t *const hst_buff,
+					HBBuffersSize_t *const bufsz, const Parameters_t *const params,
+					HBWriter_t *hbResultWriter, FILE *hbSnapshotFile, FILE *hbRoiFile,
+					HBSimState_t *const state, size_t num_iterations, CCLErr **err )
+{
+	CCLEvent *evt_rdwr = NULL;	/* Read/Write termination event.  */
+	CCLEvent *evt_krnl_exec = NULL;	/* Kernel exec termination event. */
+	CCLEventWaitList ewl = NULL;	/* Event wait list. */
 
-	/* Output result to file. */
-	fprintf( hbResultFile, "%.17g\n", *hst_buff->unhapp_average );
+	/* Buffer selectors, as in 'simulate(...)'. A launch swaps them once per iteration done. */
+	struct {
+		cl_uint main;		/* Heatmap main.   */
+		cl_uint secd;		/* Heatmap buffer. */
+	} bufsel;
 
+	cl_uint mk_sync[ MK_SYNC_SIZE ];	/* Zeroed before each launch, then read back for the iterations done. */
+	cl_uint num_steps, steps_done;
 
-	/* Map the previously created device space buffer into host space. */
-//	buff_host->bug_step_retry = ccl_buffer_enqueue_map( buff_dev->bug_step_retry, oclobj->queue, NON_BLOCK, CL_MAP_READ, 0,  );
+	cl_uint conv_reason = HB_STOP_ITERATIONS;	/* Convergence stop reason, read with the iterations done. */
 
+	size_t iter_counter = 0;	/* Iterations of this call. */
 
-	iter_counter = 0;
+	cl_uint *stop_flag = NULL;
 
-	bufsel.main = 0;    /* On first step, main buffer has index 0.      */
-	bufsel.secd = 1;    /* On first step, secondary buffer has index 1. */
+	cl_float *unhapp_results = NULL;	/* Results of a launch, read or mapped. */
+
+	CCLErr *err_simul = NULL;
+
+
+	bufsel.main = state->heat_main;
+	bufsel.secd = OTHER_HEAT_MAP( bufsel.main );
+
+
+	/** Map the stop flag, and let a stop request set it. */
+
+	stop_flag = ccl_buffer_enqueue_map( dev_buff->stop_flag, oclobj->queue, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE,
+						0, bufsz->stop_flag, NULL, NULL, &err_simul );
+	hb_if_err_propagate_goto( err, err_simul, error_handler );
+
+	*stop_flag = state->stop_requested;
+
+	state->stop_flag = stop_flag;
 
 
 	/*******************************/
-	/**      SIMULATION LOOP      **/
+	/**   MEGAKERNEL LAUNCH LOOP  **/
 	/*******************************/
 
-	while ( (iter_counter < params->numIterations) || (params->numIterations == 0) )
+	while (!state->stop_requested && !conv_reason &&
+		((state->iterations < params->numIterations) || (params->numIterations == 0)) &&
+		((iter_counter < num_iterations) || (num_iterations == 0)))
 	{
-		/** Compute world heat, diffusion followed by evaporation. */
+		/* Iterations of this launch. */
+		num_steps = params->megakernel_steps;
 
-		/* Set transient arguments, using 'bufsel' to switch over. */
-		ccl_kernel_set_arg( krnl->comp_world_heat, 0, dev_buff->heat_map[ bufsel.main ] );
-		ccl_kernel_set_arg( krnl->comp_world_heat, 1, dev_buff->heat_map[ bufsel.secd ] );
+		if (params->numIterations)
+			num_steps = MIN( num_steps, params->numIterations - state->iterations );
 
-		evt_krnl_exec =	ccl_kernel_enqueue_ndrange( krnl->comp_world_heat, oclobj->queue, HB_DIMS_2, NULL,
-								gws->comp_world_heat, lws->comp_world_heat,
-								&ewl, &err_simul );
-		hb_if_err_propagate_goto( err, err_simul, error_handler );
+		if (num_iterations)
+			num_steps = MIN( num_steps, num_iterations - iter_counter );
 
-		/* Add kernel termination event to wait list. */
-		ccl_event_wait_list_add( &ewl, evt_krnl_exec, NULL );
+		if (params->snapshot_period)
+			num_steps = MIN( num_steps, params->snapshot_period - state->iterations % params->snapshot_period );
 
+		if (hbRoiFile && params->roi_count)
+			num_steps = MIN( num_steps, params->roi_period - state->iterations % params->roi_period );
 
 
-		/** Prepare step report. */
+		/** Clear the barrier, the retry slots and the iterations done. */
 
-		evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->prepare_step_report, oclobj->queue, HB_DIMS_1, NULL,
-								gws->prepare_step_report, lws->prepare_step_report,
-								&ewl, &err_simul );
+		memset( mk_sync, 0, sizeof( mk_sync ) );
+
+		evt_rdwr = ccl_buffer_enqueue_write( dev_buff->mk_sync, oclobj->queue, HB_NON_BLOCK, 0,
+							bufsz->mk_sync, mk_sync, &ewl, &err_simul );
 		hb_if_err_propagate_goto( err, err_simul, error_handler );
 
-		/* Add kernel termination event to wait list. */
-		ccl_event_wait_list_add( &ewl, evt_krnl_exec, NULL );
+		ccl_event_wait_list_add( &ewl, evt_rdwr, NULL );
 
 
+		/** Run the iterations. */
 
-		/** Prepare bug step. */
+		ccl_kernel_set_arg( krnl->megakernel, 0, dev_buff->heat_map[ bufsel.main ] );
+		ccl_kernel_set_arg( krnl->megakernel, 1, dev_buff->heat_map[ bufsel.secd ] );
+		ccl_kernel_set_arg( krnl->megakernel, 11, ccl_arg_priv( num_steps, cl_uint ) );
 
-		evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->prepare_bug_step, oclobj->queue, HB_DIMS_1, NULL,
-								gws->prepare_bug_step, lws->prepare_bug_step,
-								&ewl, &err_simul );
+		evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->megakernel, oclobj->queue, HB_DIMS_1, NULL,
+								gws->megakernel, lws->megakernel, &ewl, &err_simul );
 		hb_if_err_propagate_goto( err, err_simul, error_handler );
 
-		/* Add kernel termination event to wait list. */
 		ccl_event_wait_list_add( &ewl, evt_krnl_exec, NULL );
 
 
+		/** Read the iterations done, then their results. */
 
-		/** Perform bug step for best place. Also compute the new unhappiness vector. */
+		evt_rdwr = ccl_buffer_enqueue_read( dev_buff->mk_sync, oclobj->queue, HB_NON_BLOCK, 0,
+							bufsz->mk_sync, mk_sync, &ewl, &err_simul );
+		hb_if_err_propagate_goto( err, err_simul, error_handler );
 
-		/* Set transient argument, using 'bufsel' to use apropriate heat buffer. */
-		ccl_kernel_set_arg( krnl->bug_step_best, 2, dev_buff->heat_map[ bufsel.secd ] );
+		ccl_event_wait_list_add( &ewl, evt_rdwr, NULL );
 
-		evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->bug_step_best, oclobj->queue, HB_DIMS_1, NULL,
-								gws->bug_step_best, lws->bug_step_best,
-								&ewl, &err_simul );
-		hb_if_err_propagate_goto( err, err_simul, error_handler );
+		if (krnl->convergence_check)
+		{
+			evt_rdwr = ccl_buffer_enqueue_read( dev_buff->conv_state, oclobj->queue, HB_NON_BLOCK,
+								CONV_REASON * sizeof( cl_uint ), sizeof( cl_uint ),
+								&conv_reason, NULL, &err_simul );
+			hb_if_err_propagate_goto( err, err_simul, error_handler );
 
-		/* Add kernel termination event to wait list. */
-		ccl_event_wait_list_add( &ewl, evt_krnl_exec, NULL );
+			ccl_event_wait_list_add( &ewl, evt_rdwr, NULL );
+		}
 
+		ccl_event_wait( &ewl, &err_simul );
+		hb_if_err_propagate_goto( err, err_simul, error_handler );
 
+		steps_done = mk_sync[ MK_SYNC_STEPS ];
 
-		/** Check flag 'bug_step_retry' to determine if kernel bug_step_any_free should be called. */
+		unhapp_results = beginReadback( dev_buff->unhapp_results, oclobj->queue, 0, steps_done * sizeof( cl_float ),
+						hst_buff->unhapp_results, params, &ewl, &ewl, &err_simul );
+		hb_if_err_propagate_goto( err, err_simul, error_handler );
 
-		evt_rdwr = ccl_buffer_enqueue_read( dev_buff->bug_step_retry, oclobj->queue, HB_NON_BLOCK, 0,
-							bufsz->bug_step_retry, hst_buff->bug_step_retry,
-							&ewl, &err_simul );
+		ccl_event_wait( &ewl, &err_simul );
 		hb_if_err_propagate_goto( err, err_simul, error_handler );
 
-		/* Add read termination event to the wait list. */
-		ccl_event_wait_list_add( &ewl, evt_rdwr, NULL );
 
-		/* Wait for read event completion. */
-		ccl_event_wait( &ewl, &err_simul );
+		/* Output results to file. The writer keeps its own copy. */
+		if (hbResultWriter) hb_writer_push( hbResultWriter, unhapp_results, steps_done );
+
+		if (steps_done) state->unhappiness = unhapp_results[ steps_done - 1 ];
+
+		endReadback( dev_buff->unhapp_results, oclobj->queue, unhapp_results, params, &err_simul );
 		hb_if_err_propagate_goto( err, err_simul, error_handler );
 
+		/* The megakernel swapped its heat maps once per iteration. */
+		if (IS_ODD( steps_done ))
+			SWAP( cl_uint, bufsel.main, bufsel.secd );
 
+		iter_counter += steps_done;
+		state->iterations += steps_done;
 
-		/* Loop until all bugs resolve their movement. */
-		while (*hst_buff->bug_step_retry)
+
+		/** Take a heat map snapshot. The up to date heat map is the main buffer, launches end on snapshots. */
+
+		if (hbSnapshotFile && params->snapshot_period && state->iterations % params->snapshot_period == 0)
 		{
-			/** Prepare step report. */
+			takeHeatSnapshot( dev_buff->heat_map[ bufsel.main ], oclobj, hst_buff, bufsz, params,
+						hbSnapshotFile, &err_simul );
+			hb_if_err_propagate_goto( err, err_simul, error_handler );
+		}
 
-			evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->prepare_step_report, oclobj->queue, HB_DIMS_1, NULL,
-									gws->prepare_step_report, lws->prepare_step_report,
-									&ewl, &err_simul );
+
+		/** Read the regions of interest, as the snapshot. */
+
+		if (hbRoiFile && params->roi_count && state->iterations % params->roi_period == 0)
+		{
+			enqueueRoiReads( dev_buff->heat_map[ bufsel.main ], dev_buff, oclobj->queue, hst_buff, params,
+						hst_buff->roi_frame, NULL, &ewl, &err_simul );
 			hb_if_err_propagate_goto( err, err_simul, error_handler );
 
-			/* Add kernel termination event to wait list. */
-			ccl_event_wait_list_add( &ewl, evt_krnl_exec, NULL );
+			ccl_event_wait( &ewl, &err_simul );
+			hb_if_err_propagate_goto( err, err_simul, error_handler );
 
+			writeRois( hst_buff, params, hbRoiFile, &err_simul );
+			hb_if_err_propagate_goto( err, err_simul, error_handler );
+		}
+	}
 
+	state->heat_main = bufsel.main;
+	state->stop_reason = conv_reason ? conv_reason : state->stop_requested ? HB_STOP_REQUESTED : HB_STOP_ITERATIONS;
 
-			/** Perform bug step any free location. */
 
-			/* Set transient argument, using 'bufsel' to use apropriate heat buffer. */
-			ccl_kernel_set_arg( krnl->bug_step_any_free, 2, dev_buff->heat_map[ bufsel.secd ] );
+error_handler:
 
-			evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->bug_step_any_free, oclobj->queue, HB_DIMS_1, NULL,
-									gws->bug_step_any_free, lws->bug_step_any_free,
-									&ewl, &err_simul );
-			hb_if_err_propagate_goto( err, err_simul, error_handler );
+	if (stop_flag)
+	{
+		state->stop_flag = NULL;
 
-			/* Add kernel termination event to wait list. */
-			ccl_event_wait_list_add( &ewl, evt_krnl_exec, NULL );
+		evt_rdwr = ccl_buffer_enqueue_unmap( dev_buff->stop_flag, oclobj->queue, stop_flag, NULL, NULL );
+		if (evt_rdwr) ccl_queue_finish( oclobj->queue, NULL );
+	}
 
+	return;
+}
 
 
-			/** Check flag 'bug_step_retry' to determine if kernel bug_step_any_free should be called. */
 
-			evt_rdwr = ccl_buffer_enqueue_read( dev_buff->bug_step_retry, oclobj->queue, HB_NON_BLOCK, 0,
-								bufsz->bug_step_retry, hst_buff->bug_step_retry,
-								&ewl, &err_simul );
-			hb_if_err_propagate_goto( err, err_simul, error_handler );
+/**
+ * Create an engine, (see heatbugs_engine.h). The parameters are checked on a copy, the OpenCL objects, buffers and
+ * kernels are created, and the permanent kernel arguments set.
+ * */
+HBEngine_t *hb_engine_new( const Parameters_t *params, GError **err )
+{
+	HBEngine_t *engine = g_new0( HBEngine_t, 1 );	/* All objects NULL. */
 
-			/* Add read termination event to the wait list. */
-			ccl_event_wait_list_add( &ewl, evt_rdwr, NULL );
+	CCLErr *err_engine = NULL;
 
-			/* Wait for read event completion. */
-			ccl_event_wait( &ewl, &err_simul );
-			hb_if_err_propagate_goto( err, err_simul, error_handler );
 
-			//printf("iter: %lu -- step retry: %u\n", iter_counter, *hst_buff->bug_step_retry);
-		}
+	engine->params = *params;
 
+	checkSimulParameters( &engine->params, &err_engine );
+	hb_if_err_propagate_goto( err, err_engine, error_handler );
 
+	getOCLObjects( &engine->oclobj, &engine->gws, &engine->lws, &engine->tuned, &engine->params, &err_engine );
+	hb_if_err_propagate_goto( err, err_engine, error_handler );
 
-		/** Get unhappiness. */
+	setupBuffers( &engine->hst_buff, &engine->dev_buff, &engine->bufsz, &engine->oclobj, &engine->params,
+			&err_engine );
+	hb_if_err_propagate_goto( err, err_engine, error_handler );
 
-		/* Reduce step 1: */
-		evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->unhapp_step1_reduce, oclobj->queue, HB_DIMS_1, NULL,
-								gws->unhapp_step1_reduce, lws->unhapp_step1_reduce,
-								&ewl, &err_simul );
-		hb_if_err_propagate_goto( err, err_simul, error_handler );
+	getKernels( &engine->krnl, &engine->gws, &engine->lws, &engine->tuned, &engine->oclobj, &engine->params,
+			&err_engine );
+	hb_if_err_propagate_goto( err, err_engine, error_handler );
 
-		/* Add 'kernel termination' event to the wait list. */
-		ccl_event_wait_list_add( &ewl, evt_krnl_exec, NULL );
+	/* Set the permanent kernel parameters (i.e. the buffers.). */
+	setKernelParameters( &engine->krnl, &engine->dev_buff, &engine->lws, &engine->params );
 
-		/* Reduce step 2: */
-		evt_krnl_exec = ccl_kernel_enqueue_ndrange( krnl->unhapp_step2_average, oclobj->queue, HB_DIMS_1, NULL,
-								gws->unhapp_step2_average, lws->unhapp_step2_average,
-								&ewl, &err_simul );
-		hb_if_err_propagate_goto( err, err_simul, error_handler );
+	return engine;
 
-		/* Add 'kernel termination' event to the wait list. */
-		ccl_event_wait_list_add( &ewl, evt_krnl_exec, NULL );
 
-		/* Read unhappiness. */
+error_handler:
+	/* Release what was created. */
 
-		evt_rdwr = ccl_buffer_enqueue_read( dev_buff->unhapp_average, oclobj->queue, HB_NON_BLOCK, 0,
-								bufsz->unhapp_average, hst_buff->unhapp_average,
-								&ewl, &err_simul );
-		hb_if_err_propagate_goto( err, err_simul, error_handler );
+	hb_engine_destroy( engine );
 
-		/* Add read termination event to the wait list. */
-		ccl_event_wait_list_add( &ewl, evt_rdwr, NULL );
+	return NULL;
+}
 
-		/* Wait for read event completion. */
-		ccl_event_wait( &ewl, &err_simul );
-		hb_if_err_propagate_goto( err, err_simul, error_handler );
 
 
-		/* Output result to file. */
-		fprintf( hbResultFile, "%.17g\n", *hst_buff->unhapp_average );
+void hb_engine_set_outputs( HBEngine_t *engine, HBWriter_t *writer, FILE *snapshots, FILE *rois, FILE *traces )
+{
+	engine->writer = writer;
+	engine->snapshot_file = snapshots;
+	engine->roi_file = rois;
+	engine->trace_file = traces;
+}
+
+
 
-		/* Swap buffer's indices. */
-		SWAP( cl_uint, bufsel.main, bufsel.secd );
+/**
+ * Initiate the engine, (see heatbugs_engine.h). Work-group sizes are tuned on the first initiated world, which is then
+ * initiated again, so the simulation starts as usual.
+ * */
+void hb_engine_init( HBEngine_t *engine, GError **err )
+{
+	CCLErr *err_engine = NULL;
 
-		/* Next iteration. */
-		iter_counter++;
+
+	engine->initiated = 0;
+	engine->state.stop_requested = 0;
+
+	/* Run all init kernels. */
+	initiate( &engine->krnl, &engine->gws, &engine->lws, &engine->oclobj, &engine->dev_buff, &engine->hst_buff,
+			&engine->bufsz, &engine->params, &err_engine );
+	hb_if_err_propagate_goto( err, err_engine, error_handler );
+
+	if (engine->params.autotune && !engine->autotuned)
+	{
+		autotune( &engine->krnl, &engine->gws, &engine->lws, &engine->oclobj, &engine->dev_buff, &engine->params,
+				&engine->tuned, &err_engine );
+		hb_if_err_propagate_goto( err, err_engine, error_handler );
+
+		saveTuneProfile( &engine->tuned, &engine->oclobj, &engine->params, &err_engine );
+		hb_if_err_propagate_goto( err, err_engine, error_handler );
+
+		engine->autotuned = 1;
+
+		initiate( &engine->krnl, &engine->gws, &engine->lws, &engine->oclobj, &engine->dev_buff,
+				&engine->hst_buff, &engine->bufsz, &engine->params, &err_engine );
+		hb_if_err_propagate_goto( err, err_engine, error_handler );
+	}
+
+	/* Profile the simulation only: events of the init kernels and of the autotuner are released. */
+	ccl_queue_gc( engine->oclobj.queue );
+
+	if (engine->params.profile)
+	{
+		if (engine->prof) ccl_prof_destroy( engine->prof );
+
+		engine->prof = ccl_prof_new();
+		ccl_prof_start( engine->prof );
+	}
+
+	if (engine->trace_file && engine->params.trace_sample)
+	{
+		writeTraceHeader( &engine->params, engine->trace_file, &err_engine );
+		hb_if_err_propagate_goto( err, err_engine, error_handler );
 	}
 
+	startSimulation( &engine->krnl, &engine->gws, &engine->lws, &engine->oclobj, &engine->dev_buff,
+				&engine->hst_buff, &engine->bufsz, &engine->params, engine->writer, engine->trace_file,
+				&engine->state, &err_engine );
+	hb_if_err_propagate_goto( err, err_engine, error_handler );
+
+	engine->initiated = 1;
+
 
 error_handler:
+	/* If error handler is reached leave function imediately. */
 
 	return;
 }
 
 
 
+/**
+ * Step the engine, (see heatbugs_engine.h). Unless profiling, the events of the step are released after it, so a
+ * long lived engine does not pile them up.
+ * */
+size_t hb_engine_step( HBEngine_t *engine, size_t n, GError **err )
+{
+	const size_t iterations = engine->state.iterations;
+
+	CCLErr *err_engine = NULL;
+
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+				!engine->initiated,
+				HB_INVALID_PARAMETER, error_handler,
+				"The engine must be initiated before it is stepped." );
+
+	/* A stopped simulation stays stopped. */
+	if (engine->state.stop_reason != HB_STOP_ITERATIONS) return 0;
+
+	if (engine->params.megakernel_steps)
+		simulateMegakernel( &engine->krnl, &engine->gws, &engine->lws, &engine->oclobj, &engine->dev_buff,
+					&engine->hst_buff, &engine->bufsz, &engine->params, engine->writer,
+					engine->snapshot_file, engine->roi_file, &engine->state, n, &err_engine );
+	else
+		simulate( &engine->krnl, &engine->gws, &engine->lws, &engine->oclobj, &engine->dev_buff,
+				&engine->hst_buff, &engine->bufsz, &engine->params, engine->writer,
+				engine->snapshot_file, engine->roi_file, engine->trace_file, &engine->state, n,
+				&err_engine );
+	hb_if_err_propagate_goto( err, err_engine, error_handler );
+
+	if (engine->prof == NULL)
+	{
+		ccl_queue_gc( engine->oclobj.queue );
+		if (engine->oclobj.io_queue) ccl_queue_gc( engine->oclobj.io_queue );
+	}
+
+	return engine->state.iterations - iterations;
+
+
+error_handler:
+	/* The state of the world is unknown. */
+
+	engine->initiated = 0;
+
+	return 0;
+}
+
+
+
+void hb_engine_read_stats( const HBEngine_t *engine, HBStats_t *stats )
+{
+	stats->iterations = engine->state.iterations;
+	stats->unhappiness = engine->state.unhappiness;
+	stats->stop_reason = engine->state.stop_reason;
+}
+
+
+
+const char *hb_stop_reason_name( int stop_reason )
+{
+	static const char *const names[] = {		/* By 'enum hb_stop_reasons'. */
+		"iterations done", "unhappiness steady", "no bug moves", "stopped on request" };
 
+	if (stop_reason < 0 || (size_t) stop_reason >= G_N_ELEMENTS( names )) return "unknown";
 
+	return names[ stop_reason ];
+}
 
 
 
-int main ( int argc, char *argv[] )
+/**
+ * Read a heat map region, (see heatbugs_engine.h). Row-major maps transfer the rows of the region only, tiled maps the
+ * whole map. Device buffers are read into the snapshot buffer, allocated here if there are no snapshots.
+ * */
+void hb_engine_read_heat_region( HBEngine_t *engine, size_t row, size_t col, size_t height, size_t width,
+					float *heat, GError **err )
 {
-	FILE *hbResultFile = NULL;
+	const Parameters_t *const params = &engine->params;
+	CCLBuffer *const heat_map = engine->dev_buff.heat_map[ engine->state.heat_main ];
 
-	Parameters_t params;					/* Host data; simulation parameters. */
+	CCLEventWaitList ewl = NULL;	/* Event wait list. */
+	cl_float *data = NULL;
 
+	size_t offset, count;		/* Cells transferred. */
+	size_t r, c;
 
-	OCLObjects_t oclobj = { NULL, NULL, NULL, NULL };	/* OpenCL related objects: context, device, queue, program. */
+	CCLErr *err_engine = NULL;
 
-	HBKernels_t krnl = { NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL };			/* Kernels. */
-	HBGlobalWorkSizes_t gws = { {0}, {0}, {0}, {0}, {0}, {0}, {0}, {0, 0}, {0}, {0} };		/* Global work sizes for all kernels. */
-	HBLocalWorkSizes_t  lws = { {0}, {0}, {0}, {0}, {0}, {0}, {0}, {0, 0}, {0}, {0} };		/* Local work sizes for all kernels. */
 
-	HBHostBuffers_t hst_buff = { NULL, /*NULL, NULL, NULL, { NULL, NULL }, NULL, NULL,*/ NULL };	/* Host buffers. */
-	HBDeviceBuffers_t dev_buff = { NULL, NULL, NULL, NULL, { NULL, NULL }, NULL, NULL, NULL };	/* Device buffers. */
-	HBBuffersSize_t bufsz;										/* Buffer sizes. */
+	hb_if_err_create_goto( *err, HB_ERROR,
+				height > params->world_height || row > params->world_height - height ||
+				width > params->world_width || col > params->world_width - width,
+				HB_INVALID_PARAMETER, release_handler,
+				"Heat map region out of the world." );
 
-	CCLErr *err_main = NULL;				/* Error reporting object. */
+	if (!params->host_buffers && engine->hst_buff.heat_snapshot == NULL)
+	{
+		engine->hst_buff.heat_snapshot = (cl_float *) malloc( engine->bufsz.heat_map );
+		hb_if_err_create_goto( *err, HB_ERROR,
+					engine->hst_buff.heat_snapshot == NULL,
+					HB_MALLOC_FAILURE, release_handler,
+					"Unable to allocate host memory for heat map snapshot." );
+	}
 
+	offset = params->world_tile ? 0 : world_index( params, row, 0 );
+	count = params->world_tile ? params->world_storage_size : height * params->world_width;
 
-	getSimulParameters( &params, argc, argv, &err_main );
-	hb_if_err_goto( err_main, error_handler );
+	data = beginReadback( heat_map, engine->oclobj.queue, offset * sizeof( cl_float ), count * sizeof( cl_float ),
+				engine->hst_buff.heat_snapshot, params, NULL, &ewl, &err_engine );
+	hb_if_err_propagate_goto( err, err_engine, error_handler );
 
-	getOCLObjects( &oclobj, &gws, &lws, &params, &err_main );
-	hb_if_err_goto( err_main, error_handler );
+	/* Wait for read event completion. */
+	ccl_event_wait( &ewl, &err_engine );
+	hb_if_err_propagate_goto( err, err_engine, error_handler );
 
-	setupBuffers( &hst_buff, &dev_buff, &bufsz, &oclobj, &params, &err_main );
-	hb_if_err_goto( err_main, error_handler );
+	for (r = 0; r < height; r++)
+		for (c = 0; c < width; c++)
+			heat[ r * width + c ] = data[ world_index( params, row + r, col + c ) - offset ];
 
-	getKernels( &krnl, &gws, &lws, &oclobj, &params, &err_main );
-	hb_if_err_goto( err_main, error_handler );
+	endReadback( heat_map, engine->oclobj.queue, data, params, &err_engine );
+	hb_if_err_propagate_goto( err, err_engine, release_handler );
+
+	return;
 
-	/* Set the permanent kernel parameters (i.e. the buffers.). */
-	setKernelParameters( &krnl, &dev_buff, &lws );
 
+error_handler:
+	/* A mapped heat map is released on errors too. Errors of the release itself are left out. */
 
-	/* Open output file for results. */
-	hbResultFile = fopen( params.output_filename, "w+" );	/* Overwrite. */
-	hb_if_err_create_goto( err_main, HB_ERROR,
-		hbResultFile == NULL, HB_UNABLE_OPEN_FILE, error_handler,
-		"Could not open output file." );
+	if (data) endReadback( heat_map, engine->oclobj.queue, data, params, NULL );
 
+release_handler:
+
+	return;
+}
+
+
+
+size_t hb_engine_roi_frame_size( const HBEngine_t *engine )
+{
+	return engine->params.roi_frame_size;
+}
 
-	/* Run all init kernels. */
-	initiate( &krnl, &gws, &lws, &oclobj, &dev_buff, &hst_buff, &bufsz, &params, &err_main );
-	hb_if_err_goto( err_main, error_handler );
 
 
-	simulate( &krnl, &gws, &lws, &oclobj, &dev_buff, &hst_buff, &bufsz, &params, hbResultFile, &err_main );
-	hb_if_err_goto( err_main, error_handler );
+/**
+ * Read the regions of interest, (see heatbugs_engine.h). Row-major maps are read straight into 'frame'.
+ * */
+void hb_engine_read_rois( HBEngine_t *engine, void *frame, GError **err )
+{
+	CCLEventWaitList ewl = NULL;	/* Event wait list. */
+
+	CCLErr *err_engine = NULL;
 
 
-	// printf( "End...\n\n" );
+	hb_if_err_create_goto( *err, HB_ERROR,
+				engine->params.roi_count == 0,
+				HB_INVALID_PARAMETER, error_handler,
+				"There are no regions of interest." );
 
-	/* TODO: Profiling. */
+	enqueueRoiReads( engine->dev_buff.heat_map[ engine->state.heat_main ], &engine->dev_buff,
+				engine->oclobj.queue, &engine->hst_buff, &engine->params, (cl_uint *) frame, NULL, &ewl,
+				&err_engine );
+	hb_if_err_propagate_goto( err, err_engine, error_handler );
 
+	/* Wait for read event completion. */
+	ccl_event_wait( &ewl, &err_engine );
+	hb_if_err_propagate_goto( err, err_engine, error_handler );
 
-	goto clean_all;
+	unpackRois( &engine->hst_buff, &engine->params, (cl_uint *) frame );
 
 
 error_handler:
+	/* If error handler is reached leave function imediately. */
+
+	return;
+}
+
+
+
+void hb_engine_reset( HBEngine_t *engine, size_t seed, size_t num_iterations, GError **err )
+{
+	engine->params.seed = seed;
+	engine->params.numIterations = num_iterations;
+
+	hb_engine_init( engine, err );
+}
+
+
+
+void hb_engine_stop( HBEngine_t *engine )
+{
+	engine->state.stop_requested = 1;
+
+	if (engine->state.stop_flag) *engine->state.stop_flag = 1;
+}
+
+
+
+void hb_engine_print_profile( HBEngine_t *engine, GError **err )
+{
+	CCLErr *err_engine = NULL;
+
+
+	if (engine->prof == NULL) return;
+
+	ccl_prof_stop( engine->prof );
+
+	ccl_prof_add_queue( engine->prof, "Compute", engine->oclobj.queue );
+	if (engine->oclobj.io_queue) ccl_prof_add_queue( engine->prof, "Transfer", engine->oclobj.io_queue );
+
+	ccl_prof_calc( engine->prof, &err_engine );
+	hb_if_err_propagate_goto( err, err_engine, error_handler );
+
+	ccl_prof_print_summary( engine->prof );
+
 
-	/* Handle error. */
-	fprintf( stderr, "Error: %s\n\n", err_main->message );
-	g_error_free( err_main );
+error_handler:
+	/* Profiling ends either way. */
 
+	ccl_prof_destroy( engine->prof );
+	engine->prof = NULL;
 
-clean_all:
+	return;
+}
 
 
-	/* Close output file. */
-	if (hbResultFile) fclose( hbResultFile );
 
-	/* Clean / Destroy all allocated items. */
+void hb_engine_destroy( HBEngine_t *engine )
+{
+	if (engine->prof) ccl_prof_destroy( engine->prof );
 
 	/** Destroy host buffers. */
-	if (hst_buff.unhapp_average)	free( hst_buff.unhapp_average );
-	/* if (hst_buff.unhapp_reduced)	free( hst_buff.unhapp_reduced ); */
-	/* if (hst_buff.unhappiness)	free( hst_buff.unhappiness ); */
-	/* if (hst_buff.heat_map[1])	free( hst_buff.heat_map[1] ); */
-	/* if (hst_buff.heat_map[0])	free( hst_buff.heat_map[0] ); */
-	/* if (hst_buff.swarm_map)	free( hst_buff.swarm_map ); */
-	/* if (hst_buff.swarm)		free( hst_buff.swarm ); */
-	/* if (hst_buff.rng_state)	free( hst_buff.rng_state ); */
-	if (hst_buff.bug_step_retry)	free( hst_buff.bug_step_retry );
+	if (engine->hst_buff.unhapp_average)	free( engine->hst_buff.unhapp_average );
+	/* if (engine->hst_buff.unhapp_reduced)	free( engine->hst_buff.unhapp_reduced ); */
+	/* if (engine->hst_buff.unhappiness)	free( engine->hst_buff.unhappiness ); */
+	/* if (engine->hst_buff.heat_map[1])	free( engine->hst_buff.heat_map[1] ); */
+	/* if (engine->hst_buff.heat_map[0])	free( engine->hst_buff.heat_map[0] ); */
+	/* if (engine->hst_buff.swarm_map)	free( engine->hst_buff.swarm_map ); */
+	/* if (engine->hst_buff.swarm)		free( engine->hst_buff.swarm ); */
+	/* if (engine->hst_buff.rng_state)	free( engine->hst_buff.rng_state ); */
+	if (engine->hst_buff.unhapp_results)	free( engine->hst_buff.unhapp_results );
+	if (engine->hst_buff.heat_row)		free( engine->hst_buff.heat_row );
+	if (engine->hst_buff.heat_snapshot)	free( engine->hst_buff.heat_snapshot );
+	if (engine->hst_buff.bug_placement)	free( engine->hst_buff.bug_placement );
+	if (engine->hst_buff.roi_staging)	free( engine->hst_buff.roi_staging );
+	if (engine->hst_buff.roi_frame)		free( engine->hst_buff.roi_frame );
+	if (engine->hst_buff.trace_ring)	free( engine->hst_buff.trace_ring );
+	if (engine->hst_buff.bug_step_retry)	free( engine->hst_buff.bug_step_retry );
 
 	/** Destroy Device buffers. */
-	if (dev_buff.unhapp_average)	ccl_buffer_destroy( dev_buff.unhapp_average );
-	if (dev_buff.unhapp_reduced)	ccl_buffer_destroy( dev_buff.unhapp_reduced );
-	if (dev_buff.unhappiness)	ccl_buffer_destroy( dev_buff.unhappiness );
-	if (dev_buff.heat_map[1])	ccl_buffer_destroy( dev_buff.heat_map[1] );
-	if (dev_buff.heat_map[0])	ccl_buffer_destroy( dev_buff.heat_map[0] );
-	if (dev_buff.swarm_map)		ccl_buffer_destroy( dev_buff.swarm_map );
-	if (dev_buff.swarm_bugPosition)	ccl_buffer_destroy( dev_buff.swarm_bugPosition );
-	if (dev_buff.rng_state)		ccl_buffer_destroy( dev_buff.rng_state );
-	if (dev_buff.bug_step_retry)	ccl_buffer_destroy( dev_buff.bug_step_retry );
+	if (engine->dev_buff.trace_ring)	ccl_buffer_destroy( engine->dev_buff.trace_ring );
+	if (engine->dev_buff.trace_last)	ccl_buffer_destroy( engine->dev_buff.trace_last );
+	if (engine->dev_buff.bin_count)		ccl_buffer_destroy( engine->dev_buff.bin_count );
+	if (engine->dev_buff.bin_list)		ccl_buffer_destroy( engine->dev_buff.bin_list );
+	if (engine->dev_buff.claims)		ccl_buffer_destroy( engine->dev_buff.claims );
+	if (engine->dev_buff.bug_target)	ccl_buffer_destroy( engine->dev_buff.bug_target );
+	if (engine->dev_buff.active_count)	ccl_buffer_destroy( engine->dev_buff.active_count );
+	if (engine->dev_buff.active_list)	ccl_buffer_destroy( engine->dev_buff.active_list );
+	if (engine->dev_buff.tile_flags)	ccl_buffer_destroy( engine->dev_buff.tile_flags );
+	if (engine->dev_buff.conv_state)	ccl_buffer_destroy( engine->dev_buff.conv_state );
+	if (engine->dev_buff.conv_window)	ccl_buffer_destroy( engine->dev_buff.conv_window );
+	if (engine->dev_buff.stop_flag)		ccl_buffer_destroy( engine->dev_buff.stop_flag );
+	if (engine->dev_buff.unhapp_results)	ccl_buffer_destroy( engine->dev_buff.unhapp_results );
+	if (engine->dev_buff.mk_reduced)	ccl_buffer_destroy( engine->dev_buff.mk_reduced );
+	if (engine->dev_buff.mk_sync)		ccl_buffer_destroy( engine->dev_buff.mk_sync );
+	if (engine->dev_buff.reduce_done)	ccl_buffer_destroy( engine->dev_buff.reduce_done );
+	if (engine->dev_buff.unhapp_average)	ccl_buffer_destroy( engine->dev_buff.unhapp_average );
+	if (engine->dev_buff.unhapp_reduced)	ccl_buffer_destroy( engine->dev_buff.unhapp_reduced );
+	if (engine->dev_buff.unhappiness)	ccl_buffer_destroy( engine->dev_buff.unhappiness );
+	if (engine->dev_buff.heat_image[1])	ccl_image_destroy( engine->dev_buff.heat_image[1] );
+	if (engine->dev_buff.heat_image[0])	ccl_image_destroy( engine->dev_buff.heat_image[0] );
+	if (engine->dev_buff.heat_map[1])	ccl_buffer_destroy( engine->dev_buff.heat_map[1] );
+	if (engine->dev_buff.heat_map[0])	ccl_buffer_destroy( engine->dev_buff.heat_map[0] );
+	if (engine->dev_buff.scenario_obstacles)	ccl_buffer_destroy( engine->dev_buff.scenario_obstacles );
+	if (engine->dev_buff.scenario_heat)	ccl_buffer_destroy( engine->dev_buff.scenario_heat );
+	if (engine->dev_buff.bug_attrs)		ccl_buffer_destroy( engine->dev_buff.bug_attrs );
+	if (engine->dev_buff.swarm_map)		ccl_buffer_destroy( engine->dev_buff.swarm_map );
+	if (engine->dev_buff.swarm_bugPosition)	ccl_buffer_destroy( engine->dev_buff.swarm_bugPosition );
+	if (engine->dev_buff.rng_state)		ccl_buffer_destroy( engine->dev_buff.rng_state );
+	if (engine->dev_buff.bug_step_retry)	ccl_buffer_destroy( engine->dev_buff.bug_step_retry );
 
 	/** Destroy kernel wrappers. */
-	if (krnl.unhapp_step2_average)	ccl_kernel_destroy( krnl.unhapp_step2_average );
-	if (krnl.unhapp_step1_reduce)	ccl_kernel_destroy( krnl.unhapp_step1_reduce );
-	if (krnl.comp_world_heat)	ccl_kernel_destroy( krnl.comp_world_heat );
-	if (krnl.bug_step_any_free)	ccl_kernel_destroy( krnl.bug_step_any_free );
-	if (krnl.bug_step_best)		ccl_kernel_destroy( krnl.bug_step_best );
-	if (krnl.prepare_step_report)	ccl_kernel_destroy( krnl.prepare_step_report );
-	if (krnl.prepare_bug_step)	ccl_kernel_destroy( krnl.prepare_bug_step );
-	if (krnl.init_swarm)		ccl_kernel_destroy( krnl.init_swarm );
-	if (krnl.init_maps)		ccl_kernel_destroy( krnl.init_maps );
-	if (krnl.init_random)		ccl_kernel_destroy( krnl.init_random );
+	if (engine->krnl.trace_sample)		ccl_kernel_destroy( engine->krnl.trace_sample );
+	if (engine->krnl.deposit_heat)		ccl_kernel_destroy( engine->krnl.deposit_heat );
+	if (engine->krnl.bug_step_release)	ccl_kernel_destroy( engine->krnl.bug_step_release );
+	if (engine->krnl.bug_step_resolve)	ccl_kernel_destroy( engine->krnl.bug_step_resolve );
+	if (engine->krnl.bug_step_claim)	ccl_kernel_destroy( engine->krnl.bug_step_claim );
+	if (engine->krnl.comp_world_heat_active)	ccl_kernel_destroy( engine->krnl.comp_world_heat_active );
+	if (engine->krnl.active_tiles_list)	ccl_kernel_destroy( engine->krnl.active_tiles_list );
+	if (engine->krnl.convergence_check)	ccl_kernel_destroy( engine->krnl.convergence_check );
+	if (engine->krnl.megakernel)		ccl_kernel_destroy( engine->krnl.megakernel );
+	if (engine->krnl.unhapp_reduce_fused)	ccl_kernel_destroy( engine->krnl.unhapp_reduce_fused );
+	if (engine->krnl.unhapp_step2_average)	ccl_kernel_destroy( engine->krnl.unhapp_step2_average );
+	if (engine->krnl.unhapp_step1_reduce)	ccl_kernel_destroy( engine->krnl.unhapp_step1_reduce );
+	if (engine->krnl.comp_world_heat)	ccl_kernel_destroy( engine->krnl.comp_world_heat );
+	if (engine->krnl.bug_step_binned)	ccl_kernel_destroy( engine->krnl.bug_step_binned );
+	if (engine->krnl.bug_step_classify)	ccl_kernel_destroy( engine->krnl.bug_step_classify );
+	if (engine->krnl.bug_step_any_free)	ccl_kernel_destroy( engine->krnl.bug_step_any_free );
+	if (engine->krnl.bug_step_best)		ccl_kernel_destroy( engine->krnl.bug_step_best );
+	if (engine->krnl.prepare_step_report)	ccl_kernel_destroy( engine->krnl.prepare_step_report );
+	if (engine->krnl.prepare_bug_step)	ccl_kernel_destroy( engine->krnl.prepare_bug_step );
+	if (engine->krnl.init_swarm)		ccl_kernel_destroy( engine->krnl.init_swarm );
+	if (engine->krnl.init_maps)		ccl_kernel_destroy( engine->krnl.init_maps );
+	if (engine->krnl.init_random)		ccl_kernel_destroy( engine->krnl.init_random );
 
 	/** Free remaining OpenCL wrappers. */
-	if (oclobj.prg)		ccl_program_destroy( oclobj.prg );
-	if (oclobj.queue)	ccl_queue_destroy( oclobj.queue );
-	if (oclobj.ctx)		ccl_context_destroy( oclobj.ctx );
+	if (engine->oclobj.prg)		ccl_program_destroy( engine->oclobj.prg );
+	if (engine->oclobj.io_queue)	ccl_queue_destroy( engine->oclobj.io_queue );
+	if (engine->oclobj.queue)	ccl_queue_destroy( engine->oclobj.queue );
+	if (engine->oclobj.ctx)		ccl_context_destroy( engine->oclobj.ctx );
 
-
-	/* Confirm that memory allocated by wrappers has been properly freed. */
-	g_assert( ccl_wrapper_memcheck() );
-
-
-	return OKI_DOKI;
-}
\ No newline at end of file
+	g_free( engine );
+}
@@ -30,12 +30,17 @@
  * The kernel in this file expect the following preprocessor defines, passed
  * to kernel at compile time with -D option:
  *
-	INIT_SEED
 	REDUCE_NUM_WORKGROUPS
 	BUGS_NUMBER
 	WORLD_WIDTH
 	WORLD_HEIGHT
 	WORLD_SIZE
+	WORLD_TILE
+	WORLD_TILES_X
+	WORLD_STORAGE_SIZE
+	WORLD_WIDTH_POW2
+	WORLD_HEIGHT_POW2
+	HEAT_VECTOR_WIDTH
 	WORLD_DIFFUSION_RATE
 	WORLD_EVAPORATION_RATE
 	BUGS_RANDOM_MOVE_CHANCE
@@ -61,13 +66,46 @@
 
 
 
+/*
+ * Deterministic mode. Floating point results must not depend on the device nor on the kernel variant: no multiply-add
+ * contraction, and the heat constants of 'world_heat_cell(...)' are single precision, as in 'comp_world_heat_vec'.
+ * */
+#if DETERMINISTIC
+	#pragma OPENCL FP_CONTRACT OFF
+
+	#define HEAT_DIFFUSION		((float) WORLD_DIFFUSION_RATE)
+	#define HEAT_REMAINING		((float) (1 - WORLD_DIFFUSION_RATE))
+	#define HEAT_KEPT		((float) (1 - WORLD_EVAPORATION_RATE))
+#else
+	#define HEAT_DIFFUSION		WORLD_DIFFUSION_RATE
+	#define HEAT_REMAINING		(1 - WORLD_DIFFUSION_RATE)
+	#define HEAT_KEPT		(1 - WORLD_EVAPORATION_RATE)
+#endif
+
+
+
 /* Used to drive what shall happen to the agent at each step. */
 #define GET_ANY_NEIGHBOUR	0x00ffffff
 #define GET_MAX_TEMP_NEIGHBOUR	0x00ffff00
 #define GET_MIN_TEMP_NEIGHBOUR	0x00ff00ff
 
+/*
+ * Neighbourhood of a cell, where bugs move and heat diffuses to, and world edges. Same values in the host. Each
+ * combination is a program of its own: the neighbour lists are expanded at build time, (see 'FOR_EACH_NEIGHBOUR'),
+ * so there is no run-time test of the model variant.
+ * */
+#define NEIGHBOURS_MOORE	0	/* The 8 surrounding cells. */
+#define NEIGHBOURS_VON_NEUMANN	1	/* The 4 cells at North, South, East and West. */
+
+#define BOUNDARY_TORUS		0	/* Edges wrap around. */
+#define BOUNDARY_BOX		1	/* Closed box, there are no cells past the edges. */
+
 /* Number of neighboring cell that surround the agent's position. */
-#define NUM_NEIGHBOURS		8
+#if NEIGHBOURHOOD == NEIGHBOURS_VON_NEUMANN
+	#define NUM_NEIGHBOURS		4
+#else
+	#define NUM_NEIGHBOURS		8
+#endif
 
 
 /*
@@ -77,7 +115,8 @@
  *	- 8 bits for bug output heat;
  *	- 8 bits flagging the bug's intention to move (aah = want to move; 00h = is at rest).
  *
- * If there is no bug, the uint variable for that bug must be zero, that is EMPTY_CELL.
+ * If there is no bug, the uint variable for that bug must be zero, that is EMPTY_CELL. An obstacle cell is
+ * OBSTACLE_CELL: not empty, so bugs never move into it, and with no bug presence nor output heat.
  * */
 
 
@@ -86,6 +125,7 @@
 /* Bug want to move, is bug's initial state. */
 #define BUG		0x00ff00aa
 #define EMPTY_CELL	0x00000000
+#define OBSTACLE_CELL	0x00000055
 
 
 /* Macros for 32 bits / unsigned int. */
@@ -100,6 +140,9 @@
 #define SET_BUG_TO_REST( uint_reg ) uint_reg = (uint_reg & 0xffffff00)
 #define SET_BUG_TO_MOVE( uint_reg ) uint_reg = ((uint_reg & 0xffffff00) | 0x000000aa)
 
+/* Same as SET_BUG_TO_MOVE for a bug in the swarm_map, at rest or already wanting to move. */
+#define SET_BUG_TO_MOVE_ATOMIC( uint_ptr ) atomic_or( (uint_ptr), 0x000000aa )
+
 
 #define HAS_BUG( uint_reg ) ((uint_reg) != EMPTY_CELL)
 #define HAS_NO_BUG( uint_reg ) ((uint_reg) == EMPTY_CELL)
@@ -117,6 +160,127 @@
 #define RESET_REPEAT_STEP( uint_reg ) uint_reg = RST_BUG_STEP_RETRY_FLAG
 #define REPORT_REPEAT_STEP( uint_reg ) uint_reg = SET_BUG_STEP_RETRY_FLAG
 
+/*
+ * The 'bug_step_retry' flag has 2 slots. Each bug step launch reports to the slot given by the host, and clears the
+ * other one, which the host has already read, so it is clear for the next launch. That way no launch of
+ * 'prepare_step_report' is needed between bug steps.
+ * */
+#define OTHER_RETRY_SLOT( slot ) (1 - (slot))
+
+/*
+ * Deterministic bug step, (see 'bug_step_claim(...)'). A 'claims' cell holds the lowest priority of the bugs claiming
+ * it in the current pass, NO_CLAIM if none. A 'bug_target' entry holds the cell a bug claimed or stays at, or:
+ * */
+#define NO_CLAIM		0xffffffff
+#define TARGET_NONE		0xffffffff	/* Bug done in an earlier pass of the iteration. */
+#define TARGET_BLOCKED		0xfffffffe	/* Best place taken, bug tries any free place in the next pass. */
+
+/*
+ * Layout of the megakernel 'mk_sync' buffer, (see 'megakernel(...)'). Same values in the host. The buffer is zeroed
+ * by the host before each launch.
+ * */
+#define MK_SYNC_COUNT		0	/* Work-groups arrived at the current global barrier.  */
+#define MK_SYNC_GENERATION	1	/* Global barriers passed.                             */
+#define MK_SYNC_STOP		2	/* Set by work-group 0 when the launch must end.       */
+#define MK_SYNC_STEPS		3	/* Iterations completed, read by the host.             */
+#define MK_SYNC_RETRY		4	/* 3 bug step retry slots, used in rotation.           */
+#define MK_SYNC_SIZE		7
+
+/*
+ * Convergence stop, (see 'convergence_step(...)'). Layout of the 'conv_state' buffer, and stop reasons. Same values
+ * in the host. CONVERGE_WINDOW = 0 disables the unhappiness criterion, STILL_WINDOW = 0 the bug moves criterion and
+ * the moves count.
+ * */
+#define CONV_SEEN		0	/* Iterations checked. */
+#define CONV_STILL		1	/* Iterations in a row without any bug moving. */
+#define CONV_REASON		2	/* Why the simulation must stop, CONV_RUNNING if it must not. */
+#define CONV_MOVES		3	/* Bugs moved in the current iteration. */
+#define CONV_STATE_SIZE		4
+
+#define CONV_RUNNING		0
+#define CONV_STEADY		1	/* Unhappiness changed less than CONVERGE_EPSILON in CONVERGE_WINDOW iterations. */
+#define CONV_NO_MOVES		2	/* No bug moved in STILL_WINDOW iterations. */
+
+#if STILL_WINDOW
+#define COUNT_MOVE( uint_ptr ) atomic_inc( (uint_ptr) )
+#else
+#define COUNT_MOVE( uint_ptr )
+#endif
+
+/*
+ * Active tiles, (see 'comp_world_heat_active(...)'). The world is split in ACTIVE_TILE x ACTIVE_TILE cell tiles, in
+ * row-major order, each with a 'tile_flags' entry telling in which of the last two iterations it was active.
+ * ACTIVE_TILE = 0 disables them. Independent of the WORLD_TILE memory layout.
+ * */
+#define ACTIVE_NOW		0x1	/* Active in the iteration being computed: hot, or has bugs. */
+#define ACTIVE_LAST		0x2	/* Active in the iteration before. */
+
+#define OTHER_LIST_SLOT( slot ) (1 - (slot))
+
+/*
+ * Binned bug step, (see 'bug_step_classify(...)'). Bins of the bugs that want to move, in the order they are laid over
+ * the work-items of 'bug_step_binned'. Same values in the host. 'bin_count' holds two sets of NUM_BINS counters, used
+ * in turns as the 'active_count' slots.
+ * */
+#define BIN_RANDOM		0	/* Moves to a random neighbour. */
+#define BIN_COLD		1	/* Moves to the warmest neighbour. */
+#define BIN_HOT			2	/* Moves to the coolest neighbour. */
+#define NUM_BINS		3
+
+#define OTHER_BIN_SLOT( slot ) (1 - (slot))
+
+#if ACTIVE_TILE
+#define ACTIVE_TILES		(ACTIVE_TILES_X * ACTIVE_TILES_Y)
+#define MARK_ACTIVE_TILE( tile_flags, index ) \
+	atomic_or( &(tile_flags)[ cell_row( index ) / ACTIVE_TILE * ACTIVE_TILES_X + cell_col( index ) / ACTIVE_TILE ], \
+			ACTIVE_NOW )
+#else
+#define MARK_ACTIVE_TILE( tile_flags, index )
+#endif
+
+/*
+ * Heat deposition, (see 'deposit_heat_atomic(...)'). Same values in the host. With DEPOSIT_INLINE bugs leave their
+ * heat as they step, a plain store of the temperature read before plus their output, a float. With the others, bug
+ * steps leave no heat, and a deposition pass adds it once all bugs are done.
+ * */
+#define DEPOSIT_INLINE		0
+#define DEPOSIT_ATOMIC		1	/* A work-item per bug, float atomic add. */
+#define DEPOSIT_GATHER		2	/* A work-item per cell, adds the heat of the bug on it. */
+
+#if HEAT_DEPOSIT == DEPOSIT_INLINE
+#define LEAVE_HEAT( heat_map, index, temperature, output ) \
+	(heat_map)[ index ] = (temperature) + (output)
+#else
+#define LEAVE_HEAT( heat_map, index, temperature, output )
+#endif
+
+/*
+ * Bug attributes: ideal temperature, output heat and random move chance. With BUG_ATTRIBUTES they are floats loaded
+ * from a bug file, read by bug from the caller's 'bug_attrs': NUM_BUG_ATTRS arrays of BUGS_NUMBER floats, one after
+ * the other as in the file, so the reads of consecutive bugs are coalesced. Otherwise they are the 8 bit fields of
+ * the bug, and the global random move chance. Same values in the host.
+ * */
+#define ATTR_IDEAL_TEMPERATURE	0
+#define ATTR_OUTPUT_HEAT	1
+#define ATTR_MOVE_CHANCE	2
+#define NUM_BUG_ATTRS		3
+
+#if BUG_ATTRIBUTES
+	#define BUG_ATTR( attr, bug_id )		bug_attrs[ (attr) * BUGS_NUMBER + (bug_id) ]
+
+	#define BUG_IDEAL_TEMPERATURE( bug, bug_id )	BUG_ATTR( ATTR_IDEAL_TEMPERATURE, (bug_id) )
+	#define BUG_OUTPUT_HEAT( bug, bug_id )		BUG_ATTR( ATTR_OUTPUT_HEAT, (bug_id) )
+	#define BUG_MOVE_CHANCE( bug_id )		BUG_ATTR( ATTR_MOVE_CHANCE, (bug_id) )
+#else
+	#define BUG_IDEAL_TEMPERATURE( bug, bug_id )	convert_float( GET_BUG_IDEAL_TEMPERATURE( bug ) )
+	#define BUG_OUTPUT_HEAT( bug, bug_id )		convert_float( GET_BUG_OUTPUT_HEAT( bug ) )
+	#if DETERMINISTIC
+		#define BUG_MOVE_CHANCE( bug_id )	((float) BUGS_RANDOM_MOVE_CHANCE)	/* As 'randomFloat(...)'. */
+	#else
+		#define BUG_MOVE_CHANCE( bug_id )	BUGS_RANDOM_MOVE_CHANCE
+	#endif
+#endif
+
 
 
 
@@ -143,8 +307,146 @@
 
 
 
+/*
+ * World memory layout.
+ *
+ * With WORLD_TILE = 0 the maps are row-major vectors. Otherwise the world is stored as square tiles of
+ * WORLD_TILE x WORLD_TILE cells, contiguous in memory, with the tiles themselves in row-major order, so the North and
+ * South neighbours of most cells are close to the cell. The last tile row / column are padded up to WORLD_TILE, so
+ * the maps have WORLD_STORAGE_SIZE cells. Padding cells are never addressed by the helpers bellow.
+ *
+ * Kernels never compute a map index by hand, they use these helpers. Bug positions are storage indices.
+ * WORLD_TILE is a power of 2, so tiled addressing compiles to shifts and masks.
+ * */
+
+/*
+ * Toroidal wrap of neighbouring rows and columns.
+ *
+ * Selected at program build time: with a power of 2 dimension the wrap is a mask, otherwise it is a compare and
+ * select. Either way, no integer modulo and no branch is needed, for border or interior cells alike.
+ *
+ * In a closed box a neighbouring row or column past an edge is clamped to the edge, so it is still a valid address,
+ * and HAS_*(...) tells it is not there. On a torus every neighbour is there.
+ * */
+#if BOUNDARY == BOUNDARY_BOX
+	#define COL_EAST( c )	select( (c) + 1, (c), (c) + 1 == WORLD_WIDTH )
+	#define COL_WEST( c )	select( (c) - 1, (c), (c) == 0 )
+	#define ROW_NORTH( r )	select( (r) + 1, (r), (r) + 1 == WORLD_HEIGHT )
+	#define ROW_SOUTH( r )	select( (r) - 1, (r), (r) == 0 )
+
+	#define HAS_EAST( c )	(uint) ((c) + 1 < WORLD_WIDTH)
+	#define HAS_WEST( c )	(uint) ((c) > 0)
+	#define HAS_NORTH( r )	(uint) ((r) + 1 < WORLD_HEIGHT)
+	#define HAS_SOUTH( r )	(uint) ((r) > 0)
+#else
+	#if WORLD_WIDTH_POW2
+		#define COL_EAST( c )	(((c) + 1) & (WORLD_WIDTH - 1))
+		#define COL_WEST( c )	(((c) - 1) & (WORLD_WIDTH - 1))
+	#else
+		#define COL_EAST( c )	select( (c) + 1, 0u, (c) + 1 == WORLD_WIDTH )
+		#define COL_WEST( c )	select( (c) - 1, WORLD_WIDTH - 1u, (c) == 0 )
+	#endif
+
+	#if WORLD_HEIGHT_POW2
+		#define ROW_NORTH( r )	(((r) + 1) & (WORLD_HEIGHT - 1))
+		#define ROW_SOUTH( r )	(((r) - 1) & (WORLD_HEIGHT - 1))
+	#else
+		#define ROW_NORTH( r )	select( (r) + 1, 0u, (r) + 1 == WORLD_HEIGHT )
+		#define ROW_SOUTH( r )	select( (r) - 1, WORLD_HEIGHT - 1u, (r) == 0 )
+	#endif
+
+	#define HAS_EAST( c )	1u
+	#define HAS_WEST( c )	1u
+	#define HAS_NORTH( r )	1u
+	#define HAS_SOUTH( r )	1u
+#endif
+
+
+/*
+ * The neighbourhood, expanded at build time. FOR_EACH_NEIGHBOUR( X ) expands X( direction, row, col, there ) for
+ * each neighbour, in the order the neighbours are summed and listed. Rows and columns are the caller's 'rc' and 'cc',
+ * the cell, and 'rn', 'rs', 'ce', 'cw' around it, the flags 'hn', 'hs', 'he', 'hw' their HAS_*(...). FOR_EACH_SLOT( X )
+ * expands X( i ) for each index of a neighbour list, so loops over the neighbours are unrolled by the preprocessor.
+ * */
+#if NEIGHBOURHOOD == NEIGHBOURS_VON_NEUMANN
+
+enum {S = 0, W, E, N};
+
+#define NEIGHBOUR_LIST		{S, W, E, N}
+
+#define FOR_EACH_NEIGHBOUR( X ) \
+	X( S,  rs, cc, hs ) \
+	X( W,  rc, cw, hw ) \
+	X( E,  rc, ce, he ) \
+	X( N,  rn, cc, hn )
+
+#define FOR_EACH_SLOT( X )	X( 0 ) X( 1 ) X( 2 ) X( 3 )
+
+#else
+
 enum {SW = 0, S, SE, W, E, NW, N, NE};
 
+#define NEIGHBOUR_LIST		{SW, S, SE, W, E, NW, N, NE}
+
+#define FOR_EACH_NEIGHBOUR( X ) \
+	X( SW, rs, cw, hs & hw ) \
+	X( S,  rs, cc, hs ) \
+	X( SE, rs, ce, hs & he ) \
+	X( W,  rc, cw, hw ) \
+	X( E,  rc, ce, he ) \
+	X( NW, rn, cw, hn & hw ) \
+	X( N,  rn, cc, hn ) \
+	X( NE, rn, ce, hn & he )
+
+#define FOR_EACH_SLOT( X )	X( 0 ) X( 1 ) X( 2 ) X( 3 ) X( 4 ) X( 5 ) X( 6 ) X( 7 )
+
+#endif
+
+/*
+ * Fill the caller's 'neighbour[ dir ]' with the position and the temperature of a neighbour. A neighbour past a closed
+ * box edge is the cell 'own' of the bug, so a bug never steps out of the world: choosing it is staying.
+ * */
+#define GET_NEIGHBOUR( dir, row, col, there ) \
+	neighbour[ dir ].s0 = select( own, cell_index( (row), (col) ), (there) ); \
+	neighbour[ dir ].s1 = as_uint( heat_map[ neighbour[ dir ].s0 ] );
+
+
+
+/* Storage index of the cell at (row, col). */
+inline uint cell_index( uint row, uint col )
+{
+#if WORLD_TILE
+	return ((row / WORLD_TILE) * WORLD_TILES_X + col / WORLD_TILE) * (WORLD_TILE * WORLD_TILE)
+		+ (row % WORLD_TILE) * WORLD_TILE + col % WORLD_TILE;
+#else
+	return row * WORLD_WIDTH + col;
+#endif
+}
+
+
+
+/* Row of the cell stored at 'index'. */
+inline uint cell_row( uint index )
+{
+#if WORLD_TILE
+	return (index / (WORLD_TILE * WORLD_TILE)) / WORLD_TILES_X * WORLD_TILE + (index % (WORLD_TILE * WORLD_TILE)) / WORLD_TILE;
+#else
+	return index / WORLD_WIDTH;
+#endif
+}
+
+
+
+/* Column of the cell stored at 'index'. */
+inline uint cell_col( uint index )
+{
+#if WORLD_TILE
+	return (index / (WORLD_TILE * WORLD_TILE)) % WORLD_TILES_X * WORLD_TILE + index % WORLD_TILE;
+#else
+	return index % WORLD_WIDTH;
+#endif
+}
+
 
 /*
  * https://gist.github.com/Marc-B-Reynolds/0b5f1db5ad7a3e453596
@@ -177,6 +479,91 @@ inline uint rand_xorShift32( __global uint *rng_state )
 
 
 
+/*
+ * Bug placement, how 'init_swarm' chooses the bug cells. Same values in the host.
+ * */
+#define PLACE_RANDOM		0	/* Random cells, retried until empty. */
+#define PLACE_PERMUTE		1	/* The first BUGS_NUMBER cells of a random permutation of the world. */
+#define PLACE_FILE		2	/* Cells given by the host, in 'swarm_bugPosition'. */
+
+#define PERMUTE_ROUNDS		4
+
+
+
+/*
+ * Round function of the Feistel network below: a multiply / xor-shift hash of the half block and the round key.
+ * */
+inline uint permute_round( uint half, uint key )
+{
+	half = (half ^ key) * 0x9e3779b1;
+	half ^= half >> 15;
+	half *= 0x85ebca6b;
+	half ^= half >> 13;
+
+	return half;
+}
+
+
+
+/*
+ * Keyed random permutation of the world cells, [0 .. WORLD_SIZE[, row-major.
+ *
+ * A balanced Feistel network is a permutation of [0 .. 4^PERMUTE_HALF_BITS[, the smallest such range covering the
+ * world. Values past the world are fed back to it until they fall inside, (cycle walking), what makes it a
+ * permutation of the world. The range is less than 4 times the world, so few rounds are walked. Keys come from
+ * 'seed', a different permutation each run.
+ * */
+inline uint permute_cell( uint index, const uint seed )
+{
+	const uint mask = (1u << PERMUTE_HALF_BITS) - 1;
+
+	__private uint left, right, next, round;
+
+	do {
+		left = index >> PERMUTE_HALF_BITS;
+		right = index & mask;
+
+		for (round = 0; round < PERMUTE_ROUNDS; round++)
+		{
+			next = left ^ (permute_round( right, seed + round * 0x632be5ab ) & mask);
+			left = right;
+			right = next;
+		}
+
+		index = (left << PERMUTE_HALF_BITS) | right;
+
+	} while (index >= WORLD_SIZE);
+
+	return index;
+}
+
+
+
+#if DETERMINISTIC
+
+/*
+ * Return random float in range [min .. max[. Single precision, the same on devices with and without doubles.
+ * The rng_state is updated.
+ * */
+inline float randomFloat( uint min, uint max, __global uint *rng_state )
+{
+	return convert_float( max - min ) * (convert_float( rand_xorShift32( rng_state ) ) * ( 1.0f / 4294967296.0f ))
+		+ convert_float( min );
+}
+
+
+
+/*
+ * Return random integer in range [min .. max[. Integer arithmetic, same values as the double version.
+ * The rng_state is updated.
+ * */
+inline uint randomInt( uint min, uint max, __global uint *rng_state )
+{
+	return min + (uint) (((ulong) rand_xorShift32( rng_state ) * (max - min)) >> 32);
+}
+
+#else
+
 /*
  * Return random float in range [min .. max[.
  * The rng_state is updated.
@@ -197,6 +584,8 @@ inline uint randomInt( uint min, uint max, __global uint *rng_state )
 	return (max - min) * (double) rand_xorShift32( rng_state ) * ( 1.0 / 4294967296.0 ) + min;
 }
 
+#endif
+
 
 
 /*
@@ -210,19 +599,26 @@ inline uint randomInt( uint min, uint max, __global uint *rng_state )
 inline uint2 best_neighbour( int todo, __global float *heat_map, __private uint2 best_bug_locus, __global uint *rng_state )
 {
 	/* Bug vector position in the world to 2D position. */
-	__private const uint rc = best_bug_locus.s0 / WORLD_WIDTH;    			/* Central row. */
-	__private const uint cc = best_bug_locus.s0 % WORLD_WIDTH;			/* Central col. */
+	__private const uint rc = cell_row( best_bug_locus.s0 );			/* Central row. */
+	__private const uint cc = cell_col( best_bug_locus.s0 );			/* Central col. */
+	__private const uint own = best_bug_locus.s0;					/* Bug's cell.  */
 
 	/* Neighbouring rows and columns. */
-	__private const uint rn = (rc + 1) % WORLD_HEIGHT;				/* Row at North.   */
-	__private const uint rs = (rc + WORLD_HEIGHT - 1) % WORLD_HEIGHT;		/* Row at South.   */
-	__private const uint ce = (cc + 1) % WORLD_WIDTH;				/* Column at East. */
-	__private const uint cw = (cc + WORLD_WIDTH - 1) % WORLD_WIDTH;			/* Column at West. */
+	__private const uint rn = ROW_NORTH( rc );					/* Row at North.   */
+	__private const uint rs = ROW_SOUTH( rc );					/* Row at South.   */
+	__private const uint ce = COL_EAST( cc );					/* Column at East. */
+	__private const uint cw = COL_WEST( cc );					/* Column at West. */
+
+	/* Whether they are in the world. */
+	__private const uint hn = HAS_NORTH( rc );
+	__private const uint hs = HAS_SOUTH( rc );
+	__private const uint he = HAS_EAST( cc );
+	__private const uint hw = HAS_WEST( cc );
 
 	__private uint2 neighbour[ NUM_NEIGHBOURS ];	/* NOTE: neighbour[..].s0 is position, neighbour[..].s1 is temperature. */
 
 	/* To index neighbours. Randomly picks the first free neighbouring cell. */
-	__private uint NEIGHBOUR_IDX[ NUM_NEIGHBOURS ] = {SW, S, SE, W, E, NW, N, NE};
+	__private uint NEIGHBOUR_IDX[ NUM_NEIGHBOURS ] = NEIGHBOUR_LIST;
 
 
 	/*
@@ -241,32 +637,33 @@ inline uint2 best_neighbour( int todo, __global float *heat_map, __private uint2
 	}
 
 
-	/* Compute back the vector positions. Used on both, best location and random location. */
-	neighbour[ SW ].s0 = rs * WORLD_WIDTH + cw;				/* SW neighbour position in the vector. */
-	neighbour[ S  ].s0 = rs * WORLD_WIDTH + cc;				/* S  neighbour position in the vector. */
-	neighbour[ SE ].s0 = rs * WORLD_WIDTH + ce;				/* SE neighbour position in the vector. */
-	neighbour[ W  ].s0 = rc * WORLD_WIDTH + cw;				/* W  neighbour position in the vector. */
-	neighbour[ E  ].s0 = rc * WORLD_WIDTH + ce;				/* E  neighbour position in the vector. */
-	neighbour[ NW ].s0 = rn * WORLD_WIDTH + cw;				/* NW neighbour position in the vector. */
-	neighbour[ N  ].s0 = rn * WORLD_WIDTH + cc;				/* N  neighbour position in the vector. */
-	neighbour[ NE ].s0 = rn * WORLD_WIDTH + ce;				/* NE neighbour position in the vector. */
-
-	/* Fetch temperature of all neighbouring positions. Store float in uint using OpenCL type reinterpretation. */
-	neighbour[ SW ].s1 = as_uint( heat_map[ neighbour[ SW ].s0 ] );		/* Temperature at SW cell. */
-	neighbour[ S  ].s1 = as_uint( heat_map[ neighbour[ S  ].s0 ] );		/* Temperature at S  cell. */
-	neighbour[ SE ].s1 = as_uint( heat_map[ neighbour[ SE ].s0 ] );		/* Temperature at SE cell. */
-	neighbour[ W  ].s1 = as_uint( heat_map[ neighbour[ W  ].s0 ] );		/* Temperature at W  cell. */
-	neighbour[ E  ].s1 = as_uint( heat_map[ neighbour[ E  ].s0 ] );		/* Temperature at E  cell. */
-	neighbour[ NW ].s1 = as_uint( heat_map[ neighbour[ NW ].s0 ] );		/* Temperature at NW cell. */
-	neighbour[ N  ].s1 = as_uint( heat_map[ neighbour[ N  ].s0 ] );		/* Temperature at N  cell. */
-	neighbour[ NE ].s1 = as_uint( heat_map[ neighbour[ NE ].s0 ] );		/* Temperature at NE cell. */
+	/*
+	   Compute back the vector positions, used on both, best location and random location, and fetch their
+	   temperatures. Store float in uint using OpenCL type reinterpretation.
+	 * */
+	FOR_EACH_NEIGHBOUR( GET_NEIGHBOUR )
 
 
 	/** Here there is a random moving chance. **/
 
 	/* Because NEIGHBOUR_IDX is a shuffled vector, whatever the index is, it return a random position. */
+#if BOUNDARY == BOUNDARY_BOX
+	/* Past the box edges, neighbours are the bug's own cell: take the first other one. */
+	#define ANY_SLOT( i ) \
+		if (neighbour[ NEIGHBOUR_IDX[ i ] ].s0 != own) return neighbour[ NEIGHBOUR_IDX[ i ] ];
+
+	if (todo == GET_ANY_NEIGHBOUR)
+	{
+		FOR_EACH_SLOT( ANY_SLOT )
+
+		return best_bug_locus;
+	}
+
+	#undef ANY_SLOT
+#else
 	if (todo == GET_ANY_NEIGHBOUR)
 		return neighbour[ NEIGHBOUR_IDX[ 0 ] ];
+#endif
 
 
 	/** Here there is either, GET_MAX_TEMP_NEIGHBOUR or GET_MIN_TEMP_NEIGHBOUR. **/
@@ -275,58 +672,108 @@ inline uint2 best_neighbour( int todo, __global float *heat_map, __private uint2
 	/* best_bug_locus variable has the actual bug's location, and local temperature until otherwise! */
 
 	/* Loop unroll. */
+	#define MAX_TEMP_SLOT( i ) \
+		if (as_float( neighbour[ NEIGHBOUR_IDX[ i ] ].s1 ) > as_float( best_bug_locus.s1 )) \
+			best_bug_locus = neighbour[ NEIGHBOUR_IDX[ i ] ];
+
+	#define MIN_TEMP_SLOT( i ) \
+		if (as_float( neighbour[ NEIGHBOUR_IDX[ i ] ].s1 ) < as_float( best_bug_locus.s1 )) \
+			best_bug_locus = neighbour[ NEIGHBOUR_IDX[ i ] ];
+
 	if (todo == GET_MAX_TEMP_NEIGHBOUR)
 	{
-		if (as_float( neighbour[ NEIGHBOUR_IDX[ 0 ] ].s1 ) > as_float( best_bug_locus.s1 ))
-			best_bug_locus = neighbour[ NEIGHBOUR_IDX[ 0 ] ];
+		FOR_EACH_SLOT( MAX_TEMP_SLOT )
+	}
+	else	/* todo == GET_MIN_TEMP_NEIGHBOUR */
+	{
+		FOR_EACH_SLOT( MIN_TEMP_SLOT )
+	}
+
+	#undef MAX_TEMP_SLOT
+	#undef MIN_TEMP_SLOT
+
+	return best_bug_locus;
+}
+
 
-		if (as_float( neighbour[ NEIGHBOUR_IDX[ 1 ] ].s1 ) > as_float( best_bug_locus.s1 ))
-			best_bug_locus = neighbour[ NEIGHBOUR_IDX[ 1 ] ];
 
-		if (as_float( neighbour[ NEIGHBOUR_IDX[ 2 ] ].s1 ) > as_float( best_bug_locus.s1 ))
-			best_bug_locus = neighbour[ NEIGHBOUR_IDX[ 2 ] ];
+/*
+ * Neighbour choice of the binned bug step, without branches. Where 'best_neighbour' shuffles the neighbours, drawing a
+ * random number per neighbour, here they are scanned from a random start, a single draw. Ties are still broken at
+ * random, and the bug's own place wins ties with its neighbours as there.
+ *
+ * Both choices are computed, the random one and the best one, and the bin selects: all the work-items of a bin run the
+ * same instructions.
+ * */
+inline uint2 binned_neighbour( const uint bin, __global float *heat_map, __private uint2 best_bug_locus,
+				__global uint *rng_state )
+{
+	/* Bug vector position in the world to 2D position. */
+	__private const uint rc = cell_row( best_bug_locus.s0 );			/* Central row. */
+	__private const uint cc = cell_col( best_bug_locus.s0 );			/* Central col. */
+	__private const uint own = best_bug_locus.s0;					/* Bug's cell.  */
 
-		if (as_float( neighbour[ NEIGHBOUR_IDX[ 3 ] ].s1 ) > as_float( best_bug_locus.s1 ))
-			best_bug_locus = neighbour[ NEIGHBOUR_IDX[ 3 ] ];
+	/* Neighbouring rows and columns. */
+	__private const uint rn = ROW_NORTH( rc );					/* Row at North.   */
+	__private const uint rs = ROW_SOUTH( rc );					/* Row at South.   */
+	__private const uint ce = COL_EAST( cc );					/* Column at East. */
+	__private const uint cw = COL_WEST( cc );					/* Column at West. */
 
-		if (as_float( neighbour[ NEIGHBOUR_IDX[ 4 ] ].s1 ) > as_float( best_bug_locus.s1 ))
-			best_bug_locus = neighbour[ NEIGHBOUR_IDX[ 4 ] ];
+	/* Whether they are in the world. */
+	__private const uint hn = HAS_NORTH( rc );
+	__private const uint hs = HAS_SOUTH( rc );
+	__private const uint he = HAS_EAST( cc );
+	__private const uint hw = HAS_WEST( cc );
 
-		if (as_float( neighbour[ NEIGHBOUR_IDX[ 5 ] ].s1 ) > as_float( best_bug_locus.s1 ))
-			best_bug_locus = neighbour[ NEIGHBOUR_IDX[ 5 ] ];
+	__private uint2 neighbour[ NUM_NEIGHBOURS ];	/* NOTE: neighbour[..].s0 is position, neighbour[..].s1 is temperature. */
 
-		if (as_float( neighbour[ NEIGHBOUR_IDX[ 6 ] ].s1 ) > as_float( best_bug_locus.s1 ))
-			best_bug_locus = neighbour[ NEIGHBOUR_IDX[ 6 ] ];
+	/* Start of the scan. NUM_NEIGHBOURS is a power of 2, so the scan wraps with a mask. */
+	__private const uint rotation = randomInt( 0, NUM_NEIGHBOURS, rng_state );
 
-		if (as_float( neighbour[ NEIGHBOUR_IDX[ 7 ] ].s1 ) > as_float( best_bug_locus.s1 ))
-			best_bug_locus = neighbour[ NEIGHBOUR_IDX[ 7 ] ];
-	}
-	else	/* todo == GET_MIN_TEMP_NEIGHBOUR */
-	{
-		if (as_float( neighbour[ NEIGHBOUR_IDX[ 0 ] ].s1 ) < as_float( best_bug_locus.s1 ))
-			best_bug_locus = neighbour[ NEIGHBOUR_IDX[ 0 ] ];
+	/* Warmer is better for a cold bug, cooler for a hot one: compare temperatures times 'sign'. */
+	__private const float sign = select( -1.0f, 1.0f, (int) (bin == BIN_COLD) );
 
-		if (as_float( neighbour[ NEIGHBOUR_IDX[ 1 ] ].s1 ) < as_float( best_bug_locus.s1 ))
-			best_bug_locus = neighbour[ NEIGHBOUR_IDX[ 1 ] ];
+	__private uint2 any_bug_locus = best_bug_locus;
+	__private uint2 candidate;
+	__private uint take;
 
-		if (as_float( neighbour[ NEIGHBOUR_IDX[ 2 ] ].s1 ) < as_float( best_bug_locus.s1 ))
-			best_bug_locus = neighbour[ NEIGHBOUR_IDX[ 2 ] ];
 
-		if (as_float( neighbour[ NEIGHBOUR_IDX[ 3 ] ].s1 ) < as_float( best_bug_locus.s1 ))
-			best_bug_locus = neighbour[ NEIGHBOUR_IDX[ 3 ] ];
+	FOR_EACH_NEIGHBOUR( GET_NEIGHBOUR )
 
-		if (as_float( neighbour[ NEIGHBOUR_IDX[ 4 ] ].s1 ) < as_float( best_bug_locus.s1 ))
-			best_bug_locus = neighbour[ NEIGHBOUR_IDX[ 4 ] ];
+	#define TAKE( locus ) \
+		locus.s0 = select( locus.s0, candidate.s0, take ); \
+		locus.s1 = select( locus.s1, candidate.s1, take );
 
-		if (as_float( neighbour[ NEIGHBOUR_IDX[ 5 ] ].s1 ) < as_float( best_bug_locus.s1 ))
-			best_bug_locus = neighbour[ NEIGHBOUR_IDX[ 5 ] ];
+	/* Random place. */
+#if BOUNDARY == BOUNDARY_BOX
+	/* Past the box edges, neighbours are the bug's own cell. Scanning backwards, the last other one is the first. */
+	#define ANY_SLOT( i ) \
+		candidate = neighbour[ (rotation + NUM_NEIGHBOURS - 1 - (i)) & (NUM_NEIGHBOURS - 1) ]; \
+		take = (uint) (candidate.s0 != own); \
+		TAKE( any_bug_locus )
 
-		if (as_float( neighbour[ NEIGHBOUR_IDX[ 6 ] ].s1 ) < as_float( best_bug_locus.s1 ))
-			best_bug_locus = neighbour[ NEIGHBOUR_IDX[ 6 ] ];
+	FOR_EACH_SLOT( ANY_SLOT )
 
-		if (as_float( neighbour[ NEIGHBOUR_IDX[ 7 ] ].s1 ) < as_float( best_bug_locus.s1 ))
-			best_bug_locus = neighbour[ NEIGHBOUR_IDX[ 7 ] ];
-	}
+	#undef ANY_SLOT
+#else
+	any_bug_locus = neighbour[ rotation ];
+#endif
+
+	/* Best place. Strictly better only, so the first best from the start wins. */
+	#define BEST_SLOT( i ) \
+		candidate = neighbour[ (rotation + (i)) & (NUM_NEIGHBOURS - 1) ]; \
+		take = (uint) (sign * as_float( candidate.s1 ) > sign * as_float( best_bug_locus.s1 )); \
+		TAKE( best_bug_locus )
+
+	FOR_EACH_SLOT( BEST_SLOT )
+
+	#undef BEST_SLOT
+
+	candidate = any_bug_locus;
+	take = (uint) (bin == BIN_RANDOM);
+	TAKE( best_bug_locus )
+
+	#undef TAKE
 
 	return best_bug_locus;
 }
@@ -337,19 +784,26 @@ inline uint2 any_free_neighbour( __global float *heat_map, __global uint *swarm_
 					__global uint *rng_state )
 {
 	/* Bug vector position in the world to 2D position. */
-	__private const uint rc = bug_locus.s0 / WORLD_WIDTH;				/* Central row. */
-	__private const uint cc = bug_locus.s0 % WORLD_WIDTH;				/* Central col. */
+	__private const uint rc = cell_row( bug_locus.s0 );				/* Central row. */
+	__private const uint cc = cell_col( bug_locus.s0 );				/* Central col. */
+	__private const uint own = bug_locus.s0;					/* Bug's cell.  */
 
 	/* Neighbouring rows and columns. */
-	__private const uint rn = (rc + 1) % WORLD_HEIGHT;				/* Row at North.   */
-	__private const uint rs = (rc + WORLD_HEIGHT - 1) % WORLD_HEIGHT;		/* Row at South.   */
-	__private const uint ce = (cc + 1) % WORLD_WIDTH;				/* Column at East. */
-	__private const uint cw = (cc + WORLD_WIDTH - 1) % WORLD_WIDTH;			/* Column at West. */
+	__private const uint rn = ROW_NORTH( rc );					/* Row at North.   */
+	__private const uint rs = ROW_SOUTH( rc );					/* Row at South.   */
+	__private const uint ce = COL_EAST( cc );					/* Column at East. */
+	__private const uint cw = COL_WEST( cc );					/* Column at West. */
+
+	/* Whether they are in the world. */
+	__private const uint hn = HAS_NORTH( rc );
+	__private const uint hs = HAS_SOUTH( rc );
+	__private const uint he = HAS_EAST( cc );
+	__private const uint hw = HAS_WEST( cc );
 
 	__private uint2 neighbour[ NUM_NEIGHBOURS ];	/* NOTE: neighbour[..].s0 is position, neighbour[..].s1 is temperature. */
 
 	/* To index neighbours. Randomly picks the first free neighbouring cell. */
-	__private uint NEIGHBOUR_IDX[ NUM_NEIGHBOURS ] = {SW, S, SE, W, E, NW, N, NE};
+	__private uint NEIGHBOUR_IDX[ NUM_NEIGHBOURS ] = NEIGHBOUR_LIST;
 
 
 	/*
@@ -368,174 +822,374 @@ inline uint2 any_free_neighbour( __global float *heat_map, __global uint *swarm_
 	}
 
 
-	/* Compute back the vector positions. Used on both, best location and random location. */
-	neighbour[ SW ].s0 = rs * WORLD_WIDTH + cw;				/* SW neighbour position in the vector. */
-	neighbour[ S  ].s0 = rs * WORLD_WIDTH + cc;				/* S  neighbour position in the vector. */
-	neighbour[ SE ].s0 = rs * WORLD_WIDTH + ce;				/* SE neighbour position in the vector. */
-	neighbour[ W  ].s0 = rc * WORLD_WIDTH + cw;				/* W  neighbour position in the vector. */
-	neighbour[ E  ].s0 = rc * WORLD_WIDTH + ce;				/* E  neighbour position in the vector. */
-	neighbour[ NW ].s0 = rn * WORLD_WIDTH + cw;				/* NW neighbour position in the vector. */
-	neighbour[ N  ].s0 = rn * WORLD_WIDTH + cc;				/* N  neighbour position in the vector. */
-	neighbour[ NE ].s0 = rn * WORLD_WIDTH + ce;				/* NE neighbour position in the vector. */
-
-	/* Fetch temperature of all neighbouring positions. Store float in uint using OpenCL type reinterpretation. */
-	neighbour[ SW ].s1 = as_uint( heat_map[ neighbour[ SW ].s0 ] );		/* Temperature at SW cell. */
-	neighbour[ S  ].s1 = as_uint( heat_map[ neighbour[ S  ].s0 ] );		/* Temperature at S  cell. */
-	neighbour[ SE ].s1 = as_uint( heat_map[ neighbour[ SE ].s0 ] );		/* Temperature at SE cell. */
-	neighbour[ W  ].s1 = as_uint( heat_map[ neighbour[ W  ].s0 ] );		/* Temperature at W  cell. */
-	neighbour[ E  ].s1 = as_uint( heat_map[ neighbour[ E  ].s0 ] );		/* Temperature at E  cell. */
-	neighbour[ NW ].s1 = as_uint( heat_map[ neighbour[ NW ].s0 ] );		/* Temperature at NW cell. */
-	neighbour[ N  ].s1 = as_uint( heat_map[ neighbour[ N  ].s0 ] );		/* Temperature at N  cell. */
-	neighbour[ NE ].s1 = as_uint( heat_map[ neighbour[ NE ].s0 ] );		/* Temperature at NE cell. */
+	/*
+	   Compute back the vector positions, used on both, best location and random location, and fetch their
+	   temperatures. Store float in uint using OpenCL type reinterpretation.
+	 * */
+	FOR_EACH_NEIGHBOUR( GET_NEIGHBOUR )
 
 
 	/** Find any / random free position and return that position along with his temperature. **/
 
 	/* Right now, rand_bug_locus variable has the current bug's location. */
 
-	/* Loop unroll. */
-	if (HAS_NO_BUG( swarm_map[ neighbour[ NEIGHBOUR_IDX[ 0 ] ].s0 ] ))
-		// rand_bug_locus = neighbour[ NEIGHBOUR_IDX[ 0 ] ];
-		return neighbour[ NEIGHBOUR_IDX[ 0 ] ];
+	/* Loop unroll. The bug's own cell, listed for neighbours past a box edge, is never free. */
+	#define FREE_SLOT( i ) \
+		if (HAS_NO_BUG( swarm_map[ neighbour[ NEIGHBOUR_IDX[ i ] ].s0 ] )) \
+			return neighbour[ NEIGHBOUR_IDX[ i ] ];
 
-	if (HAS_NO_BUG( swarm_map[ neighbour[ NEIGHBOUR_IDX[ 1 ] ].s0 ] ))
-		// rand_bug_locus = neighbour[ NEIGHBOUR_IDX[ 1 ] ];
-		return neighbour[ NEIGHBOUR_IDX[ 1 ] ];
+	FOR_EACH_SLOT( FREE_SLOT )
 
-	if (HAS_NO_BUG( swarm_map[ neighbour[ NEIGHBOUR_IDX[ 2 ] ].s0 ] ))
-		// rand_bug_locus = neighbour[ NEIGHBOUR_IDX[ 2 ] ];
-		return neighbour[ NEIGHBOUR_IDX[ 2 ] ];
+	#undef FREE_SLOT
 
-	if (HAS_NO_BUG( swarm_map[ neighbour[ NEIGHBOUR_IDX[ 3 ] ].s0 ] ))
-		// rand_bug_locus = neighbour[ NEIGHBOUR_IDX[ 3 ] ];
-		return neighbour[ NEIGHBOUR_IDX[ 3 ] ];
 
-	if (HAS_NO_BUG( swarm_map[ neighbour[ NEIGHBOUR_IDX[ 4 ] ].s0 ] ))
-		// rand_bug_locus = neighbour[ NEIGHBOUR_IDX[ 4 ] ];
-		return neighbour[ NEIGHBOUR_IDX[ 4 ] ];
+	return bug_locus;
+}
 
-	if (HAS_NO_BUG( swarm_map[ neighbour[ NEIGHBOUR_IDX[ 5 ] ].s0 ] ))
-		// rand_bug_locus = neighbour[ NEIGHBOUR_IDX[ 5 ] ];
-		return neighbour[ NEIGHBOUR_IDX[ 5 ] ];
 
-	if (HAS_NO_BUG( swarm_map[ neighbour[ NEIGHBOUR_IDX[ 6 ] ].s0 ] ))
-		// rand_bug_locus = neighbour[ NEIGHBOUR_IDX[ 6 ] ];
-		return neighbour[ NEIGHBOUR_IDX[ 6 ] ];
 
-	if (HAS_NO_BUG( swarm_map[ neighbour[ NEIGHBOUR_IDX[ 7 ] ].s0 ] ))
-		// rand_bug_locus = neighbour[ NEIGHBOUR_IDX[ 7 ] ];
-		return neighbour[ NEIGHBOUR_IDX[ 7 ] ];
 
+/*
+ * Compute the new heat of the cell at (rc, cc): diffusion from and to the neighbouring cells, followed by evaporation.
+ * Used by every kernel variant that computes the world heat, so they all perform the same arithmetic.
+ * */
+inline float world_heat_cell( __global float *heat_map, uint rc, uint cc )
+{
+	/* Compute required neighbouring coodinates. */
+	__private const uint rn = ROW_NORTH( rc );				/* Row at North.    */
+	__private const uint rs = ROW_SOUTH( rc );				/* Row at South.    */
+	__private const uint ce = COL_EAST( cc );				/* Column at East.  */
+	__private const uint cw = COL_WEST( cc );				/* Columns at West. */
 
-	return bug_locus;
-}
+	/* Whether they are in the world. */
+	__private const uint hn = HAS_NORTH( rc );
+	__private const uint hs = HAS_SOUTH( rc );
+	__private const uint he = HAS_EAST( cc );
+	__private const uint hw = HAS_WEST( cc );
 
+	__private const float own = heat_map[ cell_index( rc, cc ) ];
 
+	__private float heat = 0.0f;
 
 
-/**
- * ************* KERNELS ******************
- * */
+	/** Compute Diffusion */
 
+	/*
+	   Store heat from neighbouring cells. A neighbour past a box edge counts as the cell itself: the share of heat
+	   the cell would give it stays in the cell.
+	 * */
+	#define ADD_NEIGHBOUR_HEAT( dir, row, col, there ) \
+		heat = heat + select( own, heat_map[ cell_index( (row), (col) ) ], (there) );
 
-/**
- * Initiates the random generator by fill a vector of seeds / initial rng state.
- * Wang Hash, hash one integer into another.
- * Obliterate any correlation in the seeds when going wide (parallel), prior
- * any use of a PRNG (going deep).
- * Correlation comes from sequential global ID's of each workitem.
- * */
-__kernel void init_random( __global uint *rng_state )
-{
-	__private uint seed;
+	FOR_EACH_NEIGHBOUR( ADD_NEIGHBOUR_HEAT )
 
-	const uint gid = get_global_id( 0 );
+	#undef ADD_NEIGHBOUR_HEAT
 
-	if (gid >= BUGS_NUMBER) return;
 
-	seed = gid ^ INIT_SEED;      /* Add diversity at each run. */
+	/* Get the NUM_NEIGHBOURS part of diffusion percentage from all neighbour cells. */
+	heat = heat * HEAT_DIFFUSION / NUM_NEIGHBOURS;
 
-	/* Use Wang Hash to decorrelate numbers. */
-	seed = (seed ^ 61) ^ (seed >> 16);
-	seed += (seed << 3);
-	seed = seed ^ (seed >> 4);
-	seed *= 0x27d4eb2d;
-	seed = seed ^ (seed >> 15);
+	/* Add cell's remaining heat. */
+	heat = heat + own * HEAT_REMAINING;
 
-	/* Store result in global space. */
-	rng_state[ gid ] = seed;
+	/* Compute Evaporation */
+	heat = heat * HEAT_KEPT;
 
-	return;
+	return heat;
 }
 
 
 
-__kernel void init_maps( __global uint *swarm_map, __global float *heat_map, __global float *heat_buffer )
+
+/*
+ * Sum the work-group's 'partial_sums', one per work-item, with a tree reduction. Every work-item returns the sum.
+ * The work-group size must be a power of 2, and all work-items of the group must call it.
+ * */
+inline float reduce_local_sum( __local float *partial_sums )
 {
-	const uint gid = get_global_id( 0 );
+	const uint lid = get_local_id( 0 );
 
-	if (gid >= WORLD_SIZE) return;
+	for (uint iter = get_local_size( 0 ) / 2; iter > 0; iter >>= 1)
+	{
+		if (lid < iter)
+			partial_sums[ lid ] += partial_sums[ lid + iter ];
 
-	swarm_map[ gid ] = EMPTY_CELL;	/* Clean all bugs from the map. */
-	heat_map[ gid ] = 0.0;	     	/* Reset all temperatures from map. */
-	heat_buffer[ gid ] = 0.0;    	/* Reset all temperatures from buffer. */
+		barrier( CLK_LOCAL_MEM_FENCE );
+	}
 
-	return;
+	return partial_sums[ 0 ];
 }
 
 
 
-/**
- * Fill the world (swarm_map) with bugs, store their position (swarm_bugPosition).
- * Initiate the unhappiness for each bug.
+/*
+ * Unhappiness sums of the two step reduction, as selected by UNHAPP_ACCUM. Same values in the host.
+ *
+ * UNHAPP_FLOAT sums in single precision, the fast path. UNHAPP_KAHAN keeps a single precision sum and the rounding
+ * error of every addition, (s0, s1), summed as Neumaier's compensated summation: the tree merges two pairs with an
+ * exact two-sum of their sums, so the error lost is the one of the compensations only. UNHAPP_DOUBLE sums in double
+ * precision, on devices with cl_khr_fp64.
+ *
+ * UNHAPP_FIXED sums in fixed point, UNHAPP_FIXED_ONE being 1, so additions are exact and the sum does not depend on
+ * their order, (i.e. on the work sizes). 64 bits hold sums up to 2^44, (e.g. 2^24 bugs with unhappiness up to 2^20).
+ * It is the one of the DETERMINISTIC mode.
  * */
-__kernel void init_swarm( __global uint *swarm_bugPosition, __global uint *swarm_map, __global float *unhappiness,
-				__global uint *rng_state )
-{
-	__private uint bug_locus;
-	__private uint bug_ideal_temperature;	/* [0..200] */
-	__private uint bug_output_heat;		/* [0..100] */
-	__private uint bug_new;
-	__private uint on_locus;
+#define UNHAPP_FLOAT		0
+#define UNHAPP_KAHAN		1
+#define UNHAPP_DOUBLE		2
+#define UNHAPP_FIXED		3
 
+#if UNHAPP_ACCUM == UNHAPP_FIXED
 
-	const uint bug_id = get_global_id( 0 );
+	#define UNHAPP_FIXED_ONE	1048576.0f	/* 2^20 */
 
-	if (bug_id >= BUGS_NUMBER) return;
+	typedef ulong unhapp_sum;
 
+	#define UNHAPP_ZERO		0
+	#define UNHAPP_TO_SUM( u )	convert_ulong_rte( (u) * UNHAPP_FIXED_ONE )
+	#define UNHAPP_ADD( a, b )	((a) + (b))
+	#define UNHAPP_AVERAGE( s )	(convert_float_rte( s ) * (1.0f / UNHAPP_FIXED_ONE / BUGS_NUMBER))
 
-	bug_ideal_temperature = (ushort) randomInt( BUGS_TEMPERATURE_MIN_IDEAL,
-							BUGS_TEMPERATURE_MAX_IDEAL, &rng_state[ bug_id ] );
+#elif UNHAPP_ACCUM == UNHAPP_DOUBLE
 
-	bug_output_heat = (ushort) randomInt( BUGS_HEAT_MIN_OUTPUT, BUGS_HEAT_MAX_OUTPUT, &rng_state[ bug_id ] );
+	typedef double unhapp_sum;
 
-	/* Create a bug. */
-	BUG_NEW( bug_new );
-	SET_BUG_IDEAL_TEMPERATURE( bug_new, bug_ideal_temperature );
-	SET_BUG_OUTPUT_HEAT( bug_new, bug_output_heat );
+	#define UNHAPP_ZERO		0.0
+	#define UNHAPP_TO_SUM( u )	convert_double( u )
+	#define UNHAPP_ADD( a, b )	((a) + (b))
+	#define UNHAPP_AVERAGE( s )	convert_float( (s) / BUGS_NUMBER )
 
-	/* Try, until succeed, to leave a bug in a empty space. */
-	do {
-		bug_locus = randomInt( 0, WORLD_SIZE, &rng_state[ bug_id ] );
+#elif UNHAPP_ACCUM == UNHAPP_KAHAN
 
-		on_locus = atomic_cmpxchg( &swarm_map[ bug_locus ], EMPTY_CELL, bug_new );
+	typedef float2 unhapp_sum;
 
-	} while ( HAS_BUG( on_locus ) );
+	#define UNHAPP_ZERO		(float2)( 0.0f, 0.0f )
+	#define UNHAPP_TO_SUM( u )	(float2)( (u), 0.0f )
+	#define UNHAPP_ADD( a, b )	kahan_add( (a), (b) )
+	#define UNHAPP_AVERAGE( s )	(((s).s0 + (s).s1) / BUGS_NUMBER)
 
-	barrier( CLK_GLOBAL_MEM_FENCE );	/* All still active workitems must arrive here to sync before go on. */
+/*
+ * Compensated sum of two (sum, compensation) pairs. The two-sum gives the exact rounding error of 'a.s0 + b.s0',
+ * whatever their magnitudes. No multiplications, so it holds under FP_CONTRACT too.
+ * */
+inline float2 kahan_add( float2 a, float2 b )
+{
+	const float sum = a.s0 + b.s0;
+	const float b_virtual = sum - a.s0;
+	const float error = (a.s0 - (sum - b_virtual)) + (b.s0 - b_virtual);
 
-	/* Store bug position in the swarm. */
-	swarm_bugPosition[ bug_id ] = bug_locus;
+	return (float2)( sum, a.s1 + b.s1 + error );
+}
 
-	/*
-	   Compute initial unhappiness as abs(ideal_temperature - temperature).
-	   Since world temperature is initially zero, it turns out that initial
-	   unhappiness = ideal_temperature.
-	 * */
+#else
 
-	/* REPLACED: unhappiness[ bug_id ] = (float) bug_ideal_temperature; */
+	typedef float unhapp_sum;
+
+	#define UNHAPP_ZERO		0.0f
+	#define UNHAPP_TO_SUM( u )	(u)
+	#define UNHAPP_ADD( a, b )	((a) + (b))
+	#define UNHAPP_AVERAGE( s )	((s) / BUGS_NUMBER)
+
+#endif
+
+#if UNHAPP_ACCUM == UNHAPP_FLOAT
+
+	#define REDUCE_UNHAPP( p )	reduce_local_sum( (p) )
+
+#else
+
+	#define REDUCE_UNHAPP( p )	reduce_local_unhapp( (p) )
+
+/*
+ * As 'reduce_local_sum(...)', for the other accumulators.
+ * */
+inline unhapp_sum reduce_local_unhapp( __local unhapp_sum *partial_sums )
+{
+	const uint lid = get_local_id( 0 );
+
+	for (uint iter = get_local_size( 0 ) / 2; iter > 0; iter >>= 1)
+	{
+		if (lid < iter)
+			partial_sums[ lid ] = UNHAPP_ADD( partial_sums[ lid ], partial_sums[ lid + iter ] );
+
+		barrier( CLK_LOCAL_MEM_FENCE );
+	}
+
+	return partial_sums[ 0 ];
+}
+
+#endif
+
+
+
+
+/**
+ * ************* KERNELS ******************
+ * */
+
+
+/**
+ * Initiates the random generator by fill a vector of seeds / initial rng state.
+ * Wang Hash, hash one integer into another.
+ * Obliterate any correlation in the seeds when going wide (parallel), prior
+ * any use of a PRNG (going deep).
+ * Correlation comes from sequential global ID's of each workitem.
+ * */
+__kernel void init_random( __global uint *rng_state, const uint seed )
+{
+	__private uint state;
+
+	const uint gid = get_global_id( 0 );
+
+	if (gid >= BUGS_NUMBER) return;
+
+	state = gid ^ seed;      /* Add diversity at each run. */
+
+	/* Use Wang Hash to decorrelate numbers. */
+	state = (state ^ 61) ^ (state >> 16);
+	state += (state << 3);
+	state = state ^ (state >> 4);
+	state *= 0x27d4eb2d;
+	state = state ^ (state >> 15);
+
+	/* Store result in global space. */
+	rng_state[ gid ] = state;
+
+	return;
+}
+
+
+
+__kernel void init_maps( __global uint *swarm_map, __global float *heat_map, __global float *heat_buffer,
+				__global uint *tile_flags, __global uint *active_count, __global uint *claims,
+				__global uint *bin_count, __global const float *scenario_heat,
+				__global const uchar *scenario_obstacles )
+{
+	const uint gid = get_global_id( 0 );
+
+	if (gid >= WORLD_STORAGE_SIZE) return;	/* Tile padding is also cleared. */
+
+#if SCENARIO_HEAT || SCENARIO_OBSTACLES
+	/* The scenario is row-major, the maps may be tiled. Tile padding is outside the world. */
+	const uint row = cell_row( gid );
+	const uint col = cell_col( gid );
+	const uint in_world = (row < WORLD_HEIGHT) && (col < WORLD_WIDTH);
+	const uint cell = row * WORLD_WIDTH + col;
+#endif
+
+#if DETERMINISTIC
+	claims[ gid ] = NO_CLAIM;
+#endif
+
+#if ACTIVE_TILE
+	/* All tiles active in the first iteration, both work list counters clear. */
+	if (gid < ACTIVE_TILES) tile_flags[ gid ] = ACTIVE_NOW | ACTIVE_LAST;
+	if (gid < 2) active_count[ gid ] = 0;
+#endif
+
+#if BINNED_STEP
+	/* Both bin counter sets clear. */
+	if (gid < 2 * NUM_BINS) bin_count[ gid ] = 0;
+#endif
+
+#if SCENARIO_OBSTACLES
+	/* Clean all bugs from the map, leaving the obstacles. */
+	swarm_map[ gid ] = (in_world && scenario_obstacles[ cell ]) ? OBSTACLE_CELL : EMPTY_CELL;
+#else
+	swarm_map[ gid ] = EMPTY_CELL;	/* Clean all bugs from the map. */
+#endif
+
+#if SCENARIO_HEAT
+	/* Both heat maps from the scenario's initial heat. */
+	const float heat = in_world ? scenario_heat[ cell ] : 0.0f;
+
+	heat_map[ gid ] = heat;
+	heat_buffer[ gid ] = heat;
+#else
+	heat_map[ gid ] = 0.0;	     	/* Reset all temperatures from map. */
+	heat_buffer[ gid ] = 0.0;    	/* Reset all temperatures from buffer. */
+#endif
+
+	return;
+}
+
+
+
+/**
+ * Fill the world (swarm_map) with bugs, store their position (swarm_bugPosition).
+ * Initiate the unhappiness for each bug.
+ *
+ * Bug cells are chosen as INIT_PLACEMENT says. PLACE_RANDOM retries random cells until an empty one is found, what
+ * gets slow and divergent in crowded worlds. PLACE_PERMUTE takes the cells of the bug indices in a random permutation,
+ * all distinct, so no retries, keyed by 'seed'. PLACE_FILE takes the row-major cells left by the host in
+ * 'swarm_bugPosition', checked to be distinct.
+ * */
+__kernel void init_swarm( __global uint *swarm_bugPosition, __global uint *swarm_map, __global float *unhappiness,
+				__global uint *rng_state, const uint seed, __global float *bug_attrs )
+{
+	__private uint bug_locus;
+	__private uint bug_ideal_temperature;	/* [0..200] */
+	__private uint bug_output_heat;		/* [0..100] */
+	__private uint bug_new;
+	__private uint on_locus;
+
+
+	const uint bug_id = get_global_id( 0 );
+
+	if (bug_id >= BUGS_NUMBER) return;
+
+
+#if BUG_ATTRIBUTES
+	/* From the bug file. The bug fields keep them rounded, for the readers of the swarm map. */
+	bug_ideal_temperature = min( convert_uint_sat_rte( BUG_ATTR( ATTR_IDEAL_TEMPERATURE, bug_id ) ), 255u );
+	bug_output_heat = min( convert_uint_sat_rte( BUG_ATTR( ATTR_OUTPUT_HEAT, bug_id ) ), 255u );
+#else
+	bug_ideal_temperature = (ushort) randomInt( BUGS_TEMPERATURE_MIN_IDEAL,
+							BUGS_TEMPERATURE_MAX_IDEAL, &rng_state[ bug_id ] );
+
+	bug_output_heat = (ushort) randomInt( BUGS_HEAT_MIN_OUTPUT, BUGS_HEAT_MAX_OUTPUT, &rng_state[ bug_id ] );
+#endif
+
+	/* Create a bug. */
+	BUG_NEW( bug_new );
+	SET_BUG_IDEAL_TEMPERATURE( bug_new, bug_ideal_temperature );
+	SET_BUG_OUTPUT_HEAT( bug_new, bug_output_heat );
+
+#if INIT_PLACEMENT == PLACE_RANDOM
+	/* Try, until succeed, to leave a bug in a empty space. */
+	do {
+		bug_locus = randomInt( 0, WORLD_SIZE, &rng_state[ bug_id ] );
+		bug_locus = cell_index( bug_locus / WORLD_WIDTH, bug_locus % WORLD_WIDTH );
+
+		on_locus = atomic_cmpxchg( &swarm_map[ bug_locus ], EMPTY_CELL, bug_new );
+
+	} while ( HAS_BUG( on_locus ) );
+#else
+	/* The bug's own cell, no other bug gets it. */
+#if INIT_PLACEMENT == PLACE_PERMUTE
+	bug_locus = permute_cell( bug_id, seed );
+#else
+	bug_locus = swarm_bugPosition[ bug_id ];
+#endif
+	bug_locus = cell_index( bug_locus / WORLD_WIDTH, bug_locus % WORLD_WIDTH );
+
+	swarm_map[ bug_locus ] = bug_new;
+#endif
+
+	barrier( CLK_GLOBAL_MEM_FENCE );	/* All still active workitems must arrive here to sync before go on. */
+
+	/* Store bug position in the swarm. */
+	swarm_bugPosition[ bug_id ] = bug_locus;
+
+	/*
+	   Compute initial unhappiness as abs(ideal_temperature - temperature).
+	   Since world temperature is initially zero, it turns out that initial
+	   unhappiness = ideal_temperature.
+	 * */
+
+	/* REPLACED: unhappiness[ bug_id ] = (float) bug_ideal_temperature; */
 	/* With OpenCL type convertion.                                     */
-	unhappiness[ bug_id ] = convert_float( bug_ideal_temperature );
+	unhappiness[ bug_id ] = BUG_IDEAL_TEMPERATURE( bug_new, bug_id );
 
 	return;
 }
@@ -585,33 +1239,98 @@ __kernel void prepare_step_report( __global uint *bug_step_retry )
 
 
 
+/*
+ * Move a bug, its private copy 'bug' set to rest, from 'bug_locus' to 'bug_new_locus'. When that is the place it is,
+ * the bug stays. When it is taken, the bug is left wanting to move and a retry is reported. Shared by 'bug_best_step'
+ * and 'bug_step_binned'.
+ * */
+inline void bug_best_move( const uint bug_id, __global uint *swarm_bugPosition, __global uint *swarm_map,
+				__global float *heat_map, __global uint *bug_step_retry, __global uint *moves,
+				const uint bug, const uint2 bug_locus, const uint2 bug_new_locus, const float bug_output_heat )
+{
+	__private uint on_locus;
+
+
+	/* If bug's current location is already the best one... */
+	if (bug_new_locus.s0 == bug_locus.s0)
+	{
+		/* Bug hasn't move, we don't need to update swarm_bugPosition. */
+
+		/* Put the resting bug in his old position, (that is 'resting' status override). */
+		atomic_xchg( &swarm_map[ bug_locus.s0 ], bug );
+
+		/* Leave heat in the old bug position. Remember bug_locus.s1 is temperature at bug position. */
+		LEAVE_HEAT( heat_map, bug_locus.s0, as_float( bug_locus.s1 ), bug_output_heat );
+
+		return;
+	}
+
+
+	/* Otherwise, try to store the resting bug in his new 'best' location and return.
+	   REMEMBER OpenCL specs:	atomic_cmpxchg( *p, cmp, val )   perform the operations:
+	   	old = *p;
+	   	*p = (old == cmp) ? val : old;
+	   	return old;
+	 * */
+	on_locus = atomic_cmpxchg( &swarm_map[ bug_new_locus.s0 ], EMPTY_CELL, bug );
+
+	if (HAS_NO_BUG( on_locus ))
+	{
+		/* SUCCESS! Reset old bug location. Should be atomic in case another work-item try to read. */
+		atomic_xchg( &swarm_map[ bug_locus.s0 ], EMPTY_CELL );
+
+		/* Update bug position in the swarm. */
+		swarm_bugPosition[ bug_id ] = bug_new_locus.s0;
+
+		/* Leave heat in the new bug position. */
+		LEAVE_HEAT( heat_map, bug_new_locus.s0, as_float( bug_new_locus.s1 ), bug_output_heat );
+
+		COUNT_MOVE( moves );
+
+		return;
+	}
+
+
+	/**
+	   Here, the best place become or was unavailable.
+	   The bug did'n move, and the bug is left in the 'want to move' state for 'bug_step_any_free(...)'. Bugs start
+	   each iteration at rest, so this is what makes the 'prepare_bug_step(...)' kernel unnecessary.
+	 * */
+	SET_BUG_TO_MOVE_ATOMIC( &swarm_map[ bug_locus.s0 ] );
+
+	/* Signal the host to call bug_step_any_free(...) kernel. */
+	REPORT_REPEAT_STEP( *bug_step_retry );
+
+	return;
+}
+
+
+
 /**
  * Perform a bug movement in the world.
  *
  * Netlogo completely separates the report of the 'best' / 'random' location from the actual bug movement. Only when
  * perform 'bug movevent', the availability (status) of the reported 'best' / 'random' location is checked, and only then
  * a new alternate free location, if exists, is computed if necessary.
+ *
+ * Step of bug 'bug_id', shared by the 'bug_step_best' kernel and the megakernel. 'bug_step_retry' is the flag to
+ * report to, 'moves' counts the bugs that move.
  * */
-__kernel void bug_step_best( __global uint *swarm_bugPosition, __global uint *swarm_map, __global float *heat_map,
-				__global float *unhappiness, __global uint *bug_step_retry, __global uint *rng_state )
+inline void bug_best_step( const uint bug_id, __global uint *swarm_bugPosition, __global uint *swarm_map,
+				__global float *heat_map, __global float *unhappiness, __global uint *bug_step_retry,
+				__global uint *rng_state, __global uint *moves, __global float *bug_attrs )
 {
 	__private uint2 bug_locus;		/* bug_locus.s0 is bug position, bug_locus.s1 is local temperature. */
 	__private uint2 bug_new_locus;		/* bug_new_locus.s0 is bug position, bug_new_locus.s1 is local temperature. */
-	__private uint bug_ideal_temperature;	/* 0,1,2,...,200 */
-	__private uint bug_output_heat;		/* 0,1,2,...,100 */
+	__private float bug_ideal_temperature;	/* 0,1,2,...,200, or any from a bug file. */
+	__private float bug_output_heat;	/* 0,1,2,...,100, or any from a bug file. */
 	__private float bug_unhappiness;
 
 	__private uint bug;
-	__private uint on_locus;
 
 	__private int todo;
 
 
-	const uint bug_id = get_global_id( 0 );
-
-	if (bug_id >= BUGS_NUMBER) return;
-
-
 	/* Get the bug location. */
 	bug_locus.s0 = swarm_bugPosition[ bug_id ];
 
@@ -630,14 +1349,12 @@ __kernel void bug_step_best( __global uint *swarm_bugPosition, __global uint *sw
 	/* Get local temperature. Store float as uint using OpenCL type reinterpretation. */
 	bug_locus.s1 = as_uint( heat_map[ bug_locus.s0 ] );
 
-	bug_ideal_temperature = GET_BUG_IDEAL_TEMPERATURE( bug );
-	bug_output_heat = GET_BUG_OUTPUT_HEAT( bug );
+	bug_ideal_temperature = BUG_IDEAL_TEMPERATURE( bug, bug_id );
+	bug_output_heat = BUG_OUTPUT_HEAT( bug, bug_id );
 
 	SET_BUG_TO_REST( bug );						/* Set bug's private copy into resting state. */
 
-	/* IDEA: use CL typecast ? */
-	// bug_unhappiness = fabs( (float) bug_ideal_temperature - as_float( bug_locus.s1 ) );
-	bug_unhappiness = fabs( convert_float( bug_ideal_temperature ) - as_float( bug_locus.s1 ) );
+	bug_unhappiness = fabs( bug_ideal_temperature - as_float( bug_locus.s1 ) );
 
 	/* Update bug's unhappiness vector in global memory. */
 	unhappiness[ bug_id ] = bug_unhappiness;
@@ -656,7 +1373,7 @@ __kernel void bug_step_best( __global uint *swarm_bugPosition, __global uint *sw
 		atomic_xchg( &swarm_map[ bug_locus.s0 ], bug );
 
 		/* Leave heat in the old bug position. Remember bug_locus.s1 is temperature at bug position. */
-		heat_map[ bug_locus.s0 ] = as_float( bug_locus.s1 ) + convert_float( bug_output_heat );
+		LEAVE_HEAT( heat_map, bug_locus.s0, as_float( bug_locus.s1 ), bug_output_heat );
 
 		return;
 	}
@@ -678,85 +1395,181 @@ __kernel void bug_step_best( __global uint *swarm_bugPosition, __global uint *sw
 	   REMEMBER OpenCL specs:	select(a, b, c), implements:	(c) ? b : a
 	 * */
 
-	todo = select( GET_MIN_TEMP_NEIGHBOUR, GET_MAX_TEMP_NEIGHBOUR, as_float( bug_locus.s1 ) < (float) bug_ideal_temperature );
-	todo = select( todo, GET_ANY_NEIGHBOUR, randomFloat( 0, 100, &rng_state[ bug_id ] ) < BUGS_RANDOM_MOVE_CHANCE );
+	todo = select( GET_MIN_TEMP_NEIGHBOUR, GET_MAX_TEMP_NEIGHBOUR, as_float( bug_locus.s1 ) < bug_ideal_temperature );
+	todo = select( todo, GET_ANY_NEIGHBOUR, randomFloat( 0, 100, &rng_state[ bug_id ] ) < BUG_MOVE_CHANCE( bug_id ) );
 
 	bug_new_locus = best_neighbour( todo, heat_map, bug_locus, &rng_state[ bug_id ] );
 
+	bug_best_move( bug_id, swarm_bugPosition, swarm_map, heat_map, bug_step_retry, moves, bug, bug_locus,
+			bug_new_locus, bug_output_heat );
 
-	/* If bug's current location is already the best one... */
-	if (bug_new_locus.s0 == bug_locus.s0)
-	{
-		/* Bug hasn't move, we don't need to update swarm_bugPosition. */
+	return;
+}
 
-		/* Put the resting bug in his old position, (that is 'resting' status override). */
-		atomic_xchg( &swarm_map[ bug_locus.s0 ], bug );
 
-		/* Leave heat in the old bug position. Remember bug_locus.s1 is temperature at bug position. */
-		heat_map[ bug_locus.s0 ] = as_float( bug_locus.s1 ) + convert_float( bug_output_heat );
 
-		return;
-	}
+__kernel void bug_step_best( __global uint *swarm_bugPosition, __global uint *swarm_map, __global float *heat_map,
+				__global float *unhappiness, __global uint *bug_step_retry, __global uint *rng_state,
+				const uint retry_slot, __global uint *conv_state, __global uint *tile_flags,
+				__global float *bug_attrs )
+{
+	const uint bug_id = get_global_id( 0 );
 
+	/* Clear the retry slot for the next bug step launch. */
+	if (bug_id == 0) RESET_REPEAT_STEP( bug_step_retry[ OTHER_RETRY_SLOT( retry_slot ) ] );
 
-	/* Otherwise, try to store the resting bug in his new 'best' location and return.
-	   REMEMBER OpenCL specs:	atomic_cmpxchg( *p, cmp, val )   perform the operations:
-	   	old = *p;
-	   	*p = (old == cmp) ? val : old;
-	   	return old;
-	 * */
-	on_locus = atomic_cmpxchg( &swarm_map[ bug_new_locus.s0 ], EMPTY_CELL, bug );
+	if (bug_id >= BUGS_NUMBER) return;
 
-	if (HAS_NO_BUG( on_locus ))
+	bug_best_step( bug_id, swarm_bugPosition, swarm_map, heat_map, unhappiness, &bug_step_retry[ retry_slot ],
+			rng_state, &conv_state[ CONV_MOVES ], bug_attrs );
+
+	/* The bug left heat where it is now, (or will, if it moves to any free place). */
+	MARK_ACTIVE_TILE( tile_flags, swarm_bugPosition[ bug_id ] );
+
+	return;
+}
+
+
+
+/*
+ * Binned bug step, first pass. In 'bug_step_best' the bugs of a warp / wavefront want different things, and take
+ * different branches: stay, move at random, move warmer or cooler. Here each bug is only classified, happy bugs stay,
+ * and the others are listed in the bin of what they want, in 'bin_list'. The second pass, 'bug_step_binned', then
+ * runs the bugs of a bin side by side.
+ *
+ * The random move chance is drawn here, as in 'bug_best_step', from the state of the bug. Bugs are counted in the
+ * 'bin_count' set 'bin_slot', and the other set, read by the previous second pass, is cleared for the next iteration.
+ * */
+__kernel void bug_step_classify( __global uint *swarm_bugPosition, __global uint *swarm_map, __global float *heat_map,
+				__global float *unhappiness, __global uint *rng_state, __global uint *tile_flags,
+				__global uint *bin_list, __global uint *bin_count, const uint bin_slot,
+				__global float *bug_attrs )
+{
+	const uint bug_id = get_global_id( 0 );
+
+	__private uint bug_locus;
+	__private uint bug;
+	__private uint bin;
+	__private float temperature;
+	__private float bug_ideal_temperature;
+	__private float bug_unhappiness;
+
+
+	if (bug_id < NUM_BINS) bin_count[ OTHER_BIN_SLOT( bin_slot ) * NUM_BINS + bug_id ] = 0;
+
+	if (bug_id >= BUGS_NUMBER) return;
+
+	bug_locus = swarm_bugPosition[ bug_id ];
+	bug = swarm_map[ bug_locus ];
+	temperature = heat_map[ bug_locus ];
+
+	bug_ideal_temperature = BUG_IDEAL_TEMPERATURE( bug, bug_id );
+	bug_unhappiness = fabs( bug_ideal_temperature - temperature );
+
+	unhappiness[ bug_id ] = bug_unhappiness;
+
+	/* Happy bug, it stays and leaves heat, as in 'bug_best_step'. */
+	if (bug_unhappiness == 0.0f)
 	{
-		/* SUCCESS! Reset old bug location. Should be atomic in case another work-item try to read. */
-		atomic_xchg( &swarm_map[ bug_locus.s0 ], EMPTY_CELL );
+		SET_BUG_TO_REST( bug );
 
-		/* Update bug position in the swarm. */
-		swarm_bugPosition[ bug_id ] = bug_new_locus.s0;
+		atomic_xchg( &swarm_map[ bug_locus ], bug );
 
-		/* Leave heat in the new bug position. */
-		heat_map[ bug_new_locus.s0 ] = as_float( bug_new_locus.s1 ) + convert_float( bug_output_heat );
+		LEAVE_HEAT( heat_map, bug_locus, temperature, BUG_OUTPUT_HEAT( bug, bug_id ) );
+
+		MARK_ACTIVE_TILE( tile_flags, bug_locus );
 
 		return;
 	}
 
+	/* As the 'todo' of 'bug_best_step': a random move takes precedence. */
+	bin = select( BIN_HOT, BIN_COLD, temperature < bug_ideal_temperature );
+	bin = select( bin, (uint) BIN_RANDOM, randomFloat( 0, 100, &rng_state[ bug_id ] ) < BUG_MOVE_CHANCE( bug_id ) );
 
-	/**
-	   Here, the best place become or was unavailable.
-	   The bug did'n move, and the bug 'want to move' status remain the same.
-	 * */
-
-	/* Signal the host to call bug_step_any_free(...) kernel. */
-	REPORT_REPEAT_STEP( *bug_step_retry );
+	bin_list[ bin * BUGS_NUMBER + atomic_inc( &bin_count[ bin_slot * NUM_BINS + bin ] ) ] = bug_id;
 
 	return;
 }
 
 
 
-__kernel void bug_step_any_free( __global uint *swarm_bugPosition, __global uint *swarm_map, __global float *heat_map,
-					 __global uint *bug_step_retry, __global uint *rng_state )
+/*
+ * Binned bug step, second pass. The bins listed by 'bug_step_classify' are laid one after the other over the
+ * work-items, so all the work-items of a warp / wavefront but those across a bin end run the same bin. Each bug picks
+ * its place with 'binned_neighbour', from its own random state, and moves as in 'bug_best_step'.
+ * */
+__kernel void bug_step_binned( __global uint *swarm_bugPosition, __global uint *swarm_map, __global float *heat_map,
+				__global uint *bug_step_retry, __global uint *rng_state, const uint retry_slot,
+				__global uint *conv_state, __global uint *tile_flags, __global uint *bin_list,
+				__global uint *bin_count, const uint bin_slot, __global float *bug_attrs )
 {
+	const uint gid = get_global_id( 0 );
+
+	/* Ends of the bins over the work-items. */
+	const uint end_random = bin_count[ bin_slot * NUM_BINS + BIN_RANDOM ];
+	const uint end_cold = end_random + bin_count[ bin_slot * NUM_BINS + BIN_COLD ];
+	const uint end_hot = end_cold + bin_count[ bin_slot * NUM_BINS + BIN_HOT ];
+
 	__private uint2 bug_locus;		/* bug_locus.s0 is bug position, bug_locus.s1 is local temperature. */
 	__private uint2 bug_new_locus;		/* bug_new_locus.s0 is bug position, bug_new_locus.s1 is local temperature. */
-	__private uint bug_output_heat;		/* 0,1,2,...,100 */
+	__private uint bug_id;
 	__private uint bug;
-	__private uint on_locus;
+	__private uint bin;
+	__private uint first;
 
 
-	const uint bug_id = get_global_id( 0 );
+	/* Clear the retry slot for the next bug step launch. */
+	if (gid == 0) RESET_REPEAT_STEP( bug_step_retry[ OTHER_RETRY_SLOT( retry_slot ) ] );
 
-	if (bug_id >= BUGS_NUMBER) return;
+	if (gid >= end_hot) return;
 
+	bin = select( select( (uint) BIN_RANDOM, (uint) BIN_COLD, gid >= end_random ), (uint) BIN_HOT, gid >= end_cold );
+	first = select( select( 0u, end_random, gid >= end_random ), end_cold, gid >= end_cold );
+
+	bug_id = bin_list[ bin * BUGS_NUMBER + gid - first ];
 
-	/* Get the bug location. */
 	bug_locus.s0 = swarm_bugPosition[ bug_id ];
+	bug_locus.s1 = as_uint( heat_map[ bug_locus.s0 ] );
 
-	/*  Get a private copy of the bug while keeping the original in the swarm. */
+	/* Private copy of the bug, at rest, (see 'bug_best_step'). */
 	bug = swarm_map[ bug_locus.s0 ];
+	SET_BUG_TO_REST( bug );
 
-	/* Check if bug has already moved in this iteration to a best position. If it has moved, then exit. */
+	bug_new_locus = binned_neighbour( bin, heat_map, bug_locus, &rng_state[ bug_id ] );
+
+	bug_best_move( bug_id, swarm_bugPosition, swarm_map, heat_map, &bug_step_retry[ retry_slot ],
+			&conv_state[ CONV_MOVES ], bug, bug_locus, bug_new_locus, BUG_OUTPUT_HEAT( bug, bug_id ) );
+
+	/* The bug left heat where it is now, (or will, if it moves to any free place). */
+	MARK_ACTIVE_TILE( tile_flags, swarm_bugPosition[ bug_id ] );
+
+	return;
+}
+
+
+
+/*
+ * Step of a bug that could not move to its best place, to any free neighbour. Shared by the 'bug_step_any_free'
+ * kernel and the megakernel. 'bug_step_retry' is the flag to report to, 'moves' counts the bugs that move.
+ * */
+inline void bug_any_free_step( const uint bug_id, __global uint *swarm_bugPosition, __global uint *swarm_map,
+					__global float *heat_map, __global uint *bug_step_retry, __global uint *rng_state,
+					__global uint *moves, __global float *bug_attrs )
+{
+	__private uint2 bug_locus;		/* bug_locus.s0 is bug position, bug_locus.s1 is local temperature. */
+	__private uint2 bug_new_locus;		/* bug_new_locus.s0 is bug position, bug_new_locus.s1 is local temperature. */
+	__private float bug_output_heat;	/* 0,1,2,...,100, or any from a bug file. */
+	__private uint bug;
+	__private uint on_locus;
+
+
+	/* Get the bug location. */
+	bug_locus.s0 = swarm_bugPosition[ bug_id ];
+
+	/*  Get a private copy of the bug while keeping the original in the swarm. */
+	bug = swarm_map[ bug_locus.s0 ];
+
+	/* Check if bug has already moved in this iteration to a best position. If it has moved, then exit. */
 	if (BUG_HAS_MOVED( bug )) return;
 
 
@@ -765,153 +1578,733 @@ __kernel void bug_step_any_free( __global uint *swarm_bugPosition, __global uint
 	/* Get local temperature. Store float as uint using OpenCL type reinterpretation. */
 	bug_locus.s1 = as_uint( heat_map[ bug_locus.s0 ] );
 
-	bug_output_heat = GET_BUG_OUTPUT_HEAT( bug );
+	bug_output_heat = BUG_OUTPUT_HEAT( bug, bug_id );
 
 	SET_BUG_TO_REST( bug );						/* Set bug's private copy into resting state. */
 
 
-	/* Find random available position or return the same position. */
-	bug_new_locus = any_free_neighbour( heat_map, swarm_map, bug_locus, &rng_state[ bug_id ] );
+	/* Find random available position or return the same position. */
+	bug_new_locus = any_free_neighbour( heat_map, swarm_map, bug_locus, &rng_state[ bug_id ] );
+
+
+	/* If bug's new location is the current one, there are no available neighbours. */
+	if (bug_new_locus.s0 == bug_locus.s0)
+	{
+		/* Bug hasn't move, we don't need to update swarm_bugPosition. */
+
+		/* Put the resting bug in his old position, (that is 'resting' status override). */
+		atomic_xchg( &swarm_map[ bug_locus.s0 ], bug );
+
+		/* Leave heat in the old bug position. Remember bug_locus.s1 is temperature at bug position. */
+		LEAVE_HEAT( heat_map, bug_locus.s0, as_float( bug_locus.s1 ), bug_output_heat );
+
+		return;
+	}
+
+
+	/* Otherwise, try to store the bug in his new 'free' location and return.
+	   REMEMBER OpenCL specs:	atomic_cmpxchg( *p, cmp, val )   perform the operations:
+	   	old = *p;
+	   	*p = (old == cmp) ? val : old;
+	   	return old;
+	 * */
+	on_locus = atomic_cmpxchg( &swarm_map[ bug_new_locus.s0 ], EMPTY_CELL, bug );
+
+	if (HAS_NO_BUG( on_locus ))
+	{
+		/* SUCCESS! Reset old bug location. Should be atomic in case another work-item try to read. */
+		atomic_xchg( &swarm_map[ bug_locus.s0 ], EMPTY_CELL );
+
+		/* Update bug position in the swarm. */
+		swarm_bugPosition[ bug_id ] = bug_new_locus.s0;
+
+		/* Leave heat in the new bug position. */
+		LEAVE_HEAT( heat_map, bug_new_locus.s0, as_float( bug_new_locus.s1 ), bug_output_heat );
+
+		COUNT_MOVE( moves );
+
+		return;
+	}
+
+
+	/* Signal the host to call bug_step_any_free(...) kernel. */
+	REPORT_REPEAT_STEP( *bug_step_retry );
+
+
+	return;
+}
+
+
+
+__kernel void bug_step_any_free( __global uint *swarm_bugPosition, __global uint *swarm_map, __global float *heat_map,
+					 __global uint *bug_step_retry, __global uint *rng_state, const uint retry_slot,
+					 __global uint *conv_state, __global uint *tile_flags, __global float *bug_attrs )
+{
+	const uint bug_id = get_global_id( 0 );
+
+	/* Clear the retry slot for the next bug step launch. */
+	if (bug_id == 0) RESET_REPEAT_STEP( bug_step_retry[ OTHER_RETRY_SLOT( retry_slot ) ] );
+
+	if (bug_id >= BUGS_NUMBER) return;
+
+	bug_any_free_step( bug_id, swarm_bugPosition, swarm_map, heat_map, &bug_step_retry[ retry_slot ], rng_state,
+				&conv_state[ CONV_MOVES ], bug_attrs );
+
+	MARK_ACTIVE_TILE( tile_flags, swarm_bugPosition[ bug_id ] );
+
+	return;
+}
+
+
+
+/**
+ * Deterministic bug step, DETERMINISTIC mode. Results do not depend on the order work-items run in.
+ *
+ * A bug step is done in passes of three launches: 'bug_step_claim', 'bug_step_resolve' and 'bug_step_release'.
+ * Claim reads the world as left by the previous pass, and writes nothing of it: each bug picks its target cell, as
+ * 'bug_best_step(...)' in the first pass and as 'bug_any_free_step(...)' in the next ones, and claims it if it is
+ * free. Of all the bugs claiming a cell, the one with the lowest priority gets it, (atomic_min is order independent).
+ * Resolve moves the winners, leaves the heat of the bugs done and reports the losers to the host, for another pass.
+ * Release clears the claims for the next pass.
+ *
+ * Cells taken by a bug at the start of the pass are never free, even if that bug moves away in the same pass. Each
+ * bug leaves heat once, on a cell no other bug is on, so plain stores are enough.
+ *
+ * Priorities are a bijective hash of the bug id, keyed by 'step_key', the pass number given by the host, so the
+ * same bug does not always win, and by the run's 'seed'.
+ * */
+inline uint claim_priority( const uint bug_id, const uint step_key, const uint seed )
+{
+	__private uint x = bug_id ^ permute_round( step_key, seed );
+
+	/* Xor-shift and odd multiply steps, each one invertible. */
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+
+	return x;
+}
+
+
+
+__kernel void bug_step_claim( __global uint *swarm_bugPosition, __global uint *swarm_map, __global float *heat_map,
+				__global float *unhappiness, __global uint *rng_state, __global uint *bug_target,
+				__global uint *claims, const uint step_key, const uint first_pass, const uint seed,
+				__global float *bug_attrs )
+{
+	__private uint2 bug_locus;		/* bug_locus.s0 is bug position, bug_locus.s1 is local temperature. */
+	__private uint2 bug_new_locus;		/* bug_new_locus.s0 is bug position, bug_new_locus.s1 is local temperature. */
+	__private float bug_ideal_temperature;	/* 0,1,2,...,200, or any from a bug file. */
+	__private float bug_unhappiness;
+	__private uint bug;
+	__private int todo;
+
+
+	const uint bug_id = get_global_id( 0 );
+
+	if (bug_id >= BUGS_NUMBER) return;
+
+
+	bug_locus.s0 = swarm_bugPosition[ bug_id ];
+	bug_locus.s1 = as_uint( heat_map[ bug_locus.s0 ] );
+
+	bug = swarm_map[ bug_locus.s0 ];
+
+	if (first_pass)
+	{
+		/* Unhappiness and best place, as in 'bug_best_step(...)'. */
+		bug_ideal_temperature = BUG_IDEAL_TEMPERATURE( bug, bug_id );
+
+		bug_unhappiness = fabs( bug_ideal_temperature - as_float( bug_locus.s1 ) );
+
+		unhappiness[ bug_id ] = bug_unhappiness;
+
+		if (bug_unhappiness == 0.0f)
+		{
+			bug_target[ bug_id ] = bug_locus.s0;
+			return;
+		}
+
+		todo = select( GET_MIN_TEMP_NEIGHBOUR, GET_MAX_TEMP_NEIGHBOUR, as_float( bug_locus.s1 ) < bug_ideal_temperature );
+		todo = select( todo, GET_ANY_NEIGHBOUR, randomFloat( 0, 100, &rng_state[ bug_id ] ) < BUG_MOVE_CHANCE( bug_id ) );
+
+		bug_new_locus = best_neighbour( todo, heat_map, bug_locus, &rng_state[ bug_id ] );
+
+		if (bug_new_locus.s0 != bug_locus.s0 && HAS_BUG( swarm_map[ bug_new_locus.s0 ] ))
+		{
+			bug_target[ bug_id ] = TARGET_BLOCKED;
+			return;
+		}
+	}
+	else
+	{
+		/* Bugs done are at rest. The others try any free place, as in 'bug_any_free_step(...)'. */
+		if (BUG_HAS_MOVED( bug ))
+		{
+			bug_target[ bug_id ] = TARGET_NONE;
+			return;
+		}
+
+		bug_new_locus = any_free_neighbour( heat_map, swarm_map, bug_locus, &rng_state[ bug_id ] );
+	}
+
+	/* Here the target is either the current cell, or a free one. */
+	if (bug_new_locus.s0 != bug_locus.s0)
+		atomic_min( &claims[ bug_new_locus.s0 ], claim_priority( bug_id, step_key, seed ) );
+
+	bug_target[ bug_id ] = bug_new_locus.s0;
+
+	return;
+}
+
+
+
+/*
+ * Second launch of a deterministic bug step pass. Reports to 'bug_step_retry' slot 'retry_slot' and clears the other,
+ * as 'bug_step_best(...)' does.
+ * */
+__kernel void bug_step_resolve( __global uint *swarm_bugPosition, __global uint *swarm_map, __global float *heat_map,
+				__global uint *bug_target, __global uint *claims, __global uint *bug_step_retry,
+				const uint retry_slot, const uint step_key, __global uint *conv_state,
+				__global uint *tile_flags, const uint seed, __global float *bug_attrs )
+{
+	__private uint bug_locus;
+	__private uint target;
+	__private uint bug;
+
+
+	const uint bug_id = get_global_id( 0 );
+
+	/* Clear the retry slot for the next pass. */
+	if (bug_id == 0) RESET_REPEAT_STEP( bug_step_retry[ OTHER_RETRY_SLOT( retry_slot ) ] );
+
+	if (bug_id >= BUGS_NUMBER) return;
+
+
+	target = bug_target[ bug_id ];
+
+	if (target == TARGET_NONE) return;
+
+	bug_locus = swarm_bugPosition[ bug_id ];
+
+	bug = swarm_map[ bug_locus ];
+
+	/* Blocked, or claimed by a bug of lower priority. Left in the 'want to move' state for the next pass. */
+	if (target == TARGET_BLOCKED ||
+		(target != bug_locus && claims[ target ] != claim_priority( bug_id, step_key, seed )))
+	{
+		SET_BUG_TO_MOVE( bug );
+		swarm_map[ bug_locus ] = bug;
+
+		REPORT_REPEAT_STEP( bug_step_retry[ retry_slot ] );
+
+		return;
+	}
+
+	/* Stays or moves, done for this iteration. */
+	SET_BUG_TO_REST( bug );
+
+	if (target != bug_locus)
+	{
+		swarm_map[ bug_locus ] = EMPTY_CELL;
+		swarm_bugPosition[ bug_id ] = target;
+
+		COUNT_MOVE( &conv_state[ CONV_MOVES ] );
+	}
+
+	swarm_map[ target ] = bug;
+
+	/* Leave heat in the bug position. */
+	LEAVE_HEAT( heat_map, target, heat_map[ target ], BUG_OUTPUT_HEAT( bug, bug_id ) );
+
+	MARK_ACTIVE_TILE( tile_flags, target );
+
+	return;
+}
+
+
+
+/*
+ * Third launch of a deterministic bug step pass: the claims of the pass are cleared, 'claims' is all NO_CLAIM again.
+ * */
+__kernel void bug_step_release( __global uint *bug_target, __global uint *claims )
+{
+	__private uint target;
+
+
+	const uint bug_id = get_global_id( 0 );
+
+	if (bug_id >= BUGS_NUMBER) return;
+
+	target = bug_target[ bug_id ];
+
+	if (target < WORLD_STORAGE_SIZE) claims[ target ] = NO_CLAIM;
+
+	return;
+}
+
+
+
+/*
+ * Add 'heat' to '*cell', without losing the adds of other work-items: OpenCL 1.2 has no float atomic add, so the sum
+ * is stored with a compare and exchange on the bits, retried while another add got in between.
+ * */
+inline void atomic_add_heat( __global float *cell, const float heat )
+{
+	__private uint old_bits, seen_bits;
+
+
+	seen_bits = as_uint( *cell );
+
+	do
+	{
+		old_bits = seen_bits;
+		seen_bits = atomic_cmpxchg( (volatile __global uint *) cell, old_bits,
+						as_uint( as_float( old_bits ) + heat ) );
+	}
+	while (seen_bits != old_bits);
+
+	return;
+}
+
+
+
+/*
+ * Deposition of bug 'bug_id', DEPOSIT_ATOMIC. Shared by the 'deposit_heat_atomic' kernel and the megakernel.
+ * */
+inline void deposit_bug_heat( const uint bug_id, __global uint *swarm_bugPosition, __global uint *swarm_map,
+				__global float *heat_map, __global float *bug_attrs )
+{
+	const uint bug_locus = swarm_bugPosition[ bug_id ];
+
+	atomic_add_heat( &heat_map[ bug_locus ], BUG_OUTPUT_HEAT( swarm_map[ bug_locus ], bug_id ) );
+
+	return;
+}
+
+
+
+/*
+ * Deposition on storage cell 'index', DEPOSIT_GATHER. Shared by the 'deposit_heat_gather' kernel and the megakernel.
+ * Padding cells never have bugs. The bug on a cell is not known, so bug attributes are not, (no BUG_ATTRIBUTES).
+ * */
+inline void deposit_cell_heat( const uint index, __global uint *swarm_map, __global float *heat_map )
+{
+	const uint bug = swarm_map[ index ];
+
+	if (HAS_BUG( bug )) heat_map[ index ] = heat_map[ index ] + convert_float( GET_BUG_OUTPUT_HEAT( bug ) );
+
+	return;
+}
+
+
+
+/**
+ * Heat deposition pass, once all bug steps of the iteration are done: each bug adds its output heat to the cell it
+ * is at, in 'heat_map'. Bugs are all at rest, on different cells, and no other kernel runs, so the result is the same
+ * whatever the order, and nothing read by the bug steps changed under them.
+ *
+ * DEPOSIT_ATOMIC runs a work-item per bug, adding with 'atomic_add_heat(...)'. As no two bugs share a cell, the
+ * compare and exchange never retries in practice, but a deposit can not be lost whatever the bug steps do.
+ * */
+__kernel void deposit_heat_atomic( __global float *heat_map, __global uint *swarm_bugPosition,
+					__global uint *swarm_map, __global float *bug_attrs )
+{
+	const uint bug_id = get_global_id( 0 );
+
+	if (bug_id >= BUGS_NUMBER) return;
+
+	deposit_bug_heat( bug_id, swarm_bugPosition, swarm_map, heat_map, bug_attrs );
+
+	return;
+}
+
+
+
+/*
+ * DEPOSIT_GATHER runs a work-item per storage cell, which adds the heat of the bug on it, if any: each cell is owned
+ * by a single work-item, so no atomics are needed, and loads and stores are coalesced. Faster than DEPOSIT_ATOMIC
+ * when bugs are dense, it reads the whole 'swarm_map' when they are not.
+ * */
+__kernel void deposit_heat_gather( __global float *heat_map, __global uint *swarm_map )
+{
+	const uint index = get_global_id( 0 );
+
+	if (index >= WORLD_STORAGE_SIZE) return;
+
+	deposit_cell_heat( index, swarm_map, heat_map );
+
+	return;
+}
+
+
+
+__kernel void comp_world_heat( __global float *heat_map, __global float *heat_buffer )
+{
+	__private const uint cc = get_global_id( 0 );	/* Column at Center. */
+	__private const uint rc = get_global_id( 1 );	/* Row at Center.   */
+
+	if (rc >= WORLD_HEIGHT || cc >= WORLD_WIDTH) return;
+
+
+	/* Double buffer it. */
+	heat_buffer[ cell_index( rc, cc ) ] = world_heat_cell( heat_map, rc, cc );
+
+
+	return;
+}
+
+
+
+#if HEAT_IMAGE
+
+/*
+ * Heat maps as images, over the heat map buffers, (row-major only): x is the column and y the row. Cells are read
+ * with integer coordinates, and wrapped by the same ROW_*(...) / COL_*(...) macros as the buffer kernels, so the
+ * neighbours are exactly those of 'world_heat_cell(...)'. Wrapping with CLK_ADDRESS_REPEAT would need normalized
+ * coordinates, where the cell read depends on float rounding in large worlds.
+ * */
+__constant sampler_t heat_sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_NONE | CLK_FILTER_NEAREST;
+
+#define HEAT_TEXEL( image, row, col ) \
+	read_imagef( (image), heat_sampler, (int2)( (int) (col), (int) (row) ) ).x
+
+
+/**
+ * Compute world heat, as 'comp_world_heat(...)', reading the heat map through the texture cache and writing the heat
+ * buffer as an image. The host ping-pongs the two images, as it does the buffers. Same arithmetic, in the same order,
+ * as 'world_heat_cell(...)'.
+ * */
+__kernel void comp_world_heat_image( __read_only image2d_t heat_map, __write_only image2d_t heat_buffer )
+{
+	__private const uint cc = get_global_id( 0 );	/* Column at Center. */
+	__private const uint rc = get_global_id( 1 );	/* Row at Center.   */
+
+	if (rc >= WORLD_HEIGHT || cc >= WORLD_WIDTH) return;
+
+
+	/* Compute required neighbouring coodinates, and whether they are in the world. */
+	__private const uint rn = ROW_NORTH( rc );
+	__private const uint rs = ROW_SOUTH( rc );
+	__private const uint ce = COL_EAST( cc );
+	__private const uint cw = COL_WEST( cc );
+
+	__private const uint hn = HAS_NORTH( rc );
+	__private const uint hs = HAS_SOUTH( rc );
+	__private const uint he = HAS_EAST( cc );
+	__private const uint hw = HAS_WEST( cc );
+
+	__private const float own = HEAT_TEXEL( heat_map, rc, cc );
+
+	__private float heat = 0.0f;
+
+
+	/** Compute Diffusion */
+
+	#define ADD_NEIGHBOUR_TEXEL( dir, row, col, there ) \
+		heat = heat + select( own, HEAT_TEXEL( heat_map, (row), (col) ), (there) );
+
+	FOR_EACH_NEIGHBOUR( ADD_NEIGHBOUR_TEXEL )
+
+	#undef ADD_NEIGHBOUR_TEXEL
+
+	heat = heat * HEAT_DIFFUSION / NUM_NEIGHBOURS;
+
+	/* Add cell's remaining heat. */
+	heat = heat + own * HEAT_REMAINING;
+
+	/* Compute Evaporation */
+	heat = heat * HEAT_KEPT;
+
+
+	/* Double buffer it. */
+	write_imagef( heat_buffer, (int2)( (int) cc, (int) rc ), (float4)( heat, 0.0f, 0.0f, 0.0f ) );
+
+
+	return;
+}
+
+#endif
+
+
+
+#if HEAT_VECTOR_WIDTH > 1
+
+/*
+ * Vector types and functions of HEAT_VECTOR_WIDTH elements, (i.e. floatv is float4 when HEAT_VECTOR_WIDTH is 4).
+ * The shuffle masks build the West (East) neighbours of a run of cells: the run shifted one cell to the East (West),
+ * taking the missing element from the second shuffle2(...) operand.
+ * */
+#define CONCAT_( a, b )		a ## b
+#define CONCAT( a, b )		CONCAT_( a, b )
+
+#define floatv			CONCAT( float, HEAT_VECTOR_WIDTH )
+#define vloadv			CONCAT( vload, HEAT_VECTOR_WIDTH )
+#define vstorev			CONCAT( vstore, HEAT_VECTOR_WIDTH )
+
+#if HEAT_VECTOR_WIDTH == 2
+	#define SHUFFLE_WEST	(uint2)( 2, 0 )
+	#define SHUFFLE_EAST	(uint2)( 1, 2 )
+#elif HEAT_VECTOR_WIDTH == 4
+	#define SHUFFLE_WEST	(uint4)( 4, 0, 1, 2 )
+	#define SHUFFLE_EAST	(uint4)( 1, 2, 3, 4 )
+#elif HEAT_VECTOR_WIDTH == 8
+	#define SHUFFLE_WEST	(uint8)( 8, 0, 1, 2, 3, 4, 5, 6 )
+	#define SHUFFLE_EAST	(uint8)( 1, 2, 3, 4, 5, 6, 7, 8 )
+#elif HEAT_VECTOR_WIDTH == 16
+	#define SHUFFLE_WEST	(uint16)( 16, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14 )
+	#define SHUFFLE_EAST	(uint16)( 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 )
+#endif
+
+/* Shift a run one cell to the East / West, bringing in 'edge' as the first / last cell. */
+#define WEST_OF( run, edge )	shuffle2( (run), (floatv)( edge ), SHUFFLE_WEST )
+#define EAST_OF( run, edge )	shuffle2( (run), (floatv)( edge ), SHUFFLE_EAST )
+
+
+/**
+ * Compute world heat, HEAT_VECTOR_WIDTH cells of a row per work-item.
+ *
+ * The run of cells and the runs right above and bellow it are fetched with vector loads. The West and East
+ * neighbours are those runs shifted by one cell, completed with the single cells just outside the run. Neighbours
+ * are summed in the same order as 'world_heat_cell(...)', but constants are single precision here.
+ *
+ * When WORLD_WIDTH is not a multiple of HEAT_VECTOR_WIDTH, the last work-item of each row has a partial run, that is
+ * computed one cell at a time. So are, in a closed box, the runs along the world edges, where some neighbours are
+ * missing: the vector path is left with the interior runs, that have all their neighbours.
+ * */
+__kernel void comp_world_heat_vec( __global float *heat_map, __global float *heat_buffer )
+{
+	__private const uint c0 = get_global_id( 0 ) * HEAT_VECTOR_WIDTH;	/* First column of the run. */
+	__private const uint rc = get_global_id( 1 );				/* Row at Center.           */
+
+	if (rc >= WORLD_HEIGHT || c0 >= WORLD_WIDTH) return;
+
+
+	/* Partial run at the end of the row, or a run along a box edge. */
+#if BOUNDARY == BOUNDARY_BOX
+	if (c0 + HEAT_VECTOR_WIDTH >= WORLD_WIDTH || c0 == 0 || rc == 0 || rc + 1 == WORLD_HEIGHT)
+#else
+	if (c0 + HEAT_VECTOR_WIDTH > WORLD_WIDTH)
+#endif
+	{
+		for (uint cc = c0; cc < WORLD_WIDTH; cc++)
+			heat_buffer[ cell_index( rc, cc ) ] = world_heat_cell( heat_map, rc, cc );
+
+		return;
+	}
+
+
+	/* Compute required neighbouring coodinates. */
+	__private const uint rn = ROW_NORTH( rc );				/* Row at North.                */
+	__private const uint rs = ROW_SOUTH( rc );				/* Row at South.                */
+	__private const uint ce = COL_EAST( c0 + HEAT_VECTOR_WIDTH - 1 );	/* Column at East of the run.   */
+	__private const uint cw = COL_WEST( c0 );				/* Column at West of the run.   */
+
+	/* Runs at South, Center and North. */
+	__private const floatv south = vloadv( 0, heat_map + cell_index( rs, c0 ) );
+	__private const floatv centre = vloadv( 0, heat_map + cell_index( rc, c0 ) );
+	__private const floatv north = vloadv( 0, heat_map + cell_index( rn, c0 ) );
+
+	__private floatv heat = (floatv)( 0.0f );
+
+
+	/** Compute Diffusion */
+
+#if NEIGHBOURHOOD == NEIGHBOURS_VON_NEUMANN
+	heat = heat + south;							/* S  */
+	heat = heat + WEST_OF( centre, heat_map[ cell_index( rc, cw ) ] );	/* W  */
+	heat = heat + EAST_OF( centre, heat_map[ cell_index( rc, ce ) ] );	/* E  */
+	heat = heat + north;							/* N  */
+#else
+	heat = heat + WEST_OF( south, heat_map[ cell_index( rs, cw ) ] );	/* SW */
+	heat = heat + south;							/* S  */
+	heat = heat + EAST_OF( south, heat_map[ cell_index( rs, ce ) ] );	/* SE */
+	heat = heat + WEST_OF( centre, heat_map[ cell_index( rc, cw ) ] );	/* W  */
+	heat = heat + EAST_OF( centre, heat_map[ cell_index( rc, ce ) ] );	/* E  */
+	heat = heat + WEST_OF( north, heat_map[ cell_index( rn, cw ) ] );	/* NW */
+	heat = heat + north;							/* N  */
+	heat = heat + EAST_OF( north, heat_map[ cell_index( rn, ce ) ] );	/* NE */
+#endif
+
+	/* Get the NUM_NEIGHBOURS part of diffusion percentage from all neighbour cells. */
+	heat = heat * (float) WORLD_DIFFUSION_RATE / NUM_NEIGHBOURS;
+
+	/* Add cell's remaining heat. */
+	heat = heat + centre * (float) (1 - WORLD_DIFFUSION_RATE);
+
+	/* Compute Evaporation */
+	heat = heat * (float) (1 - WORLD_EVAPORATION_RATE);
+
+
+	/* Double buffer it. */
+	vstorev( heat, 0, heat_buffer + cell_index( rc, c0 ) );
+
+
+	return;
+}
+
+#endif
 
 
-	/* If bug's new location is the current one, there are no available neighbours. */
-	if (bug_new_locus.s0 == bug_locus.s0)
-	{
-		/* Bug hasn't move, we don't need to update swarm_bugPosition. */
 
-		/* Put the resting bug in his old position, (that is 'resting' status override). */
-		atomic_xchg( &swarm_map[ bug_locus.s0 ], bug );
+#if ACTIVE_TILE
 
-		/* Leave heat in the old bug position. Remember bug_locus.s1 is temperature at bug position. */
-		heat_map[ bug_locus.s0 ] = as_float( bug_locus.s1 ) + convert_float( bug_output_heat );
+/**
+ * Build the work list of 'comp_world_heat_active(...)': the tiles having an active tile, in any of the last two
+ * iterations, among themselves and their 8 neighbours. One work-item per tile, appending to the 'list_slot' counter.
+ * The other counter, used by the previous iteration, is cleared for the next one.
+ *
+ * Tiles are listed in no particular order, each tile is computed on its own.
+ * */
+__kernel void active_tiles_list( __global uint *tile_flags, __global uint *active_list, __global uint *active_count,
+					const uint list_slot )
+{
+	const uint tile = get_global_id( 0 );
 
-		return;
-	}
+	__private uint tr, tc, rn, rs, ce, cw;
 
+	__private uint flags;
 
-	/* Otherwise, try to store the bug in his new 'free' location and return.
-	   REMEMBER OpenCL specs:	atomic_cmpxchg( *p, cmp, val )   perform the operations:
-	   	old = *p;
-	   	*p = (old == cmp) ? val : old;
-	   	return old;
-	 * */
-	on_locus = atomic_cmpxchg( &swarm_map[ bug_new_locus.s0 ], EMPTY_CELL, bug );
 
-	if (HAS_NO_BUG( on_locus ))
-	{
-		/* SUCCESS! Reset old bug location. Should be atomic in case another work-item try to read. */
-		atomic_xchg( &swarm_map[ bug_locus.s0 ], EMPTY_CELL );
+	if (tile == 0) active_count[ OTHER_LIST_SLOT( list_slot ) ] = 0;
 
-		/* Update bug position in the swarm. */
-		swarm_bugPosition[ bug_id ] = bug_new_locus.s0;
+	if (tile >= ACTIVE_TILES) return;
 
-		/* Leave heat in the new bug position. */
-		heat_map[ bug_new_locus.s0 ] = as_float( bug_new_locus.s1 ) + convert_float( bug_output_heat );
 
-		return;
-	}
+	/* Tile row and column, and their neighbours: toroidal, or the tile itself past a box edge. */
+	tr = tile / ACTIVE_TILES_X;
+	tc = tile % ACTIVE_TILES_X;
 
+#if BOUNDARY == BOUNDARY_BOX
+	rn = select( tr + 1, tr, tr + 1 == ACTIVE_TILES_Y );
+	rs = select( tr - 1, tr, tr == 0 );
+	ce = select( tc + 1, tc, tc + 1 == ACTIVE_TILES_X );
+	cw = select( tc - 1, tc, tc == 0 );
+#else
+	rn = select( tr + 1, 0u, tr + 1 == ACTIVE_TILES_Y );
+	rs = select( tr - 1, ACTIVE_TILES_Y - 1u, tr == 0 );
+	ce = select( tc + 1, 0u, tc + 1 == ACTIVE_TILES_X );
+	cw = select( tc - 1, ACTIVE_TILES_X - 1u, tc == 0 );
+#endif
 
-	/* Signal the host to call bug_step_any_free(...) kernel. */
-	REPORT_REPEAT_STEP( *bug_step_retry );
+	flags = tile_flags[ rs * ACTIVE_TILES_X + cw ] | tile_flags[ rs * ACTIVE_TILES_X + tc ]
+		| tile_flags[ rs * ACTIVE_TILES_X + ce ] | tile_flags[ tr * ACTIVE_TILES_X + cw ]
+		| tile_flags[ tile ] | tile_flags[ tr * ACTIVE_TILES_X + ce ]
+		| tile_flags[ rn * ACTIVE_TILES_X + cw ] | tile_flags[ rn * ACTIVE_TILES_X + tc ]
+		| tile_flags[ rn * ACTIVE_TILES_X + ce ];
 
+	if (flags)
+		active_list[ atomic_inc( &active_count[ list_slot ] ) ] = tile;
 
 	return;
 }
 
 
 
-__kernel void comp_world_heat( __global float *heat_map, __global float *heat_buffer )
+/**
+ * Compute world heat over the listed tiles only, a work-group per tile. As many work-groups as fit the device are
+ * launched, and they stride over the list, so its length never goes back to the host.
+ *
+ * A tile whose new heat is at most ACTIVE_THRESHOLD everywhere is cold: it is flushed to zero. So every tile not
+ * active in an iteration is exactly zero in the heat map written. A tile that is not listed had no active tile
+ * around for two iterations: its new heat is zero, and so it is in the heat map left from two iterations ago, that
+ * is the one not written. With ACTIVE_THRESHOLD = 0 only all zero tiles are skipped, and results are unchanged.
+ *
+ * The tile flags are moved on by one iteration here. The bug steps that follow flag the tiles with bugs.
+ * */
+__kernel void comp_world_heat_active( __global float *heat_map, __global float *heat_buffer,
+					__global uint *tile_flags, __global uint *active_list,
+					__global uint *active_count, const uint list_slot )
 {
-	__private const uint cc = get_global_id( 0 );	/* Column at Center. */
-	__private const uint rc = get_global_id( 1 );	/* Row at Center.   */
-
-	if (rc >= WORLD_HEIGHT || cc >= WORLD_WIDTH) return;
+	const uint lid = get_local_id( 0 );
+	const uint lsize = get_local_size( 0 );
+	const uint count = active_count[ list_slot ];
 
+	__local uint hot;			/* Set if some cell of the tile is above ACTIVE_THRESHOLD. */
 
-	/* Compute required neighbouring coodinates. */
-	__private const uint rn = (rc + 1) % WORLD_HEIGHT;			/* Row at North.    */
-	__private const uint rs = (rc + WORLD_HEIGHT - 1) % WORLD_HEIGHT;	/* Row at South.    */
-	__private const uint ce = (cc + 1) % WORLD_WIDTH;			/* Column at East.  */
-	__private const uint cw = (cc + WORLD_WIDTH - 1) % WORLD_WIDTH;		/* Columns at West. */
+	__private uint entry, tile, cell, rc, cc;
+	__private uint r0, c0;			/* First row and column of the tile. */
+	__private uint hot_cells;
+	__private float heat;
 
-	__private uint pos;
 
-	__private float heat = 0.0f;
+	for (entry = get_group_id( 0 ); entry < count; entry += get_num_groups( 0 ))
+	{
+		tile = active_list[ entry ];
 
+		r0 = tile / ACTIVE_TILES_X * ACTIVE_TILE;
+		c0 = tile % ACTIVE_TILES_X * ACTIVE_TILE;
 
-	/** Compute Diffusion */
+		if (lid == 0) hot = 0;
 
-	/* Store heat from neighbouring cells. */
+		barrier( CLK_LOCAL_MEM_FENCE );
 
-	/* SW */
-	pos = rs * WORLD_WIDTH + cw;
-	heat = heat + heat_map[ pos ];
 
-	/* S  */
-	pos = rs * WORLD_WIDTH + cc;
-	heat = heat + heat_map[ pos ];
+		/* Double buffer it. Tiles at the world edges are cut short. */
+		hot_cells = 0;
 
-	/* SE */
-	pos = rs * WORLD_WIDTH + ce;
-	heat = heat + heat_map[ pos ];
+		for (cell = lid; cell < ACTIVE_TILE * ACTIVE_TILE; cell += lsize)
+		{
+			rc = r0 + cell / ACTIVE_TILE;
+			cc = c0 + cell % ACTIVE_TILE;
 
-	/* W  */
-	pos = rc * WORLD_WIDTH + cw;
-	heat = heat + heat_map[ pos ];
+			if (rc >= WORLD_HEIGHT || cc >= WORLD_WIDTH) continue;
 
-	/* E  */
-	pos = rc * WORLD_WIDTH + ce;
-	heat = heat + heat_map[ pos ];
+			heat = world_heat_cell( heat_map, rc, cc );
 
-	/* NW */
-	pos = rn * WORLD_WIDTH + cw;
-	heat = heat + heat_map[ pos ];
+			heat_buffer[ cell_index( rc, cc ) ] = heat;
 
-	/* N  */
-	pos = rn * WORLD_WIDTH + cc;
-	heat = heat + heat_map[ pos ];
+			hot_cells |= (heat > ACTIVE_THRESHOLD);
+		}
 
-	/* NE */
-	pos = rn * WORLD_WIDTH + ce;
-	heat = heat + heat_map[ pos ];
+		if (hot_cells) atomic_or( &hot, 1 );
 
+		barrier( CLK_LOCAL_MEM_FENCE );
 
-	/* Get the 8th part of diffusion percentage from all neighbour cells. */
-	heat = heat * WORLD_DIFFUSION_RATE / 8;
 
-	/* Add cell's remaining heat. */
-	pos = rc * WORLD_WIDTH + cc;
-	heat = heat + heat_map[ pos ] * (1 - WORLD_DIFFUSION_RATE);
+		/* Flush a cold tile, each work-item its own cells. */
+		if (!hot)
+		{
+			for (cell = lid; cell < ACTIVE_TILE * ACTIVE_TILE; cell += lsize)
+			{
+				rc = r0 + cell / ACTIVE_TILE;
+				cc = c0 + cell % ACTIVE_TILE;
 
-	/* Compute Evaporation */
-	heat = heat * (1 - WORLD_EVAPORATION_RATE);
+				if (rc >= WORLD_HEIGHT || cc >= WORLD_WIDTH) continue;
 
+				heat_buffer[ cell_index( rc, cc ) ] = 0.0f;
+			}
+		}
 
-	/* Double buffer it. */
-	heat_buffer[pos] = heat;
+		if (lid == 0)
+			tile_flags[ tile ] = ((tile_flags[ tile ] & ACTIVE_NOW) ? ACTIVE_LAST : 0) | (hot ? ACTIVE_NOW : 0);
 
+		/* 'hot' is read by all before the next tile clears it. */
+		barrier( CLK_LOCAL_MEM_FENCE );
+	}
 
 	return;
 }
 
+#endif
 
 
 
 /*
  *
  */
-__kernel void unhappiness_step1_reduce( __global float *unhappiness, __local float *partial_sums,
-						__global float *unhapp_reduced )
+__kernel void unhappiness_step1_reduce( __global float *unhappiness, __local unhapp_sum *partial_sums,
+						__global unhapp_sum *unhapp_reduced )
 {
 	const uint gid = get_global_id( 0 );
 	const uint lid = get_local_id( 0 );
 	const uint global_size = get_global_size( 0 );
-	const uint group_size = get_local_size( 0 );
 
 	__private uint serialCount, index, iter;
 
-	__private float sum = 0.0f;
+	__private unhapp_sum sum = UNHAPP_ZERO;
 
 	/*
 	   The size of vector unhappiness is the number of bugs (BUGS_NUMBER), so we must take care of both cases, when
@@ -942,7 +2335,7 @@ __kernel void unhappiness_step1_reduce( __global float *unhappiness, __local flo
 
 		/* If workitem is out of range. */
 		if (index < BUGS_NUMBER)
-			sum += unhappiness[ index ];
+			sum = UNHAPP_ADD( sum, UNHAPP_TO_SUM( unhappiness[ index ] ) );
 	}
 
 	/* All workitems (including out of range (sum = 0.0), store 'sum' in local memory. */
@@ -953,17 +2346,11 @@ __kernel void unhappiness_step1_reduce( __global float *unhappiness, __local flo
 
 
 	/* Reduce. */
-	for (iter = group_size / 2; iter > 0; iter >>= 1)
-	{
-		if (lid < iter)
-			partial_sums[ lid ] += partial_sums[ lid + iter ];
-
-		barrier( CLK_LOCAL_MEM_FENCE );
-	}
+	sum = REDUCE_UNHAPP( partial_sums );
 
 	/* Store in global memory. */
 	if (lid == 0) {
-		unhapp_reduced[ get_group_id( 0 ) ] = partial_sums[ 0 ];
+		unhapp_reduced[ get_group_id( 0 ) ] = sum;
 	}
 
 	return;
@@ -971,32 +2358,409 @@ __kernel void unhappiness_step1_reduce( __global float *unhappiness, __local flo
 
 
 
-__kernel void unhappiness_step2_average( __global float *unhapp_reduced, __local float *partial_sums,
+__kernel void unhappiness_step2_average( __global unhapp_sum *unhapp_reduced, __local unhapp_sum *partial_sums,
 						__global float *unhapp_average )
 {
-	__private uint iter;
+	__private unhapp_sum sum;
 
 
 	const uint lid = get_local_id( 0 );
-	const uint group_size = get_local_size( 0 );
 
 
-	partial_sums[ lid ] = select( 0.0f, unhapp_reduced[ lid ], lid < REDUCE_NUM_WORKGROUPS );
+	partial_sums[ lid ] = (lid < REDUCE_NUM_WORKGROUPS) ? unhapp_reduced[ lid ] : UNHAPP_ZERO;
 
 	barrier( CLK_LOCAL_MEM_FENCE );
 
 	/* Further reduce. */
-	for (iter = group_size / 2; iter > 0; iter >>= 1)
+	sum = REDUCE_UNHAPP( partial_sums );
+
+	/* Compute average and store final result in global memory. */
+	if (lid == 0) {
+		*unhapp_average = UNHAPP_AVERAGE( sum );
+	}
+
+	return;
+}
+
+
+
+/**
+ * Fused pipeline version of the unhappiness reduction: 'unhappiness_step1_reduce(...)' followed, by the last
+ * work-group to finish, by 'unhappiness_step2_average(...)'. One launch instead of two.
+ *
+ * Each work-group stores its sum and counts itself done in 'reduce_done'. The work-group counting last gathers all
+ * sums, read with atomics so the other work-groups stores are seen, computes the average and clears the counter for
+ * the next launch. Work sizes are those of 'unhappiness_step1_reduce(...)'.
+ * */
+__kernel void unhappiness_reduce_fused( __global float *unhappiness, __local float *partial_sums,
+						__global float *unhapp_reduced, __global float *unhapp_average,
+						__global uint *reduce_done )
+{
+	const uint gid = get_global_id( 0 );
+	const uint lid = get_local_id( 0 );
+	const uint global_size = get_global_size( 0 );
+
+	__local uint is_last_group;
+
+	__private uint serialCount, index, iter;
+
+	__private float sum = 0.0f;
+
+
+	/* Serial sum, as in 'unhappiness_step1_reduce(...)'. */
+	serialCount = DIV_CEIL( BUGS_NUMBER, global_size );
+
+	for (iter = 0; iter < serialCount; iter++)
 	{
-		if (lid < iter)
-			partial_sums[ lid ] += partial_sums[ lid + iter ];
+		index = iter * global_size + gid;
 
-		barrier( CLK_LOCAL_MEM_FENCE );
+		if (index < BUGS_NUMBER)
+			sum += unhappiness[ index ];
 	}
 
-	/* Compute average and store final result in global memory. */
-	if (lid == 0) {
-		*unhapp_average = partial_sums[ 0 ] / BUGS_NUMBER;
+	partial_sums[ lid ] = sum;
+
+	barrier( CLK_LOCAL_MEM_FENCE );
+
+	sum = reduce_local_sum( partial_sums );
+
+
+	/* Store the work-group sum and count the work-group done. */
+	if (lid == 0)
+	{
+		atomic_xchg( &unhapp_reduced[ get_group_id( 0 ) ], sum );
+
+		is_last_group = (atomic_inc( reduce_done ) == REDUCE_NUM_WORKGROUPS - 1);
+	}
+
+	barrier( CLK_LOCAL_MEM_FENCE );
+
+	if (!is_last_group) return;
+
+
+	/* Last work-group. Further reduce, as in 'unhappiness_step2_average(...)'. */
+	partial_sums[ lid ] = 0.0f;
+
+	if (lid < REDUCE_NUM_WORKGROUPS)
+		partial_sums[ lid ] = as_float( atomic_or( (__global uint *) &unhapp_reduced[ lid ], 0 ) );
+
+	barrier( CLK_LOCAL_MEM_FENCE );
+
+	sum = reduce_local_sum( partial_sums );
+
+	if (lid == 0)
+	{
+		*unhapp_average = sum / BUGS_NUMBER;
+
+		atomic_xchg( reduce_done, 0 );
+	}
+
+	return;
+}
+
+
+
+/**
+ * Convergence check of an iteration, given its unhappiness 'average'. Run by a single work-item, after the bug steps
+ * and the reduction of the iteration.
+ *
+ * The last CONVERGE_WINDOW averages are kept, in rotation, in 'conv_window'. Once the window is full, the simulation
+ * is steady when they span less than CONVERGE_EPSILON. Bug moves, counted in 'conv_state[CONV_MOVES]' by the bug
+ * steps, are taken and cleared: after STILL_WINDOW iterations in a row without any, the simulation is still.
+ *
+ * Returns the stop reason, also left in 'conv_state[CONV_REASON]'.
+ * */
+inline uint convergence_step( const float average, __global float *conv_window, __global uint *conv_state )
+{
+	__private uint reason = CONV_RUNNING;
+
+#if CONVERGE_WINDOW
+	__private uint seen, iter;
+	__private float lo, hi;
+
+	seen = conv_state[ CONV_SEEN ]++;
+
+	conv_window[ seen % CONVERGE_WINDOW ] = average;
+
+	if (seen + 1 >= CONVERGE_WINDOW)
+	{
+		lo = hi = conv_window[ 0 ];
+
+		for (iter = 1; iter < CONVERGE_WINDOW; iter++)
+		{
+			lo = fmin( lo, conv_window[ iter ] );
+			hi = fmax( hi, conv_window[ iter ] );
+		}
+
+		if (hi - lo < CONVERGE_EPSILON) reason = CONV_STEADY;
+	}
+#endif
+
+#if STILL_WINDOW
+	if (atomic_xchg( &conv_state[ CONV_MOVES ], 0 ) == 0)
+		conv_state[ CONV_STILL ]++;
+	else
+		conv_state[ CONV_STILL ] = 0;
+
+	if (conv_state[ CONV_STILL ] >= STILL_WINDOW) reason = CONV_NO_MOVES;
+#endif
+
+	conv_state[ CONV_REASON ] = reason;
+
+	return reason;
+}
+
+
+
+/** Convergence check, after the unhappiness reduction. The host reads the stop reason with the next results. */
+__kernel void convergence_check( __global float *unhapp_average, __global float *conv_window,
+					__global uint *conv_state )
+{
+	if (get_global_id( 0 ) > 0) return;
+
+	convergence_step( *unhapp_average, conv_window, conv_state );
+
+	return;
+}
+
+
+
+/*
+ * Trajectory sampling. TRACE_SAMPLE bugs, TRACE_STRIDE bug ids apart, are sampled each iteration into a slot of
+ * 'trace_ring', on the device, the host reads the slots in one go when the ring is full. A record is 2 words: the
+ * row-major cell of the bug, with TRACE_MOVED set if it left the cell of its previous record, and the bits of its
+ * unhappiness. 'trace_last' keeps the storage cell of each previous record.
+ * */
+#define TRACE_MOVED	0x80000000
+
+
+
+/**
+ * Gather the records of the sampled bugs into slot 'slot' of 'trace_ring', a work-item per sampled bug. 'start' is
+ * set for the initial world, with no previous records.
+ * */
+__kernel void trace_sample( __global uint *swarm_bugPosition, __global float *unhappiness, __global uint *trace_last,
+				__global uint *trace_ring, const uint slot, const uint start )
+{
+	__private uint bug_locus;
+	__private uint record;
+
+
+	const uint sample = get_global_id( 0 );
+
+	if (sample >= TRACE_SAMPLE) return;
+
+
+	bug_locus = swarm_bugPosition[ sample * TRACE_STRIDE ];
+
+	record = cell_row( bug_locus ) * WORLD_WIDTH + cell_col( bug_locus );
+
+	if (!start && bug_locus != trace_last[ sample ]) record |= TRACE_MOVED;
+
+	trace_last[ sample ] = bug_locus;
+
+	trace_ring[ 2 * (slot * TRACE_SAMPLE + sample) ] = record;
+	trace_ring[ 2 * (slot * TRACE_SAMPLE + sample) + 1 ] = as_uint( unhappiness[ sample * TRACE_STRIDE ] );
+
+	return;
+}
+
+
+
+/**
+ * Global barrier for the megakernel. All work-items of all work-groups must call it.
+ *
+ * The first work-item of each work-group counts its group in. The last group to arrive clears the counter and bumps
+ * the barrier generation, the others spin until the generation changes. Requires all work-groups to be resident on
+ * the device at once, (see 'megakernel(...)').
+ * */
+inline void global_barrier( __global uint *mk_sync )
+{
+	__private uint generation;
+
+	barrier( CLK_GLOBAL_MEM_FENCE | CLK_LOCAL_MEM_FENCE );
+
+	if (get_local_id( 0 ) == 0)
+	{
+		/* The generation can not change before this group is counted. */
+		generation = atomic_or( &mk_sync[ MK_SYNC_GENERATION ], 0 );
+
+		if (atomic_inc( &mk_sync[ MK_SYNC_COUNT ] ) == get_num_groups( 0 ) - 1)
+		{
+			atomic_xchg( &mk_sync[ MK_SYNC_COUNT ], 0 );
+			atomic_inc( &mk_sync[ MK_SYNC_GENERATION ] );
+		}
+		else
+		{
+			while (atomic_or( &mk_sync[ MK_SYNC_GENERATION ], 0 ) == generation);
+		}
+	}
+
+	barrier( CLK_GLOBAL_MEM_FENCE | CLK_LOCAL_MEM_FENCE );
+
+	return;
+}
+
+
+
+/**
+ * Persistent threads version of the simulation loop: up to 'num_steps' iterations in one launch.
+ *
+ * Each iteration runs the phases of the host loop, separated by global barriers instead of launches: world heat from
+ * 'heat_map' into 'heat_buffer', bug step to the best place, bug steps to any free place while any bug is left to
+ * move, the heat deposition, (unless DEPOSIT_INLINE), and the unhappiness reduction. The heat maps then swap.
+ * Work-items loop over cells and bugs with a stride of the global size, so any number of work-groups covers the world.
+ *
+ * The average unhappiness of iteration 'i' is stored in 'unhapp_results[i]'. The launch ends after 'num_steps'
+ * iterations, or earlier, at the end of an iteration, when the host sets '*stop_flag' or the convergence check, (if
+ * enabled), says so. The iterations done are left in 'mk_sync[MK_SYNC_STEPS]'. When that number is odd, the last heat map is 'heat_buffer'.
+ *
+ * The bug step retry flag rotates over 3 slots of 'mk_sync': while a bug step pass reports to its slot, the slot of
+ * the next pass is cleared, and the slot of the previous one may still be read by the slowest work-groups.
+ *
+ * The global barriers need all work-groups resident at once, and stores of one work-group visible to the others
+ * after the barrier atomics. This holds on CPU runtimes, and on GPUs when the launch is no larger than the device can
+ * hold, (one work-group per compute unit is used), but OpenCL 1.2 does not guarantee it. The local work size must be
+ * a power of 2.
+ * */
+__kernel void megakernel( __global float *heat_map, __global float *heat_buffer, __global uint *swarm_bugPosition,
+				__global uint *swarm_map, __global float *unhappiness, __global uint *rng_state,
+				__local float *partial_sums, __global float *mk_reduced, __global float *unhapp_results,
+				__global uint *mk_sync, __global uint *stop_flag, const uint num_steps,
+				__global float *conv_window, __global uint *conv_state, __global float *bug_attrs )
+{
+	const uint gid = get_global_id( 0 );
+	const uint lid = get_local_id( 0 );
+	const uint global_size = get_global_size( 0 );
+
+	__global float *swap;
+
+	__private uint step, pass, index, iter, reason;
+
+	__private float sum;
+
+
+	pass = 0;
+
+	for (step = 0; step < num_steps; step++)
+	{
+		/** Compute world heat, diffusion followed by evaporation. */
+
+		for (index = gid; index < WORLD_SIZE; index += global_size)
+		{
+			heat_buffer[ cell_index( index / WORLD_WIDTH, index % WORLD_WIDTH ) ] =
+				world_heat_cell( heat_map, index / WORLD_WIDTH, index % WORLD_WIDTH );
+		}
+
+		global_barrier( mk_sync );
+
+
+		/** Bug step for best place. Also computes the new unhappiness vector. */
+
+		if (gid == 0) atomic_xchg( &mk_sync[ MK_SYNC_RETRY + (pass + 1) % 3 ], RST_BUG_STEP_RETRY_FLAG );
+
+		for (index = gid; index < BUGS_NUMBER; index += global_size)
+		{
+			bug_best_step( index, swarm_bugPosition, swarm_map, heat_buffer, unhappiness,
+					&mk_sync[ MK_SYNC_RETRY + pass % 3 ], rng_state, &conv_state[ CONV_MOVES ], bug_attrs );
+		}
+
+		global_barrier( mk_sync );
+
+
+		/** Bug steps for any free place, until all bugs resolve their movement. */
+
+		while (atomic_or( &mk_sync[ MK_SYNC_RETRY + pass % 3 ], 0 ))
+		{
+			pass++;
+
+			if (gid == 0) atomic_xchg( &mk_sync[ MK_SYNC_RETRY + (pass + 1) % 3 ], RST_BUG_STEP_RETRY_FLAG );
+
+			for (index = gid; index < BUGS_NUMBER; index += global_size)
+			{
+				bug_any_free_step( index, swarm_bugPosition, swarm_map, heat_buffer,
+							&mk_sync[ MK_SYNC_RETRY + pass % 3 ], rng_state,
+							&conv_state[ CONV_MOVES ], bug_attrs );
+			}
+
+			global_barrier( mk_sync );
+		}
+
+		pass++;
+
+
+		/** Heat deposition, when not left by the bug steps. */
+
+#if HEAT_DEPOSIT == DEPOSIT_ATOMIC
+		for (index = gid; index < BUGS_NUMBER; index += global_size)
+			deposit_bug_heat( index, swarm_bugPosition, swarm_map, heat_buffer, bug_attrs );
+
+		global_barrier( mk_sync );
+#elif HEAT_DEPOSIT == DEPOSIT_GATHER
+		for (index = gid; index < WORLD_STORAGE_SIZE; index += global_size)
+			deposit_cell_heat( index, swarm_map, heat_buffer );
+
+		global_barrier( mk_sync );
+#endif
+
+
+		/** Unhappiness reduction. Work-group sums, then work-group 0 sums those and computes the average. */
+
+		sum = 0.0f;
+
+		for (index = gid; index < BUGS_NUMBER; index += global_size)
+			sum += unhappiness[ index ];
+
+		partial_sums[ lid ] = sum;
+
+		barrier( CLK_LOCAL_MEM_FENCE );
+
+		sum = reduce_local_sum( partial_sums );
+
+		if (lid == 0) atomic_xchg( &mk_reduced[ get_group_id( 0 ) ], sum );
+
+		global_barrier( mk_sync );
+
+		if (get_group_id( 0 ) == 0)
+		{
+			sum = 0.0f;
+
+			for (iter = lid; iter < get_num_groups( 0 ); iter += get_local_size( 0 ))
+				sum += as_float( atomic_or( (__global uint *) &mk_reduced[ iter ], 0 ) );
+
+			/* Every work-item has read 'partial_sums[0]' before it is overwritten. */
+			barrier( CLK_LOCAL_MEM_FENCE );
+
+			partial_sums[ lid ] = sum;
+
+			barrier( CLK_LOCAL_MEM_FENCE );
+
+			sum = reduce_local_sum( partial_sums );
+
+			if (lid == 0)
+			{
+				unhapp_results[ step ] = sum / BUGS_NUMBER;
+
+				/* Bugs of the next iteration only move after the barrier below. */
+				reason = (CONVERGE_WINDOW || STILL_WINDOW) ?
+					convergence_step( sum / BUGS_NUMBER, conv_window, conv_state ) : CONV_RUNNING;
+
+				atomic_xchg( &mk_sync[ MK_SYNC_STEPS ], step + 1 );
+				atomic_xchg( &mk_sync[ MK_SYNC_STOP ],
+						(step + 1 == num_steps) || atomic_or( stop_flag, 0 ) || reason );
+			}
+		}
+
+
+		/** Swap heat maps, and end the launch here if work-group 0 says so. */
+
+		swap = heat_map;
+		heat_map = heat_buffer;
+		heat_buffer = swap;
+
+		global_barrier( mk_sync );
+
+		if (atomic_or( &mk_sync[ MK_SYNC_STOP ], 0 )) break;
 	}
 
 	return;
@@ -39,6 +39,12 @@
 /* Evaluate to 1 if 'val' is an odd integer, evaluate to 0 if 'val' is an even integer. */
 #define IS_ODD( val ) ((val) & 1)
 
+/* Evaluate to 1 if 'val' is a power of 2, evaluate to 0 otherwise. 'val' must be a positive integer. */
+#define IS_POW2( val ) (((val) & ((val) - 1)) == 0)
+
+/* Integer division of positive integers, rounded up. */
+#define DIV_CEIL( num, den ) (((num) + (den) - 1) / (den))
+
 /* Return the value's square. */
 #define SQUARE( x ) ((x) * (x))
 
@@ -99,7 +105,9 @@ enum hb_error_codes {
 	HB_OUTPUT_HEAT_OUT_RANGE = -11,		/* Bug's max output heat exceeds range. */
 	HB_UNABLE_OPEN_FILE = -12,		/* Failed to open a file. */
 	HB_UNABLE_TO_READ_FILE = -13,		/* Failed to read a file. */
-	HB_MALLOC_FAILURE = -14			/* Memory alocation failed. */
+	HB_MALLOC_FAILURE = -14,		/* Memory alocation failed. */
+	HB_TILE_INVALID = -15,			/* Memory tile side is not a supported power of 2. */
+	HB_UNABLE_TO_WRITE_FILE = -16		/* Failed to write a file. */
 
 };
 
@@ -0,0 +1,294 @@
+/*
+ * This file is part of heatbugs_GPU.
+ *
+ * heatbugs_GPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_GPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_GPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+
+
+/**
+ * Host (CPU) world heat step, hand vectorised.
+ *
+ * Each row is computed as:
+ *	- column 0, wrapping to the West, one cell;
+ *	- columns [1 .. width - 2], whole SIMD vectors loaded unaligned at (col - 1), col and (col + 1) in the rows at
+ *	  South, Center and North;
+ *	- the scalar tail of those columns that does not fill a vector;
+ *	- column (width - 1), wrapping to the East, one cell.
+ *
+ * The variants are compiled with GCC function target attributes, so this file builds without any -m flag and the
+ * right one is picked at run time by 'hb_heat_step_select(...)'.
+ * */
+
+
+#include "heatbugs_cpu.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+
+
+/* Rows at North and South of row 'r', wrapping around the world. */
+#define ROW_NORTH( r, height )	((r) + 1 == (height) ? 0 : (r) + 1)
+#define ROW_SOUTH( r, height )	((r) == 0 ? (height) - 1 : (r) - 1)
+
+
+
+/*
+ * New heat of one cell, given its South, Center and North rows and its West, Center and East columns.
+ * Same operations, in the same order, as every vector lane.
+ * */
+static inline float heat_cell( const float *s, const float *c, const float *n, size_t cw, size_t cc, size_t ce,
+				float diffusion_rate, float keep, float evap_keep )
+{
+	float heat;
+
+	heat = s[ cw ];		/* SW */
+	heat += s[ cc ];	/* S  */
+	heat += s[ ce ];	/* SE */
+	heat += c[ cw ];	/* W  */
+	heat += c[ ce ];	/* E  */
+	heat += n[ cw ];	/* NW */
+	heat += n[ cc ];	/* N  */
+	heat += n[ ce ];	/* NE */
+
+	/* Get the 8th part of diffusion percentage from all neighbour cells. */
+	heat = heat * diffusion_rate / 8;
+
+	/* Add cell's remaining heat. */
+	heat = heat + c[ cc ] * keep;
+
+	/* Compute Evaporation */
+	return heat * evap_keep;
+}
+
+
+
+/* Cells of a row that can not be vectorised: from column 'col' to the last one. */
+static inline void heat_row_tail( const float *s, const float *c, const float *n, float *o, size_t col, size_t width,
+					float diffusion_rate, float keep, float evap_keep )
+{
+	for (; col < width - 1; col++)
+		o[ col ] = heat_cell( s, c, n, col - 1, col, col + 1, diffusion_rate, keep, evap_keep );
+
+	o[ width - 1 ] = heat_cell( s, c, n, width - 2, width - 1, 0, diffusion_rate, keep, evap_keep );
+}
+
+
+
+void hb_heat_step_scalar( const float *heat_map, float *heat_buffer, size_t width, size_t height,
+				float diffusion_rate, float evaporation_rate )
+{
+	const float keep = 1 - diffusion_rate;
+	const float evap_keep = 1 - evaporation_rate;
+
+	for (size_t r = 0; r < height; r++)
+	{
+		const float *s = heat_map + ROW_SOUTH( r, height ) * width;
+		const float *c = heat_map + r * width;
+		const float *n = heat_map + ROW_NORTH( r, height ) * width;
+		float *o = heat_buffer + r * width;
+
+		o[ 0 ] = heat_cell( s, c, n, width - 1, 0, 1, diffusion_rate, keep, evap_keep );
+
+		heat_row_tail( s, c, n, o, 1, width, diffusion_rate, keep, evap_keep );
+	}
+}
+
+
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__(( target( "avx2" ) ))
+void hb_heat_step_avx2( const float *heat_map, float *heat_buffer, size_t width, size_t height,
+				float diffusion_rate, float evaporation_rate )
+{
+	const float keep = 1 - diffusion_rate;
+	const float evap_keep = 1 - evaporation_rate;
+
+	const __m256 v_rate = _mm256_set1_ps( diffusion_rate );
+	const __m256 v_eight = _mm256_set1_ps( 8.0f );
+	const __m256 v_keep = _mm256_set1_ps( keep );
+	const __m256 v_evap_keep = _mm256_set1_ps( evap_keep );
+
+	for (size_t r = 0; r < height; r++)
+	{
+		const float *s = heat_map + ROW_SOUTH( r, height ) * width;
+		const float *c = heat_map + r * width;
+		const float *n = heat_map + ROW_NORTH( r, height ) * width;
+		float *o = heat_buffer + r * width;
+		size_t col;
+
+		o[ 0 ] = heat_cell( s, c, n, width - 1, 0, 1, diffusion_rate, keep, evap_keep );
+
+		for (col = 1; col + 8 <= width - 1; col += 8)
+		{
+			__m256 heat;
+
+			heat = _mm256_loadu_ps( s + col - 1 );				/* SW */
+			heat = _mm256_add_ps( heat, _mm256_loadu_ps( s + col ) );	/* S  */
+			heat = _mm256_add_ps( heat, _mm256_loadu_ps( s + col + 1 ) );	/* SE */
+			heat = _mm256_add_ps( heat, _mm256_loadu_ps( c + col - 1 ) );	/* W  */
+			heat = _mm256_add_ps( heat, _mm256_loadu_ps( c + col + 1 ) );	/* E  */
+			heat = _mm256_add_ps( heat, _mm256_loadu_ps( n + col - 1 ) );	/* NW */
+			heat = _mm256_add_ps( heat, _mm256_loadu_ps( n + col ) );	/* N  */
+			heat = _mm256_add_ps( heat, _mm256_loadu_ps( n + col + 1 ) );	/* NE */
+
+			heat = _mm256_div_ps( _mm256_mul_ps( heat, v_rate ), v_eight );
+			heat = _mm256_add_ps( heat, _mm256_mul_ps( _mm256_loadu_ps( c + col ), v_keep ) );
+			heat = _mm256_mul_ps( heat, v_evap_keep );
+
+			_mm256_storeu_ps( o + col, heat );
+		}
+
+		heat_row_tail( s, c, n, o, col, width, diffusion_rate, keep, evap_keep );
+	}
+}
+
+
+
+__attribute__(( target( "avx512f" ) ))
+void hb_heat_step_avx512( const float *heat_map, float *heat_buffer, size_t width, size_t height,
+				float diffusion_rate, float evaporation_rate )
+{
+	const float keep = 1 - diffusion_rate;
+	const float evap_keep = 1 - evaporation_rate;
+
+	const __m512 v_rate = _mm512_set1_ps( diffusion_rate );
+	const __m512 v_eight = _mm512_set1_ps( 8.0f );
+	const __m512 v_keep = _mm512_set1_ps( keep );
+	const __m512 v_evap_keep = _mm512_set1_ps( evap_keep );
+
+	for (size_t r = 0; r < height; r++)
+	{
+		const float *s = heat_map + ROW_SOUTH( r, height ) * width;
+		const float *c = heat_map + r * width;
+		const float *n = heat_map + ROW_NORTH( r, height ) * width;
+		float *o = heat_buffer + r * width;
+		size_t col;
+
+		o[ 0 ] = heat_cell( s, c, n, width - 1, 0, 1, diffusion_rate, keep, evap_keep );
+
+		for (col = 1; col + 16 <= width - 1; col += 16)
+		{
+			__m512 heat;
+
+			heat = _mm512_loadu_ps( s + col - 1 );				/* SW */
+			heat = _mm512_add_ps( heat, _mm512_loadu_ps( s + col ) );	/* S  */
+			heat = _mm512_add_ps( heat, _mm512_loadu_ps( s + col + 1 ) );	/* SE */
+			heat = _mm512_add_ps( heat, _mm512_loadu_ps( c + col - 1 ) );	/* W  */
+			heat = _mm512_add_ps( heat, _mm512_loadu_ps( c + col + 1 ) );	/* E  */
+			heat = _mm512_add_ps( heat, _mm512_loadu_ps( n + col - 1 ) );	/* NW */
+			heat = _mm512_add_ps( heat, _mm512_loadu_ps( n + col ) );	/* N  */
+			heat = _mm512_add_ps( heat, _mm512_loadu_ps( n + col + 1 ) );	/* NE */
+
+			heat = _mm512_div_ps( _mm512_mul_ps( heat, v_rate ), v_eight );
+			heat = _mm512_add_ps( heat, _mm512_mul_ps( _mm512_loadu_ps( c + col ), v_keep ) );
+			heat = _mm512_mul_ps( heat, v_evap_keep );
+
+			_mm512_storeu_ps( o + col, heat );
+		}
+
+		heat_row_tail( s, c, n, o, col, width, diffusion_rate, keep, evap_keep );
+	}
+}
+
+#endif
+
+
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+
+void hb_heat_step_neon( const float *heat_map, float *heat_buffer, size_t width, size_t height,
+				float diffusion_rate, float evaporation_rate )
+{
+	const float keep = 1 - diffusion_rate;
+	const float evap_keep = 1 - evaporation_rate;
+
+	const float32x4_t v_rate = vdupq_n_f32( diffusion_rate );
+	const float32x4_t v_eight = vdupq_n_f32( 8.0f );
+	const float32x4_t v_keep = vdupq_n_f32( keep );
+	const float32x4_t v_evap_keep = vdupq_n_f32( evap_keep );
+
+	for (size_t r = 0; r < height; r++)
+	{
+		const float *s = heat_map + ROW_SOUTH( r, height ) * width;
+		const float *c = heat_map + r * width;
+		const float *n = heat_map + ROW_NORTH( r, height ) * width;
+		float *o = heat_buffer + r * width;
+		size_t col;
+
+		o[ 0 ] = heat_cell( s, c, n, width - 1, 0, 1, diffusion_rate, keep, evap_keep );
+
+		for (col = 1; col + 4 <= width - 1; col += 4)
+		{
+			float32x4_t heat;
+
+			heat = vld1q_f32( s + col - 1 );			/* SW */
+			heat = vaddq_f32( heat, vld1q_f32( s + col ) );		/* S  */
+			heat = vaddq_f32( heat, vld1q_f32( s + col + 1 ) );	/* SE */
+			heat = vaddq_f32( heat, vld1q_f32( c + col - 1 ) );	/* W  */
+			heat = vaddq_f32( heat, vld1q_f32( c + col + 1 ) );	/* E  */
+			heat = vaddq_f32( heat, vld1q_f32( n + col - 1 ) );	/* NW */
+			heat = vaddq_f32( heat, vld1q_f32( n + col ) );		/* N  */
+			heat = vaddq_f32( heat, vld1q_f32( n + col + 1 ) );	/* NE */
+
+			/* Separate mul and add, not vmlaq_f32, to round as the other variants. */
+			heat = vdivq_f32( vmulq_f32( heat, v_rate ), v_eight );
+			heat = vaddq_f32( heat, vmulq_f32( vld1q_f32( c + col ), v_keep ) );
+			heat = vmulq_f32( heat, v_evap_keep );
+
+			vst1q_f32( o + col, heat );
+		}
+
+		heat_row_tail( s, c, n, o, col, width, diffusion_rate, keep, evap_keep );
+	}
+}
+
+#endif
+
+
+
+HBHeatStepFn hb_heat_step_select( const char **name )
+{
+	const char *selected = "scalar";
+	HBHeatStepFn fn = hb_heat_step_scalar;
+
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports( "avx512f" ))
+	{
+		selected = "avx512";
+		fn = hb_heat_step_avx512;
+	}
+	else if (__builtin_cpu_supports( "avx2" ))
+	{
+		selected = "avx2";
+		fn = hb_heat_step_avx2;
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	selected = "neon";
+	fn = hb_heat_step_neon;
+#endif
+
+	if (name) *name = selected;
+
+	return fn;
+}
@@ -0,0 +1,75 @@
+/*
+ * This file is part of heatbugs_GPU.
+ *
+ * heatbugs_GPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_GPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_GPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+
+#ifndef __HEATBUGS_CPU_H_
+#define __HEATBUGS_CPU_H_
+
+
+#include <stddef.h>
+
+
+/**
+ * Host (CPU) world heat step. Mirror of the 'comp_world_heat' kernel, for a row-major toroidal world.
+ *
+ * Computes 'heat_buffer' from 'heat_map': each cell receives the 8th part of the diffused heat of its 8 neighbours,
+ * keeps the non diffused part of its own heat, and then evaporates. All variants sum the neighbours in the same order
+ * (SW, S, SE, W, E, NW, N, NE) in single precision, so they return bit identical maps.
+ *
+ * @param[in]	heat_map         - Current heat map, 'width' x 'height' floats.
+ * @param[out]	heat_buffer      - New heat map. Must not overlap 'heat_map'.
+ * @param[in]	width            - World width. At least 2.
+ * @param[in]	height           - World height. At least 2.
+ * @param[in]	diffusion_rate   - [0..1], % temperature to neighbour cells.
+ * @param[in]	evaporation_rate - [0..1], % temperature loss to 'ether'.
+ * */
+typedef void (*HBHeatStepFn)( const float *heat_map, float *heat_buffer, size_t width, size_t height,
+				float diffusion_rate, float evaporation_rate );
+
+
+/* Portable version, one cell at a time. */
+void hb_heat_step_scalar( const float *heat_map, float *heat_buffer, size_t width, size_t height,
+				float diffusion_rate, float evaporation_rate );
+
+#if defined(__x86_64__) || defined(__i386__)
+/* 8 cells at a time. Requires a CPU with AVX2. */
+void hb_heat_step_avx2( const float *heat_map, float *heat_buffer, size_t width, size_t height,
+				float diffusion_rate, float evaporation_rate );
+
+/* 16 cells at a time. Requires a CPU with AVX-512F. */
+void hb_heat_step_avx512( const float *heat_map, float *heat_buffer, size_t width, size_t height,
+				float diffusion_rate, float evaporation_rate );
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+/* 4 cells at a time. AArch64 only, (vdivq_f32). */
+void hb_heat_step_neon( const float *heat_map, float *heat_buffer, size_t width, size_t height,
+				float diffusion_rate, float evaporation_rate );
+#endif
+
+
+/**
+ * Select the widest variant the running CPU supports, (CPUID on x86).
+ *
+ * @param[out]	name - If not NULL, receives the selected variant's name.
+ *
+ * @return The selected heat step function.
+ * */
+HBHeatStepFn hb_heat_step_select( const char **name );
+
+
+#endif
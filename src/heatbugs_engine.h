@@ -0,0 +1,325 @@
+/*
+ * This file is part of heatbugs_GPU.
+ *
+ * heatbugs_GPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_GPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_GPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+
+#ifndef __HEATBUGS_ENGINE_H_
+#define __HEATBUGS_ENGINE_H_
+
+
+/**
+ * Simulation engine, (libheatbugs).
+ *
+ * An engine holds the OpenCL context, the built program, the kernels and the buffers of one simulation setup. It is
+ * initiated, stepped, read and reset any number of times, so runs after the first cost no setup. Errors are reported
+ * in the HB_ERROR domain, with the codes of 'enum hb_error_codes'. After an error, the engine must be initiated
+ * again before it is stepped.
+ *
+ * Usage:
+ *
+ *     hb_params_defaults( &params );
+ *     engine = hb_engine_new( &params, &err );
+ *     hb_engine_init( engine, &err );
+ *     hb_engine_step( engine, 100, &err );
+ *     hb_engine_read_stats( engine, &stats );
+ *     hb_engine_reset( engine, seed, iterations, &err );
+ *     ...
+ *     hb_engine_destroy( engine );
+ * */
+
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include <glib.h>
+
+#include "heatbugs.h"
+#include "heatbugs_writer.h"
+
+
+/** Why the simulation stopped. The convergence reasons have the kernel's values. */
+enum hb_stop_reasons {
+	HB_STOP_ITERATIONS = 0,			/* Iterations done, (CONV_RUNNING in the kernel). */
+	HB_STOP_STEADY,				/* Unhappiness steady, (CONV_STEADY in the kernel). */
+	HB_STOP_NO_MOVES,			/* No bug moves, (CONV_NO_MOVES in the kernel). */
+	HB_STOP_REQUESTED			/* 'hb_engine_stop(...)', (SIGINT / SIGTERM in the CLI). */
+};
+
+
+/** How 'init_swarm' places the bugs. Same values as PLACE_* in the kernel. */
+enum hb_placements {
+	HB_PLACE_RANDOM = 0,			/* --placement random */
+	HB_PLACE_PERMUTE,			/* --placement permute */
+	HB_PLACE_FILE				/* --placement-file */
+};
+
+
+/** How bugs leave their heat. Same values as DEPOSIT_* in the kernel. */
+enum hb_deposits {
+	HB_DEPOSIT_INLINE = 0,			/* --deposit inline */
+	HB_DEPOSIT_ATOMIC,			/* --deposit atomic */
+	HB_DEPOSIT_GATHER			/* --deposit gather */
+};
+
+
+/** Accumulator of the unhappiness sums. Same values as UNHAPP_* in the kernel. */
+enum hb_accumulators {
+	HB_ACCUM_FLOAT = 0,			/* --accumulator float, single precision, the fast path. */
+	HB_ACCUM_KAHAN,				/* --accumulator kahan, compensated single precision. */
+	HB_ACCUM_DOUBLE,			/* --accumulator double, devices with cl_khr_fp64 only. */
+	HB_ACCUM_FIXED				/* --accumulator fixed, 64 bit fixed point. Exact, as in deterministic mode. */
+};
+
+
+/** Cells around a cell, where bugs move and heat diffuses to. Same values as NEIGHBOURS_* in the kernel. */
+enum hb_neighbourhoods {
+	HB_NEIGHBOURS_MOORE = 0,		/* --neighbourhood moore, the 8 surrounding cells. */
+	HB_NEIGHBOURS_VON_NEUMANN		/* --neighbourhood von-neumann, the 4 cells at N, S, E and W. */
+};
+
+
+/** World edges. Same values as BOUNDARY_* in the kernel. */
+enum hb_boundaries {
+	HB_BOUNDARY_TORUS = 0,			/* --boundary torus, edges wrap around. */
+	HB_BOUNDARY_BOX				/* --boundary box, no cells past the edges. */
+};
+
+
+/** Where the buffers read by the host are placed. */
+enum hb_buffer_placements {
+	HB_BUFFERS_AUTO = 0,			/* --buffers auto: host memory if the device shares it, device otherwise. */
+	HB_BUFFERS_HOST,			/* --buffers host */
+	HB_BUFFERS_DEVICE			/* --buffers device */
+};
+
+
+/** Kind of OpenCL device used. The first device found, of that kind, is used. */
+enum hb_device_types {
+	HB_DEVICE_GPU = 0,			/* --device gpu */
+	HB_DEVICE_CPU,				/* --device cpu */
+	HB_DEVICE_ANY				/* --device any */
+};
+
+
+/** Maps a region of interest is read from. */
+enum hb_roi_maps {
+	HB_ROI_HEAT = 0,			/* --roi heat:... , cells are floats. */
+	HB_ROI_SWARM				/* --roi swarm:..., cells are the bug map's 32 bit words. */
+};
+
+
+/** Regions of interest of a simulation, at most. */
+#define HB_ROI_MAX	8
+
+
+/** A region of interest: 'height' rows of 'width' cells from ('row', 'col'). */
+typedef struct hb_roi {
+	int map;					/* (enum hb_roi_maps). */
+	size_t row, col;
+	size_t height, width;
+} HBRoi_t;
+
+
+/** Input data used for simulation. */
+typedef struct parameters {
+	size_t seed;					/* IN: The seed to be used. */
+	size_t reduce_num_workgroups;			/* 'reduce_num_workgroups' used to send information across functions. */
+	size_t numIterations;				/* IN: Num Iterations to stop. (0 = non stop). */
+	size_t bugs_number;				/* IN: Number of bugs in the world. */
+	size_t world_width;				/* IN: World width size. */
+	size_t world_height;				/* IN: World height size. */
+	size_t world_size;				/* IN: World's vector size = (world_height * world_width). */
+	size_t world_tile;				/* IN: Side of the square memory tiles, power of 2. (0 = row-major). */
+	size_t world_tiles_x;				/* Number of tiles along the world width. */
+	size_t world_storage_size;			/* Cells stored in the world maps, including tile padding. */
+	size_t snapshot_period;				/* IN: Iterations between heat map snapshots. (0 = none). */
+	size_t heat_vector_width;			/* IN: Cells per comp_world_heat work-item. (0 = device's). */
+	int heat_image;					/* IN: If set, world heat reads and writes the heat maps as images. */
+	int binned_step;				/* IN: If set, bugs are binned by what they want before they step. */
+	int device_type;				/* IN: Kind of OpenCL device, (enum hb_device_types). */
+	int autotune;					/* IN: If set, tune work-group sizes and save them to the profile. */
+	int fused;					/* IN: If set, run each iteration with the fused kernel pipeline. */
+	size_t megakernel_steps;			/* IN: Iterations per megakernel launch. (0 = no megakernel). */
+	size_t megakernel_groups;			/* Megakernel work-groups, one per compute unit. */
+	int async_io;					/* IN: If set, read results back in a transfer queue, overlapping compute. */
+	size_t writer_ring;				/* IN: Results queued for the writer thread. Power of 2. */
+	size_t flush_records;				/* IN: Results between result file flushes. (0 = by stdio). */
+	unsigned int flush_ms;				/* IN: Milliseconds between result file flushes. (0 = by stdio). */
+	float converge_epsilon;				/* IN: Stop when unhappiness changes less than this. (0 = never). */
+	size_t converge_window;				/* IN: Iterations the unhappiness change is measured over. */
+	size_t still_window;				/* IN: Stop after these iterations without bug moves. (0 = never). */
+	size_t active_tile;				/* IN: Side of the active region tiles, power of 2. (0 = whole world). */
+	size_t active_tiles_x;				/* Number of active region tiles along the world width. */
+	size_t active_tiles_y;				/* Number of active region tiles along the world height. */
+	float active_threshold;				/* IN: Heat at or below which a tile is cold, and flushed to zero. */
+	size_t active_groups;				/* Work-groups striding over the active tile list. */
+	int placement;					/* IN: How bugs are placed, (enum hb_placements). */
+	unsigned int permute_half_bits;			/* Half the bits of the world cell permutation. */
+	int deterministic;				/* IN: If set, results do not depend on the device nor work sizes. */
+	int accumulator;				/* IN: Accumulator of the unhappiness sums, (enum hb_accumulators). */
+	size_t unhapp_sum_size;				/* Bytes of an unhappiness partial sum, of the accumulator. */
+	int deposit;					/* IN: How bugs leave their heat, (enum hb_deposits). */
+	int neighbourhood;				/* IN: Cells around a cell, (enum hb_neighbourhoods). */
+	int boundary;					/* IN: World edges, (enum hb_boundaries). */
+	int profile;					/* IN: If set, print the device time of each kernel and transfer. */
+	int buffers;					/* IN: Where buffers read by the host are, (enum hb_buffer_placements). */
+	int host_buffers;				/* Set if they are in host memory, and mapped to be read. */
+	size_t roi_count;				/* IN: Regions of interest. (0 = none). */
+	HBRoi_t rois[ HB_ROI_MAX ];			/* IN: The regions of interest. */
+	size_t roi_period;				/* IN: Iterations between reads of the regions of interest. */
+	size_t roi_frame_size;				/* Bytes of all regions of interest, one after the other. */
+	size_t roi_staging_size;			/* Bytes of the whole tiles covering them. Tiled maps only. */
+	size_t trace_sample;				/* IN: Bugs whose trajectories are sampled. (0 = none). */
+	size_t trace_ring;				/* IN: Iterations of samples kept in the device, then written at once. */
+	size_t trace_stride;				/* Bug ids between two sampled bugs. */
+	float world_diffusion_rate;			/* IN: [0..1], % temperature to adjacent cells. */
+	float world_evaporation_rate;			/* IN: [0..1], % temperature's loss to 'ether'.  */
+	float bugs_random_move_chance;			/* IN: [0..100], Chance a bug will move. */
+	unsigned int bugs_temperature_min_ideal;	/* IN: [0 .. 200], bug's minimum prefered temperature. */
+	unsigned int bugs_temperature_max_ideal;	/* IN: [0 .. 200], bug's maximum prefered temperature. */
+	unsigned int bugs_heat_min_output;		/* IN: [0 .. 100], min heat a bug leaves in the world per step. */
+	unsigned int bugs_heat_max_output;		/* IN: [0 .. 100], max heat a bug leaves in the world per step. */
+	char output_filename[256];			/* IN: File to send results. */
+	char snapshot_filename[256];			/* IN: File to send heat map snapshots. */
+	char roi_filename[256];				/* IN: File to send the regions of interest. */
+	char trace_filename[256];			/* IN: File to send the bug trajectory samples. */
+	char tune_filename[256];			/* IN: File with the work-group size profiles. */
+	char placement_filename[256];			/* IN: File with the bug cells, (HB_PLACE_FILE). */
+	char bug_filename[256];				/* IN: File with the bug attributes. (empty = drawn at random). */
+	char scenario_filename[256];			/* IN: File with the initial heat and obstacles. (empty = none). */
+	unsigned int scenario_sections;			/* Sections of the scenario file, from its header. */
+} Parameters_t;
+
+
+/** Simulation engine. Opaque, see heatbugs.c. */
+typedef struct hb_engine HBEngine_t;
+
+
+/** Engine state, as read by 'hb_engine_read_stats(...)'. */
+typedef struct hb_stats {
+	size_t iterations;		/* Iterations done since the engine was initiated. */
+	float unhappiness;		/* Unhappiness average after the last iteration. */
+	int stop_reason;		/* Why the simulation stopped, (enum hb_stop_reasons). HB_STOP_ITERATIONS while not stopped. */
+} HBStats_t;
+
+
+
+#define HB_ERROR hb_error_quark()
+
+/** Error domain of the engine. */
+GQuark hb_error_quark( void );
+
+
+/**
+ * Fill 'params' with the default parameters. The seed is read from /dev/urandom, the default seed is used if it can
+ * not be read.
+ * */
+void hb_params_defaults( Parameters_t *params );
+
+
+/**
+ * Create an engine: pick the OpenCL device, build the kernels for 'params' and create the buffers.
+ *
+ * @param[in]	params - Simulation parameters. Checked, and copied, the caller's copy is not kept.
+ * @param[out]	err    - GLib object for error reporting.
+ *
+ * @return The engine, or NULL on error.
+ * */
+HBEngine_t *hb_engine_new( const Parameters_t *params, GError **err );
+
+
+/**
+ * Set where results go: each unhappiness average is pushed to 'writer', heat map snapshots, every 'snapshot_period'
+ * iterations, are appended to 'snapshots', the regions of interest, every 'roi_period' iterations, to 'rois', and the
+ * trajectory samples, every iteration, to 'traces'. Any may be NULL, for none. Set before 'hb_engine_init(...)' for
+ * the writer to receive the initial unhappiness, and the traces their header. None is closed by the engine.
+ *
+ * A region of interest frame is all the regions, in the order given, each in row-major order.
+ *
+ * A trace is a header of "HBTR" and 5 uint32: version (1), 'trace_sample', 'trace_stride', 'world_width' and
+ * 'world_height'. Then a frame per iteration, from the initial world: a record per sampled bug, bug ids 0,
+ * 'trace_stride', 2 * 'trace_stride', ..., each 2 uint32: the row-major cell of the bug, with bit 31 set if it moved
+ * in the iteration, and its unhappiness, a float.
+ * */
+void hb_engine_set_outputs( HBEngine_t *engine, HBWriter_t *writer, FILE *snapshots, FILE *rois, FILE *traces );
+
+
+/**
+ * Place the bugs, clear the world and compute the initial unhappiness, ready to step. The first time, with
+ * 'autotune' set, work-group sizes are tuned and saved first. Profiling starts here, with 'profile' set.
+ * */
+void hb_engine_init( HBEngine_t *engine, GError **err );
+
+
+/**
+ * Run 'n' iterations, (0 = until a stop criterion). Fewer are run when 'numIterations', the convergence criteria or
+ * 'hb_engine_stop(...)' stop the simulation first. A stopped simulation runs no more iterations until initiated again.
+ *
+ * @return Iterations run.
+ * */
+size_t hb_engine_step( HBEngine_t *engine, size_t n, GError **err );
+
+
+/** Read the iterations done, the last unhappiness average and the stop reason. */
+void hb_engine_read_stats( const HBEngine_t *engine, HBStats_t *stats );
+
+
+/** Readable name of a stop reason, (enum hb_stop_reasons). "unknown" for any other value. */
+const char *hb_stop_reason_name( int stop_reason );
+
+
+/**
+ * Read a region of the current heat map, 'height' rows of 'width' cells from ('row', 'col'), into 'heat', in
+ * row-major order, whatever the layout of the map in the device.
+ * */
+void hb_engine_read_heat_region( HBEngine_t *engine, size_t row, size_t col, size_t height, size_t width,
+					float *heat, GError **err );
+
+
+/** Bytes of a region of interest frame. */
+size_t hb_engine_roi_frame_size( const HBEngine_t *engine );
+
+
+/** Read the regions of interest of the current world into 'frame', 'hb_engine_roi_frame_size(...)' bytes. */
+void hb_engine_read_rois( HBEngine_t *engine, void *frame, GError **err );
+
+
+/**
+ * Initiate the engine again, with a new seed and a new 'numIterations', (0 = non stop). The program is not built
+ * again.
+ * */
+void hb_engine_reset( HBEngine_t *engine, size_t seed, size_t num_iterations, GError **err );
+
+
+/**
+ * Ask a running 'hb_engine_step(...)' to stop at the end of its iteration, or, in megakernel mode, at the end of the
+ * launch, (see 'simulateMegakernel(...)'). Async-signal-safe.
+ * */
+void hb_engine_stop( HBEngine_t *engine );
+
+
+/**
+ * Print the device time of each kernel and transfer since the engine was initiated, with 'profile' set. Profiling
+ * ends here, until the engine is initiated again.
+ * */
+void hb_engine_print_profile( HBEngine_t *engine, GError **err );
+
+
+/** Release the engine, its OpenCL objects and buffers. */
+void hb_engine_destroy( HBEngine_t *engine );
+
+
+#endif
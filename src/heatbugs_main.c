@@ -0,0 +1,789 @@
+/*
+ * This file is part of heatbugs_GPU.
+ *
+ * heatbugs_GPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_GPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_GPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+
+
+/**
+ * Heatbugs command line. A thin client of the engine, (see heatbugs_engine.h): it parses the options, sends the
+ * results to files and runs the simulation to its end.
+ * */
+
+
+#define _GNU_SOURCE	/* this allow 'getopt(..)' function in <unistd.h> to compile under */
+			/* -std=c99 compiler option, because 'getopt' is POSIX, not c99.   */
+
+#include <stdio.h>	/* printf(...)	*/
+#include <stdlib.h>	/* exit(...)	*/
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>	/* errno	*/
+#include <stdint.h>	/* SIZE_MAX	*/
+#include <limits.h>	/* UINT_MAX	*/
+#include <ctype.h>	/* isprint(..)	*/
+#include <getopt.h>	/* getopt_long(..) */
+#include <signal.h>	/* signal(..)	*/
+
+#include <cf4ocl2.h>	/* ccl_wrapper_memcheck() */
+
+#include "heatbugs_engine.h"
+#include "heatbugs_server.h"
+
+
+#define OKI_DOKI	 0
+#define NOT_DOKI	-1
+
+#define SERVE_WORKERS	1	/* Jobs run at once on each kind of device in server mode. */
+
+
+
+/** Values returned by 'getopt_long' for options without a single character selector. */
+enum hb_long_options {
+	OPT_FIRST_LONG = 256,			/* Out of the 'char' range. */
+	OPT_TILE = OPT_FIRST_LONG,		/* --tile */
+	OPT_SNAPSHOT_PERIOD,			/* --snapshot-period */
+	OPT_SNAPSHOT_FILE,			/* --snapshot-file */
+	OPT_DEVICE,				/* --device */
+	OPT_VECTOR_WIDTH,			/* --vector-width */
+	OPT_AUTOTUNE,				/* --autotune */
+	OPT_TUNE_FILE,				/* --tune-file */
+	OPT_FUSED,				/* --fused */
+	OPT_MEGAKERNEL,				/* --megakernel */
+	OPT_ASYNC_IO,				/* --async-io */
+	OPT_WRITER_RING,			/* --writer-ring */
+	OPT_FLUSH_RECORDS,			/* --flush-records */
+	OPT_FLUSH_MS,				/* --flush-ms */
+	OPT_CONVERGE_EPSILON,			/* --converge-eps */
+	OPT_CONVERGE_WINDOW,			/* --converge-window */
+	OPT_STILL_WINDOW,			/* --still-window */
+	OPT_ACTIVE_TILE,			/* --active-tile */
+	OPT_ACTIVE_THRESHOLD,			/* --active-threshold */
+	OPT_PLACEMENT,				/* --placement */
+	OPT_PLACEMENT_FILE,			/* --placement-file */
+	OPT_BUG_FILE,				/* --bug-file */
+	OPT_SCENARIO_FILE,			/* --scenario-file */
+	OPT_DETERMINISTIC,			/* --deterministic */
+	OPT_DEPOSIT,				/* --deposit */
+	OPT_HEAT_IMAGE,				/* --heat-image */
+	OPT_BINNED_STEP,			/* --binned-step */
+	OPT_ACCUMULATOR,			/* --accumulator */
+	OPT_NEIGHBOURHOOD,			/* --neighbourhood */
+	OPT_BOUNDARY,				/* --boundary */
+	OPT_PROFILE,				/* --profile */
+	OPT_BUFFERS,				/* --buffers */
+	OPT_SERVE,				/* --serve */
+	OPT_SERVE_WORKERS,			/* --serve-workers */
+	OPT_ROI,				/* --roi */
+	OPT_ROI_PERIOD,				/* --roi-period */
+	OPT_ROI_FILE,				/* --roi-file */
+	OPT_TRACE,				/* --trace */
+	OPT_TRACE_RING,				/* --trace-ring */
+	OPT_TRACE_FILE				/* --trace-file */
+};
+
+
+
+const char version[] = "Heatbugs simulation for GPU (parallel processing) v3.1.";
+
+
+
+/* The engine a SIGINT / SIGTERM stops. */
+static HBEngine_t *hb_signal_engine = NULL;
+
+/* Server mode options. They are not simulation parameters, and are refused in jobs. */
+static char hb_serve_path[ 256 ] = "";		/* --serve */
+static size_t hb_serve_workers[ HB_SERVE_DEVICES ] = {	/* --serve-workers, by 'enum hb_device_types'. */
+	SERVE_WORKERS, SERVE_WORKERS, SERVE_WORKERS };
+
+
+/**
+ * SIGINT / SIGTERM handler. Asks the simulation to stop, so the results written so far are flushed and the files
+ * closed. A second signal is not caught.
+ * */
+static void hb_request_stop( int signum )
+{
+	signal( signum, SIG_DFL );
+
+	if (hb_signal_engine) hb_engine_stop( hb_signal_engine );
+}
+
+
+
+/**
+ * Read the argument of an option taking a non-negative integer. Negative values, text that is not a number and values
+ * above 'max' are errors, not wrapped nor taken as 0.
+ *
+ * @param[in]	text   - Option argument.
+ * @param[in]	option - Long option name, for the error message.
+ * @param[in]	max    - Largest value accepted.
+ * @param[out]	err    - GLib object for error reporting.
+ * @return	The value, or 0 on error.
+ * */
+static inline size_t parseCount( const char *const text, const char *const option, const size_t max, GError **err )
+{
+	char *end;
+	unsigned long long value;
+
+
+	errno = 0;
+	value = strtoull( text, &end, 10 );
+
+	/* 'strtoull' takes a leading '-' and negates the value. */
+	hb_if_err_create_goto( *err, HB_ERROR,
+				text[ strspn( text, " \t" ) ] == '-' || end == text || *end != '\0' ||
+				errno == ERANGE || value > max,
+				HB_INVALID_PARAMETER, error_handler,
+				"Option --%s needs an integer in [0 .. %zu].", option, max );
+
+	return (size_t) value;
+
+
+error_handler:
+
+	return 0;
+}
+
+
+
+/**
+ * Copy the argument of an option taking a file name, or other text, to 'dest', of 'size' bytes. An argument that does
+ * not fit is an error, not truncated.
+ * */
+static inline void copyArgument( char *const dest, const size_t size, const char *const text,
+					const char *const option, GError **err )
+{
+	hb_if_err_create_goto( *err, HB_ERROR,
+				g_strlcpy( dest, text, size ) >= size,
+				HB_INVALID_PARAMETER, error_handler,
+				"Option %s argument is longer than %zu characters.", option, size - 1 );
+
+
+error_handler:
+
+	return;
+}
+
+
+
+/**
+ * Read the argument of --serve-workers: a number of workers for each kind of device, or a list of kinds and their
+ * workers, (e.g. gpu=2,cpu=4). Kinds left out of a list get no workers.
+ * */
+static inline void parseServeWorkers( const char *const text, size_t workers[ HB_SERVE_DEVICES ], GError **err )
+{
+	static const char *const kinds[ HB_SERVE_DEVICES ] = { "gpu", "cpu", "any" };	/* By 'enum hb_device_types'. */
+
+	gchar **items = NULL;
+	gchar *value;
+	size_t i, device;
+
+	GError *err_parse = NULL;
+
+
+	if (strchr( text, '=' ) == NULL)
+	{
+		workers[ 0 ] = parseCount( text, "serve-workers", SIZE_MAX, &err_parse );
+		hb_if_err_propagate_goto( err, err_parse, error_handler );
+
+		for (device = 1; device < HB_SERVE_DEVICES; device++)
+			workers[ device ] = workers[ 0 ];
+	}
+	else
+	{
+		for (device = 0; device < HB_SERVE_DEVICES; device++)
+			workers[ device ] = 0;
+
+		items = g_strsplit( text, ",", -1 );
+
+		for (i = 0; items[ i ] != NULL; i++)
+		{
+			value = strchr( items[ i ], '=' );
+
+			for (device = 0; device < HB_SERVE_DEVICES; device++)
+				if (value && (size_t) (value - items[ i ]) == strlen( kinds[ device ] ) &&
+					strncmp( items[ i ], kinds[ device ], strlen( kinds[ device ] ) ) == 0)
+					break;
+
+			hb_if_err_create_goto( *err, HB_ERROR,
+						device == HB_SERVE_DEVICES,
+						HB_INVALID_PARAMETER, error_handler,
+						"Option --serve-workers must be a number, or a list of gpu=N, cpu=N and any=N." );
+
+			workers[ device ] = parseCount( value + 1, "serve-workers", SIZE_MAX, &err_parse );
+			hb_if_err_propagate_goto( err, err_parse, error_handler );
+		}
+	}
+
+
+error_handler:
+
+	g_strfreev( items );
+
+	return;
+}
+
+
+
+/**
+ * Sets the parameters passed as command line arguments.
+ * If there are no parameters, default parameters are used.
+ * Default parameter will be used for every omitted parameter.
+ *
+ * This function uses the GNU 'getopt_long' command line argument parser, and requires the macro _GNU_SOURCE to be
+ * defined. As such, the code using the 'getopt_long' function is not portable.
+ * Consequence of using 'getopt_long' is that the previous result of 'argv' parameter may change after 'getopt_long' is
+ * used, therefore 'argv' should not be used again.
+ * The function 'getopt_long' is marked as Thread Unsafe.
+ *
+ * Options of the original model have a single character selector. Options that only tune how the simulation is
+ * carried out are long options, (i.e. --tile 16  or  --tile=16).
+ *
+ * @param[out]	params - Parameters to be filled with default or
+ *                     from command line.
+ * @param[in]	argc   - Command line argument counter.
+ * @param[in]	argv   - Command line arguments.
+ * @param[in]	job    - Set if they are the options of a server job, where the server options are refused.
+ * @param[out]	err    - GLib object for error reporting.
+ * */
+static void getSimulParameters( Parameters_t *const params, int argc, char *argv[], int job, GError **err )
+{
+	int c;	/* Parsed command line option */
+
+	HBRoi_t *roi;	/* Region of interest being parsed. */
+
+	/*
+	   The string 't:T:h:H:r:n:d:e:w:W:i:f:' is the parameter string to be checked by 'getopt' function.
+	   The ':' character means that a value is required after the parameter selector character (i.e. -t 50  or  -t50).
+	 * */
+	const char matches[] = "t:T:h:H:r:n:d:e:w:W:i:s:f:";
+
+	/* Long options. Those without a single character selector return a value out of the 'char' range. */
+	const struct option long_matches[] = {
+		{ "tile",		required_argument,	NULL,	OPT_TILE },
+		{ "snapshot-period",	required_argument,	NULL,	OPT_SNAPSHOT_PERIOD },
+		{ "snapshot-file",	required_argument,	NULL,	OPT_SNAPSHOT_FILE },
+		{ "device",		required_argument,	NULL,	OPT_DEVICE },
+		{ "vector-width",	required_argument,	NULL,	OPT_VECTOR_WIDTH },
+		{ "autotune",		no_argument,		NULL,	OPT_AUTOTUNE },
+		{ "tune-file",		required_argument,	NULL,	OPT_TUNE_FILE },
+		{ "fused",		no_argument,		NULL,	OPT_FUSED },
+		{ "megakernel",		required_argument,	NULL,	OPT_MEGAKERNEL },
+		{ "async-io",		no_argument,		NULL,	OPT_ASYNC_IO },
+		{ "writer-ring",	required_argument,	NULL,	OPT_WRITER_RING },
+		{ "flush-records",	required_argument,	NULL,	OPT_FLUSH_RECORDS },
+		{ "flush-ms",		required_argument,	NULL,	OPT_FLUSH_MS },
+		{ "converge-eps",	required_argument,	NULL,	OPT_CONVERGE_EPSILON },
+		{ "converge-window",	required_argument,	NULL,	OPT_CONVERGE_WINDOW },
+		{ "still-window",	required_argument,	NULL,	OPT_STILL_WINDOW },
+		{ "active-tile",	required_argument,	NULL,	OPT_ACTIVE_TILE },
+		{ "active-threshold",	required_argument,	NULL,	OPT_ACTIVE_THRESHOLD },
+		{ "placement",		required_argument,	NULL,	OPT_PLACEMENT },
+		{ "placement-file",	required_argument,	NULL,	OPT_PLACEMENT_FILE },
+		{ "bug-file",		required_argument,	NULL,	OPT_BUG_FILE },
+		{ "scenario-file",	required_argument,	NULL,	OPT_SCENARIO_FILE },
+		{ "deterministic",	no_argument,		NULL,	OPT_DETERMINISTIC },
+		{ "deposit",		required_argument,	NULL,	OPT_DEPOSIT },
+		{ "heat-image",		no_argument,		NULL,	OPT_HEAT_IMAGE },
+		{ "binned-step",	no_argument,		NULL,	OPT_BINNED_STEP },
+		{ "accumulator",	required_argument,	NULL,	OPT_ACCUMULATOR },
+		{ "neighbourhood",	required_argument,	NULL,	OPT_NEIGHBOURHOOD },
+		{ "boundary",		required_argument,	NULL,	OPT_BOUNDARY },
+		{ "profile",		no_argument,		NULL,	OPT_PROFILE },
+		{ "buffers",		required_argument,	NULL,	OPT_BUFFERS },
+		{ "serve",		required_argument,	NULL,	OPT_SERVE },
+		{ "serve-workers",	required_argument,	NULL,	OPT_SERVE_WORKERS },
+		{ "roi",		required_argument,	NULL,	OPT_ROI },
+		{ "roi-period",		required_argument,	NULL,	OPT_ROI_PERIOD },
+		{ "roi-file",		required_argument,	NULL,	OPT_ROI_FILE },
+		{ "trace",		required_argument,	NULL,	OPT_TRACE },
+		{ "trace-ring",		required_argument,	NULL,	OPT_TRACE_RING },
+		{ "trace-file",		required_argument,	NULL,	OPT_TRACE_FILE },
+		{ NULL,			0,			NULL,	0 }
+	};
+
+
+	hb_params_defaults( params );
+
+	optind = 0;	/* Parse from the start. The server parses the options of each job. */
+
+
+	/* Parse command line arguments using GNU's getopt_long function. */
+
+	while ( (c = getopt_long( argc, argv, matches, long_matches, NULL )) != -1 )
+	{
+		switch (c)
+		{
+			case 't':
+				params->bugs_temperature_min_ideal = atoi( optarg );
+				break;
+			case 'T':
+				params->bugs_temperature_max_ideal = atoi( optarg );
+				break;
+			case 'h':
+				params->bugs_heat_min_output = atoi( optarg );
+				break;
+			case 'H':
+				params->bugs_heat_max_output = atoi( optarg );
+				break;
+			case 'r':
+				params->bugs_random_move_chance = atof( optarg );
+				break;
+			case 'n':
+				params->bugs_number = atoi( optarg );
+				break;
+			case 'd':
+				params->world_diffusion_rate = atof( optarg );
+				break;
+			case 'e':
+				params->world_evaporation_rate = atof( optarg );
+				break;
+			case 'w':
+				params->world_width = atoi( optarg );
+				break;
+			case 'W':
+				params->world_height = atoi( optarg );
+				break;
+			case 'i':
+				params->numIterations = atoi( optarg );
+				break;
+			case 's':
+				params->seed = atoi( optarg );
+				break;
+			case 'f':
+				copyArgument( params->output_filename, sizeof( params->output_filename ), optarg, "-f", err );
+				hb_if_err_goto( *err, error_handler );
+				break;
+			case OPT_TILE:
+				params->world_tile = atoi( optarg );
+				break;
+			case OPT_SNAPSHOT_PERIOD:
+				params->snapshot_period = atoi( optarg );
+				break;
+			case OPT_SNAPSHOT_FILE:
+				copyArgument( params->snapshot_filename, sizeof( params->snapshot_filename ), optarg, "--snapshot-file", err );
+				hb_if_err_goto( *err, error_handler );
+				break;
+			case OPT_DEVICE:
+				if (strcmp( optarg, "gpu" ) == 0)
+					params->device_type = HB_DEVICE_GPU;
+				else if (strcmp( optarg, "cpu" ) == 0)
+					params->device_type = HB_DEVICE_CPU;
+				else if (strcmp( optarg, "any" ) == 0)
+					params->device_type = HB_DEVICE_ANY;
+				else
+					hb_if_err_create_goto( *err, HB_ERROR,
+								TRUE,
+								HB_INVALID_PARAMETER, error_handler,
+								"Device must be one of: gpu, cpu, any." );
+				break;
+			case OPT_VECTOR_WIDTH:
+				params->heat_vector_width = atoi( optarg );
+				break;
+			case OPT_AUTOTUNE:
+				params->autotune = 1;
+				break;
+			case OPT_TUNE_FILE:
+				copyArgument( params->tune_filename, sizeof( params->tune_filename ), optarg, "--tune-file", err );
+				hb_if_err_goto( *err, error_handler );
+				break;
+			case OPT_FUSED:
+				params->fused = 1;
+				break;
+			case OPT_MEGAKERNEL:
+				params->megakernel_steps = atoi( optarg );
+				break;
+			case OPT_ASYNC_IO:
+				params->async_io = 1;
+				break;
+			case OPT_WRITER_RING:
+				params->writer_ring = parseCount( optarg, "writer-ring", SIZE_MAX, err );
+				hb_if_err_goto( *err, error_handler );
+				break;
+			case OPT_FLUSH_RECORDS:
+				params->flush_records = parseCount( optarg, "flush-records", SIZE_MAX, err );
+				hb_if_err_goto( *err, error_handler );
+				break;
+			case OPT_FLUSH_MS:
+				params->flush_ms = parseCount( optarg, "flush-ms", UINT_MAX, err );
+				hb_if_err_goto( *err, error_handler );
+				break;
+			case OPT_CONVERGE_EPSILON:
+				params->converge_epsilon = atof( optarg );
+				break;
+			case OPT_CONVERGE_WINDOW:
+				params->converge_window = atoi( optarg );
+				break;
+			case OPT_STILL_WINDOW:
+				params->still_window = atoi( optarg );
+				break;
+			case OPT_ACTIVE_TILE:
+				params->active_tile = atoi( optarg );
+				break;
+			case OPT_ACTIVE_THRESHOLD:
+				params->active_threshold = atof( optarg );
+				break;
+			case OPT_PLACEMENT:
+				if (strcmp( optarg, "random" ) == 0)
+					params->placement = HB_PLACE_RANDOM;
+				else if (strcmp( optarg, "permute" ) == 0)
+					params->placement = HB_PLACE_PERMUTE;
+				else
+					hb_if_err_create_goto( *err, HB_ERROR,
+								TRUE,
+								HB_INVALID_PARAMETER, error_handler,
+								"Placement must be one of: random, permute." );
+				break;
+			case OPT_PLACEMENT_FILE:
+				copyArgument( params->placement_filename, sizeof( params->placement_filename ), optarg, "--placement-file", err );
+				hb_if_err_goto( *err, error_handler );
+				params->placement = HB_PLACE_FILE;
+				break;
+			case OPT_BUG_FILE:
+				copyArgument( params->bug_filename, sizeof( params->bug_filename ), optarg, "--bug-file", err );
+				hb_if_err_goto( *err, error_handler );
+				break;
+			case OPT_SCENARIO_FILE:
+				copyArgument( params->scenario_filename, sizeof( params->scenario_filename ), optarg, "--scenario-file", err );
+				hb_if_err_goto( *err, error_handler );
+				break;
+			case OPT_DETERMINISTIC:
+				params->deterministic = 1;
+				break;
+			case OPT_DEPOSIT:
+				if (strcmp( optarg, "inline" ) == 0)
+					params->deposit = HB_DEPOSIT_INLINE;
+				else if (strcmp( optarg, "atomic" ) == 0)
+					params->deposit = HB_DEPOSIT_ATOMIC;
+				else if (strcmp( optarg, "gather" ) == 0)
+					params->deposit = HB_DEPOSIT_GATHER;
+				else
+					hb_if_err_create_goto( *err, HB_ERROR,
+								TRUE,
+								HB_INVALID_PARAMETER, error_handler,
+								"Deposit must be one of: inline, atomic, gather." );
+				break;
+			case OPT_HEAT_IMAGE:
+				params->heat_image = 1;
+				break;
+			case OPT_BINNED_STEP:
+				params->binned_step = 1;
+				break;
+			case OPT_ACCUMULATOR:
+				if (strcmp( optarg, "float" ) == 0)
+					params->accumulator = HB_ACCUM_FLOAT;
+				else if (strcmp( optarg, "kahan" ) == 0)
+					params->accumulator = HB_ACCUM_KAHAN;
+				else if (strcmp( optarg, "double" ) == 0)
+					params->accumulator = HB_ACCUM_DOUBLE;
+				else if (strcmp( optarg, "fixed" ) == 0)
+					params->accumulator = HB_ACCUM_FIXED;
+				else
+					hb_if_err_create_goto( *err, HB_ERROR,
+								TRUE,
+								HB_INVALID_PARAMETER, error_handler,
+								"Accumulator must be one of: float, kahan, double, fixed." );
+				break;
+			case OPT_NEIGHBOURHOOD:
+				if (strcmp( optarg, "moore" ) == 0)
+					params->neighbourhood = HB_NEIGHBOURS_MOORE;
+				else if (strcmp( optarg, "von-neumann" ) == 0)
+					params->neighbourhood = HB_NEIGHBOURS_VON_NEUMANN;
+				else
+					hb_if_err_create_goto( *err, HB_ERROR,
+								TRUE,
+								HB_INVALID_PARAMETER, error_handler,
+								"Neighbourhood must be one of: moore, von-neumann." );
+				break;
+			case OPT_BOUNDARY:
+				if (strcmp( optarg, "torus" ) == 0)
+					params->boundary = HB_BOUNDARY_TORUS;
+				else if (strcmp( optarg, "box" ) == 0)
+					params->boundary = HB_BOUNDARY_BOX;
+				else
+					hb_if_err_create_goto( *err, HB_ERROR,
+								TRUE,
+								HB_INVALID_PARAMETER, error_handler,
+								"Boundary must be one of: torus, box." );
+				break;
+			case OPT_PROFILE:
+				params->profile = 1;
+				break;
+			case OPT_BUFFERS:
+				if (strcmp( optarg, "auto" ) == 0)
+					params->buffers = HB_BUFFERS_AUTO;
+				else if (strcmp( optarg, "host" ) == 0)
+					params->buffers = HB_BUFFERS_HOST;
+				else if (strcmp( optarg, "device" ) == 0)
+					params->buffers = HB_BUFFERS_DEVICE;
+				else
+					hb_if_err_create_goto( *err, HB_ERROR,
+								TRUE,
+								HB_INVALID_PARAMETER, error_handler,
+								"Buffers must be one of: auto, host, device." );
+				break;
+			case OPT_SERVE:
+				hb_if_err_create_goto( *err, HB_ERROR,
+							job,
+							HB_INVALID_PARAMETER, error_handler,
+							"Option --serve can not be given in a job." );
+
+				copyArgument( hb_serve_path, sizeof( hb_serve_path ), optarg, "--serve", err );
+				hb_if_err_goto( *err, error_handler );
+				break;
+			case OPT_SERVE_WORKERS:
+				hb_if_err_create_goto( *err, HB_ERROR,
+							job,
+							HB_INVALID_PARAMETER, error_handler,
+							"Option --serve-workers can not be given in a job." );
+
+				parseServeWorkers( optarg, hb_serve_workers, err );
+				hb_if_err_goto( *err, error_handler );
+				break;
+			case OPT_ROI:
+				/* heat:ROW,COL,HEIGHT,WIDTH  or  swarm:ROW,COL,HEIGHT,WIDTH. Repeated for more regions. */
+				hb_if_err_create_goto( *err, HB_ERROR,
+							params->roi_count == HB_ROI_MAX,
+							HB_INVALID_PARAMETER, error_handler,
+							"At most %d regions of interest.", HB_ROI_MAX );
+
+				roi = &params->rois[ params->roi_count ];
+
+				if (strncmp( optarg, "heat:", 5 ) == 0)
+					roi->map = HB_ROI_HEAT;
+				else if (strncmp( optarg, "swarm:", 6 ) == 0)
+					roi->map = HB_ROI_SWARM;
+				else
+					roi->map = -1;
+
+				hb_if_err_create_goto( *err, HB_ERROR,
+							roi->map < 0 ||
+							sscanf( strchr( optarg, ':' ) + 1, "%zu,%zu,%zu,%zu", &roi->row,
+								&roi->col, &roi->height, &roi->width ) != 4,
+							HB_INVALID_PARAMETER, error_handler,
+							"Region of interest must be heat:ROW,COL,HEIGHT,WIDTH or "
+							"swarm:ROW,COL,HEIGHT,WIDTH." );
+
+				params->roi_count++;
+				break;
+			case OPT_ROI_PERIOD:
+				params->roi_period = atoi( optarg );
+				break;
+			case OPT_ROI_FILE:
+				copyArgument( params->roi_filename, sizeof( params->roi_filename ), optarg, "--roi-file", err );
+				hb_if_err_goto( *err, error_handler );
+				break;
+			case OPT_TRACE:
+				params->trace_sample = atoi( optarg );
+				break;
+			case OPT_TRACE_RING:
+				params->trace_ring = atoi( optarg );
+				break;
+			case OPT_TRACE_FILE:
+				copyArgument( params->trace_filename, sizeof( params->trace_filename ), optarg, "--trace-file", err );
+				hb_if_err_goto( *err, error_handler );
+				break;
+			case '?':
+				hb_if_err_create_goto( *err, HB_ERROR,
+							(optopt >= OPT_FIRST_LONG) ||
+							(optopt != 0 && optopt != ':' && strchr( matches, optopt ) != NULL),
+							HB_PARAM_ARG_MISSING, error_handler,
+							"Option required argument missing." );
+
+				hb_if_err_create_goto( *err, HB_ERROR,
+							(isprint( optopt )),
+							HB_PARAM_OPTION_UNKNOWN, error_handler,
+							"Unknown option." );
+
+				hb_if_err_create_goto( *err, HB_ERROR,
+							TRUE,
+							HB_PARAM_CHAR_UNKNOWN, error_handler,
+							"Unprintable character in command line." );
+			default:
+				hb_if_err_create_goto( *err, HB_ERROR,
+							TRUE,
+							HB_PARAM_PARSING, error_handler,
+							"Weird error occurred while parsing parameter." );
+		}
+	}
+
+	/*
+	   NOTE: Check here for extra arguments... see:
+	   	 https://www.gnu.org/software/libc/manual/html_node/Example-of-Getopt.html
+	 */
+
+
+error_handler:
+	/* If error handler is reached leave function imediately. */
+
+	return;
+}
+
+
+
+/** Parser of the server jobs, (see 'HBServeParse_t'): the command line's, without the server options. */
+static void getJobParameters( Parameters_t *const params, int argc, char *argv[], GError **err )
+{
+	getSimulParameters( params, argc, argv, 1, err );
+}
+
+
+
+
+int main ( int argc, char *argv[] )
+{
+	FILE *hbResultFile = NULL;
+	FILE *hbSnapshotFile = NULL;
+	FILE *hbRoiFile = NULL;
+	FILE *hbTraceFile = NULL;
+
+	HBWriter_t *hbResultWriter = NULL;			/* Writer thread of the results. */
+	HBWriterStats_t writer_stats;				/* Its metrics. */
+	int writer_status;
+
+	HBStats_t stats;					/* How the simulation ended. */
+
+	Parameters_t params;					/* Host data; simulation parameters. */
+
+	HBEngine_t *engine = NULL;				/* OpenCL objects, buffers and kernels. */
+
+	GError *err_main = NULL;				/* Error reporting object. */
+
+
+	getSimulParameters( &params, argc, argv, 0, &err_main );
+	hb_if_err_goto( err_main, error_handler );
+
+	/* Server mode: jobs come from the socket, each with its own options, parsed as these. */
+	if (hb_serve_path[ 0 ])
+	{
+		hb_serve( hb_serve_path, hb_serve_workers, getJobParameters, &err_main );
+		hb_if_err_goto( err_main, error_handler );
+
+		goto clean_all;
+	}
+
+	engine = hb_engine_new( &params, &err_main );
+	hb_if_err_goto( err_main, error_handler );
+
+
+	/* Open output file for results. */
+	hbResultFile = fopen( params.output_filename, "w+" );	/* Overwrite. */
+	hb_if_err_create_goto( err_main, HB_ERROR,
+		hbResultFile == NULL, HB_UNABLE_OPEN_FILE, error_handler,
+		"Could not open output file." );
+
+	/* Results are written by a writer thread, so the disk never holds back the simulation. */
+	hbResultWriter = hb_writer_new( hbResultFile, params.writer_ring, params.flush_records, params.flush_ms );
+	hb_if_err_create_goto( err_main, HB_ERROR,
+		hbResultWriter == NULL, HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate host memory for the result writer." );
+
+	/* Open output file for heat map snapshots, if any. */
+	if (params.snapshot_period)
+	{
+		hbSnapshotFile = fopen( params.snapshot_filename, "w+b" );	/* Overwrite. */
+		hb_if_err_create_goto( err_main, HB_ERROR,
+			hbSnapshotFile == NULL, HB_UNABLE_OPEN_FILE, error_handler,
+			"Could not open snapshot file." );
+	}
+
+	/* Open output file for the regions of interest, if any. */
+	if (params.roi_count)
+	{
+		hbRoiFile = fopen( params.roi_filename, "w+b" );	/* Overwrite. */
+		hb_if_err_create_goto( err_main, HB_ERROR,
+			hbRoiFile == NULL, HB_UNABLE_OPEN_FILE, error_handler,
+			"Could not open region of interest file." );
+	}
+
+	/* Open output file for the trajectory samples, if any. */
+	if (params.trace_sample)
+	{
+		hbTraceFile = fopen( params.trace_filename, "w+b" );	/* Overwrite. */
+		hb_if_err_create_goto( err_main, HB_ERROR,
+			hbTraceFile == NULL, HB_UNABLE_OPEN_FILE, error_handler,
+			"Could not open trace file." );
+	}
+
+	hb_engine_set_outputs( engine, hbResultWriter, hbSnapshotFile, hbRoiFile, hbTraceFile );
+
+	/* From here on, SIGINT / SIGTERM stop the simulation cleanly. Results so far are written. */
+	hb_signal_engine = engine;
+
+	signal( SIGINT, hb_request_stop );
+	signal( SIGTERM, hb_request_stop );
+
+
+	/* Run all init kernels, tuning work-group sizes first if asked. */
+	hb_engine_init( engine, &err_main );
+	hb_if_err_goto( err_main, error_handler );
+
+	/* Run until a stop criterion. */
+	hb_engine_step( engine, 0, &err_main );
+	hb_if_err_goto( err_main, error_handler );
+
+	hb_engine_read_stats( engine, &stats );
+
+	printf( "Stopped after %zu iterations: %s.\n", stats.iterations, hb_stop_reason_name( stats.stop_reason ) );
+
+	/* Write all queued results. */
+	writer_status = hb_writer_close( hbResultWriter, &writer_stats );
+	hbResultWriter = NULL;
+	hb_if_err_create_goto( err_main, HB_ERROR,
+		writer_status != 0, HB_UNABLE_TO_WRITE_FILE, error_handler,
+		"Could not write results." );
+
+	printf( "Writer: %zu results in %zu batches, %zu flushes. %zu stalls, %.3f ms. Ring max fill %zu / %zu.\n",
+		writer_stats.records, writer_stats.batches, writer_stats.flushes, writer_stats.stalls,
+		writer_stats.stall_us * 1e-3, writer_stats.max_fill, writer_stats.capacity );
+
+	/* Device time of each kernel and transfer, to compare the modes of the simulation. */
+	hb_engine_print_profile( engine, &err_main );
+	hb_if_err_goto( err_main, error_handler );
+
+
+	goto clean_all;
+
+
+error_handler:
+
+	/* Handle error. */
+	fprintf( stderr, "Error: %s\n\n", err_main->message );
+	g_error_free( err_main );
+
+
+clean_all:
+
+
+	/* Write what was queued before an error, then close output files. */
+	if (hbResultWriter) hb_writer_close( hbResultWriter, NULL );
+
+	if (hbTraceFile) fclose( hbTraceFile );
+	if (hbRoiFile) fclose( hbRoiFile );
+	if (hbSnapshotFile) fclose( hbSnapshotFile );
+	if (hbResultFile) fclose( hbResultFile );
+
+	/* Clean / Destroy all allocated items. */
+	hb_signal_engine = NULL;
+
+	if (engine) hb_engine_destroy( engine );
+
+
+	/* Confirm that memory allocated by wrappers has been properly freed. */
+	g_assert( ccl_wrapper_memcheck() );
+
+
+	return OKI_DOKI;
+}
@@ -0,0 +1,789 @@
+/*
+ * This file is part of heatbugs_GPU.
+ *
+ * heatbugs_GPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_GPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_GPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+
+
+/**
+ * Simulation server.
+ *
+ * The main thread accepts the connections, and hands each to a reader thread, which reads and parses its job, and
+ * queues it for its kind of device. The worker threads of each kind run its jobs, each with a small cache of engines,
+ * so jobs of the same setup pay no OpenCL context creation nor build. The results go to the connection through a
+ * result writer, (see heatbugs_writer.c), so they stream as they are computed.
+ *
+ * SIGINT / SIGTERM are blocked in the threads, so they interrupt the main thread's 'accept(...)'.
+ * */
+
+
+#define _GNU_SOURCE	/* sigaction(..), fdopen(..) under -std=c99. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>	/* pthread_sigmask(..) */
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "heatbugs_server.h"
+
+
+#define SERVE_BACKLOG		64	/* Connections waiting to be accepted. */
+#define SERVE_LINE_MAX		4096	/* Longest job line. */
+#define SERVE_READ_TIMEOUT_S	5	/* Seconds a connection has to send its job. */
+#define SERVE_CACHE		4	/* Engines kept by each worker. */
+#define SERVE_FLUSH_MS		100	/* Result flush period, unless the job gives a flush policy. */
+#define SERVE_READERS_MAX	64	/* Connections being read at once. More are refused. */
+#define SERVE_WAIT_US		10000	/* Sleep while waiting for the readers to end. */
+#define SERVE_INPUT_FILES	3	/* Files read by the engine when created: placement, bug and scenario. */
+
+
+
+/** A queued job. */
+typedef struct hb_serve_job {
+	int fd;				/* The connection. Answered, and closed, by the worker. */
+	Parameters_t params;		/* The job parameters. */
+} HBServeJob_t;
+
+
+/** What changes with the contents of an input file, all zero without the file. */
+typedef struct hb_serve_stamp {
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+} HBServeStamp_t;
+
+
+/** An engine kept by a worker, and the parameters it was created with. */
+typedef struct hb_serve_cached {
+	Parameters_t key;		/* Parameters, but the seed, the iterations and the outputs. */
+	HBServeStamp_t files[ SERVE_INPUT_FILES ];	/* The input files, as they were when the engine read them. */
+	HBEngine_t *engine;
+	gint64 last_used;
+} HBServeCached_t;
+
+
+/** A connection being read, by a reader thread. */
+typedef struct hb_serve_reader {
+	int fd;
+	HBServeParse_t parse;
+	GAsyncQueue *const *queues;		/* Job queue of each kind of device, NULL if it has no workers. */
+} HBServeReader_t;
+
+
+/** A worker thread. */
+typedef struct hb_serve_worker {
+	GAsyncQueue *jobs;			/* Shared by the workers of a kind of device. */
+	HBServeCached_t cache[ SERVE_CACHE ];
+	HBEngine_t *volatile running;		/* The engine stepping now, stopped on SIGINT / SIGTERM. */
+	GThread *thread;
+} HBServeWorker_t;
+
+
+
+/* Set by SIGINT / SIGTERM. */
+static volatile sig_atomic_t hb_serve_stop = 0;
+
+/* The workers, for the signal handler to stop their jobs. */
+static HBServeWorker_t *hb_serve_pool = NULL;
+static size_t hb_serve_pool_size = 0;
+
+/* Pushed once per worker, after the last job. */
+static HBServeJob_t hb_serve_quit;
+
+/* Reader threads running. The queues are there until they all end. */
+static int hb_serve_readers = 0;
+
+/* The job parser is the command line's, with 'getopt_long(...)', not thread safe. */
+static GMutex hb_serve_parse_lock;
+
+
+
+/* SIGINT / SIGTERM handler. No more connections are accepted, running jobs stop, queued ones are refused. */
+static void serveRequestStop( int signum )
+{
+	size_t i;
+	HBEngine_t *engine;
+
+
+	hb_serve_stop = 1;
+
+	for (i = 0; i < hb_serve_pool_size; i++)
+	{
+		engine = hb_serve_pool[ i ].running;
+
+		if (engine) hb_engine_stop( engine );
+	}
+}
+
+
+
+/* A new thread, with SIGINT / SIGTERM blocked, so they are caught by the main thread. */
+static GThread *serveThreadNew( const gchar *name, GThreadFunc func, gpointer data )
+{
+	sigset_t signals, previous;
+	GThread *thread;
+
+
+	sigemptyset( &signals );
+	sigaddset( &signals, SIGINT );
+	sigaddset( &signals, SIGTERM );
+
+	pthread_sigmask( SIG_BLOCK, &signals, &previous );
+
+	thread = g_thread_new( name, func, data );
+
+	pthread_sigmask( SIG_SETMASK, &previous, NULL );
+
+	return thread;
+}
+
+
+
+/* Answer an error, as a JSON line. */
+static void serveError( FILE *out, const char *message )
+{
+	gchar *escaped = g_strescape( message, NULL );
+
+	fprintf( out, "{\"error\": \"%s\"}\n", escaped );
+
+	g_free( escaped );
+}
+
+
+
+/**
+ * Convert a job line, a flat JSON object, to command line arguments: "key": value to --key value, or -k value for
+ * single character keys. Values are strings, numbers, or true and false for options without argument.
+ *
+ * @return NULL terminated arguments, 'argv[0]' is the program name. Free with 'g_strfreev(...)'.
+ * */
+static gchar **jobArgv( const char *line, int *argc, GError **err )
+{
+	gchar **argv = g_new0( gchar *, strlen( line ) + 2 );	/* Each argument takes at least a character. */
+	const char *p = line, *start;
+	gchar *key = NULL, *value = NULL, *escaped;
+	int n = 0, first = 1;
+
+
+	argv[ n++ ] = g_strdup( "heatbugs" );
+
+	#define SKIP_SPACES() while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++
+
+	SKIP_SPACES();
+	hb_if_err_create_goto( *err, HB_ERROR, *p++ != '{', HB_PARAM_PARSING, error_handler,
+				"A job must be a JSON object." );
+
+	for (;;)
+	{
+		SKIP_SPACES();
+
+		if (*p == '}' && first) break;	/* Empty object. */
+
+		first = 0;
+
+		/* Key. */
+		hb_if_err_create_goto( *err, HB_ERROR, *p++ != '"', HB_PARAM_PARSING, error_handler,
+					"Job option names must be strings." );
+
+		for (start = p; *p && *p != '"'; p++);
+
+		hb_if_err_create_goto( *err, HB_ERROR, *p != '"', HB_PARAM_PARSING, error_handler,
+					"Unterminated job option name." );
+
+		key = g_strndup( start, p++ - start );
+
+		SKIP_SPACES();
+		hb_if_err_create_goto( *err, HB_ERROR, *p++ != ':', HB_PARAM_PARSING, error_handler,
+					"Expected ':' after job option '%s'.", key );
+		SKIP_SPACES();
+
+		/* Value. Strings may escape quotes and backslashes. */
+		if (*p == '"')
+		{
+			for (start = ++p; *p && *p != '"'; p++)
+				if (*p == '\\' && p[ 1 ]) p++;
+
+			hb_if_err_create_goto( *err, HB_ERROR, *p != '"', HB_PARAM_PARSING, error_handler,
+						"Unterminated value of job option '%s'.", key );
+
+			escaped = g_strndup( start, p++ - start );
+			value = g_strcompress( escaped );
+			g_free( escaped );
+		}
+		else
+		{
+			for (start = p; *p && *p != ',' && *p != '}' && *p != ' ' && *p != '\t'; p++);
+
+			value = g_strndup( start, p - start );
+		}
+
+		/* Option. */
+		if (strcmp( value, "false" ) != 0)
+		{
+			argv[ n++ ] = g_strdup_printf( strlen( key ) == 1 ? "-%s" : "--%s", key );
+
+			if (strcmp( value, "true" ) != 0)
+			{
+				argv[ n++ ] = value;
+				value = NULL;
+			}
+		}
+
+		g_free( key );
+		g_free( value );
+		key = value = NULL;
+
+		SKIP_SPACES();
+
+		if (*p == ',')
+		{
+			p++;
+			continue;
+		}
+
+		hb_if_err_create_goto( *err, HB_ERROR, *p != '}', HB_PARAM_PARSING, error_handler,
+					"Expected ',' or '}' in the job." );
+		break;
+	}
+
+	#undef SKIP_SPACES
+
+	*argc = n;
+
+	return argv;
+
+
+error_handler:
+	/* If error handler is reached leave function imediately. */
+
+	g_free( key );
+	g_free( value );
+	g_strfreev( argv );
+
+	return NULL;
+}
+
+
+
+/**
+ * Read the job of a new connection, one line, parse it, and queue it for its kind of device. An invalid job is
+ * answered, and the connection closed.
+ * */
+static void serveReadJob( int fd, HBServeParse_t parse, GAsyncQueue *const *queues )
+{
+	char line[ SERVE_LINE_MAX ];
+	size_t len = 0;
+	ssize_t got = 1;
+	char *newline = NULL;
+
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	const gint64 deadline = g_get_monotonic_time() + SERVE_READ_TIMEOUT_S * G_USEC_PER_SEC;
+	gint64 remaining_ms;
+
+	gchar **argv = NULL;
+	int argc = 0;
+
+	HBServeJob_t *job = g_new0( HBServeJob_t, 1 );	/* Zeroed, so equal parameters compare equal. */
+	FILE *out = NULL;
+
+	GError *err_job = NULL;
+
+
+	/* The whole line within SERVE_READ_TIMEOUT_S, however slowly it arrives. Up to the end of the connection. */
+	while (len < sizeof( line ) - 1 && got > 0 && newline == NULL)
+	{
+		remaining_ms = (deadline - g_get_monotonic_time() + 999) / 1000;
+
+		hb_if_err_create_goto( err_job, HB_ERROR,
+					remaining_ms <= 0 || poll( &pfd, 1, (int) remaining_ms ) <= 0,
+					HB_INVALID_PARAMETER, error_handler,
+					"No job received in %d seconds.", SERVE_READ_TIMEOUT_S );
+
+		got = read( fd, line + len, sizeof( line ) - 1 - len );
+
+		if (got > 0)
+		{
+			newline = memchr( line + len, '\n', got );
+			len += got;
+		}
+	}
+
+	line[ newline ? (size_t) (newline - line) : len ] = '\0';
+
+	argv = jobArgv( line, &argc, &err_job );
+	hb_if_err_goto( err_job, error_handler );
+
+	g_mutex_lock( &hb_serve_parse_lock );
+	parse( &job->params, argc, argv, &err_job );
+	g_mutex_unlock( &hb_serve_parse_lock );
+	hb_if_err_goto( err_job, error_handler );
+
+	hb_if_err_create_goto( err_job, HB_ERROR,
+				job->params.device_type < 0 || job->params.device_type >= HB_SERVE_DEVICES ||
+				queues[ job->params.device_type ] == NULL,
+				HB_INVALID_PARAMETER, error_handler,
+				"The server has no workers for this device." );
+
+	g_strfreev( argv );
+
+	job->fd = fd;
+
+	g_async_queue_push( queues[ job->params.device_type ], job );
+
+	return;
+
+
+error_handler:
+
+	out = fdopen( fd, "w" );
+
+	if (out)
+	{
+		serveError( out, err_job->message );
+		fclose( out );
+	}
+	else
+	{
+		close( fd );
+	}
+
+	g_error_free( err_job );
+	g_strfreev( argv );
+	g_free( job );
+
+	return;
+}
+
+
+
+/** Reader thread: read the job of one connection, and end. */
+static gpointer serveReader( gpointer data )
+{
+	HBServeReader_t *reader = (HBServeReader_t *) data;
+
+
+	serveReadJob( reader->fd, reader->parse, reader->queues );
+
+	g_free( reader );
+
+	__atomic_sub_fetch( &hb_serve_readers, 1, __ATOMIC_RELEASE );
+
+	return NULL;
+}
+
+
+
+/** Stamp of the input file 'filename', all zero if it is not given, or is not there. */
+static void serveStamp( const char *filename, HBServeStamp_t *stamp )
+{
+	struct stat file_stat;
+
+
+	memset( stamp, 0, sizeof( *stamp ) );
+
+	if (filename[ 0 ] == '\0' || stat( filename, &file_stat ) != 0) return;
+
+	stamp->dev = file_stat.st_dev;
+	stamp->ino = file_stat.st_ino;
+	stamp->size = file_stat.st_size;
+	stamp->mtime = file_stat.st_mtim;
+}
+
+
+
+/**
+ * The engine for a job: a cached one created with the same parameters, but the seed, the iterations and the outputs,
+ * and from the same input files, unchanged, or a new one, replacing the least recently used.
+ * */
+static HBEngine_t *serveEngine( HBServeWorker_t *worker, const Parameters_t *params, int *cached, GError **err )
+{
+	Parameters_t key;
+	HBServeStamp_t files[ SERVE_INPUT_FILES ];
+	HBServeCached_t *slot = &worker->cache[ 0 ];
+	size_t i;
+
+
+	/* Copied whole, padding too, as the job was zeroed, for 'memcmp(...)'. Set by each run, not by the engine. */
+	memcpy( &key, params, sizeof( key ) );
+
+	key.seed = 0;
+	key.numIterations = 0;
+	key.writer_ring = 0;
+	key.flush_records = 0;
+	key.flush_ms = 0;
+	memset( key.output_filename, 0, sizeof( key.output_filename ) );
+	memset( key.snapshot_filename, 0, sizeof( key.snapshot_filename ) );
+	memset( key.roi_filename, 0, sizeof( key.roi_filename ) );
+	memset( key.trace_filename, 0, sizeof( key.trace_filename ) );
+
+	/* The engine reads the input files once, when created. The names alone miss a file written again. */
+	serveStamp( params->placement_filename, &files[ 0 ] );
+	serveStamp( params->bug_filename, &files[ 1 ] );
+	serveStamp( params->scenario_filename, &files[ 2 ] );
+
+	for (i = 0; i < SERVE_CACHE; i++)
+	{
+		if (worker->cache[ i ].engine && memcmp( &worker->cache[ i ].key, &key, sizeof( key ) ) == 0 &&
+			memcmp( worker->cache[ i ].files, files, sizeof( files ) ) == 0)
+		{
+			worker->cache[ i ].last_used = g_get_monotonic_time();
+			*cached = 1;
+
+			return worker->cache[ i ].engine;
+		}
+
+		if (worker->cache[ i ].last_used < slot->last_used)
+			slot = &worker->cache[ i ];
+	}
+
+	*cached = 0;
+
+	if (slot->engine) hb_engine_destroy( slot->engine );
+
+	/* The engine checks the job's own parameters, the key blanks some it needs, (e.g. the writer ring). The seed and
+	 * the iterations of a cached engine are set by 'hb_engine_reset(...)' for each job. */
+	memcpy( &slot->key, &key, sizeof( key ) );
+	memcpy( slot->files, files, sizeof( files ) );
+	slot->engine = hb_engine_new( params, err );
+	slot->last_used = slot->engine ? g_get_monotonic_time() : 0;
+
+	return slot->engine;
+}
+
+
+
+/** Run a job, and answer it. */
+static void serveJob( HBServeWorker_t *worker, HBServeJob_t *job )
+{
+	const Parameters_t *const params = &job->params;
+
+	FILE *out = NULL;
+	FILE *snapshots = NULL;
+	FILE *rois = NULL;
+	FILE *traces = NULL;
+
+	HBWriter_t *writer = NULL;
+	int writer_status;
+
+	HBEngine_t *engine = NULL;
+	HBStats_t stats;
+	int cached = 0;
+
+	gint64 start, setup_us, run_us;
+
+	GError *err_job = NULL;
+
+
+	out = fdopen( job->fd, "w" );
+
+	if (out == NULL)
+	{
+		close( job->fd );
+		return;
+	}
+
+	hb_if_err_create_goto( err_job, HB_ERROR,
+		hb_serve_stop, HB_INVALID_PARAMETER, error_handler,
+		"Server stopping." );
+
+	start = g_get_monotonic_time();
+
+	engine = serveEngine( worker, params, &cached, &err_job );
+	hb_if_err_goto( err_job, error_handler );
+
+	setup_us = g_get_monotonic_time() - start;
+
+	if (params->snapshot_period)
+	{
+		snapshots = fopen( params->snapshot_filename, "w+b" );	/* Overwrite. */
+		hb_if_err_create_goto( err_job, HB_ERROR,
+			snapshots == NULL, HB_UNABLE_OPEN_FILE, error_handler,
+			"Could not open snapshot file." );
+	}
+
+	if (params->roi_count)
+	{
+		rois = fopen( params->roi_filename, "w+b" );	/* Overwrite. */
+		hb_if_err_create_goto( err_job, HB_ERROR,
+			rois == NULL, HB_UNABLE_OPEN_FILE, error_handler,
+			"Could not open region of interest file." );
+	}
+
+	if (params->trace_sample)
+	{
+		traces = fopen( params->trace_filename, "w+b" );	/* Overwrite. */
+		hb_if_err_create_goto( err_job, HB_ERROR,
+			traces == NULL, HB_UNABLE_OPEN_FILE, error_handler,
+			"Could not open trace file." );
+	}
+
+	/* Checked here, as a cached engine does not check the job again, and the cache key leaves the writer out. */
+	hb_if_err_create_goto( err_job, HB_ERROR,
+		params->writer_ring == 0 || !IS_POW2( params->writer_ring ), HB_INVALID_PARAMETER, error_handler,
+		"Writer ring size must be a power of 2." );
+
+	/* Results stream to the client, flushed every SERVE_FLUSH_MS unless the job has a flush policy. */
+	writer = hb_writer_new( out, params->writer_ring, params->flush_records,
+				params->flush_records || params->flush_ms ? params->flush_ms : SERVE_FLUSH_MS );
+	hb_if_err_create_goto( err_job, HB_ERROR,
+		writer == NULL, HB_MALLOC_FAILURE, error_handler,
+		"Unable to allocate host memory for the result writer." );
+
+	hb_engine_set_outputs( engine, writer, snapshots, rois, traces );
+
+	start = g_get_monotonic_time();
+
+	hb_engine_reset( engine, params->seed, params->numIterations, &err_job );
+	hb_if_err_goto( err_job, error_handler );
+
+	worker->running = engine;
+
+	/* A stop requested while initiating. */
+	if (hb_serve_stop) hb_engine_stop( engine );
+
+	hb_engine_step( engine, params->numIterations, &err_job );
+
+	worker->running = NULL;
+	hb_if_err_goto( err_job, error_handler );
+
+	run_us = g_get_monotonic_time() - start;
+
+	hb_engine_read_stats( engine, &stats );
+	hb_engine_set_outputs( engine, NULL, NULL, NULL, NULL );
+
+	/* All results are out before the stats. */
+	writer_status = hb_writer_close( writer, NULL );
+	writer = NULL;
+	hb_if_err_create_goto( err_job, HB_ERROR,
+		writer_status != 0, HB_UNABLE_TO_WRITE_FILE, error_handler,
+		"Could not write results." );
+
+	fprintf( out, "{\"iterations\": %zu, \"unhappiness\": %.9g, \"stop_reason\": \"%s\", \"engine\": \"%s\", "
+			"\"setup_ms\": %.3f, \"run_ms\": %.3f}\n",
+		stats.iterations, stats.unhappiness, hb_stop_reason_name( stats.stop_reason ),
+		cached ? "cached" : "new", setup_us * 1e-3, run_us * 1e-3 );
+
+	goto clean_all;
+
+
+error_handler:
+
+	worker->running = NULL;
+
+	if (engine) hb_engine_set_outputs( engine, NULL, NULL, NULL, NULL );
+
+	/* The writer thread writes to the connection until closed. */
+	if (writer) hb_writer_close( writer, NULL );
+
+	serveError( out, err_job->message );
+	g_error_free( err_job );
+
+
+clean_all:
+
+	if (traces) fclose( traces );
+	if (rois) fclose( rois );
+	if (snapshots) fclose( snapshots );
+
+	fclose( out );
+}
+
+
+
+/** Worker thread: run jobs until told to quit. */
+static gpointer serveRun( gpointer data )
+{
+	HBServeWorker_t *worker = (HBServeWorker_t *) data;
+	HBServeJob_t *job;
+
+
+	while ((job = (HBServeJob_t *) g_async_queue_pop( worker->jobs )) != &hb_serve_quit)
+	{
+		serveJob( worker, job );
+		g_free( job );
+	}
+
+	return NULL;
+}
+
+
+
+void hb_serve( const char *socket_path, const size_t workers[ HB_SERVE_DEVICES ], HBServeParse_t parse, GError **err )
+{
+	struct sockaddr_un addr;
+	struct sigaction action;
+
+	int server_fd = -1, fd;
+	int listening = 0;
+
+	GAsyncQueue *jobs[ HB_SERVE_DEVICES ] = { NULL };	/* A queue per kind of device with workers. */
+	HBServeWorker_t *pool = NULL;
+	HBServeReader_t *reader;
+	size_t pool_size = 0;
+
+	FILE *out;
+
+	size_t i, j, device;
+
+
+	for (device = 0; device < HB_SERVE_DEVICES; device++)
+		pool_size += workers[ device ];
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+				pool_size == 0,
+				HB_INVALID_PARAMETER, error_handler,
+				"The server needs at least one worker." );
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+				strlen( socket_path ) >= sizeof( addr.sun_path ),
+				HB_INVALID_PARAMETER, error_handler,
+				"Socket path too long." );
+
+	server_fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+	hb_if_err_create_goto( *err, HB_ERROR,
+				server_fd < 0,
+				HB_UNABLE_OPEN_FILE, error_handler,
+				"Could not create the server socket." );
+
+	memset( &addr, 0, sizeof( addr ) );
+	addr.sun_family = AF_UNIX;
+	strcpy( addr.sun_path, socket_path );
+
+	unlink( socket_path );	/* A socket left by a previous server. */
+
+	hb_if_err_create_goto( *err, HB_ERROR,
+				bind( server_fd, (struct sockaddr *) &addr, sizeof( addr ) ) != 0 ||
+				listen( server_fd, SERVE_BACKLOG ) != 0,
+				HB_UNABLE_OPEN_FILE, error_handler,
+				"Could not listen on '%s'.", socket_path );
+
+	listening = 1;
+
+
+	/* Workers of each kind of device, taking jobs from its queue. */
+	pool = g_new0( HBServeWorker_t, pool_size );
+
+	for (device = 0, i = 0; device < HB_SERVE_DEVICES; device++)
+	{
+		if (workers[ device ] == 0) continue;
+
+		jobs[ device ] = g_async_queue_new();
+
+		for (j = 0; j < workers[ device ]; j++, i++)
+		{
+			pool[ i ].jobs = jobs[ device ];
+			pool[ i ].thread = serveThreadNew( "hb-serve", serveRun, &pool[ i ] );
+		}
+	}
+
+	hb_serve_pool = pool;
+	hb_serve_pool_size = pool_size;
+
+	/* SIGINT / SIGTERM interrupt 'accept(...)', not restarted. A client leaving before its answer is no harm. */
+	memset( &action, 0, sizeof( action ) );
+	action.sa_handler = serveRequestStop;
+	sigemptyset( &action.sa_mask );
+
+	sigaction( SIGINT, &action, NULL );
+	sigaction( SIGTERM, &action, NULL );
+	signal( SIGPIPE, SIG_IGN );
+
+	printf( "Serving on '%s', workers: %zu gpu, %zu cpu, %zu any.\n", socket_path,
+		workers[ HB_DEVICE_GPU ], workers[ HB_DEVICE_CPU ], workers[ HB_DEVICE_ANY ] );
+	fflush( stdout );
+
+
+	while (!hb_serve_stop)
+	{
+		fd = accept( server_fd, NULL, NULL );
+
+		if (fd < 0)
+		{
+			if (errno != EINTR) fprintf( stderr, "Warning: Could not accept a connection.\n" );
+			continue;
+		}
+
+		/* Each connection is read by a thread of its own, up to SERVE_READERS_MAX of them. */
+		if (__atomic_load_n( &hb_serve_readers, __ATOMIC_ACQUIRE ) >= SERVE_READERS_MAX)
+		{
+			out = fdopen( fd, "w" );
+
+			if (out)
+			{
+				serveError( out, "Server busy." );
+				fclose( out );
+			}
+			else
+			{
+				close( fd );
+			}
+
+			continue;
+		}
+
+		reader = g_new( HBServeReader_t, 1 );
+		reader->fd = fd;
+		reader->parse = parse;
+		reader->queues = jobs;
+
+		__atomic_add_fetch( &hb_serve_readers, 1, __ATOMIC_RELEASE );
+
+		g_thread_unref( serveThreadNew( "hb-serve-read", serveReader, reader ) );
+	}
+
+
+error_handler:
+	/* Readers queue their jobs, (each has SERVE_READ_TIMEOUT_S in all to read its job, then parses it). Workers
+	 * answer the jobs queued, then quit. */
+
+	while (__atomic_load_n( &hb_serve_readers, __ATOMIC_ACQUIRE ))
+		g_usleep( SERVE_WAIT_US );
+
+	if (pool)
+	{
+		for (i = 0; i < pool_size; i++)
+			g_async_queue_push( pool[ i ].jobs, &hb_serve_quit );
+
+		for (i = 0; i < pool_size; i++)
+		{
+			g_thread_join( pool[ i ].thread );
+
+			for (j = 0; j < SERVE_CACHE; j++)
+				if (pool[ i ].cache[ j ].engine) hb_engine_destroy( pool[ i ].cache[ j ].engine );
+		}
+
+		hb_serve_pool = NULL;
+		hb_serve_pool_size = 0;
+
+		g_free( pool );
+	}
+
+	for (device = 0; device < HB_SERVE_DEVICES; device++)
+		if (jobs[ device ]) g_async_queue_unref( jobs[ device ] );
+
+	if (server_fd >= 0) close( server_fd );
+
+	if (listening) unlink( socket_path );
+
+	return;
+}
@@ -0,0 +1,58 @@
+/*
+ * This file is part of heatbugs_GPU.
+ *
+ * heatbugs_GPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_GPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_GPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+
+#ifndef __HEATBUGS_SERVER_H_
+#define __HEATBUGS_SERVER_H_
+
+
+#include "heatbugs_engine.h"
+
+
+/** Parser of the options of a job, the command line's. */
+typedef void (*HBServeParse_t)( Parameters_t *params, int argc, char *argv[], GError **err );
+
+
+/** Kinds of device a job runs on, (enum hb_device_types). Each has its own workers. */
+#define HB_SERVE_DEVICES	3
+
+
+/**
+ * Serve simulation jobs on a Unix socket, until SIGINT / SIGTERM.
+ *
+ * A job is a connection sending one line, a flat JSON object of command line options, without their dashes:
+ *
+ *     {"n": 500, "w": 256, "W": 256, "i": 1000, "tile": 16, "deterministic": true, "s": 42}
+ *
+ * A 'true' value is an option without argument, 'false' leaves it out. The answer streams the unhappiness series,
+ * one average per line as in the result file, then one JSON line with the stats, or with an "error". Snapshots, if
+ * asked, are written to the job's snapshot file. Its result file is not used.
+ *
+ * Each connection is read by a thread of its own, so a slow client holds no other. Jobs wait in a queue for their
+ * kind of device, (the job's --device), and run on the 'workers' threads of that kind: the jobs run at once on the
+ * device. A job for a kind without workers is refused. Each worker keeps the engines of its last jobs: a job with the
+ * same parameters, but the seed and the iterations, runs on one of them, without new OpenCL objects nor build.
+ *
+ * @param[in]	socket_path - Where to create the socket. A socket already there is replaced.
+ * @param[in]	workers     - Jobs run at once on each kind of device, by 'enum hb_device_types'.
+ * @param[in]	parse       - Parser of the job options.
+ * @param[out]	err         - GLib object for error reporting.
+ * */
+void hb_serve( const char *socket_path, const size_t workers[ HB_SERVE_DEVICES ], HBServeParse_t parse, GError **err );
+
+
+#endif
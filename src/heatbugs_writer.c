@@ -0,0 +1,226 @@
+/*
+ * This file is part of heatbugs_GPU.
+ *
+ * heatbugs_GPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_GPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_GPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+
+
+/**
+ * Background result writer.
+ *
+ * The simulation thread (producer) and the writer thread (consumer) share a ring of records, without locks. Each
+ * side owns one index: the producer stores records and then publishes 'head' with a release store, the consumer
+ * writes them out and then publishes 'tail' the same way. Each side reads the other's index with an acquire load.
+ * Indices grow without bound, the slot is the index modulo the capacity, a power of 2.
+ *
+ * When there is nothing to do the consumer sleeps for short periods, and so does a producer facing a full ring.
+ * Disk stalls then cost the simulation nothing, until the ring fills.
+ * */
+
+
+#include "heatbugs_writer.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+
+
+#define WRITER_IDLE_US		1000	/* Consumer sleep when the ring is empty. */
+#define WRITER_STALL_US		100	/* Producer sleep when the ring is full. */
+
+
+#define LOAD_ACQUIRE( p )	__atomic_load_n( (p), __ATOMIC_ACQUIRE )
+#define STORE_RELEASE( p, v )	__atomic_store_n( (p), (v), __ATOMIC_RELEASE )
+
+
+
+struct hb_writer {
+	float *ring;			/* Records. */
+	size_t mask;			/* Capacity - 1. */
+
+	size_t head;			/* Next record to store. Written by the producer. */
+	size_t tail;			/* Next record to write. Written by the consumer. */
+	int closing;			/* Set by the producer after its last push. */
+
+	FILE *file;
+	size_t flush_records;
+	gint64 flush_us;
+
+	int error;			/* Set by the consumer when a write fails. */
+
+	HBWriterStats_t stats;		/* Producer and consumer fields are apart, and read only after the join. */
+
+	GThread *thread;
+};
+
+
+
+/* Write the records in [tail .. head), flushing as the policy says. */
+static void writer_drain( HBWriter_t *w, size_t tail, size_t head, size_t *since_flush, gint64 *last_flush )
+{
+	for (; tail != head; tail++)
+	{
+		if (fprintf( w->file, "%.17g\n", w->ring[ tail & w->mask ] ) < 0)
+			w->error = 1;
+
+		w->stats.records++;
+
+		if (w->flush_records && ++(*since_flush) >= w->flush_records)
+		{
+			fflush( w->file );
+			w->stats.flushes++;
+			*since_flush = 0;
+			*last_flush = g_get_monotonic_time();
+		}
+
+		/* Free the slot as soon as it is written, so a waiting producer goes on. */
+		STORE_RELEASE( &w->tail, tail + 1 );
+	}
+
+	if (w->flush_us && *since_flush && g_get_monotonic_time() - *last_flush >= w->flush_us)
+	{
+		fflush( w->file );
+		w->stats.flushes++;
+		*since_flush = 0;
+		*last_flush = g_get_monotonic_time();
+	}
+}
+
+
+
+static gpointer writer_run( gpointer data )
+{
+	HBWriter_t *w = (HBWriter_t *) data;
+
+	size_t head, since_flush = 0;
+	gint64 last_flush = g_get_monotonic_time();
+
+
+	for (;;)
+	{
+		head = LOAD_ACQUIRE( &w->head );
+
+		if (head != w->tail)
+		{
+			writer_drain( w, w->tail, head, &since_flush, &last_flush );
+			continue;
+		}
+
+		/* Empty. 'closing' is stored after the last 'head', so one more look sees every record. */
+		if (LOAD_ACQUIRE( &w->closing ))
+		{
+			head = LOAD_ACQUIRE( &w->head );
+
+			if (head == w->tail) break;
+
+			continue;
+		}
+
+		g_usleep( WRITER_IDLE_US );
+	}
+
+	if (fflush( w->file ) != 0) w->error = 1;
+
+	return NULL;
+}
+
+
+
+HBWriter_t *hb_writer_new( FILE *file, size_t capacity, size_t flush_records, unsigned int flush_ms )
+{
+	HBWriter_t *w;
+
+
+	/* The ring is indexed with a mask. */
+	if (capacity == 0 || (capacity & (capacity - 1)) != 0 || capacity > SIZE_MAX / sizeof( float )) return NULL;
+
+	w = (HBWriter_t *) calloc( 1, sizeof( HBWriter_t ) );
+
+	if (w == NULL) return NULL;
+
+	w->ring = (float *) malloc( capacity * sizeof( float ) );
+
+	if (w->ring == NULL)
+	{
+		free( w );
+		return NULL;
+	}
+
+	w->mask = capacity - 1;
+	w->file = file;
+	w->flush_records = flush_records;
+	w->flush_us = (gint64) flush_ms * 1000;
+	w->stats.capacity = capacity;
+
+	w->thread = g_thread_new( "hb-writer", writer_run, w );
+
+	return w;
+}
+
+
+
+void hb_writer_push( HBWriter_t *w, const float *records, size_t n )
+{
+	size_t head = w->head;
+	size_t i, fill;
+	gint64 start;
+
+
+	for (i = 0; i < n; i++)
+	{
+		/* Back-pressure: publish what is stored, and wait for a free slot. */
+		if (head - LOAD_ACQUIRE( &w->tail ) > w->mask)
+		{
+			STORE_RELEASE( &w->head, head );
+
+			w->stats.stalls++;
+			start = g_get_monotonic_time();
+
+			while (head - LOAD_ACQUIRE( &w->tail ) > w->mask)
+				g_usleep( WRITER_STALL_US );
+
+			w->stats.stall_us += g_get_monotonic_time() - start;
+		}
+
+		w->ring[ head & w->mask ] = records[ i ];
+		head++;
+	}
+
+	STORE_RELEASE( &w->head, head );
+
+	fill = head - LOAD_ACQUIRE( &w->tail );
+	w->stats.max_fill = MAX( w->stats.max_fill, fill );
+	w->stats.batches++;
+}
+
+
+
+int hb_writer_close( HBWriter_t *w, HBWriterStats_t *stats )
+{
+	int error;
+
+
+	STORE_RELEASE( &w->closing, 1 );
+
+	g_thread_join( w->thread );
+
+	error = w->error;
+
+	if (stats) *stats = w->stats;
+
+	free( w->ring );
+	free( w );
+
+	return error ? -1 : 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * This file is part of heatbugs_GPU.
+ *
+ * heatbugs_GPU is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * heatbugs_GPU is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with heatbugs_GPU. If not, see <http://www.gnu.org/licenses/>.
+ * */
+
+
+#ifndef __HEATBUGS_WRITER_H_
+#define __HEATBUGS_WRITER_H_
+
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include <glib.h>
+
+
+/** Background result writer. Opaque, see heatbugs_writer.c. */
+typedef struct hb_writer HBWriter_t;
+
+
+/** Writer metrics, filled when the writer is closed. */
+typedef struct hb_writer_stats {
+	size_t records;		/* Records written to the file. */
+	size_t batches;		/* Batches pushed by the simulation. */
+	size_t stalls;		/* Pushes that found the ring full, and waited for the writer. */
+	gint64 stall_us;	/* Time the simulation spent waiting for the writer, in microseconds. */
+	size_t max_fill;	/* Most records ever waiting in the ring. */
+	size_t capacity;	/* Ring capacity, in records. */
+	size_t flushes;		/* Explicit flushes of the file, by the flush policy. */
+} HBWriterStats_t;
+
+
+/**
+ * Start a writer thread appending records, one unhappiness average per line, to 'file'.
+ *
+ * Flush policy: the file is flushed every 'flush_records' records and at least every 'flush_ms' milliseconds while
+ * records arrive, both 0 leaving it to stdio. It is always flushed when the writer is closed.
+ *
+ * @param[in]	file          - Open file to write to. Not closed by the writer.
+ * @param[in]	capacity      - Ring capacity in records. A power of 2.
+ * @param[in]	flush_records - Records between flushes. (0 = no flush by count).
+ * @param[in]	flush_ms      - Milliseconds between flushes. (0 = no flush by time).
+ *
+ * @return The writer, or NULL if out of memory or 'capacity' is not a power of 2.
+ * */
+HBWriter_t *hb_writer_new( FILE *file, size_t capacity, size_t flush_records, unsigned int flush_ms );
+
+
+/**
+ * Queue a batch of 'n' records. Only the thread that created the writer may push. Waits, counting a stall, while
+ * the ring is full.
+ * */
+void hb_writer_push( HBWriter_t *writer, const float *records, size_t n );
+
+
+/**
+ * Write all queued records, flush the file, stop the thread and free the writer.
+ *
+ * @param[in]	writer - The writer.
+ * @param[out]	stats  - If not NULL, receives the writer metrics.
+ *
+ * @return 0, or -1 if some record could not be written.
+ * */
+int hb_writer_close( HBWriter_t *writer, HBWriterStats_t *stats );
+
+
+#endif